@@ -0,0 +1,425 @@
+// differential.c
+// Compiles generated programs through every backend and compares exit codes
+//
+// Usage: bench_differential [--programs=N] [--seed=N] [FILE...]
+//
+// Each program has globals, functions with parameters, calls, nested
+// if/else and while loops, and a bounded recursion. Values are reduced
+// after every assignment so no backend can overflow, and divisors are
+// non-zero constants, so every backend must agree on what main returns.
+// A program runs through:
+//
+//   C -O0      fluentc -O0, then $CC
+//   C -O2      fluentc -O2, then $CC
+//   asm        fluentc -O2 --emit=asm, then as and ld
+//   --run      the bytecode VM
+//   --jit      the bytecode JIT
+//   --stream   fluentc --stream at -O1 and -O2, then $CC
+//
+// Before the generated programs it runs a few fixed ones with known exit
+// codes, such as the extreme literals of each integer type; those using
+// types wider than i32 only go to the backends that support them.
+//
+// Given files, it compares those instead of generating programs; `make
+// check` passes it programs from bench_flugen, whose globals are declared
+// by the --stream scan before any function is folded.
+//
+// Run from the repository root. The exit status is 1 if any program's
+// exit codes differ; the programs that disagreed are kept for inspection.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#define DEFAULT_PROGRAMS 100
+#define MAX_FUNCTIONS 8
+#define MAX_PARAMS 3
+#define MAX_DEPTH 3
+#define MAX_STATEMENTS 5
+#define MAX_TRIPS 10              // Iterations of any one loop
+#define MAX_CALLS 2               // Calls in a function's body, outside loops
+#define BOUND 4096                // Every stored value lies within (-BOUND, BOUND)
+#define TIMEOUT "10"              // Seconds allowed per command
+
+typedef struct {
+    const char* name;
+    const char* command;          // %1$s is the directory, %2$s the C compiler
+    int wide;                     // Supports the types wider than i32
+} Backend;
+
+static const Backend backends[] = {
+    { "C -O0", "./fluentc -O0 -o %1$s/c0.c %1$s/program.flu && %2$s -w -o %1$s/c0 %1$s/c0.c && "
+               "timeout " TIMEOUT " %1$s/c0", 1 },
+    { "C -O2", "./fluentc -O2 -o %1$s/c2.c %1$s/program.flu && %2$s -w -o %1$s/c2 %1$s/c2.c && "
+               "timeout " TIMEOUT " %1$s/c2", 1 },
+    { "asm", "./fluentc -O2 --emit=asm -o %1$s/program.s %1$s/program.flu && "
+             "as -o %1$s/program.o %1$s/program.s && ld -o %1$s/asm %1$s/program.o && "
+             "timeout " TIMEOUT " %1$s/asm", 0 },
+    { "--run", "timeout " TIMEOUT " ./fluentc --run %1$s/program.flu", 0 },
+    { "--jit", "timeout " TIMEOUT " ./fluentc --jit %1$s/program.flu", 0 },
+    { "--stream -O1", "./fluentc --stream -O1 -o %1$s/s1.c %1$s/program.flu && %2$s -w -o %1$s/s1 %1$s/s1.c && "
+                      "timeout " TIMEOUT " %1$s/s1", 1 },
+    { "--stream -O2", "./fluentc --stream -O2 -o %1$s/s2.c %1$s/program.flu && %2$s -w -o %1$s/s2 %1$s/s2.c && "
+                      "timeout " TIMEOUT " %1$s/s2", 1 },
+};
+#define BACKEND_COUNT (int)(sizeof(backends) / sizeof(backends[0]))
+
+typedef struct {
+    const char* name;
+    const char* source;
+    int expected;                 // Exit code every backend must produce
+    int wide;                     // Uses types wider than i32
+} FixedProgram;
+
+static const FixedProgram fixed_programs[] = {
+    { "INT32_MIN literal",
+      "let lo: i32 = -2147483648\n"
+      "func main:\n"
+      "    var code = 0\n"
+      "    if lo == -2147483647 - 1:\n"
+      "        code = code + 1\n"
+      "    if lo < -2147483647:\n"
+      "        code = code + 2\n"
+      "    if lo / 2 == -1073741824:\n"
+      "        code = code + 4\n"
+      "    return code\n", 7, 0 },
+    { "INT64_MIN literal",
+      "let lo: i64 = -9223372036854775808\n"
+      "let narrow = -2147483648\n"
+      "func main:\n"
+      "    var code = 0\n"
+      "    if lo < -9223372036854775807:\n"
+      "        code = code + 1\n"
+      "    if lo / 2 == -4611686018427387904:\n"
+      "        code = code + 2\n"
+      "    if i64(narrow) * 4294967296 == lo:\n"
+      "        code = code + 4\n"
+      "    return code\n", 7, 1 },
+};
+#define FIXED_COUNT (int)(sizeof(fixed_programs) / sizeof(fixed_programs[0]))
+
+static const char* const globals[] = { "g0", "g1", "g2" };
+#define GLOBAL_COUNT (int)(sizeof(globals) / sizeof(globals[0]))
+
+static const char* const locals[] = { "a", "b", "c" };
+#define LOCAL_COUNT (int)(sizeof(locals) / sizeof(locals[0]))
+
+typedef struct {
+    FILE* out;
+    unsigned long long state;
+    int functions;                // Functions defined so far, callable by later ones
+    int params[MAX_FUNCTIONS];
+    int current_params;           // Parameters of the function being written
+    int calls;                    // Calls left in this function's body
+    int loops;                    // Loops enclosing the statement being written
+} Generator;
+
+// xorshift64*, as in flugen.c, so programs do not depend on the C library
+static unsigned int next_random(Generator* gen) {
+    gen->state ^= gen->state >> 12;
+    gen->state ^= gen->state << 25;
+    gen->state ^= gen->state >> 27;
+    return (unsigned int)((gen->state * 2685821657736338717ULL) >> 32);
+}
+
+static int pick(Generator* gen, int n) {
+    return (int)(next_random(gen) % (unsigned int)n);
+}
+
+static void indent(Generator* gen, int depth) {
+    fprintf(gen->out, "%*s", depth * 4, "");
+}
+
+// A variable, parameter, global or small constant, all within the bound
+static void emit_atom(Generator* gen) {
+    int choice = pick(gen, 4);
+    if (choice == 0) {
+        fprintf(gen->out, "%d", pick(gen, 100));
+    } else if (choice == 1) {
+        fprintf(gen->out, "%s", globals[pick(gen, GLOBAL_COUNT)]);
+    } else if (choice == 2 && gen->current_params > 0) {
+        fprintf(gen->out, "p%d", pick(gen, gen->current_params));
+    } else {
+        fprintf(gen->out, "%s", locals[pick(gen, LOCAL_COUNT)]);
+    }
+}
+
+// A call whose result is bounded because every function returns a local
+static int emit_call(Generator* gen) {
+    if (gen->functions == 0 || gen->calls == 0 || gen->loops > 0) {
+        return 0;
+    }
+    gen->calls--;
+    int callee = pick(gen, gen->functions);
+    fprintf(gen->out, "f%d(", callee);
+    for (int i = 0; i < gen->params[callee]; i++) {
+        fprintf(gen->out, i ? ", " : "");
+        emit_atom(gen);
+    }
+    fprintf(gen->out, ")");
+    return 1;
+}
+
+static void emit_term(Generator* gen) {
+    switch (pick(gen, 6)) {
+        case 0:
+            emit_atom(gen);
+            fprintf(gen->out, " * ");
+            emit_atom(gen);
+            break;
+        case 1:
+            emit_atom(gen);
+            fprintf(gen->out, " / %d", 1 + pick(gen, 50));
+            break;
+        case 2:
+            fprintf(gen->out, "-");
+            emit_atom(gen);
+            break;
+        case 3:
+            if (emit_call(gen)) {
+                break;
+            }
+            // Fall through
+        default:
+            emit_atom(gen);
+            break;
+    }
+}
+
+// At most three terms of at most BOUND * BOUND each, so no int overflows
+static void emit_expression(Generator* gen) {
+    emit_term(gen);
+    for (int i = pick(gen, 3); i > 0; i--) {
+        fprintf(gen->out, pick(gen, 2) ? " + " : " - ");
+        emit_term(gen);
+    }
+}
+
+static void emit_condition(Generator* gen) {
+    static const char* const comparisons[] = { "==", "!=", "<", ">", "<=", ">=" };
+    emit_atom(gen);
+    fprintf(gen->out, " %s ", comparisons[pick(gen, 6)]);
+    emit_atom(gen);
+}
+
+// name = expression, then reduced back within the bound
+static void emit_assignment(Generator* gen, int depth, const char* name) {
+    indent(gen, depth);
+    fprintf(gen->out, "%s = ", name);
+    emit_expression(gen);
+    fprintf(gen->out, "\n");
+    indent(gen, depth);
+    fprintf(gen->out, "%1$s = %1$s - %1$s / %2$d * %2$d\n", name, BOUND);
+}
+
+static void emit_block(Generator* gen, int depth, int level);
+
+static void emit_statement(Generator* gen, int depth, int level) {
+    int choice = level < MAX_DEPTH ? pick(gen, 6) : 0;
+    switch (choice) {
+        case 0:
+        case 1:
+            emit_assignment(gen, depth, locals[pick(gen, LOCAL_COUNT)]);
+            break;
+        case 2:
+            emit_assignment(gen, depth, globals[pick(gen, GLOBAL_COUNT)]);
+            break;
+        case 3:
+            indent(gen, depth);
+            fprintf(gen->out, "if ");
+            emit_condition(gen);
+            fprintf(gen->out, ":\n");
+            emit_block(gen, depth + 1, level + 1);
+            if (pick(gen, 2)) {
+                indent(gen, depth);
+                fprintf(gen->out, "else:\n");
+                emit_block(gen, depth + 1, level + 1);
+            }
+            break;
+        case 4:
+            // Counters are declared up front, one per nesting level
+            indent(gen, depth);
+            fprintf(gen->out, "i%d = %d\n", gen->loops, pick(gen, MAX_TRIPS + 1));
+            indent(gen, depth);
+            fprintf(gen->out, "while i%d > 0:\n", gen->loops);
+            gen->loops++;
+            emit_block(gen, depth + 1, level + 1);
+            gen->loops--;
+            indent(gen, depth + 1);
+            fprintf(gen->out, "i%1$d = i%1$d - 1\n", gen->loops);
+            break;
+        default:
+            indent(gen, depth);
+            fprintf(gen->out, "r(%d)\n", pick(gen, 50));
+            break;
+    }
+}
+
+static void emit_block(Generator* gen, int depth, int level) {
+    for (int i = 1 + pick(gen, MAX_STATEMENTS); i > 0; i--) {
+        emit_statement(gen, depth, level);
+    }
+}
+
+// Declares the locals and loop counters, writes the body and returns a
+// local, plus the globals when they should be part of the result
+static void emit_body(Generator* gen, int return_globals) {
+    for (int i = 0; i < LOCAL_COUNT; i++) {
+        fprintf(gen->out, "    var %s = ", locals[i]);
+        if (gen->current_params > 0) {
+            fprintf(gen->out, "p%d\n", pick(gen, gen->current_params));
+        } else {
+            fprintf(gen->out, "%d\n", pick(gen, 100));
+        }
+    }
+    for (int i = 0; i < MAX_DEPTH; i++) {
+        fprintf(gen->out, "    var i%d = 0\n", i);
+    }
+    gen->calls = MAX_CALLS;
+    emit_block(gen, 1, 0);
+    fprintf(gen->out, "    return %s%s\n", locals[pick(gen, LOCAL_COUNT)],
+            return_globals ? " + g0 * 3 + g1 * 5 + g2 * 7" : "");
+}
+
+static void generate_program(Generator* gen) {
+    for (int i = 0; i < GLOBAL_COUNT; i++) {
+        fprintf(gen->out, "var %s = %d\n", globals[i], pick(gen, 100) - 50);
+    }
+    fprintf(gen->out, "\n"
+                      "func r(n: int):\n"
+                      "    if n < 1:\n"
+                      "        return g0\n"
+                      "    g1 = g1 + 1 - g1 / 64 * 64\n"
+                      "    return r(n - 1) + 1\n");
+
+    gen->functions = 0;
+    int count = 1 + pick(gen, MAX_FUNCTIONS);
+    for (int f = 0; f < count; f++) {
+        int params = pick(gen, MAX_PARAMS + 1);
+        fprintf(gen->out, "\nfunc f%d(", f);
+        for (int p = 0; p < params; p++) {
+            fprintf(gen->out, "%sp%d: int", p ? ", " : "", p);
+        }
+        fprintf(gen->out, "):\n");
+        gen->current_params = params;
+        emit_body(gen, 0);
+        gen->params[f] = params;
+        gen->functions++;
+    }
+
+    // main folds the globals into its result so stores are checked too
+    fprintf(gen->out, "\nfunc main:\n");
+    gen->current_params = 0;
+    emit_body(gen, 1);
+}
+
+// Runs a shell command and returns its exit status, or -1 if it died
+static int run(const char* command) {
+    int status = system(command);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// Runs dir/program.flu through every backend, or only those supporting wide
+// types, and checks that each exits with expected (or, when that is -1,
+// with what the first does). Returns 0 after a report if any does not.
+static int compare_backends(const char* dir, const char* cc, const char* label, int expected, int wide) {
+    int status[BACKEND_COUNT];
+    int agree = 1;
+    for (int b = 0; b < BACKEND_COUNT; b++) {
+        if (wide && !backends[b].wide) {
+            continue;
+        }
+        char command[2048];
+        snprintf(command, sizeof(command), backends[b].command, dir, cc);
+        status[b] = run(command);
+        if (expected < 0) {
+            expected = status[b];
+        }
+        agree &= status[b] == expected;
+    }
+    if (!agree) {
+        printf("%s disagrees:", label);
+        for (int b = 0; b < BACKEND_COUNT; b++) {
+            if (!wide || backends[b].wide) {
+                printf(" %s %d;", backends[b].name, status[b]);
+            }
+        }
+        printf(" expected %d\n", expected);
+    }
+    return agree;
+}
+
+int main(int argc, char** argv) {
+    int programs = DEFAULT_PROGRAMS;
+    unsigned long long seed = 1;
+    char** files = calloc(argc, sizeof(char*));
+    int file_count = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--programs=", 11) == 0) {
+            programs = atoi(argv[i] + 11);
+        } else if (strncmp(argv[i], "--seed=", 7) == 0) {
+            seed = strtoull(argv[i] + 7, NULL, 10);
+        } else if (argv[i][0] != '-' && files) {
+            files[file_count++] = argv[i];
+        } else {
+            fprintf(stderr, "Usage: %s [--programs=N] [--seed=N] [FILE...]\n", argv[0]);
+            return 2;
+        }
+    }
+    const char* cc = getenv("CC") ? getenv("CC") : "cc";
+    char dir[] = "/tmp/fluent_differential_XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    int mismatches = 0;
+    char path[256], command[1024];
+    snprintf(path, sizeof(path), "%s/program.flu", dir);
+    for (int f = 0; f < file_count; f++) {
+        snprintf(command, sizeof(command), "cp '%s' %s", files[f], path);
+        if (run(command) != 0) {
+            fprintf(stderr, "Could not copy %s\n", files[f]);
+            return 1;
+        }
+        mismatches += !compare_backends(dir, cc, files[f], -1, 0);
+    }
+    for (int p = 0; p < FIXED_COUNT && file_count == 0; p++) {
+        FILE* file = fopen(path, "w");
+        if (!file) {
+            perror(path);
+            return 1;
+        }
+        fputs(fixed_programs[p].source, file);
+        fclose(file);
+        mismatches += !compare_backends(dir, cc, fixed_programs[p].name, fixed_programs[p].expected,
+                                        fixed_programs[p].wide);
+    }
+    for (int p = 0; p < programs && file_count == 0; p++) {
+        Generator gen = { .out = fopen(path, "w"), .state = (seed + p) * 0x9E3779B97F4A7C15ULL | 1 };
+        if (!gen.out) {
+            perror(path);
+            return 1;
+        }
+        generate_program(&gen);
+        fclose(gen.out);
+
+        char label[512];
+        snprintf(label, sizeof(label), "%s/mismatch-%d.flu", dir, p);
+        if (!compare_backends(dir, cc, label, -1, 0)) {
+            rename(path, label);
+            mismatches++;
+        }
+    }
+
+    printf("%d programs, %d backends, %d mismatches\n", file_count ? file_count : FIXED_COUNT + programs,
+           BACKEND_COUNT, mismatches);
+    if (!mismatches) {
+        snprintf(command, sizeof(command), "rm -rf %s", dir);
+        run(command);
+    }
+    free(files);
+    return mismatches ? 1 : 0;
+}
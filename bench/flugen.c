@@ -0,0 +1,235 @@
+// flugen.c
+// Deterministic generator of synthetic Fluent programs for benchmarking
+//
+// Usage: bench_flugen [--shape=NAME] [--size=BYTES] [--seed=N]
+//
+// Shapes:
+//   mixed      a blend of everything below (default)
+//   deep       control flow nested dozens of levels deep
+//   expr       long expression chains with comparisons and unary minus
+//   functions  thousands of small functions
+//   comments   mostly comment lines and trailing comments
+//
+// The same shape, size and seed always produce the same bytes. Every
+// program parses and compiles; none is meant to be run.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#define MAX_DEPTH 60
+
+typedef enum {
+    SHAPE_MIXED,
+    SHAPE_DEEP,
+    SHAPE_EXPR,
+    SHAPE_FUNCTIONS,
+    SHAPE_COMMENTS
+} Shape;
+
+static const char* const shape_names[] = { "mixed", "deep", "expr", "functions", "comments" };
+
+static const char* const locals[] = { "total", "count", "index", "value", "delta", "scale" };
+#define LOCAL_COUNT (int)(sizeof(locals) / sizeof(locals[0]))
+
+static const char* const words[] = {
+    "update", "the", "running", "total", "before", "checking", "bounds", "and",
+    "carry", "over", "remainder", "into", "next", "step", "see", "above"
+};
+#define WORD_COUNT (int)(sizeof(words) / sizeof(words[0]))
+
+typedef struct {
+    unsigned long long state;
+    long long written;
+    int functions;
+} Generator;
+
+// xorshift64*, so output does not depend on the C library's rand()
+static unsigned int next_random(Generator* gen) {
+    gen->state ^= gen->state >> 12;
+    gen->state ^= gen->state << 25;
+    gen->state ^= gen->state >> 27;
+    return (unsigned int)((gen->state * 2685821657736338717ULL) >> 32);
+}
+
+static int pick(Generator* gen, int n) {
+    return (int)(next_random(gen) % (unsigned int)n);
+}
+
+static void emit(Generator* gen, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+static void emit(Generator* gen, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int n = vprintf(format, args);
+    va_end(args);
+    gen->written += n > 0 ? n : 0;
+}
+
+static void indent(Generator* gen, int depth) {
+    emit(gen, "%*s", depth * 4, "");
+}
+
+static void emit_operand(Generator* gen) {
+    if (pick(gen, 3) == 0) {
+        emit(gen, "%d", 1 + pick(gen, 999));
+    } else {
+        emit(gen, "%s", locals[pick(gen, LOCAL_COUNT)]);
+    }
+}
+
+// A left-to-right chain of terms; divisors are never zero literals
+static void emit_expression(Generator* gen, int terms) {
+    static const char ops[] = "+-*/";
+    static const char* const comparisons[] = { "<", ">", "<=", ">=", "==", "!=" };
+    emit_operand(gen);
+    for (int i = 1; i < terms; i++) {
+        char op = ops[pick(gen, 4)];
+        if (op == '/') {
+            emit(gen, " / %d", 2 + pick(gen, 97));
+        } else if (pick(gen, 6) == 0) {
+            emit(gen, " %c (", op);
+            emit_operand(gen);
+            emit(gen, " + ");
+            emit_operand(gen);
+            emit(gen, ")");
+        } else if (pick(gen, 8) == 0) {
+            emit(gen, " %c (", op);
+            emit_operand(gen);
+            emit(gen, " %s ", comparisons[pick(gen, 6)]);
+            emit_operand(gen);
+            emit(gen, ")");
+        } else if (pick(gen, 8) == 0) {
+            emit(gen, " %c -", op);
+            emit_operand(gen);
+        } else {
+            emit(gen, " %c ", op);
+            emit_operand(gen);
+        }
+    }
+}
+
+static void emit_comment(Generator* gen, int depth) {
+    indent(gen, depth);
+    emit(gen, "#");
+    int count = 4 + pick(gen, 10);
+    for (int i = 0; i < count; i++) {
+        emit(gen, " %s", words[pick(gen, WORD_COUNT)]);
+    }
+    emit(gen, "\n");
+}
+
+static void emit_assignment(Generator* gen, int depth, int terms, int comment) {
+    indent(gen, depth);
+    emit(gen, "%s = ", locals[pick(gen, LOCAL_COUNT)]);
+    emit_expression(gen, terms);
+    if (comment) {
+        emit(gen, "  # %s %s", words[pick(gen, WORD_COUNT)], words[pick(gen, WORD_COUNT)]);
+    }
+    emit(gen, "\n");
+}
+
+// Opens an if/while at each level down to `levels`, then unwinds, with
+// statements and an occasional else on the way
+static void emit_nest(Generator* gen, int depth, int levels) {
+    int is_if = pick(gen, 2);
+    indent(gen, depth);
+    if (is_if) {
+        emit(gen, "if %s - %d:\n", locals[pick(gen, LOCAL_COUNT)], pick(gen, 10));
+    } else {
+        emit(gen, "while %s / %d:\n", locals[pick(gen, LOCAL_COUNT)], 2 + pick(gen, 8));
+    }
+    emit_assignment(gen, depth + 1, 2 + pick(gen, 3), 0);
+    if (levels > 1 && depth + 1 < MAX_DEPTH) {
+        emit_nest(gen, depth + 1, levels - 1);
+    }
+    emit_assignment(gen, depth + 1, 2, 0);
+    if (is_if && pick(gen, 3) == 0) {
+        indent(gen, depth);
+        emit(gen, "else:\n");
+        emit_assignment(gen, depth + 1, 2 + pick(gen, 3), 0);
+    }
+}
+
+static void emit_function(Generator* gen, Shape shape) {
+    if (shape == SHAPE_MIXED) {
+        shape = (Shape)(1 + pick(gen, 4));
+    }
+    if (shape == SHAPE_COMMENTS) {
+        emit_comment(gen, 0);
+        emit_comment(gen, 0);
+    }
+    emit(gen, "func f%d:\n", gen->functions++);
+    for (int i = 0; i < LOCAL_COUNT; i++) {
+        indent(gen, 1);
+        emit(gen, "var %s = %d\n", locals[i], pick(gen, 100));
+    }
+
+    switch (shape) {
+        case SHAPE_DEEP:
+            emit_nest(gen, 1, 20 + pick(gen, 40));
+            break;
+        case SHAPE_EXPR:
+            for (int i = 0, n = 2 + pick(gen, 4); i < n; i++) {
+                emit_assignment(gen, 1, 50 + pick(gen, 150), 0);
+            }
+            break;
+        case SHAPE_FUNCTIONS:
+            emit_assignment(gen, 1, 2 + pick(gen, 3), 0);
+            break;
+        case SHAPE_COMMENTS:
+            for (int i = 0, n = 4 + pick(gen, 8); i < n; i++) {
+                if (pick(gen, 4) == 0) {
+                    emit_assignment(gen, 1, 2 + pick(gen, 4), pick(gen, 2));
+                } else {
+                    emit_comment(gen, 1);
+                }
+            }
+            break;
+        case SHAPE_MIXED:
+            break;
+    }
+
+    indent(gen, 1);
+    emit(gen, "return %s\n\n", locals[pick(gen, LOCAL_COUNT)]);
+}
+
+int main(int argc, char** argv) {
+    Shape shape = SHAPE_MIXED;
+    long long size = 1 << 20;
+    unsigned long long seed = 1;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--shape=", 8) == 0) {
+            int found = 0;
+            for (int s = 0; s < (int)(sizeof(shape_names) / sizeof(shape_names[0])); s++) {
+                if (strcmp(argv[i] + 8, shape_names[s]) == 0) {
+                    shape = (Shape)s;
+                    found = 1;
+                }
+            }
+            if (!found) {
+                fprintf(stderr, "Unknown shape '%s'\n", argv[i] + 8);
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--size=", 7) == 0) {
+            size = atoll(argv[i] + 7);
+        } else if (strncmp(argv[i], "--seed=", 7) == 0) {
+            seed = strtoull(argv[i] + 7, NULL, 10);
+        } else {
+            fprintf(stderr, "Usage: %s [--shape=mixed|deep|expr|functions|comments] [--size=BYTES] [--seed=N]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    Generator gen = { seed * 0x9e3779b97f4a7c15ULL + 1, 0, 0 };
+    emit(&gen, "# Generated by flugen: shape=%s size=%lld seed=%llu\n\n", shape_names[shape], size, seed);
+    emit(&gen, "var state = 1\n\n");
+    while (gen.written < size) {
+        emit_function(&gen, shape);
+    }
+    emit(&gen, "func main:\n    return state\n");
+    return 0;
+}
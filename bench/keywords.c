@@ -0,0 +1,130 @@
+// keywords.c
+// Microbenchmark for keyword classification on an identifier-heavy corpus
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include "lexer.h"
+#include "context.h"
+
+#define CORPUS_LINES 200000
+#define ROUNDS 5
+
+static const char* words[] = {
+    "func", "let", "var", "if", "else", "elif", "for", "while", "return",
+    "counter", "index", "total", "value", "f", "lhs", "rhs", "iterator",
+    "letter", "variable", "in", "elsewhere", "format", "whilst", "returned",
+    "_tmp", "x1", "accumulator", "e", "fun", "w"
+};
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Deterministic pseudo-random numbers so every run sees the same corpus
+static unsigned int next_random(unsigned int* state) {
+    *state = *state * 1103515245u + 12345u;
+    return (*state >> 16) & 0x7fff;
+}
+
+static char* build_corpus(size_t* out_size) {
+    size_t capacity = (size_t)CORPUS_LINES * 64;
+    char* corpus = malloc(capacity);
+    size_t size = 0;
+    unsigned int state = 42;
+    int word_count = sizeof(words) / sizeof(words[0]);
+
+    for (int i = 0; i < CORPUS_LINES; i++) {
+        int per_line = 3 + next_random(&state) % 4;
+        for (int j = 0; j < per_line; j++) {
+            size += sprintf(corpus + size, "%s%s", j ? " " : "",
+                            words[next_random(&state) % word_count]);
+        }
+        corpus[size++] = '\n';
+    }
+    corpus[size] = '\0';
+    *out_size = size;
+    return corpus;
+}
+
+// The classifier the lexer used before lookup_keyword: copy, then compare
+static TokenType classify_strcmp(const char* start, int length) {
+    char* text = strndup(start, length);
+    TokenType type = TOKEN_IDENTIFIER;
+    if (strcmp(text, "func") == 0) type = TOKEN_FUNC;
+    else if (strcmp(text, "let") == 0) type = TOKEN_LET;
+    else if (strcmp(text, "var") == 0) type = TOKEN_VAR;
+    else if (strcmp(text, "if") == 0) type = TOKEN_IF;
+    else if (strcmp(text, "else") == 0) type = TOKEN_ELSE;
+    else if (strcmp(text, "elif") == 0) type = TOKEN_ELIF;
+    else if (strcmp(text, "for") == 0) type = TOKEN_FOR;
+    else if (strcmp(text, "while") == 0) type = TOKEN_WHILE;
+    else if (strcmp(text, "return") == 0) type = TOKEN_RETURN;
+    free(text);
+    return type;
+}
+
+static double run_classifier(const char* corpus, TokenType (*classify)(const char*, int),
+                             long* identifiers, long* keywords) {
+    double start = now();
+    *identifiers = 0;
+    *keywords = 0;
+    for (int round = 0; round < ROUNDS; round++) {
+        const char* p = corpus;
+        while (*p) {
+            if (isalpha((unsigned char)*p) || *p == '_') {
+                const char* word = p;
+                while (isalnum((unsigned char)*p) || *p == '_') p++;
+                if (classify(word, (int)(p - word)) != TOKEN_IDENTIFIER) {
+                    (*keywords)++;
+                }
+                (*identifiers)++;
+            } else {
+                p++;
+            }
+        }
+    }
+    return now() - start;
+}
+
+int main(void) {
+    size_t size;
+    char* corpus = build_corpus(&size);
+    long identifiers, keywords;
+
+    printf("corpus: %zu bytes, %d lines\n", size, CORPUS_LINES);
+
+    double t_old = run_classifier(corpus, classify_strcmp, &identifiers, &keywords);
+    printf("strndup+strcmp: %8.1f M identifiers/s (%ld keywords)\n",
+           identifiers / t_old / 1e6, keywords);
+
+    double t_new = run_classifier(corpus, lookup_keyword, &identifiers, &keywords);
+    printf("lookup_keyword: %8.1f M identifiers/s (%ld keywords)\n",
+           identifiers / t_new / 1e6, keywords);
+
+    printf("speedup:        %8.2fx\n", t_old / t_new);
+
+    // End-to-end lexer throughput on the same corpus
+    FluentContext ctx;
+    init_context(&ctx);
+    double start = now();
+    long tokens = 0;
+    for (int round = 0; round < ROUNDS; round++) {
+        init_lexer(&ctx, corpus);
+        while (get_next_token(&ctx).type != TOKEN_EOF) {
+            tokens++;
+        }
+    }
+    double t_lex = now() - start;
+    printf("get_next_token: %8.1f M tokens/s, %.1f MB/s\n",
+           tokens / t_lex / 1e6, size * (double)ROUNDS / t_lex / 1e6);
+
+    free_context(&ctx);
+    free(corpus);
+    return 0;
+}
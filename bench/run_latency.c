@@ -0,0 +1,109 @@
+// run_latency.c
+// End-to-end latency of `fluentc --run` and `--jit` against compiling through C
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#define ROUNDS 5
+
+typedef struct {
+    const char* name;
+    const char* source;
+} Program;
+
+static const Program programs[] = {
+    { "script",
+      "var total = 0\n"
+      "func main:\n"
+      "    var i = 10\n"
+      "    while i:\n"
+      "        total = total + i * 2\n"
+      "        i = i - 1\n"
+      "    return total\n" },
+    { "hot loop",
+      "func main:\n"
+      "    var n = 20000000\n"
+      "    var acc = 0\n"
+      "    while n:\n"
+      "        acc = acc + n * 3 / 7\n"
+      "        n = n - 1\n"
+      "    return acc - acc / 256 * 256\n" },
+};
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Runs a shell command and returns its exit status, or -1 if it died
+static int run(const char* command) {
+    int status = system(command);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Median wall time of ROUNDS runs, in milliseconds
+static double time_command(const char* command, int* status) {
+    double samples[ROUNDS];
+    for (int i = 0; i < ROUNDS; i++) {
+        double start = now();
+        *status = run(command);
+        samples[i] = (now() - start) * 1000.0;
+    }
+    qsort(samples, ROUNDS, sizeof(double), compare_doubles);
+    return samples[ROUNDS / 2];
+}
+
+int main(void) {
+    const char* cc = getenv("CC") ? getenv("CC") : "cc";
+    char dir[] = "/tmp/fluent_bench_XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    printf("%-10s %12s %12s %12s %12s\n", "program", "--run (ms)", "--jit (ms)", "C -O0 (ms)", "C -O2 (ms)");
+    int mismatches = 0;
+    for (size_t p = 0; p < sizeof(programs) / sizeof(programs[0]); p++) {
+        char path[256], command[1024];
+        snprintf(path, sizeof(path), "%s/program.flu", dir);
+        FILE* file = fopen(path, "w");
+        fputs(programs[p].source, file);
+        fclose(file);
+
+        int vm_status, jit_status, c0_status, c2_status;
+        snprintf(command, sizeof(command), "./fluentc --run %s", path);
+        double vm = time_command(command, &vm_status);
+        snprintf(command, sizeof(command), "./fluentc --jit %s", path);
+        double jit = time_command(command, &jit_status);
+        snprintf(command, sizeof(command),
+                 "./fluentc -o %1$s/program.c %1$s/program.flu && %2$s -O0 -o %1$s/program %1$s/program.c && %1$s/program",
+                 dir, cc);
+        double c0 = time_command(command, &c0_status);
+        snprintf(command, sizeof(command),
+                 "./fluentc -O2 -o %1$s/program.c %1$s/program.flu && %2$s -O2 -o %1$s/program %1$s/program.c && %1$s/program",
+                 dir, cc);
+        double c2 = time_command(command, &c2_status);
+
+        printf("%-10s %12.1f %12.1f %12.1f %12.1f\n", programs[p].name, vm, jit, c0, c2);
+        if (vm_status != jit_status || vm_status != c0_status || vm_status != c2_status) {
+            printf("  exit status differs: --run %d, --jit %d, C -O0 %d, C -O2 %d\n",
+                   vm_status, jit_status, c0_status, c2_status);
+            mismatches++;
+        }
+    }
+
+    char command[512];
+    snprintf(command, sizeof(command), "rm -rf %s", dir);
+    run(command);
+    return mismatches ? 1 : 0;
+}
@@ -0,0 +1,150 @@
+// stress.c
+// Compiles huge programs on a small stack to catch per-statement recursion
+//
+// Usage: bench_stress [--statements=N]
+//
+// Each program is built in memory and compiled (parse and C codegen) on a
+// thread whose stack is STACK_SIZE bytes, far less than the default. A
+// path that recurses once per statement or per skipped line overflows it
+// and crashes the run; the exit status is 1 if any program fails to
+// compile.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include "lexer.h"
+#include "parser.h"
+#include "codegen.h"
+#include "context.h"
+#include "output.h"
+
+#define STACK_SIZE (256 * 1024)
+#define SKIPPED_LINES 20000       // Consecutive blank or comment lines per run
+
+typedef struct {
+    char* data;
+    size_t length;
+    size_t capacity;
+} Text;
+
+typedef struct {
+    const char* name;
+    Text source;
+    int failed;
+    double seconds;
+} Job;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void append(Text* text, const char* str) {
+    size_t n = strlen(str);
+    if (text->length + n + 1 > text->capacity) {
+        text->capacity = text->capacity ? text->capacity * 2 : 1 << 20;
+        while (text->length + n + 1 > text->capacity) {
+            text->capacity *= 2;
+        }
+        text->data = realloc(text->data, text->capacity);
+        if (!text->data) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+    memcpy(text->data + text->length, str, n + 1);
+    text->length += n;
+}
+
+static void append_skipped_lines(Text* text, int blank) {
+    for (int i = 0; i < SKIPPED_LINES; i++) {
+        append(text, blank ? (i % 2 ? "\n" : "    \n") : "    # nothing to see here\n");
+    }
+}
+
+// One function with `statements` assignments in its body
+static void build_long_block(Text* text, long statements) {
+    append(text, "func main:\n    var total = 0\n");
+    for (long i = 0; i < statements; i++) {
+        append(text, "    total = total + 1\n");
+    }
+    append(text, "    return total\n");
+}
+
+// Top-level statements separated by long runs of blank and comment lines
+static void build_sparse(Text* text, long statements) {
+    append(text, "var total = 0\n");
+    for (long i = 0; i < statements; i++) {
+        append(text, "total = total + 1\n");
+        if (i % (statements / 8 + 1) == 0) {
+            append_skipped_lines(text, (int)(i & 1));
+        }
+    }
+    append(text, "func main:\n");
+    append_skipped_lines(text, 1);
+    append_skipped_lines(text, 0);
+    append(text, "    return total\n");
+}
+
+static void* compile_job(void* arg) {
+    Job* job = arg;
+    FluentContext ctx;
+    init_context(&ctx);
+    init_lexer(&ctx, job->source.data);
+    double start = now();
+    NodeId ast = parse_program(&ctx);
+    if (ast) {
+        OutputBuffer out;
+        open_memory_output(&out);
+        job->failed = generate_code(&ctx, ast, &out) != 0;
+        close_output(&out);
+    } else {
+        job->failed = 1;
+    }
+    job->seconds = now() - start;
+    free_context(&ctx);
+    return NULL;
+}
+
+static int run_job(Job* job) {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, STACK_SIZE);
+    pthread_t thread;
+    if (pthread_create(&thread, &attr, compile_job, job) != 0) {
+        perror("pthread_create");
+        exit(1);
+    }
+    pthread_join(thread, NULL);
+    pthread_attr_destroy(&attr);
+
+    printf("%-12s %8.1f MB %8.2f s  %s\n", job->name, job->source.length / 1e6, job->seconds,
+           job->failed ? "FAILED" : "ok");
+    free(job->source.data);
+    return job->failed;
+}
+
+int main(int argc, char** argv) {
+    long statements = 2000000;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--statements=", 13) == 0) {
+            statements = atol(argv[i] + 13);
+        } else {
+            fprintf(stderr, "Usage: %s [--statements=N]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    printf("%ld statements, %d KiB stack\n", statements, STACK_SIZE / 1024);
+    Job long_block = { "long-block" };
+    build_long_block(&long_block.source, statements);
+    Job sparse = { "sparse" };
+    build_sparse(&sparse.source, statements);
+
+    int failures = run_job(&long_block) + run_job(&sparse);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,217 @@
+// throughput.c
+// Lexer, parser and codegen throughput on generated programs, with a baseline
+//
+// Usage: bench_throughput [--baseline=FILE] [--save-baseline=FILE]
+//
+// Each shape bench_flugen knows is generated once, then every phase is run
+// ROUNDS times in-process and the fastest round is kept. With --baseline,
+// any phase slower than the stored MB/s by more than BENCH_TOLERANCE
+// percent (default 15) is flagged and the exit status is 1.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "lexer.h"
+#include "parser.h"
+#include "codegen.h"
+#include "context.h"
+#include "output.h"
+
+#define ROUNDS 5
+#define PROGRAM_SIZE (4 * 1024 * 1024)
+#define MAX_RESULTS 64
+
+static const char* const shapes[] = { "mixed", "deep", "expr", "functions", "comments" };
+static const char* const phases[] = { "lex", "parse", "codegen" };
+
+typedef struct {
+    char name[64];                // "<shape> <phase>"
+    double mb_per_second;
+} Result;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char* generate(const char* shape, size_t* size) {
+    char command[256];
+    snprintf(command, sizeof(command), "obj/bench_flugen --shape=%s --size=%d", shape, PROGRAM_SIZE);
+    FILE* pipe = popen(command, "r");
+    if (!pipe) {
+        return NULL;
+    }
+    size_t capacity = PROGRAM_SIZE + 65536, length = 0;
+    char* source = malloc(capacity + 1);
+    size_t n;
+    while ((n = fread(source + length, 1, capacity - length, pipe)) > 0) {
+        length += n;
+        if (length == capacity) {
+            capacity *= 2;
+            source = realloc(source, capacity + 1);
+        }
+    }
+    if (pclose(pipe) != 0 || length == 0) {
+        free(source);
+        return NULL;
+    }
+    source[length] = '\0';
+    *size = length;
+    return source;
+}
+
+// Times one phase on a fresh context and returns seconds; *tokens is the
+// number of tokens the source holds. Parsing pulls its own tokens, so the
+// parse figure includes lexing, and codegen is timed on its own.
+static double run_phase(int phase, const char* source, long* tokens) {
+    FluentContext ctx;
+    init_context(&ctx);
+    double elapsed = 0;
+    *tokens = 0;
+
+    init_lexer(&ctx, source);
+    if (phase == 0) {
+        double start = now();
+        while (get_next_token(&ctx).type != TOKEN_EOF) {
+            (*tokens)++;
+        }
+        elapsed = now() - start;
+    } else {
+        while (get_next_token(&ctx).type != TOKEN_EOF) {
+            (*tokens)++;
+        }
+        init_lexer(&ctx, source);
+        double start = now();
+        NodeId ast = parse_program(&ctx);
+        elapsed = now() - start;
+        if (!ast) {
+            fprintf(stderr, "generated program did not parse\n");
+            exit(1);
+        }
+        if (phase == 2) {
+            OutputBuffer out;
+            open_memory_output(&out);
+            start = now();
+            int failed = generate_code(&ctx, ast, &out);
+            elapsed = now() - start;
+            close_output(&out);
+            if (failed) {
+                fprintf(stderr, "generated program did not compile\n");
+                exit(1);
+            }
+        }
+    }
+    free_context(&ctx);
+    return elapsed;
+}
+
+static int load_baseline(const char* path, Result* results) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        return -1;
+    }
+    int count = 0;
+    char shape[32], phase[32];
+    double value;
+    while (count < MAX_RESULTS && fscanf(file, "%31s %31s %lf", shape, phase, &value) == 3) {
+        snprintf(results[count].name, sizeof(results[count].name), "%s %s", shape, phase);
+        results[count++].mb_per_second = value;
+    }
+    fclose(file);
+    return count;
+}
+
+static const Result* find_result(const Result* results, int count, const char* name) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(results[i].name, name) == 0) {
+            return &results[i];
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char** argv) {
+    const char* baseline_path = NULL;
+    const char* save_path = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--baseline=", 11) == 0) {
+            baseline_path = argv[i] + 11;
+        } else if (strncmp(argv[i], "--save-baseline=", 16) == 0) {
+            save_path = argv[i] + 16;
+        } else {
+            fprintf(stderr, "Usage: %s [--baseline=FILE] [--save-baseline=FILE]\n", argv[0]);
+            return 1;
+        }
+    }
+    double tolerance = getenv("BENCH_TOLERANCE") ? atof(getenv("BENCH_TOLERANCE")) : 15.0;
+
+    Result baseline[MAX_RESULTS];
+    int baseline_count = 0;
+    if (baseline_path) {
+        baseline_count = load_baseline(baseline_path, baseline);
+        if (baseline_count < 0) {
+            printf("no baseline at %s; record one with `make bench-baseline`\n", baseline_path);
+            baseline_count = 0;
+        }
+    }
+
+    Result results[MAX_RESULTS];
+    int result_count = 0;
+    int regressions = 0;
+    printf("%-10s %-8s %10s %12s %10s %9s\n", "shape", "phase", "MB/s", "M tokens/s", "baseline", "change");
+    for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++) {
+        size_t size;
+        char* source = generate(shapes[s], &size);
+        if (!source) {
+            fprintf(stderr, "could not generate the '%s' program\n", shapes[s]);
+            return 1;
+        }
+        for (int phase = 0; phase < (int)(sizeof(phases) / sizeof(phases[0])); phase++) {
+            double best = 0;
+            long tokens = 0;
+            for (int round = 0; round < ROUNDS; round++) {
+                double elapsed = run_phase(phase, source, &tokens);
+                if (round == 0 || elapsed < best) {
+                    best = elapsed;
+                }
+            }
+
+            Result* result = &results[result_count++];
+            snprintf(result->name, sizeof(result->name), "%s %s", shapes[s], phases[phase]);
+            result->mb_per_second = size / best / 1e6;
+            printf("%-10s %-8s %10.1f %12.2f", shapes[s], phases[phase], result->mb_per_second, tokens / best / 1e6);
+
+            const Result* old = find_result(baseline, baseline_count, result->name);
+            if (old) {
+                double change = (result->mb_per_second / old->mb_per_second - 1) * 100;
+                printf(" %10.1f %+8.1f%%", old->mb_per_second, change);
+                if (change < -tolerance) {
+                    printf("  REGRESSION");
+                    regressions++;
+                }
+            }
+            printf("\n");
+        }
+        free(source);
+    }
+
+    if (save_path) {
+        FILE* file = fopen(save_path, "w");
+        if (!file) {
+            perror(save_path);
+            return 1;
+        }
+        for (int i = 0; i < result_count; i++) {
+            fprintf(file, "%s %.1f\n", results[i].name, results[i].mb_per_second);
+        }
+        fclose(file);
+        printf("baseline saved to %s\n", save_path);
+    }
+    if (regressions) {
+        printf("%d phase(s) more than %.0f%% slower than the baseline\n", regressions, tolerance);
+    }
+    return regressions ? 1 : 0;
+}
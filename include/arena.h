@@ -0,0 +1,48 @@
+// arena.h
+// Fluent Language Arena Allocator Header File
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t size;                  // Usable bytes in data
+    size_t used;                  // Bytes handed out from data
+    char data[];
+} ArenaBlock;
+
+typedef struct {
+    ArenaBlock* head;             // Block currently being bumped
+    ArenaBlock* free_list;        // Blocks kept around after a reset
+
+    // Counters
+    size_t allocations;           // Number of arena_alloc calls
+    size_t bytes_allocated;       // Bytes handed out (including alignment)
+    size_t bytes_reserved;        // Bytes obtained from malloc
+    size_t blocks;                // Number of blocks obtained from malloc
+    size_t resets;                // Number of reset_arena calls
+} Arena;
+
+// A position in an arena that arena_rewind can return to
+typedef struct {
+    ArenaBlock* block;
+    size_t used;
+} ArenaMark;
+
+// Function prototypes
+void init_arena(Arena* arena);
+void* arena_alloc(Arena* arena, size_t size);
+char* arena_strdup(Arena* arena, const char* str);
+char* arena_strndup(Arena* arena, const char* str, size_t length);
+void reset_arena(Arena* arena);
+ArenaMark arena_mark(const Arena* arena);
+void arena_rewind(Arena* arena, ArenaMark mark);
+void free_arena(Arena* arena);
+void print_arena_stats(const Arena* arena, FILE* out);
+
+#endif // ARENA_H
@@ -4,7 +4,9 @@
 #ifndef AST_H
 #define AST_H
 
+#include <stdint.h>
 #include "lexer.h"
+#include "types.h"
 
 typedef enum {
     AST_PROGRAM,
@@ -19,31 +21,80 @@ typedef enum {
     AST_BIN_OP,
     AST_NUMBER,
     AST_IDENTIFIER,
+    AST_PARAM,
+    AST_CALL,
+    AST_CAST,
     AST_NOOP
     // Add other AST node types as needed
 } ASTNodeType;
 
-typedef struct ASTNode {
-    ASTNodeType type;
-    char* value;                  // For identifiers and literals
-    struct ASTNode* left;
-    struct ASTNode* right;
-    struct ASTNode* expr;         // For variable declarations and assignments
-    char* var_name;               // Variable name
-    int is_mutable;               // 1 for 'var', 0 for 'let'
-    TokenType op;                 // Operator for binary operations
-    struct ASTNode* next;         // For linked list of statements
-    struct ASTNode* statements;   // For blocks and programs
-    struct ASTNode* condition;    // For control flow
-    struct ASTNode* then_branch;  // For 'if' statements
-    struct ASTNode* else_branch;  // For 'if' statements
-    char* func_name;              // Function name
-    struct ASTNode* params;       // Function parameters
-    struct ASTNode* body;         // Function body
+// Index of a node in Ast.nodes. Children and list links are NodeIds rather
+// than pointers, so a node is 32 bytes and a whole tree is one array.
+typedef uint32_t NodeId;
+
+#define NO_NODE 0                 // nodes[0] is never used
+
+#define MAX_PARAMETERS 255        // Per function
+
+// Index of a Symbol in the file's symbol table, filled in by resolve_program
+typedef uint32_t SymbolId;
+
+// Each node type uses one member of the union:
+//   AST_PROGRAM, AST_BLOCK         block
+//   AST_VAR_DECL, AST_ASSIGNMENT,  decl
+//   AST_PARAM
+//   AST_FUNC_DECL                  func
+//   AST_IF_STMT                    if_stmt
+//   AST_WHILE_STMT, AST_FOR_STMT   loop
+//   AST_RETURN_STMT                ret
+//   AST_BIN_OP                     binary
+//   AST_IDENTIFIER                 ident
+//   AST_CALL                       call
+//   AST_CAST                       cast
+//   AST_NUMBER                     value
+//
+// value_type is the ValueType of an expression, of the variable an
+// AST_VAR_DECL or AST_PARAM declares, and the return type of an
+// AST_FUNC_DECL. The parser stores annotations; resolution fills in the rest.
+typedef struct {
+    uint8_t type;                 // ASTNodeType
+    uint8_t op;                   // TokenType of an AST_BIN_OP
+    uint8_t is_mutable;           // AST_VAR_DECL: 1 for 'var', 0 for 'let'
+    uint8_t value_type;           // ValueType
+    NodeId next;                  // Next statement in a list
+    union {
+        struct { NodeId statements; } block;
+        struct { Slice name; NodeId expr; SymbolId symbol; } decl;
+        struct { Slice name; NodeId params; NodeId body; } func;
+        struct { NodeId condition; NodeId then_branch; NodeId else_branch; } if_stmt;
+        struct { NodeId condition; NodeId body; } loop;
+        struct { NodeId expr; } ret;
+        struct { NodeId left; NodeId right; } binary;
+        struct { Slice name; SymbolId symbol; } ident;
+        struct { Slice name; NodeId args; SymbolId symbol; } call;
+        struct { NodeId expr; } cast;     // To value_type
+        Slice value;              // Literal text
+    };
 } ASTNode;
 
+// Every node of one file. Growing may move the array, so pointers from
+// ast_node() are only good until the next new_ast_node().
+typedef struct {
+    ASTNode* nodes;
+    uint32_t count;               // Including the unused nodes[0]
+    uint32_t capacity;
+} Ast;
+
 // Function prototypes
-ASTNode* create_ast_node(ASTNodeType type);
-void free_ast(ASTNode* node);
+void init_ast(Ast* ast);
+void reset_ast(Ast* ast);
+void free_ast(Ast* ast);
+NodeId new_ast_node(Ast* ast, ASTNodeType type);
+int ast_children(const ASTNode* node, NodeId children[3]);
+int ast_list_length(const Ast* ast, NodeId first);
+
+static inline ASTNode* ast_node(const Ast* ast, NodeId id) {
+    return &ast->nodes[id];
+}
 
 #endif // AST_H
@@ -0,0 +1,53 @@
+// cache.h
+// Fluent Language Compilation Cache Header File
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include "ast.h"
+
+struct FluentContext;
+
+// Part of every cache key; bump it whenever generated output changes
+#define FLUENT_VERSION "0.5.0"
+
+#define DEFAULT_CACHE_SIZE (512LL * 1024 * 1024)
+
+typedef struct {
+    unsigned __int128 state;      // FNV-1a, 128-bit
+} CacheHash;
+
+typedef struct {
+    char hex[33];
+} CacheKey;
+
+// Shared by every worker; counters are updated atomically
+typedef struct Cache {
+    const char* directory;
+    long long max_bytes;          // Evict least recently used entries past this
+    int file_hits;
+    int file_misses;
+    int function_hits;
+    int function_misses;
+    int stored;                   // Entries written during this run
+    int evicted;
+} Cache;
+
+// Function prototypes
+void init_cache(Cache* cache, const char* directory, long long max_bytes);
+void cache_hash_init(CacheHash* hash);
+void cache_hash_update(CacheHash* hash, const void* data, size_t length);
+void cache_hash_string(CacheHash* hash, const char* str);
+CacheKey cache_hash_final(const CacheHash* hash);
+void cache_hash_options(CacheHash* hash, const struct FluentContext* ctx);
+void cache_hash_ast(CacheHash* hash, const Ast* ast, NodeId node);
+
+// Returns a malloc'd copy of the entry, or NULL on a miss
+char* cache_load(Cache* cache, const CacheKey* key, size_t* length);
+void cache_store(Cache* cache, const CacheKey* key, const char* data, size_t length);
+void cache_count(int* counter);
+void trim_cache(Cache* cache);
+long long parse_cache_size(const char* text);
+
+#endif // CACHE_H
@@ -5,7 +5,22 @@
 #define CODEGEN_H
 
 #include "ast.h"
+#include "output.h"
+#include "context.h"
+#include "ir.h"
 
-void generate_code(ASTNode* ast);
+int generate_code(FluentContext* ctx, NodeId ast, OutputBuffer* out);
+int generate_asm(FluentContext* ctx, NodeId ast, OutputBuffer* out);
+
+// The parts of generate_code's C output, for emitting a file piece by piece.
+// Errors unwind to ctx->error_jmp.
+void emit_c_prologue(OutputBuffer* out);
+void emit_c_prototype(OutputBuffer* out, Slice name, ValueType return_type, const uint8_t* param_types,
+                      int param_count);
+void emit_c_global(OutputBuffer* out, Slice name, ValueType type);
+void generate_c_function(FluentContext* ctx, IRModule* module, NodeId func_decl, OutputBuffer* out);
+void generate_c_init(FluentContext* ctx, IRModule* module, NodeId program, const char* signature,
+                     OutputBuffer* out);
+void emit_c_entry(OutputBuffer* out, int has_main);
 
 #endif // CODEGEN_H
@@ -0,0 +1,77 @@
+// context.h
+// Fluent Language Compilation Context Header File
+
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#include <setjmp.h>
+#include "arena.h"
+#include "lexer.h"
+#include "output.h"
+#include "ast.h"
+#include "intern.h"
+#include "symbols.h"
+#include "tokens.h"
+
+typedef struct {
+    int folded;                   // Operations evaluated at compile time
+    int simplified;               // Algebraic identities applied
+    int propagated;               // Uses of constant 'let' bindings replaced
+    int nodes_removed;            // AST nodes no longer reachable
+    int copies_propagated;        // Operands rewritten to skip a copy
+    int values_numbered;          // SSA values folded or found redundant
+    int instrs_removed;           // Dead SSA instructions deleted
+    int blocks_removed;           // Unreachable or merged basic blocks
+} OptimizeStats;
+
+typedef enum {
+    EMIT_C,
+    EMIT_IR,
+    EMIT_ASM                      // x86-64 assembly
+} EmitKind;
+
+// Largest callee cost (see lower.c) that -O2 inlines
+#define DEFAULT_INLINE_THRESHOLD 25
+
+struct Cache;
+struct Profile;
+
+// Everything one compilation needs. Contexts share no state besides the
+// optional cache, which is safe to use from several threads, so separate
+// threads can each compile with their own.
+typedef struct FluentContext {
+    Arena arena;                  // Owns IR, bytecode and folded literals
+    Ast ast;                      // Nodes of the file being compiled
+    Interner names;               // Identifiers of the file
+    SymbolTable symbols;          // Declarations the AST is resolved to
+    Lexer lexer;
+    TokenStream tokens;           // The whole file, unless pull_tokens
+    uint32_t token_index;         // Next token in tokens
+    Token current_token;          // Parser lookahead
+    Token next_token;             // Second lookahead when pulling tokens
+    int has_next_token;
+    int pull_tokens;              // Lex on demand instead of up front
+    int stream;                   // Compile one top-level piece at a time
+    int codegen_jobs;             // Threads generating functions; 1 or less is serial
+    OutputBuffer* out;            // Code generator sink
+    int opt_level;                // 0 = none, 1 = AST folding, 2 = SSA passes
+    const char* ir_pipeline;      // Overrides the -O2 pass list when set
+    int inline_threshold;         // 0 disables inlining
+    EmitKind emit;
+    OptimizeStats opt_stats;
+    struct Cache* cache;          // NULL disables the compilation cache
+    struct Profile* profile;      // Phase timers and counters; NULL when off
+    jmp_buf error_jmp;            // Where the parser unwinds to on an error
+    int error_count;
+    const char* file_name;        // Prefixed to diagnostics when set
+    FILE* diagnostics;            // Diagnostics sink; NULL means stderr
+} FluentContext;
+
+// Function prototypes
+void init_context(FluentContext* ctx);
+void reset_context(FluentContext* ctx);
+void free_context(FluentContext* ctx);
+void report_error(FluentContext* ctx, const char* format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+#endif // CONTEXT_H
@@ -0,0 +1,49 @@
+// driver.h
+// Fluent Compiler Build Driver Header File
+
+#ifndef DRIVER_H
+#define DRIVER_H
+
+#include "context.h"
+#include "profile.h"
+
+typedef enum {
+    RUN_NONE,                     // Compile to an output file
+    RUN_VM,                       // --run: interpret bytecode
+    RUN_JIT                       // --jit: translate to machine code
+} RunMode;
+
+typedef struct {
+    const char* input_path;
+    const char* output_path;      // NULL writes to standard output
+    int status;                   // 0 on success
+    char* diagnostics;            // Messages produced while compiling
+    size_t diagnostics_length;
+} CompileJob;
+
+typedef struct {
+    int jobs;                     // Worker threads
+    int opt_level;                // -O level
+    const char* ir_pipeline;      // --passes list, NULL for the default
+    EmitKind emit;
+    int mem_stats;                // Token, node and memory counters
+    int time_passes;              // Per-phase timers
+    StatsFormat stats_format;     // Table or JSON for the two above
+    const char* trace_path;       // Chrome trace-event output, or NULL
+    int opt_stats;                // Report what the optimizer did per file
+    RunMode run;
+    struct Cache* cache;          // Shared by all workers; NULL when disabled
+    int cache_stats;              // Report hit/miss counters
+    int pull_tokens;              // Lex on demand instead of up front
+    int stream;                   // --stream: emit each function as it is parsed
+    int inline_threshold;         // Largest callee cost inlined at -O2
+} BuildOptions;
+
+// Function prototypes
+int compile_file(FluentContext* ctx, const char* input_path, const char* output_path);
+int run_file(FluentContext* ctx, const char* input_path, RunMode mode, int* exit_status);
+int run_build(CompileJob* jobs, int count, const BuildOptions* options);
+int wants_profile(const BuildOptions* options);
+int report_profiles(const BuildOptions* options, Profile* profiles, int count, double started);
+
+#endif // DRIVER_H
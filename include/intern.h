@@ -0,0 +1,40 @@
+// intern.h
+// Fluent Language Identifier Interner Header File
+
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stdint.h>
+#include "arena.h"
+#include "lexer.h"
+
+// Dense ID of an interned name; equal names get equal IDs, so names are
+// compared and hashed as integers from here on
+typedef uint32_t NameId;
+
+#define NO_NAME 0                 // names[0] is never used
+
+// Names are slices of the source, so an interner is reset with the file,
+// unless storage is set: then each new name is copied into it, for input
+// that is freed while the file is still being compiled
+typedef struct {
+    Slice* names;                 // Indexed by NameId
+    uint32_t* hashes;             // Hash of each name, for rehashing
+    uint32_t count;               // Including the unused names[0]
+    uint32_t capacity;
+    uint32_t* table;              // Open-addressed NameIds; NO_NAME is empty
+    uint32_t table_capacity;      // Power of two
+    Arena* storage;               // Owns the names when set
+} Interner;
+
+// Function prototypes
+void init_interner(Interner* interner);
+void reset_interner(Interner* interner);
+void free_interner(Interner* interner);
+NameId intern(Interner* interner, Slice name);
+
+static inline Slice interned_name(const Interner* interner, NameId id) {
+    return interner->names[id];
+}
+
+#endif // INTERN_H
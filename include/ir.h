@@ -0,0 +1,137 @@
+// ir.h
+// Fluent Language SSA Intermediate Representation Header File
+
+#ifndef IR_H
+#define IR_H
+
+#include "ast.h"
+#include "context.h"
+#include "output.h"
+
+typedef enum {
+    IR_CONST,                     // imm, or fimm for a float type
+    IR_COPY,                      // args[0]
+    IR_PHI,                       // phi_args[i] flows in from preds[i]
+    IR_PARAM,                     // Parameter number imm
+    IR_CONVERT,                   // args[0] converted to this instruction's type
+    IR_ADD,
+    IR_SUB,
+    IR_MUL,
+    IR_DIV,
+    IR_EQ,
+    IR_NE,
+    IR_LT,
+    IR_GT,
+    IR_LE,
+    IR_GE,
+    IR_LOAD_GLOBAL,               // global
+    IR_CALL,                      // callee(args[0..arg_count))
+    IR_STORE_GLOBAL,              // global = args[0]
+
+    // Terminators
+    IR_JUMP,                      // targets[0]
+    IR_BRANCH,                    // args[0] ? targets[0] : targets[1]
+    IR_RETURN,                    // args[0]
+
+    IR_NOP                        // Deleted; never appears in a block
+} IROpcode;
+
+typedef struct {
+    IROpcode op;
+    int id;                       // The value this instruction defines
+    int block;
+    uint8_t type;                 // ValueType of that value; operands of arithmetic share it
+    union {
+        long long imm;            // A u64 is kept as its bits
+        double fimm;
+    };
+    int* args;                    // inline_args, or arg_count operands of a call
+    int inline_args[2];
+    int arg_count;
+    int* phi_args;
+    int global;
+    int callee;                   // Index into IRModule.functions
+    int targets[2];
+} IRInstr;
+
+typedef struct {
+    int id;
+    int* phis;
+    int phi_count;
+    int phi_capacity;
+    int* instrs;                  // Terminator last once the block is filled
+    int instr_count;
+    int instr_capacity;
+    int* preds;
+    int pred_count;
+    int pred_capacity;
+    int sealed;                   // All predecessors are known
+    int removed;
+
+    // Filled in by compute_dominators
+    int rpo_index;                // -1 when unreachable
+    int idom;
+} IRBlock;
+
+typedef struct {
+    Slice name;
+    IRInstr** values;             // Indexed by value id
+    int value_count;
+    int value_capacity;
+    IRBlock** blocks;             // blocks[0] is the entry
+    int block_count;
+    int block_capacity;
+    int* rpo;                     // Reachable blocks in reverse postorder
+    int rpo_count;
+} IRFunction;
+
+typedef struct {
+    Slice name;
+    int is_mutable;
+    ValueType type;
+} IRGlobal;
+
+typedef struct {
+    Slice name;
+    int param_count;
+    NodeId decl;                  // AST_FUNC_DECL, or NO_NODE when not in memory
+} IRCallee;
+
+typedef struct {
+    IRGlobal* globals;
+    int global_count;
+    int global_capacity;
+    IRCallee* functions;          // Numbered like their symbols' slots
+    int function_count;
+    int function_capacity;
+} IRModule;
+
+// Function prototypes
+// ir.c: construction and inspection
+IRFunction* create_ir_function(Arena* arena, Slice name);
+IRBlock* create_ir_block(Arena* arena, IRFunction* fn);
+IRInstr* append_ir_instr(Arena* arena, IRFunction* fn, IRBlock* block, IROpcode op);
+IRInstr* append_ir_phi(Arena* arena, IRFunction* fn, IRBlock* block);
+IRInstr* append_ir_call(Arena* arena, IRFunction* fn, IRBlock* block, int callee, int arg_count);
+void add_ir_pred(Arena* arena, IRBlock* block, int pred);
+void remove_ir_pred(IRFunction* fn, IRBlock* block, int pred);
+IRInstr* ir_terminator(IRFunction* fn, IRBlock* block);
+int ir_successors(IRFunction* fn, IRBlock* block, int* succs);
+int ir_is_pure(IROpcode op);
+int ir_operand_count(IRInstr* instr);
+void compute_dominators(Arena* arena, IRFunction* fn);
+void print_ir_function(IRFunction* fn, IRModule* module, OutputBuffer* out);
+
+// lower.c: AST to SSA
+void collect_globals(FluentContext* ctx, NodeId program, IRModule* module);
+IRFunction* lower_function(FluentContext* ctx, IRModule* module, NodeId func_decl);
+IRFunction* lower_global_init(FluentContext* ctx, IRModule* module, NodeId program);
+int inlining_enabled(const FluentContext* ctx);
+
+// passes.c: optimization pipeline
+int run_ir_passes(FluentContext* ctx, IRFunction* fn, const char* pipeline);
+const char* ir_pass_name(int index);
+int valid_ir_pipeline(const char* pipeline);
+void optimize_ir_function(FluentContext* ctx, IRFunction* fn);
+
+#endif // IR_H
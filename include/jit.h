@@ -0,0 +1,12 @@
+// jit.h
+// Fluent Language x86-64 JIT Header File
+
+#ifndef JIT_H
+#define JIT_H
+
+#include "vm.h"
+
+// Function prototypes
+int run_jit(FluentContext* ctx, const BytecodeProgram* program, int* result);
+
+#endif // JIT_H
@@ -5,6 +5,7 @@
 #define LEXER_H
 
 #include <stdio.h>
+#include "source.h"
 
 typedef enum {
     // Single-character tokens
@@ -23,6 +24,7 @@ typedef enum {
     TOKEN_RPAREN,
     TOKEN_COLON,
     TOKEN_COMMA,
+    TOKEN_ARROW,                  // '->'
 
     // Keywords
     TOKEN_FUNC,
@@ -50,16 +52,47 @@ typedef enum {
     TOKEN_UNKNOWN
 } TokenType;
 
+// A view into the source buffer; not NUL-terminated, print with "%.*s"
+typedef struct {
+    const char* start;
+    int length;
+} Slice;
+
+#define SLICE_ARG(s) (s).length, (s).start
+
 typedef struct {
     TokenType type;
-    char* value;
+    Slice text;                   // Empty for INDENT, DEDENT, NEWLINE and EOF
     int line;
     int column;
 } Token;
 
+#define MAX_INDENT_LEVELS 100
+
+// Lexer state; lives inside a FluentContext
+typedef struct {
+    const char* src;
+    size_t src_length;
+    size_t pos;
+    size_t token_start;           // First byte of the token being scanned
+    SourceInput* input;           // Set when src is refilled in chunks
+    int line;
+    int column;
+    int at_line_start;
+    int indent_levels[MAX_INDENT_LEVELS];
+    int indent_stack_top;
+    int pending_dedents;
+} Lexer;
+
+struct FluentContext;
+
 // Function prototypes
-void init_lexer(const char* source_code);
-Token* get_next_token(void);
-void free_token(Token* token);
+// The source buffer must outlive every token and AST node that refers to it.
+// Lexical errors are reported through the context and yield TOKEN_UNKNOWN.
+void init_lexer(struct FluentContext* ctx, const char* source_code);
+void init_lexer_input(struct FluentContext* ctx, SourceInput* source);
+Token get_next_token(struct FluentContext* ctx);
+TokenType lookup_keyword(const char* text, int length);
+int slice_equals(Slice slice, const char* str);
 
 #endif // LEXER_H
\ No newline at end of file
@@ -0,0 +1,35 @@
+// optimize.h
+// Fluent Language AST Optimization Header File
+
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+
+#include "ast.h"
+#include "context.h"
+
+// The value of a 'let' whose initializer folded to a constant
+typedef struct {
+    int is_constant;
+    int value;
+} FoldConstant;
+
+// Constants known so far, indexed by SymbolId. A file folded piece by
+// piece keeps one table, so later pieces see earlier global 'let's.
+typedef struct {
+    FoldConstant* constants;
+    uint32_t capacity;
+} FoldTable;
+
+// Function prototypes
+// Folds constant i32 subexpressions, applies algebraic identities and
+// propagates 'let' bindings with constant initializers. Counts go to
+// ctx->opt_stats.
+void fold_constants(FluentContext* ctx, NodeId program);
+// Folds one piece of a file with the constants of the pieces before it.
+// Entries from first_new on are forgotten first.
+void fold_with_table(FluentContext* ctx, FoldTable* table, NodeId program, SymbolId first_new);
+void init_fold_table(FoldTable* table);
+void free_fold_table(FoldTable* table);
+void print_opt_stats(FluentContext* ctx, FILE* out);
+
+#endif // OPTIMIZE_H
@@ -0,0 +1,58 @@
+// output.h
+// Fluent Language Output Buffer Header File
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stddef.h>
+#include <string.h>
+#include "lexer.h"
+
+#define OUTPUT_BUFFER_SIZE (256 * 1024)
+
+typedef struct {
+    char* buffer;
+    size_t length;                // Bytes waiting to be flushed
+    size_t capacity;
+    int fd;                       // -1 for a memory buffer that only grows
+    int owns_fd;                  // fd was opened by open_output
+    int failed;                   // A write error occurred
+} OutputBuffer;
+
+// Function prototypes
+// A NULL path or "-" writes to standard output.
+int open_output(OutputBuffer* out, const char* path);
+// Collects everything in memory (buffer/length) instead of writing a file
+void open_memory_output(OutputBuffer* out);
+void flush_output(OutputBuffer* out);
+int close_output(OutputBuffer* out);
+void out_write_slow(OutputBuffer* out, const char* data, size_t length);
+void out_int(OutputBuffer* out, long value);
+
+// Append primitives; the common case is a memcpy into the buffer
+static inline void out_write(OutputBuffer* out, const char* data, size_t length) {
+    if (out->capacity - out->length >= length) {
+        memcpy(out->buffer + out->length, data, length);
+        out->length += length;
+    } else {
+        out_write_slow(out, data, length);
+    }
+}
+
+static inline void out_char(OutputBuffer* out, char c) {
+    if (out->length == out->capacity) {
+        out_write_slow(out, &c, 1);
+    } else {
+        out->buffer[out->length++] = c;
+    }
+}
+
+static inline void out_str(OutputBuffer* out, const char* str) {
+    out_write(out, str, strlen(str));
+}
+
+static inline void out_slice(OutputBuffer* out, Slice slice) {
+    out_write(out, slice.start, slice.length);
+}
+
+#endif // OUTPUT_H
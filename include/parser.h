@@ -6,8 +6,11 @@
 
 #include "lexer.h"
 #include "ast.h"
+#include "context.h"
 
 // Function prototypes
-ASTNode* parse_program(void);
+NodeId parse_program(FluentContext* ctx);
+void begin_streaming_parse(FluentContext* ctx);
+NodeId parse_top_level(FluentContext* ctx);
 
 #endif // PARSER_H
\ No newline at end of file
@@ -0,0 +1,92 @@
+// profile.h
+// Fluent Compiler Phase Timing and Memory Counters Header File
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include "arena.h"
+
+// Phases are timed exclusively: time spent lexing inside the parser is
+// charged to PHASE_LEX only, lowering inside codegen to PHASE_LOWER, etc.
+typedef enum {
+    PHASE_READ,                   // Opening or mapping the source
+    PHASE_LEX,                    // get_next_token
+    PHASE_PARSE,                  // parse_program, less lexing
+    PHASE_RESOLVE,                // Binding names to symbols
+    PHASE_FOLD,                   // -O1 AST folding
+    PHASE_LOWER,                  // AST -> SSA
+    PHASE_CODEGEN,                // Emitting C, IR or assembly
+    PHASE_BYTECODE,               // --run/--jit compilation
+    PHASE_EXECUTE,                // --run/--jit execution
+    PHASE_PASSES,                 // One slot per IR pass from here on
+    MAX_PHASES = PHASE_PASSES + 8
+} Phase;
+
+#define MAX_PHASE_DEPTH 16
+
+typedef struct {
+    double seconds;
+    long long calls;
+} PhaseTimer;
+
+// One span for the Chrome trace, in microseconds since the build started
+typedef struct {
+    int phase;
+    const char* file_name;
+    double start;
+    double duration;
+} TraceEvent;
+
+typedef struct {
+    int phase;
+    double start;
+} OpenPhase;
+
+// Per-worker profile. Counters are always kept; timers only when timing.
+typedef struct Profile {
+    int timing;                   // --time-passes or --trace
+    int tracing;                  // Record spans for --trace
+    double epoch;                 // Build start, shared by all workers
+    PhaseTimer phases[MAX_PHASES];
+    OpenPhase stack[MAX_PHASE_DEPTH];
+    int depth;
+    double last;                  // When the innermost phase last resumed
+    const char* file_name;        // File being compiled, for trace spans
+
+    // Counters
+    long long files;
+    long long source_bytes;
+    long long tokens;
+    long long ast_nodes;
+    long long ast_bytes;          // ast_nodes * sizeof(ASTNode)
+    long long arena_allocations;
+    long long arena_bytes;        // Bytes handed out by the arena
+    long long arena_reserved;     // High-water mark of bytes obtained from malloc
+
+    TraceEvent* events;
+    int event_count;
+    int event_capacity;
+} Profile;
+
+typedef enum {
+    STATS_TABLE,
+    STATS_JSON
+} StatsFormat;
+
+// Function prototypes
+double profile_now(void);
+void init_profile(Profile* profile, int timing, int tracing, double epoch);
+void free_profile(Profile* profile);
+void profile_begin(Profile* profile, int phase);
+void profile_end(Profile* profile);
+void profile_unwind(Profile* profile);
+void record_arena(Profile* profile, const Arena* arena);
+void merge_profile(Profile* total, const Profile* part);
+const char* phase_name(int phase);
+void print_profile(const Profile* profile, FILE* out, StatsFormat format,
+                   int time_passes, int mem_stats, double wall_seconds);
+int write_chrome_trace(const Profile* profiles, int count, const char* path);
+
+#endif // PROFILE_H
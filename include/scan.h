@@ -0,0 +1,23 @@
+// scan.h
+// Fluent Language Byte-Run Scanners Header File
+
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+
+// Each scanner returns how many bytes from the start of text[0..length)
+// belong to the run, so the lexer can skip it in one step. They never read
+// past length, which may be the end of a mapped file.
+typedef struct {
+    const char* name;
+    size_t (*span)(const char* text, size_t length, char a, char b); // Bytes equal to a or b
+    size_t (*until)(const char* text, size_t length, char stop);     // Up to stop or NUL
+    size_t (*identifier)(const char* text, size_t length);           // [A-Za-z0-9_]
+} Scanner;
+
+// Chosen once at startup: AVX2 or SSE2 where the CPU has them, otherwise
+// plain C. FLUENTC_SCAN=scalar|sse2|avx2 overrides the choice.
+extern const Scanner* scanner;
+
+#endif // SCAN_H
@@ -0,0 +1,36 @@
+// source.h
+// Fluent Language Source Input Header File
+
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <stddef.h>
+
+#define SOURCE_CHUNK_SIZE (64 * 1024)
+
+typedef struct SourceChunk {
+    struct SourceChunk* next;
+    size_t length;                // Valid bytes in data
+    char data[];
+} SourceChunk;
+
+typedef struct {
+    const char* data;             // Whole mapped file, or the current chunk
+    size_t length;                // Valid bytes in data
+    int fd;
+    int is_mapped;                // data is an mmap of a regular file
+    int is_stream;                // data is refilled from fd in chunks
+    int at_eof;
+    SourceChunk* chunks;          // Chunks still alive, newest first; tokens may point into them
+    size_t bytes_read;            // Total source bytes seen so far
+} SourceInput;
+
+// Function prototypes
+// A path of "-" reads standard input. Regular files are mapped, anything
+// else (pipes, terminals) is read in SOURCE_CHUNK_SIZE chunks on demand.
+int open_source(SourceInput* input, const char* path);
+int refill_source(SourceInput* input, size_t keep_from);
+void release_source_chunks(SourceInput* input, const char* const* live, int live_count);
+void close_source(SourceInput* input);
+
+#endif // SOURCE_H
@@ -0,0 +1,22 @@
+// stream.h
+// Fluent Language Streaming Compilation Header File
+
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "context.h"
+#include "output.h"
+#include "source.h"
+
+// Top-level statements other than functions are run in groups of at most
+// this many, each compiled to its own initializer
+#define STREAM_INIT_STATEMENTS 256
+
+// Function prototypes
+// Compiles source to C one top-level function, or group of top-level
+// statements, at a time: each is parsed, resolved, folded, lowered and
+// written to out before the next is read, then its nodes and IR are freed.
+// Returns 0 on success, or -1 after reporting an error.
+int compile_streamed(FluentContext* ctx, SourceInput* source, OutputBuffer* out);
+
+#endif // STREAM_H
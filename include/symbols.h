@@ -0,0 +1,92 @@
+// symbols.h
+// Fluent Language Symbol Table and Name Resolution Header File
+
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+#include <stdint.h>
+#include "ast.h"
+#include "intern.h"
+
+#define NO_SYMBOL 0               // symbols[0] is never used
+
+typedef enum {
+    SYMBOL_GLOBAL,
+    SYMBOL_LOCAL,                 // Parameters are a function's first locals
+    SYMBOL_FUNCTION
+} SymbolKind;
+
+// One per declaration; a name declared twice gets two symbols
+typedef struct {
+    NameId name;
+    uint8_t kind;                 // SymbolKind
+    uint8_t is_mutable;           // 1 for 'var', 0 for 'let'
+    uint8_t type;                 // ValueType of the variable, or a function's return type
+    uint8_t param_count;          // SYMBOL_FUNCTION only
+    uint32_t slot;                // Global or function index, or local number within its function
+    uint32_t param_types;         // SYMBOL_FUNCTION: index of its first parameter's in SymbolTable.types
+} Symbol;
+
+// What a declaration hid, so closing its scope can put it back
+typedef struct {
+    NameId name;
+    SymbolId hidden;
+} ShadowEntry;
+
+// Symbols of one file. Lookup is an array index by NameId: `visible` holds
+// the innermost symbol for each name, and scopes undo their declarations
+// from a log when they close.
+typedef struct {
+    Symbol* symbols;
+    uint32_t count;               // Including the unused symbols[0]
+    uint32_t capacity;
+    SymbolId* visible;            // Indexed by NameId
+    uint32_t visible_capacity;
+    ShadowEntry* shadowed;
+    int shadowed_count;
+    int shadowed_capacity;
+    int* scopes;                  // shadowed_count when each open scope began
+    int depth;
+    int scope_capacity;
+    uint8_t* types;               // Parameter types of every function, one run each
+    int type_count;
+    int type_capacity;
+} SymbolTable;
+
+struct FluentContext;
+
+// Function prototypes
+void init_symbols(SymbolTable* table);
+void reset_symbols(SymbolTable* table);
+void free_symbols(SymbolTable* table);
+void push_scope(SymbolTable* table);
+void pop_scope(SymbolTable* table);
+SymbolId declare_symbol(SymbolTable* table, NameId name, SymbolKind kind, int is_mutable, uint32_t slot);
+
+// Binds every identifier, call, declaration and assignment in the program
+// to a symbol and gives every expression its type, reporting undeclared
+// names, assignments to 'let', calls with the wrong number of arguments,
+// duplicate globals or functions and values that would narrow implicitly.
+// Implicit widenings become AST_CAST nodes. Unwinds to ctx->error_jmp on
+// the first error.
+void resolve_program(struct FluentContext* ctx, NodeId program);
+
+// The steps of resolve_program, for compiling a file piece by piece.
+// Globals and functions must be declared in the outermost scope before
+// anything that refers to them is resolved. A global declared with
+// TYPE_NONE takes the type of its initializer when that is resolved.
+void declare_global(struct FluentContext* ctx, Slice name, int is_mutable, ValueType type, uint32_t slot);
+void declare_function(struct FluentContext* ctx, Slice name, const uint8_t* param_types, int param_count,
+                      ValueType return_type, uint32_t slot);
+void resolve_function(struct FluentContext* ctx, NodeId func_decl);
+void resolve_global_init(struct FluentContext* ctx, NodeId program);
+
+static inline SymbolId lookup_symbol(const SymbolTable* table, NameId name) {
+    return name < table->visible_capacity ? table->visible[name] : NO_SYMBOL;
+}
+
+static inline Symbol* symbol_at(const SymbolTable* table, SymbolId id) {
+    return &table->symbols[id];
+}
+
+#endif // SYMBOLS_H
@@ -0,0 +1,44 @@
+// tokens.h
+// Fluent Language Pre-Tokenized Token Stream Header File
+
+#ifndef TOKENS_H
+#define TOKENS_H
+
+#include <stdint.h>
+#include "lexer.h"
+
+// Every token of one file, lexed up front into parallel arrays so the
+// parser walks indices with arbitrary lookahead. Offsets are relative to
+// source, so only a contiguous (mapped or in-memory) source below 4 GiB
+// can be tokenized this way. The last token is always TOKEN_EOF.
+typedef struct {
+    uint8_t* kinds;               // TokenType
+    uint32_t* offsets;            // Start of the text in source
+    uint32_t* lengths;
+    uint32_t* lines;
+    uint32_t count;
+    uint32_t capacity;
+    const char* source;
+} TokenStream;
+
+struct FluentContext;
+
+// Function prototypes
+void init_token_stream(TokenStream* stream);
+void reset_token_stream(TokenStream* stream);
+void free_token_stream(TokenStream* stream);
+int can_tokenize(const Lexer* lexer);
+int tokenize(struct FluentContext* ctx, TokenStream* stream);
+
+// Columns are not kept; the token's column is 0
+static inline Token token_at(const TokenStream* stream, uint32_t index) {
+    Token token;
+    token.type = (TokenType)stream->kinds[index];
+    token.text.start = stream->source + stream->offsets[index];
+    token.text.length = (int)stream->lengths[index];
+    token.line = (int)stream->lines[index];
+    token.column = 0;
+    return token;
+}
+
+#endif // TOKENS_H
@@ -0,0 +1,49 @@
+// types.h
+// Fluent Language Numeric Types Header File
+
+#ifndef TYPES_H
+#define TYPES_H
+
+#include "lexer.h"
+
+// Ordered by rank: a value converts implicitly to a type of equal or higher
+// rank, and the operands of a binary operation meet at the higher of theirs
+typedef enum {
+    TYPE_NONE,                    // Statements, and globals not yet typed
+    TYPE_I32,
+    TYPE_I64,
+    TYPE_U64,
+    TYPE_F32,
+    TYPE_F64
+} ValueType;
+
+// A constant of one of the types: integers in i, u64 as its bits, and
+// floats in f, with f32 values already rounded to float
+typedef union {
+    long long i;
+    double f;
+} NumericValue;
+
+struct FluentContext;
+
+// Function prototypes
+// TYPE_NONE for a name that is not a type; 'int' is i32
+ValueType type_from_name(Slice name);
+const char* type_name(ValueType type);
+const char* type_c_name(ValueType type);
+int type_is_float(ValueType type);
+
+// The type of a literal where nothing is expected: a decimal is f64, and an
+// integer the first of i32, i64 and u64 that holds it. TYPE_NONE when no
+// type does.
+ValueType literal_type(Slice text);
+// Stores the literal's value as type; 0 if it is out of that type's range
+// or is a decimal and the type an integer
+int literal_value(Slice text, ValueType type, NumericValue* value);
+
+// The bytecode VM, the JIT and the assembly backend only have 32-bit integer
+// arithmetic. Reports the first wider type the program uses, naming the
+// backend, and unwinds to ctx->error_jmp.
+void require_i32_values(struct FluentContext* ctx, const char* backend);
+
+#endif // TYPES_H
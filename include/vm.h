@@ -0,0 +1,81 @@
+// vm.h
+// Fluent Language Bytecode and Virtual Machine Header File
+
+#ifndef VM_H
+#define VM_H
+
+#include <stdint.h>
+#include "ast.h"
+#include "context.h"
+
+// Register-based instructions. R[] is the current function's register
+// file, G[] the globals and F[] the program's functions, numbered in
+// declaration order; c is a register, constant or jump target.
+typedef enum {
+    OP_MOVE,                      // R[a] = R[b]
+    OP_GETG,                      // R[a] = G[c]
+    OP_SETG,                      // G[c] = R[a]
+    OP_ADD,                       // R[a] = R[b] + R[c]
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_EQ,                        // R[a] = R[b] == R[c]
+    OP_NE,
+    OP_LT,
+    OP_GT,
+    OP_LE,
+    OP_GE,
+    OP_ADDK,                      // R[a] = R[b] + c
+    OP_INCK,                      // R[a] += c
+    OP_JMP,                       // goto c
+    OP_JZ,                        // if (R[a] == 0) goto c
+    OP_JNZ,                       // if (R[a] != 0) goto c
+    OP_JEQ,                       // if (R[a] == R[b]) goto c
+    OP_JNE,
+    OP_JLT,
+    OP_JGT,
+    OP_JLE,
+    OP_JGE,
+    OP_CALL,                      // R[a] = F[b](R[c], R[c + 1], ...)
+    OP_RET,                       // return R[a]
+    OP_COUNT
+} Opcode;
+
+typedef struct {
+    uint16_t op;
+    uint16_t a;
+    uint16_t b;
+    int32_t c;
+} BytecodeInstr;
+
+typedef struct {
+    Slice name;
+    BytecodeInstr* code;
+    int code_count;
+    int code_capacity;
+    int32_t* constants;           // Preloaded into R[0..constant_count)
+    int constant_count;
+    int param_count;              // Passed in the registers after the constants
+    int register_count;           // Constants, locals and temporaries
+} BytecodeFunction;
+
+typedef struct {
+    BytecodeFunction* functions;
+    int function_count;
+    int init_function;            // Top-level statements
+    int main_function;            // -1 when the program has no main
+    int global_count;
+} BytecodeProgram;
+
+// Deepest chain of Fluent calls --run and --jit allow; a deeper one is
+// reported as a stack overflow instead of exhausting memory or the C stack
+#define MAX_CALL_DEPTH 1000000
+
+// Function prototypes
+// bytecode.c
+int compile_bytecode(FluentContext* ctx, NodeId program, BytecodeProgram* out);
+
+// vm.c
+int run_bytecode(FluentContext* ctx, const BytecodeProgram* program, int* result);
+
+#endif // VM_H
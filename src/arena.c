@@ -0,0 +1,126 @@
+// arena.c
+// Implementation of the bump allocator used for AST nodes and their strings
+
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGNMENT 8
+
+static size_t align_up(size_t size) {
+    return (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+}
+
+void init_arena(Arena* arena) {
+    memset(arena, 0, sizeof(Arena));
+}
+
+static ArenaBlock* new_block(Arena* arena, size_t min_size) {
+    // Reuse a block from a previous reset if it is large enough
+    ArenaBlock** link = &arena->free_list;
+    while (*link) {
+        ArenaBlock* block = *link;
+        if (block->size >= min_size) {
+            *link = block->next;
+            block->used = 0;
+            return block;
+        }
+        link = &block->next;
+    }
+
+    size_t size = min_size > ARENA_BLOCK_SIZE ? min_size : ARENA_BLOCK_SIZE;
+    ArenaBlock* block = malloc(sizeof(ArenaBlock) + size);
+    if (!block) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    block->size = size;
+    block->used = 0;
+    arena->bytes_reserved += size;
+    arena->blocks++;
+    return block;
+}
+
+void* arena_alloc(Arena* arena, size_t size) {
+    size = align_up(size ? size : 1);
+
+    ArenaBlock* block = arena->head;
+    if (!block || block->size - block->used < size) {
+        block = new_block(arena, size);
+        block->next = arena->head;
+        arena->head = block;
+    }
+
+    void* ptr = block->data + block->used;
+    block->used += size;
+    arena->allocations++;
+    arena->bytes_allocated += size;
+    return ptr;
+}
+
+char* arena_strndup(Arena* arena, const char* str, size_t length) {
+    char* copy = arena_alloc(arena, length + 1);
+    memcpy(copy, str, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+char* arena_strdup(Arena* arena, const char* str) {
+    return arena_strndup(arena, str, strlen(str));
+}
+
+void reset_arena(Arena* arena) {
+    // Move every block onto the free list so the next compilation reuses them
+    ArenaBlock* block = arena->head;
+    while (block) {
+        ArenaBlock* next = block->next;
+        block->next = arena->free_list;
+        arena->free_list = block;
+        block = next;
+    }
+    arena->head = NULL;
+    arena->resets++;
+}
+
+ArenaMark arena_mark(const Arena* arena) {
+    ArenaMark mark = { arena->head, arena->head ? arena->head->used : 0 };
+    return mark;
+}
+
+// Releases everything allocated since the mark, keeping the blocks that
+// were started after it on the free list
+void arena_rewind(Arena* arena, ArenaMark mark) {
+    ArenaBlock* block = arena->head;
+    while (block != mark.block) {
+        ArenaBlock* next = block->next;
+        block->next = arena->free_list;
+        arena->free_list = block;
+        block = next;
+    }
+    arena->head = mark.block;
+    if (mark.block) {
+        mark.block->used = mark.used;
+    }
+}
+
+static void free_blocks(ArenaBlock* block) {
+    while (block) {
+        ArenaBlock* next = block->next;
+        free(block);
+        block = next;
+    }
+}
+
+void free_arena(Arena* arena) {
+    free_blocks(arena->head);
+    free_blocks(arena->free_list);
+    arena->head = NULL;
+    arena->free_list = NULL;
+}
+
+void print_arena_stats(const Arena* arena, FILE* out) {
+    fprintf(out, "arena: %zu allocations, %zu bytes allocated\n",
+            arena->allocations, arena->bytes_allocated);
+    fprintf(out, "arena: %zu blocks, %zu bytes reserved, %zu resets\n",
+            arena->blocks, arena->bytes_reserved, arena->resets);
+}
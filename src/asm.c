@@ -0,0 +1,914 @@
+// asm.c
+// x86-64 System V assembly backend
+//
+// Emits GNU as syntax from the same optimized SSA the C backend uses.
+// Values get a register or a stack slot from a linear scan over live
+// intervals; constants are never allocated and appear as immediates. All
+// arithmetic is 32-bit to match the C backend's int.
+//
+// Calls follow the System V convention. The first six register parameters
+// are stored to the frame on entry, since their registers are allocatable;
+// values live across a call are kept in callee-saved registers or on the
+// stack.
+
+#include "codegen.h"
+#include "ir.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <limits.h>
+
+typedef enum {
+    LOC_NONE,
+    LOC_REG,
+    LOC_STACK,
+    LOC_IMM
+} LocationKind;
+
+typedef struct {
+    LocationKind kind;
+    int index;                    // Register number or stack slot
+    long long imm;
+} Location;
+
+// Caller-saved registers are handed out first since they cost no
+// save/restore. %eax, %ecx, %edx and %r11d are reserved as scratch.
+#define ALLOCATABLE_REGS 9
+#define FIRST_CALLEE_SAVED 4
+#define REG_SCRATCH 9
+#define REG_EAX 10
+
+static const char* const reg32[] = {
+    "%esi", "%edi", "%r8d", "%r9d", "%ebx", "%r12d", "%r13d", "%r14d", "%r15d", "%r11d", "%eax"
+};
+static const char* const reg64[] = {
+    "%rsi", "%rdi", "%r8", "%r9", "%rbx", "%r12", "%r13", "%r14", "%r15", "%r11", "%rax"
+};
+
+typedef struct {
+    FluentContext* ctx;
+    IRFunction* fn;
+    IRModule* module;
+    OutputBuffer* out;
+    const char* symbol;
+    Location* locs;               // Indexed by value id
+    int* use_counts;
+    char* is_call;                // Indexed by interval position
+    int slot_count;
+    int saved[ALLOCATABLE_REGS];  // Callee-saved registers to preserve
+    int saved_count;
+} AsmFunction;
+
+#define REGISTER_PARAMS 6
+
+static const char* const param_reg64[REGISTER_PARAMS] = { "%rdi", "%rsi", "%rdx", "%rcx", "%r8", "%r9" };
+static const char* const param_reg32[REGISTER_PARAMS] = { "%edi", "%esi", "%edx", "%ecx", "%r8d", "%r9d" };
+
+static int defines_value(IROpcode op) {
+    return op <= IR_CALL;
+}
+
+static Location reg_location(int reg) {
+    return (Location){ LOC_REG, reg, 0 };
+}
+
+static int same_location(Location a, Location b) {
+    if (a.kind != b.kind) {
+        return 0;
+    }
+    return a.kind == LOC_IMM ? a.imm == b.imm : a.index == b.index;
+}
+
+static void emit_location(AsmFunction* af, Location loc) {
+    OutputBuffer* out = af->out;
+    switch (loc.kind) {
+        case LOC_REG:
+            out_str(out, reg32[loc.index]);
+            break;
+        case LOC_STACK:
+            out_int(out, -(8 * af->saved_count + 4 * (loc.index + 1)));
+            out_str(out, "(%rbp)");
+            break;
+        case LOC_IMM:
+            out_char(out, '$');
+            out_int(out, loc.imm);
+            break;
+        default:
+            break;
+    }
+}
+
+// "    op a, b\n"
+static void emit_op2(AsmFunction* af, const char* op, Location a, Location b) {
+    out_str(af->out, "    ");
+    out_str(af->out, op);
+    out_char(af->out, ' ');
+    emit_location(af, a);
+    out_str(af->out, ", ");
+    emit_location(af, b);
+    out_char(af->out, '\n');
+}
+
+static void emit_move(AsmFunction* af, Location dst, Location src) {
+    if (same_location(dst, src)) {
+        return;
+    }
+    if (dst.kind == LOC_STACK && src.kind == LOC_STACK) {
+        emit_op2(af, "movl", src, reg_location(REG_EAX));
+        src = reg_location(REG_EAX);
+    }
+    emit_op2(af, "movl", src, dst);
+}
+
+static void emit_label(AsmFunction* af, int block, const char* suffix) {
+    out_str(af->out, ".L");
+    out_str(af->out, af->symbol);
+    out_char(af->out, '_');
+    out_int(af->out, block);
+    out_str(af->out, suffix);
+}
+
+static void emit_jump(AsmFunction* af, const char* op, int block, const char* suffix) {
+    out_str(af->out, "    ");
+    out_str(af->out, op);
+    out_char(af->out, ' ');
+    emit_label(af, block, suffix);
+    out_char(af->out, '\n');
+}
+
+// ---- Liveness and register allocation ----
+
+typedef unsigned long long Word;
+
+static int bitset_words(int bits) {
+    return (bits + 63) / 64;
+}
+
+static void extend(int* start, int* end, int value, int pos) {
+    if (pos < start[value]) start[value] = pos;
+    if (pos > end[value]) end[value] = pos;
+}
+
+// Returns the index of pred among block's predecessors, or -1
+static int pred_index(IRBlock* block, int pred) {
+    for (int p = 0; p < block->pred_count; p++) {
+        if (block->preds[p] == pred) {
+            return p;
+        }
+    }
+    return -1;
+}
+
+// Computes each value's live interval as the hull of every position it is
+// live at, over a numbering of the blocks in layout order. Real phis are
+// defined at their block's start and their inputs are used at the end of
+// the matching predecessor, where the edge copies are emitted. Returns the
+// number of positions and marks those of calls in af->is_call.
+static int compute_intervals(AsmFunction* af, int* start, int* end) {
+    IRFunction* fn = af->fn;
+    Arena* arena = &af->ctx->arena;
+    int words = bitset_words(fn->value_count);
+    Word* live_in = arena_alloc(arena, (size_t)fn->block_count * words * sizeof(Word));
+    Word* live = arena_alloc(arena, words * sizeof(Word));
+    memset(live_in, 0, (size_t)fn->block_count * words * sizeof(Word));
+
+    // Backward dataflow until no live-in set grows
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int b = fn->block_count - 1; b >= 0; b--) {
+            IRBlock* block = fn->blocks[b];
+            if (block->removed) {
+                continue;
+            }
+            memset(live, 0, words * sizeof(Word));
+            int succs[2];
+            int succ_count = ir_successors(fn, block, succs);
+            for (int s = 0; s < succ_count; s++) {
+                IRBlock* succ = fn->blocks[succs[s]];
+                Word* in = live_in + (size_t)succ->id * words;
+                for (int w = 0; w < words; w++) {
+                    live[w] |= in[w];
+                }
+                int index = pred_index(succ, block->id);
+                for (int i = 0; i < succ->phi_count && index >= 0; i++) {
+                    IRInstr* phi = fn->values[succ->phis[i]];
+                    if (phi->op == IR_PHI) {
+                        int arg = phi->phi_args[index];
+                        live[arg / 64] |= 1ULL << (arg % 64);
+                    }
+                }
+            }
+            for (int pass = 1; pass >= 0; pass--) {
+                int* list = pass == 0 ? block->phis : block->instrs;
+                int count = pass == 0 ? block->phi_count : block->instr_count;
+                for (int i = count - 1; i >= 0; i--) {
+                    IRInstr* instr = fn->values[list[i]];
+                    live[instr->id / 64] &= ~(1ULL << (instr->id % 64));
+                    for (int a = 0; a < ir_operand_count(instr); a++) {
+                        live[instr->args[a] / 64] |= 1ULL << (instr->args[a] % 64);
+                    }
+                }
+            }
+            Word* in = live_in + (size_t)b * words;
+            for (int w = 0; w < words; w++) {
+                if (live[w] & ~in[w]) {
+                    in[w] |= live[w];
+                    changed = 1;
+                }
+            }
+        }
+    }
+
+    for (int v = 0; v < fn->value_count; v++) {
+        start[v] = INT_MAX;
+        end[v] = -1;
+    }
+
+    int pos = 0;
+    int* block_end = arena_alloc(arena, fn->block_count * sizeof(int));
+    int positions = 2 * fn->block_count + fn->value_count;
+    af->is_call = arena_alloc(arena, positions);
+    memset(af->is_call, 0, positions);
+    for (int b = 0; b < fn->block_count; b++) {
+        IRBlock* block = fn->blocks[b];
+        if (block->removed) {
+            continue;
+        }
+        int block_start = pos++;
+        Word* in = live_in + (size_t)b * words;
+        for (int v = 0; v < fn->value_count; v++) {
+            if (in[v / 64] & (1ULL << (v % 64))) {
+                extend(start, end, v, block_start);
+            }
+        }
+        for (int i = 0; i < block->phi_count; i++) {
+            IRInstr* instr = fn->values[block->phis[i]];
+            if (instr->op == IR_PHI) {
+                extend(start, end, instr->id, block_start);
+            }
+        }
+        // Copies left behind by trivial phis run in order after the real ones
+        for (int pass = 0; pass < 2; pass++) {
+            int* list = pass == 0 ? block->phis : block->instrs;
+            int count = pass == 0 ? block->phi_count : block->instr_count;
+            for (int i = 0; i < count; i++) {
+                IRInstr* instr = fn->values[list[i]];
+                if (instr->op == IR_PHI) {
+                    continue;
+                }
+                int at = pos++;
+                af->is_call[at] = instr->op == IR_CALL;
+                if (defines_value(instr->op)) {
+                    extend(start, end, instr->id, at);
+                }
+                for (int a = 0; a < ir_operand_count(instr); a++) {
+                    extend(start, end, instr->args[a], at);
+                }
+            }
+        }
+        block_end[b] = pos++;
+    }
+
+    // Values flowing out of a block stay live until its edge copies
+    for (int b = 0; b < fn->block_count; b++) {
+        IRBlock* block = fn->blocks[b];
+        if (block->removed) {
+            continue;
+        }
+        int succs[2];
+        int succ_count = ir_successors(fn, block, succs);
+        for (int s = 0; s < succ_count; s++) {
+            IRBlock* succ = fn->blocks[succs[s]];
+            Word* in = live_in + (size_t)succ->id * words;
+            for (int v = 0; v < fn->value_count; v++) {
+                if (in[v / 64] & (1ULL << (v % 64))) {
+                    extend(start, end, v, block_end[b]);
+                }
+            }
+            int index = pred_index(succ, block->id);
+            for (int i = 0; i < succ->phi_count && index >= 0; i++) {
+                IRInstr* phi = fn->values[succ->phis[i]];
+                if (phi->op == IR_PHI) {
+                    extend(start, end, phi->phi_args[index], block_end[b]);
+                }
+            }
+        }
+    }
+    return pos;
+}
+
+static void spill(AsmFunction* af, int value) {
+    af->locs[value] = (Location){ LOC_STACK, af->slot_count++, 0 };
+}
+
+// Classic linear scan: when every register is taken, the interval that
+// ends last goes to the stack. An interval containing a call only gets a
+// callee-saved register.
+static void allocate_registers(AsmFunction* af) {
+    IRFunction* fn = af->fn;
+    Arena* arena = &af->ctx->arena;
+    int* start = arena_alloc(arena, fn->value_count * sizeof(int));
+    int* end = arena_alloc(arena, fn->value_count * sizeof(int));
+    int total = compute_intervals(af, start, end);
+    int* calls_before = arena_alloc(arena, (total + 1) * sizeof(int));
+    calls_before[0] = 0;
+    for (int p = 0; p < total; p++) {
+        calls_before[p + 1] = calls_before[p] + af->is_call[p];
+    }
+
+    // Counting sort of the allocated values by interval start
+    int positions = 0;
+    for (int v = 0; v < fn->value_count; v++) {
+        IRInstr* instr = fn->values[v];
+        if (instr->op == IR_CONST) {
+            af->locs[v] = (Location){ LOC_IMM, 0, instr->imm };
+            end[v] = -1;
+        } else if (!defines_value(instr->op)) {
+            end[v] = -1;
+        } else if (end[v] >= 0 && start[v] >= positions) {
+            positions = start[v] + 1;
+        }
+    }
+    int* first = arena_alloc(arena, (positions + 1) * sizeof(int));
+    memset(first, 0, (positions + 1) * sizeof(int));
+    for (int v = 0; v < fn->value_count; v++) {
+        if (end[v] >= 0) first[start[v] + 1]++;
+    }
+    for (int p = 0; p < positions; p++) {
+        first[p + 1] += first[p];
+    }
+    int count = first[positions];
+    int* order = arena_alloc(arena, (count + 1) * sizeof(int));
+    for (int v = 0; v < fn->value_count; v++) {
+        if (end[v] >= 0) order[first[start[v]]++] = v;
+    }
+
+    int active[ALLOCATABLE_REGS];     // Value held by each register, or -1
+    int used[ALLOCATABLE_REGS] = { 0 };
+    for (int r = 0; r < ALLOCATABLE_REGS; r++) {
+        active[r] = -1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        int value = order[i];
+        int free_reg = -1;
+        int furthest = -1;
+        int crosses_call = calls_before[end[value]] > calls_before[start[value] + 1];
+        for (int r = 0; r < ALLOCATABLE_REGS; r++) {
+            // An operand whose interval ends here may hand its register to
+            // the result
+            if (active[r] >= 0 && end[active[r]] <= start[value]) {
+                active[r] = -1;
+            }
+            if (crosses_call && r < FIRST_CALLEE_SAVED) {
+                continue;
+            }
+            if (active[r] < 0) {
+                if (free_reg < 0) free_reg = r;
+            } else if (furthest < 0 || end[active[r]] > end[active[furthest]]) {
+                furthest = r;
+            }
+        }
+        if (free_reg < 0) {
+            if (end[active[furthest]] <= end[value]) {
+                spill(af, value);
+                continue;
+            }
+            spill(af, active[furthest]);
+            free_reg = furthest;
+        }
+        active[free_reg] = value;
+        used[free_reg] = 1;
+        af->locs[value] = reg_location(free_reg);
+    }
+
+    for (int r = FIRST_CALLEE_SAVED; r < ALLOCATABLE_REGS; r++) {
+        if (used[r]) {
+            af->saved[af->saved_count++] = r;
+        }
+    }
+}
+
+// ---- Instruction selection ----
+
+static const char* condition_code(IROpcode op) {
+    switch (op) {
+        case IR_EQ: return "e";
+        case IR_NE: return "ne";
+        case IR_LT: return "l";
+        case IR_GT: return "g";
+        case IR_LE: return "le";
+        case IR_GE: return "ge";
+        default: return "ne";
+    }
+}
+
+static const char* inverse_condition(const char* cc) {
+    static const char* const pairs[][2] = {
+        { "e", "ne" }, { "ne", "e" }, { "l", "ge" }, { "ge", "l" }, { "g", "le" }, { "le", "g" }
+    };
+    for (size_t i = 0; i < sizeof(pairs) / sizeof(pairs[0]); i++) {
+        if (strcmp(pairs[i][0], cc) == 0) {
+            return pairs[i][1];
+        }
+    }
+    return "e";
+}
+
+static int is_comparison(IROpcode op) {
+    return op >= IR_EQ && op <= IR_GE;
+}
+
+// Sets the flags for a comparison and returns its condition code
+static const char* emit_compare(AsmFunction* af, IRInstr* instr) {
+    Location a = af->locs[instr->args[0]];
+    Location b = af->locs[instr->args[1]];
+    if (a.kind == LOC_IMM || (a.kind == LOC_STACK && b.kind == LOC_STACK)) {
+        emit_move(af, reg_location(REG_EAX), a);
+        a = reg_location(REG_EAX);
+    }
+    emit_op2(af, "cmpl", b, a);
+    return condition_code(instr->op);
+}
+
+static void emit_binary(AsmFunction* af, IRInstr* instr) {
+    Location dst = af->locs[instr->id];
+    Location a = af->locs[instr->args[0]];
+    Location b = af->locs[instr->args[1]];
+    Location eax = reg_location(REG_EAX);
+    const char* op = instr->op == IR_ADD ? "addl" : instr->op == IR_SUB ? "subl" : "imull";
+
+    if (dst.kind == LOC_REG && !same_location(dst, b)) {
+        emit_move(af, dst, a);
+        emit_op2(af, op, b, dst);
+    } else if (dst.kind == LOC_REG && instr->op != IR_SUB) {
+        emit_op2(af, op, a, dst);
+    } else {
+        emit_move(af, eax, a);
+        emit_op2(af, op, b, eax);
+        emit_move(af, dst, eax);
+    }
+}
+
+static void emit_divide(AsmFunction* af, IRInstr* instr) {
+    Location divisor = af->locs[instr->args[1]];
+    emit_move(af, reg_location(REG_EAX), af->locs[instr->args[0]]);
+    out_str(af->out, "    cltd\n");
+    if (divisor.kind == LOC_IMM) {
+        out_str(af->out, "    movl $");
+        out_int(af->out, divisor.imm);
+        out_str(af->out, ", %ecx\n    idivl %ecx\n");
+    } else {
+        out_str(af->out, "    idivl ");
+        emit_location(af, divisor);
+        out_char(af->out, '\n');
+    }
+    emit_move(af, af->locs[instr->id], reg_location(REG_EAX));
+}
+
+static void emit_global(AsmFunction* af, int global) {
+    out_str(af->out, "fl_");
+    out_slice(af->out, af->module->globals[global].name);
+    out_str(af->out, "(%rip)");
+}
+
+// Performs the phi copies for the edge block -> target as one parallel
+// move, breaking cycles through %r11d
+static void emit_edge_copies(AsmFunction* af, IRBlock* block, int target) {
+    IRFunction* fn = af->fn;
+    IRBlock* succ = fn->blocks[target];
+    int index = pred_index(succ, block->id);
+    if (index < 0 || succ->phi_count == 0) {
+        return;
+    }
+
+    Location* dsts = arena_alloc(&af->ctx->arena, succ->phi_count * sizeof(Location));
+    Location* srcs = arena_alloc(&af->ctx->arena, succ->phi_count * sizeof(Location));
+    int count = 0;
+    for (int i = 0; i < succ->phi_count; i++) {
+        IRInstr* phi = fn->values[succ->phis[i]];
+        if (phi->op != IR_PHI || af->locs[phi->id].kind == LOC_NONE) {
+            continue;
+        }
+        Location src = af->locs[phi->phi_args[index]];
+        if (!same_location(af->locs[phi->id], src)) {
+            dsts[count] = af->locs[phi->id];
+            srcs[count] = src;
+            count++;
+        }
+    }
+
+    while (count > 0) {
+        int progress = 0;
+        for (int i = 0; i < count; i++) {
+            int blocked = 0;
+            for (int j = 0; j < count && !blocked; j++) {
+                blocked = j != i && same_location(srcs[j], dsts[i]);
+            }
+            if (!blocked) {
+                emit_move(af, dsts[i], srcs[i]);
+                dsts[i] = dsts[count - 1];
+                srcs[i] = srcs[count - 1];
+                count--;
+                i--;
+                progress = 1;
+            }
+        }
+        if (!progress) {
+            // Every remaining destination is still needed as a source
+            Location scratch = reg_location(REG_SCRATCH);
+            Location saved = dsts[0];
+            emit_move(af, scratch, saved);
+            for (int j = 0; j < count; j++) {
+                if (same_location(srcs[j], saved)) {
+                    srcs[j] = scratch;
+                }
+            }
+        }
+    }
+}
+
+static int has_edge_copies(IRFunction* fn, int target) {
+    IRBlock* succ = fn->blocks[target];
+    for (int i = 0; i < succ->phi_count; i++) {
+        if (fn->values[succ->phis[i]]->op == IR_PHI) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void emit_goto(AsmFunction* af, IRBlock* block, int target, int next_block) {
+    emit_edge_copies(af, block, target);
+    if (target != next_block) {
+        emit_jump(af, "jmp", target, "");
+    }
+}
+
+static void emit_branch(AsmFunction* af, IRBlock* block, IRInstr* instr, IRInstr* fused, int next_block) {
+    int on_true = instr->targets[0];
+    int on_false = instr->targets[1];
+    Location cond = af->locs[instr->args[0]];
+    const char* cc;
+
+    if (cond.kind == LOC_IMM) {
+        emit_goto(af, block, cond.imm ? on_true : on_false, next_block);
+        return;
+    }
+    if (fused) {
+        cc = emit_compare(af, fused);
+    } else {
+        emit_op2(af, "cmpl", (Location){ LOC_IMM, 0, 0 }, cond);
+        cc = "ne";
+    }
+
+    char jcc[8];
+    if (has_edge_copies(af->fn, on_true)) {
+        snprintf(jcc, sizeof(jcc), "j%s", inverse_condition(cc));
+        emit_jump(af, jcc, block->id, "_f");
+        emit_goto(af, block, on_true, -1);
+        emit_label(af, block->id, "_f:\n");
+        emit_goto(af, block, on_false, next_block);
+    } else if (on_true == next_block && !has_edge_copies(af->fn, on_false)) {
+        snprintf(jcc, sizeof(jcc), "j%s", inverse_condition(cc));
+        emit_jump(af, jcc, on_false, "");
+    } else {
+        snprintf(jcc, sizeof(jcc), "j%s", cc);
+        emit_jump(af, jcc, on_true, "");
+        emit_goto(af, block, on_false, next_block);
+    }
+}
+
+// Parameters past the sixth are above the return address
+static void emit_param(AsmFunction* af, IRInstr* instr) {
+    Location dst = af->locs[instr->id];
+    if (instr->imm < REGISTER_PARAMS) {
+        emit_move(af, dst, (Location){ LOC_STACK, (int)instr->imm, 0 });
+        return;
+    }
+    Location target = dst.kind == LOC_REG ? dst : reg_location(REG_EAX);
+    out_str(af->out, "    movl ");
+    out_int(af->out, 16 + 8 * (instr->imm - REGISTER_PARAMS));
+    out_str(af->out, "(%rbp), ");
+    emit_location(af, target);
+    out_char(af->out, '\n');
+    emit_move(af, dst, target);
+}
+
+static void emit_push(AsmFunction* af, Location loc) {
+    if (loc.kind == LOC_STACK) {
+        emit_move(af, reg_location(REG_EAX), loc);
+        loc = reg_location(REG_EAX);
+    }
+    out_str(af->out, "    pushq ");
+    if (loc.kind == LOC_REG) {
+        out_str(af->out, reg64[loc.index]);
+    } else {
+        emit_location(af, loc);
+    }
+    out_char(af->out, '\n');
+}
+
+// Arguments are pushed right to left and the register ones popped back
+// into place, which sidesteps ordering the moves between registers that
+// are both sources and destinations
+static void emit_call(AsmFunction* af, IRInstr* instr) {
+    OutputBuffer* out = af->out;
+    int stack_args = instr->arg_count > REGISTER_PARAMS ? instr->arg_count - REGISTER_PARAMS : 0;
+    int register_args = instr->arg_count - stack_args;
+    int padding = stack_args % 2 ? 8 : 0;
+    if (padding) {
+        out_str(out, "    subq $8, %rsp\n");
+    }
+    for (int i = instr->arg_count - 1; i >= 0; i--) {
+        emit_push(af, af->locs[instr->args[i]]);
+    }
+    for (int i = 0; i < register_args; i++) {
+        out_str(out, "    popq ");
+        out_str(out, param_reg64[i]);
+        out_char(out, '\n');
+    }
+    out_str(out, "    call fl_");
+    out_slice(out, af->module->functions[instr->callee].name);
+    out_char(out, '\n');
+    if (stack_args > 0) {
+        out_str(out, "    addq $");
+        out_int(out, 8 * stack_args + padding);
+        out_str(out, ", %rsp\n");
+    }
+    emit_move(af, af->locs[instr->id], reg_location(REG_EAX));
+}
+
+static void emit_epilogue(AsmFunction* af) {
+    OutputBuffer* out = af->out;
+    if (af->saved_count > 0) {
+        out_str(out, "    leaq ");
+        out_int(out, -8 * af->saved_count);
+        out_str(out, "(%rbp), %rsp\n");
+        for (int i = af->saved_count - 1; i >= 0; i--) {
+            out_str(out, "    popq ");
+            out_str(out, reg64[af->saved[i]]);
+            out_char(out, '\n');
+        }
+    } else {
+        out_str(out, "    movq %rbp, %rsp\n");
+    }
+    out_str(out, "    popq %rbp\n    ret\n");
+}
+
+static void emit_instr(AsmFunction* af, IRBlock* block, IRInstr* instr, IRInstr* fused, int next_block) {
+    Location dst = af->locs[instr->id];
+    Location eax = reg_location(REG_EAX);
+    switch (instr->op) {
+        case IR_CONST:
+        case IR_PHI:
+        case IR_NOP:
+            break;
+        case IR_COPY:
+        case IR_CONVERT:
+            // Only i32 programs get here, so a conversion moves the bits
+            emit_move(af, dst, af->locs[instr->args[0]]);
+            break;
+        case IR_PARAM:
+            emit_param(af, instr);
+            break;
+        case IR_CALL:
+            emit_call(af, instr);
+            break;
+        case IR_ADD:
+        case IR_SUB:
+        case IR_MUL:
+            emit_binary(af, instr);
+            break;
+        case IR_DIV:
+            emit_divide(af, instr);
+            break;
+        case IR_EQ:
+        case IR_NE:
+        case IR_LT:
+        case IR_GT:
+        case IR_LE:
+        case IR_GE: {
+            if (instr == fused) {
+                break;
+            }
+            const char* cc = emit_compare(af, instr);
+            out_str(af->out, "    set");
+            out_str(af->out, cc);
+            out_str(af->out, " %al\n    movzbl %al, %eax\n");
+            emit_move(af, dst, eax);
+            break;
+        }
+        case IR_LOAD_GLOBAL: {
+            Location target = dst.kind == LOC_REG ? dst : eax;
+            out_str(af->out, "    movl ");
+            emit_global(af, instr->global);
+            out_str(af->out, ", ");
+            emit_location(af, target);
+            out_char(af->out, '\n');
+            emit_move(af, dst, target);
+            break;
+        }
+        case IR_STORE_GLOBAL: {
+            Location src = af->locs[instr->args[0]];
+            if (src.kind == LOC_STACK) {
+                emit_move(af, eax, src);
+                src = eax;
+            }
+            out_str(af->out, "    movl ");
+            emit_location(af, src);
+            out_str(af->out, ", ");
+            emit_global(af, instr->global);
+            out_char(af->out, '\n');
+            break;
+        }
+        case IR_JUMP:
+            emit_goto(af, block, instr->targets[0], next_block);
+            break;
+        case IR_BRANCH:
+            emit_branch(af, block, instr, fused, next_block);
+            break;
+        case IR_RETURN:
+            emit_move(af, eax, af->locs[instr->args[0]]);
+            emit_epilogue(af);
+            break;
+    }
+}
+
+static void count_uses(AsmFunction* af) {
+    IRFunction* fn = af->fn;
+    for (int b = 0; b < fn->block_count; b++) {
+        IRBlock* block = fn->blocks[b];
+        if (block->removed) {
+            continue;
+        }
+        for (int i = 0; i < block->phi_count; i++) {
+            IRInstr* phi = fn->values[block->phis[i]];
+            if (phi->op == IR_PHI) {
+                for (int p = 0; p < block->pred_count; p++) {
+                    af->use_counts[phi->phi_args[p]]++;
+                }
+            } else {
+                for (int a = 0; a < ir_operand_count(phi); a++) {
+                    af->use_counts[phi->args[a]]++;
+                }
+            }
+        }
+        for (int i = 0; i < block->instr_count; i++) {
+            IRInstr* instr = fn->values[block->instrs[i]];
+            for (int a = 0; a < ir_operand_count(instr); a++) {
+                af->use_counts[instr->args[a]]++;
+            }
+        }
+    }
+}
+
+// A comparison used only by the branch right after it sets the flags for
+// that branch instead of materializing 0/1
+static IRInstr* fused_compare(AsmFunction* af, IRBlock* block) {
+    if (block->instr_count < 2) {
+        return NULL;
+    }
+    IRInstr* term = af->fn->values[block->instrs[block->instr_count - 1]];
+    IRInstr* prev = af->fn->values[block->instrs[block->instr_count - 2]];
+    if (term->op == IR_BRANCH && term->args[0] == prev->id && is_comparison(prev->op) &&
+        af->use_counts[prev->id] == 1) {
+        return prev;
+    }
+    return NULL;
+}
+
+static void emit_asm_function(FluentContext* ctx, IRModule* module, IRFunction* fn,
+                              const char* symbol, OutputBuffer* out) {
+    AsmFunction af;
+    memset(&af, 0, sizeof(af));
+    af.ctx = ctx;
+    af.fn = fn;
+    af.module = module;
+    af.out = out;
+    af.symbol = symbol;
+    af.locs = arena_alloc(&ctx->arena, fn->value_count * sizeof(Location));
+    af.use_counts = arena_alloc(&ctx->arena, fn->value_count * sizeof(int));
+    memset(af.locs, 0, fn->value_count * sizeof(Location));
+    memset(af.use_counts, 0, fn->value_count * sizeof(int));
+
+    // The register parameters get the first stack slots
+    for (int v = 0; v < fn->value_count; v++) {
+        IRInstr* instr = fn->values[v];
+        if (instr->op == IR_PARAM && instr->imm < REGISTER_PARAMS && instr->imm >= af.slot_count) {
+            af.slot_count = (int)instr->imm + 1;
+        }
+    }
+    int register_params = af.slot_count;
+
+    count_uses(&af);
+    allocate_registers(&af);
+
+    // Keep %rsp 16-byte aligned below the saved registers and spill slots
+    int frame = 8 * af.saved_count + 4 * af.slot_count;
+    int reserve = ((frame + 15) & ~15) - 8 * af.saved_count;
+
+    out_str(out, "\n    .p2align 4\n");
+    out_str(out, symbol);
+    out_str(out, ":\n    pushq %rbp\n    movq %rsp, %rbp\n");
+    for (int i = 0; i < af.saved_count; i++) {
+        out_str(out, "    pushq ");
+        out_str(out, reg64[af.saved[i]]);
+        out_char(out, '\n');
+    }
+    if (reserve > 0) {
+        out_str(out, "    subq $");
+        out_int(out, reserve);
+        out_str(out, ", %rsp\n");
+    }
+    for (int i = 0; i < register_params; i++) {
+        out_str(out, "    movl ");
+        out_str(out, param_reg32[i]);
+        out_str(out, ", ");
+        emit_location(&af, (Location){ LOC_STACK, i, 0 });
+        out_char(out, '\n');
+    }
+
+    for (int b = 0; b < fn->block_count; b++) {
+        IRBlock* block = fn->blocks[b];
+        if (block->removed) {
+            continue;
+        }
+        int next_block = b + 1;
+        while (next_block < fn->block_count && fn->blocks[next_block]->removed) {
+            next_block++;
+        }
+        if (block->pred_count > 0) {
+            emit_label(&af, block->id, ":\n");
+        }
+        IRInstr* fused = fused_compare(&af, block);
+        for (int i = 0; i < block->phi_count; i++) {
+            emit_instr(&af, block, fn->values[block->phis[i]], fused, next_block);
+        }
+        for (int i = 0; i < block->instr_count; i++) {
+            emit_instr(&af, block, fn->values[block->instrs[i]], fused, next_block);
+        }
+    }
+}
+
+// Returns 0 on success, or -1 after reporting an error
+int generate_asm(FluentContext* ctx, NodeId ast, OutputBuffer* out) {
+    ctx->out = out;
+    if (setjmp(ctx->error_jmp)) {
+        return -1;
+    }
+
+    require_i32_values(ctx, "the assembly backend");
+    IRModule module;
+    collect_globals(ctx, ast, &module);
+
+    out_str(out, "    .text\n");
+    int has_main = 0;
+    char symbol[512];
+    for (NodeId id = ast_node(&ctx->ast, ast)->block.statements; id; id = ast_node(&ctx->ast, id)->next) {
+        if (ast_node(&ctx->ast, id)->type == AST_FUNC_DECL) {
+            Slice name = ast_node(&ctx->ast, id)->func.name;
+            IRFunction* fn = lower_function(ctx, &module, id);
+            optimize_ir_function(ctx, fn);
+            snprintf(symbol, sizeof(symbol), "fl_%.*s", SLICE_ARG(name));
+            emit_asm_function(ctx, &module, fn, symbol, out);
+            has_main |= slice_equals(name, "main");
+        }
+    }
+
+    IRFunction* init = lower_global_init(ctx, &module, ast);
+    optimize_ir_function(ctx, init);
+    emit_asm_function(ctx, &module, init, "fluent_init", out);
+
+    // main runs the top-level statements, then the Fluent main. _start is
+    // weak so the same file links with plain ld or against the C runtime.
+    out_str(out, "\n    .globl main\n"
+                 "    .p2align 4\n"
+                 "main:\n"
+                 "    pushq %rbp\n"
+                 "    movq %rsp, %rbp\n"
+                 "    call fluent_init\n");
+    out_str(out, has_main ? "    call fl_main\n" : "    xorl %eax, %eax\n");
+    out_str(out, "    popq %rbp\n"
+                 "    ret\n"
+                 "\n    .weak _start\n"
+                 "_start:\n"
+                 "    xorl %ebp, %ebp\n"
+                 "    call main\n"
+                 "    movl %eax, %edi\n"
+                 "    movl $60, %eax\n"
+                 "    syscall\n");
+
+    if (module.global_count > 0) {
+        out_str(out, "\n    .bss\n    .p2align 2\n");
+        for (int i = 0; i < module.global_count; i++) {
+            out_str(out, "fl_");
+            out_slice(out, module.globals[i].name);
+            out_str(out, ":\n    .zero 4\n");
+        }
+    }
+    out_str(out, "\n    .section .note.GNU-stack,\"\",@progbits\n");
+    return 0;
+}
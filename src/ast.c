@@ -2,46 +2,97 @@
 // Implementation of the AST functions for Fluent language
 
 #include "ast.h"
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-ASTNode* create_ast_node(ASTNodeType type) {
-    ASTNode* node = (ASTNode*)malloc(sizeof(ASTNode));
-    node->type = type;
-    node->value = NULL;
-    node->left = NULL;
-    node->right = NULL;
-    node->expr = NULL;
-    node->var_name = NULL;
-    node->is_mutable = 0;
-    node->op = TOKEN_UNKNOWN;
-    node->next = NULL;
-    node->statements = NULL;
-    node->condition = NULL;
-    node->then_branch = NULL;
-    node->else_branch = NULL;
-    node->func_name = NULL;
-    node->params = NULL;
-    node->body = NULL;
-    return node;
+#define INITIAL_AST_CAPACITY 1024
+
+void init_ast(Ast* ast) {
+    memset(ast, 0, sizeof(Ast));
+}
+
+// Keeps the array for the next file
+void reset_ast(Ast* ast) {
+    ast->count = 0;
 }
 
-void free_ast(ASTNode* node) {
-    if (!node) return;
+void free_ast(Ast* ast) {
+    free(ast->nodes);
+    init_ast(ast);
+}
 
-    if (node->value) free(node->value);
-    if (node->var_name) free(node->var_name);
-    if (node->func_name) free(node->func_name);
+NodeId new_ast_node(Ast* ast, ASTNodeType type) {
+    if (ast->count == 0) {
+        ast->count = 1;           // Reserve NO_NODE
+    }
+    if (ast->count >= ast->capacity) {
+        uint32_t capacity = ast->capacity ? ast->capacity * 2 : INITIAL_AST_CAPACITY;
+        ASTNode* nodes = realloc(ast->nodes, capacity * sizeof(ASTNode));
+        if (!nodes || capacity <= ast->capacity) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        ast->nodes = nodes;
+        ast->capacity = capacity;
+    }
+    NodeId id = ast->count++;
+    ASTNode* node = &ast->nodes[id];
+    memset(node, 0, sizeof(ASTNode));
+    node->type = type;
+    node->op = TOKEN_UNKNOWN;
+    return id;
+}
 
-    if (node->left) free_ast(node->left);
-    if (node->right) free_ast(node->right);
-    if (node->expr) free_ast(node->expr);
-    if (node->next) free_ast(node->next);
-    if (node->statements) free_ast(node->statements);
-    if (node->condition) free_ast(node->condition);
-    if (node->then_branch) free_ast(node->then_branch);
-    if (node->else_branch) free_ast(node->else_branch);
-    if (node->body) free_ast(node->body);
+// Stores the node's children (the heads of any lists) and returns how
+// many there are; unset children are NO_NODE
+int ast_children(const ASTNode* node, NodeId children[3]) {
+    switch (node->type) {
+        case AST_PROGRAM:
+        case AST_BLOCK:
+            children[0] = node->block.statements;
+            return 1;
+        case AST_VAR_DECL:
+        case AST_ASSIGNMENT:
+            children[0] = node->decl.expr;
+            return 1;
+        case AST_FUNC_DECL:
+            children[0] = node->func.params;
+            children[1] = node->func.body;
+            return 2;
+        case AST_IF_STMT:
+            children[0] = node->if_stmt.condition;
+            children[1] = node->if_stmt.then_branch;
+            children[2] = node->if_stmt.else_branch;
+            return 3;
+        case AST_WHILE_STMT:
+        case AST_FOR_STMT:
+            children[0] = node->loop.condition;
+            children[1] = node->loop.body;
+            return 2;
+        case AST_RETURN_STMT:
+            children[0] = node->ret.expr;
+            return 1;
+        case AST_BIN_OP:
+            children[0] = node->binary.left;
+            children[1] = node->binary.right;
+            return 2;
+        case AST_CALL:
+            children[0] = node->call.args;
+            return 1;
+        case AST_CAST:
+            children[0] = node->cast.expr;
+            return 1;
+        default:
+            return 0;
+    }
+}
 
-    free(node);
+// Number of nodes in the list linked through 'next' from first
+int ast_list_length(const Ast* ast, NodeId first) {
+    int length = 0;
+    for (NodeId id = first; id; id = ast->nodes[id].next) {
+        length++;
+    }
+    return length;
 }
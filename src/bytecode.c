@@ -0,0 +1,403 @@
+// bytecode.c
+// Compiles the Fluent AST into register-based bytecode for the VM
+//
+// Every function gets a register file laid out as constants, then
+// parameters, then locals in declaration order, then temporaries. Constants are collected up front
+// and preloaded on entry, so no instruction ever materializes a literal.
+// Locals and temporaries are allocated like a stack and released at the
+// end of each statement and block.
+
+#include "vm.h"
+#include "ir.h"
+#include <string.h>
+#include <setjmp.h>
+
+#define MAX_REGISTERS 65535
+
+typedef struct {
+    FluentContext* ctx;
+    Arena* arena;
+    IRModule* module;
+    BytecodeFunction* fn;
+    int in_global_init;
+
+    int* registers;               // Register of each local, indexed by SymbolId
+    int next_register;            // First free register
+} BytecodeCompiler;
+
+static void compile_statements(BytecodeCompiler* bc, NodeId stmt, int top_level);
+
+static ASTNode* node_at(BytecodeCompiler* bc, NodeId id) {
+    return ast_node(&bc->ctx->ast, id);
+}
+
+// The value of an AST_NUMBER. Resolution has checked that the literal fits
+// its type, and require_i32_values that the type is i32.
+static int32_t number_value(BytecodeCompiler* bc, NodeId id) {
+    NumericValue value = { 0 };
+    literal_value(node_at(bc, id)->value, TYPE_I32, &value);
+    return (int32_t)value.i;
+}
+
+static __attribute__((noreturn)) void compile_error(BytecodeCompiler* bc, const char* format, Slice name) {
+    report_error(bc->ctx, format, SLICE_ARG(name));
+    longjmp(bc->ctx->error_jmp, 1);
+}
+
+static void* grow(BytecodeCompiler* bc, void* items, int count, int* capacity, size_t size) {
+    if (count < *capacity) {
+        return items;
+    }
+    *capacity = *capacity ? *capacity * 2 : 16;
+    void* bigger = arena_alloc(bc->arena, *capacity * size);
+    if (count) {
+        memcpy(bigger, items, count * size);
+    }
+    return bigger;
+}
+
+static int emit(BytecodeCompiler* bc, Opcode op, int a, int b, int c) {
+    BytecodeFunction* fn = bc->fn;
+    fn->code = grow(bc, fn->code, fn->code_count, &fn->code_capacity, sizeof(BytecodeInstr));
+    fn->code[fn->code_count] = (BytecodeInstr){ op, a, b, c };
+    return fn->code_count++;
+}
+
+static void patch_jump(BytecodeCompiler* bc, int jump) {
+    bc->fn->code[jump].c = bc->fn->code_count;
+}
+
+static int allocate_register(BytecodeCompiler* bc) {
+    if (bc->next_register >= MAX_REGISTERS) {
+        compile_error(bc, "Function '%.*s' needs too many registers", bc->fn->name);
+    }
+    int reg = bc->next_register++;
+    if (bc->next_register > bc->fn->register_count) {
+        bc->fn->register_count = bc->next_register;
+    }
+    return reg;
+}
+
+// Constants
+
+static int find_constant(BytecodeFunction* fn, int32_t value) {
+    for (int i = 0; i < fn->constant_count; i++) {
+        if (fn->constants[i] == value) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void add_constant(BytecodeCompiler* bc, int32_t value, int* capacity) {
+    if (find_constant(bc->fn, value) < 0) {
+        bc->fn->constants = grow(bc, bc->fn->constants, bc->fn->constant_count, capacity, sizeof(int32_t));
+        bc->fn->constants[bc->fn->constant_count++] = value;
+    }
+}
+
+static void collect_constants(BytecodeCompiler* bc, NodeId id, int* capacity) {
+    for (; id; id = node_at(bc, id)->next) {
+        ASTNode* node = node_at(bc, id);
+        if (node->type == AST_NUMBER) {
+            add_constant(bc, number_value(bc, id), capacity);
+        }
+        if (node->type == AST_FUNC_DECL) {
+            // Nested functions are rejected when their statement is reached
+            continue;
+        }
+        NodeId children[3];
+        int count = ast_children(node, children);
+        for (int i = 0; i < count; i++) {
+            if (children[i]) {
+                collect_constants(bc, children[i], capacity);
+            }
+        }
+    }
+}
+
+// Symbols
+
+static Symbol* symbol_of(BytecodeCompiler* bc, SymbolId id) {
+    return symbol_at(&bc->ctx->symbols, id);
+}
+
+// Expressions
+
+static Opcode arithmetic_opcode(TokenType op) {
+    switch (op) {
+        case TOKEN_PLUS: return OP_ADD;
+        case TOKEN_MINUS: return OP_SUB;
+        case TOKEN_ASTERISK: return OP_MUL;
+        case TOKEN_SLASH: return OP_DIV;
+        case TOKEN_EQUAL: return OP_EQ;
+        case TOKEN_NOT_EQUAL: return OP_NE;
+        case TOKEN_LESS: return OP_LT;
+        case TOKEN_GREATER: return OP_GT;
+        case TOKEN_LESS_EQUAL: return OP_LE;
+        case TOKEN_GREATER_EQUAL: return OP_GE;
+        default: return OP_COUNT;
+    }
+}
+
+// Conditional jump taken when the comparison holds, and the one taken
+// when it does not
+static Opcode branch_opcode(TokenType op, int when_true) {
+    switch (op) {
+        case TOKEN_EQUAL: return when_true ? OP_JEQ : OP_JNE;
+        case TOKEN_NOT_EQUAL: return when_true ? OP_JNE : OP_JEQ;
+        case TOKEN_LESS: return when_true ? OP_JLT : OP_JGE;
+        case TOKEN_GREATER: return when_true ? OP_JGT : OP_JLE;
+        case TOKEN_LESS_EQUAL: return when_true ? OP_JLE : OP_JGT;
+        case TOKEN_GREATER_EQUAL: return when_true ? OP_JGE : OP_JLT;
+        default: return OP_COUNT;
+    }
+}
+
+static void compile_expression_to(BytecodeCompiler* bc, NodeId id, int target);
+
+// Returns a register holding the value without copying locals or
+// constants; the caller must not write to it
+static int compile_expression(BytecodeCompiler* bc, NodeId id) {
+    ASTNode* node = node_at(bc, id);
+    switch (node->type) {
+        case AST_NUMBER:
+            return find_constant(bc->fn, number_value(bc, id));
+        case AST_CAST:
+            // Every value is an i32 here, so conversions change nothing
+            return compile_expression(bc, node->cast.expr);
+        case AST_IDENTIFIER: {
+            Symbol* symbol = symbol_of(bc, node->ident.symbol);
+            if (symbol->kind == SYMBOL_LOCAL) {
+                return bc->registers[node->ident.symbol];
+            }
+            int reg = allocate_register(bc);
+            emit(bc, OP_GETG, reg, 0, symbol->slot);
+            return reg;
+        }
+        default: {
+            int reg = allocate_register(bc);
+            compile_expression_to(bc, id, reg);
+            return reg;
+        }
+    }
+}
+
+static void compile_expression_to(BytecodeCompiler* bc, NodeId id, int target) {
+    ASTNode* node = node_at(bc, id);
+    int saved = bc->next_register;
+    if (node->type == AST_CALL) {
+        // Arguments go to consecutive registers, where the callee's
+        // parameters are copied from
+        int first = bc->next_register;
+        int count = 0;
+        for (NodeId arg = node->call.args; arg; arg = node_at(bc, arg)->next) {
+            allocate_register(bc);
+            count++;
+        }
+        NodeId arg = node->call.args;
+        for (int i = 0; i < count; i++) {
+            compile_expression_to(bc, arg, first + i);
+            arg = node_at(bc, arg)->next;
+        }
+        emit(bc, OP_CALL, target, symbol_of(bc, node->call.symbol)->slot, first);
+    } else if (node->type == AST_BIN_OP) {
+        // x + k and x - k add an immediate; into the same register they
+        // become an in-place increment
+        NodeId right = node->binary.right;
+        if ((node->op == TOKEN_PLUS || node->op == TOKEN_MINUS) && node_at(bc, right)->type == AST_NUMBER) {
+            int left = compile_expression(bc, node->binary.left);
+            uint32_t k = (uint32_t)number_value(bc, right);
+            if (node->op == TOKEN_MINUS) {
+                k = 0u - k;
+            }
+            if (left == target) {
+                emit(bc, OP_INCK, target, 0, (int32_t)k);
+            } else {
+                emit(bc, OP_ADDK, target, left, (int32_t)k);
+            }
+        } else {
+            int left = compile_expression(bc, node->binary.left);
+            int right_reg = compile_expression(bc, right);
+            emit(bc, arithmetic_opcode(node->op), target, left, right_reg);
+        }
+    } else {
+        int source = compile_expression(bc, id);
+        if (source != target) {
+            emit(bc, OP_MOVE, target, source, 0);
+        }
+    }
+    bc->next_register = saved;
+}
+
+// Emits a jump to be patched that is taken when the condition equals
+// when_true. Comparisons fuse into a single compare-and-branch.
+static int compile_condition(BytecodeCompiler* bc, NodeId id, int when_true) {
+    ASTNode* condition = node_at(bc, id);
+    int saved = bc->next_register;
+    int jump;
+    if (condition->type == AST_BIN_OP && branch_opcode(condition->op, 1) != OP_COUNT) {
+        int left = compile_expression(bc, condition->binary.left);
+        int right = compile_expression(bc, condition->binary.right);
+        jump = emit(bc, branch_opcode(condition->op, when_true), left, right, -1);
+    } else {
+        int reg = compile_expression(bc, id);
+        jump = emit(bc, when_true ? OP_JNZ : OP_JZ, reg, 0, -1);
+    }
+    bc->next_register = saved;
+    return jump;
+}
+
+// Statements
+
+static void compile_block(BytecodeCompiler* bc, NodeId block) {
+    int saved_register = bc->next_register;
+    compile_statements(bc, node_at(bc, block)->block.statements, 0);
+    bc->next_register = saved_register;
+}
+
+static void compile_statement(BytecodeCompiler* bc, NodeId id, int top_level) {
+    ASTNode* node = node_at(bc, id);
+    switch (node->type) {
+        case AST_VAR_DECL: {
+            if (top_level && bc->in_global_init) {
+                int value = compile_expression(bc, node->decl.expr);
+                emit(bc, OP_SETG, value, 0, symbol_of(bc, node->decl.symbol)->slot);
+            } else {
+                // The initializer cannot see the name it is declaring
+                int reg = allocate_register(bc);
+                compile_expression_to(bc, node->decl.expr, reg);
+                bc->registers[node->decl.symbol] = reg;
+            }
+            break;
+        }
+        case AST_ASSIGNMENT: {
+            Symbol* symbol = symbol_of(bc, node->decl.symbol);
+            if (symbol->kind == SYMBOL_GLOBAL) {
+                int value = compile_expression(bc, node->decl.expr);
+                emit(bc, OP_SETG, value, 0, symbol->slot);
+            } else {
+                compile_expression_to(bc, node->decl.expr, bc->registers[node->decl.symbol]);
+            }
+            break;
+        }
+        case AST_RETURN_STMT:
+            emit(bc, OP_RET, compile_expression(bc, node->ret.expr), 0, 0);
+            break;
+        case AST_IF_STMT: {
+            int skip_then = compile_condition(bc, node->if_stmt.condition, 0);
+            compile_block(bc, node->if_stmt.then_branch);
+            if (node->if_stmt.else_branch) {
+                int skip_else = emit(bc, OP_JMP, 0, 0, -1);
+                patch_jump(bc, skip_then);
+                compile_block(bc, node->if_stmt.else_branch);
+                patch_jump(bc, skip_else);
+            } else {
+                patch_jump(bc, skip_then);
+            }
+            break;
+        }
+        case AST_WHILE_STMT: {
+            // Rotated so each iteration runs a single conditional branch
+            int to_test = emit(bc, OP_JMP, 0, 0, -1);
+            int body = bc->fn->code_count;
+            compile_block(bc, node->loop.body);
+            patch_jump(bc, to_test);
+            int back = compile_condition(bc, node->loop.condition, 1);
+            bc->fn->code[back].c = body;
+            break;
+        }
+        case AST_FUNC_DECL:
+            compile_error(bc, "Nested function '%.*s' is not supported", node->func.name);
+        case AST_BIN_OP:
+        case AST_NUMBER:
+        case AST_IDENTIFIER:
+        case AST_CALL:
+            compile_expression(bc, id);
+            break;
+        default:
+            break;
+    }
+}
+
+static void compile_statements(BytecodeCompiler* bc, NodeId stmt, int top_level) {
+    for (; stmt; stmt = node_at(bc, stmt)->next) {
+        int type = node_at(bc, stmt)->type;
+        if (top_level && type == AST_FUNC_DECL) {
+            continue;
+        }
+        int saved = bc->next_register;
+        compile_statement(bc, stmt, top_level);
+        // Declarations keep their register; temporaries are released
+        if (type != AST_VAR_DECL || (top_level && bc->in_global_init)) {
+            bc->next_register = saved;
+        }
+    }
+}
+
+static void compile_function(BytecodeCompiler* bc, BytecodeFunction* fn, Slice name, NodeId params,
+                             NodeId statements, int in_global_init) {
+    memset(fn, 0, sizeof(BytecodeFunction));
+    fn->name = name;
+    bc->fn = fn;
+    bc->in_global_init = in_global_init;
+
+    // Zero is always present for the implicit return at the end
+    int capacity = 0;
+    add_constant(bc, 0, &capacity);
+    collect_constants(bc, statements, &capacity);
+    bc->next_register = 0;
+    for (int i = 0; i < fn->constant_count; i++) {
+        allocate_register(bc);
+    }
+    for (NodeId param = params; param; param = node_at(bc, param)->next) {
+        bc->registers[node_at(bc, param)->decl.symbol] = allocate_register(bc);
+        fn->param_count++;
+    }
+
+    compile_statements(bc, statements, in_global_init);
+    emit(bc, OP_RET, find_constant(fn, 0), 0, 0);
+}
+
+// Returns 0 on success, or -1 after reporting an error
+int compile_bytecode(FluentContext* ctx, NodeId program, BytecodeProgram* out) {
+    if (setjmp(ctx->error_jmp)) {
+        return -1;
+    }
+    require_i32_values(ctx, "the bytecode VM or the JIT");
+
+    BytecodeCompiler bc;
+    memset(&bc, 0, sizeof(bc));
+    bc.ctx = ctx;
+    bc.arena = &ctx->arena;
+    IRModule module;
+    collect_globals(ctx, program, &module);
+    bc.module = &module;
+    bc.registers = arena_alloc(&ctx->arena, (ctx->symbols.count + 1) * sizeof(int));
+
+    NodeId statements = ast_node(&ctx->ast, program)->block.statements;
+    int count = 1;
+    for (NodeId id = statements; id; id = ast_node(&ctx->ast, id)->next) {
+        count += ast_node(&ctx->ast, id)->type == AST_FUNC_DECL;
+    }
+    memset(out, 0, sizeof(BytecodeProgram));
+    out->functions = arena_alloc(&ctx->arena, count * sizeof(BytecodeFunction));
+    out->global_count = module.global_count;
+    out->main_function = -1;
+
+    for (NodeId id = statements; id; id = ast_node(&ctx->ast, id)->next) {
+        const ASTNode* stmt = ast_node(&ctx->ast, id);
+        if (stmt->type == AST_FUNC_DECL) {
+            if (slice_equals(stmt->func.name, "main")) {
+                out->main_function = out->function_count;
+            }
+            BytecodeFunction* fn = &out->functions[out->function_count++];
+            compile_function(&bc, fn, stmt->func.name, stmt->func.params,
+                             ast_node(&ctx->ast, stmt->func.body)->block.statements, 0);
+        }
+    }
+    out->init_function = out->function_count;
+    compile_function(&bc, &out->functions[out->function_count++], (Slice){ "<init>", 6 }, NO_NODE,
+                     statements, 1);
+    return 0;
+}
@@ -0,0 +1,327 @@
+// cache.c
+// Content-addressed on-disk cache for generated output
+//
+// Entries live at <directory>/<first 2 hex digits>/<remaining 30>, named by
+// a 128-bit FNV-1a hash of everything that determines their contents. They
+// are written to a temporary file and renamed into place, so concurrent
+// compilers never see a partial entry. Hits refresh the entry's mtime,
+// which is what eviction orders by.
+
+#include "cache.h"
+#include "context.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#define FNV128_OFFSET (((unsigned __int128)0x6c62272e07bb0142ULL << 64) | 0x62b821756295c58dULL)
+#define FNV128_PRIME (((unsigned __int128)0x0000000001000000ULL << 64) | 0x000000000000013BULL)
+
+void init_cache(Cache* cache, const char* directory, long long max_bytes) {
+    memset(cache, 0, sizeof(Cache));
+    cache->directory = directory;
+    cache->max_bytes = max_bytes > 0 ? max_bytes : DEFAULT_CACHE_SIZE;
+}
+
+void cache_hash_init(CacheHash* hash) {
+    hash->state = FNV128_OFFSET;
+}
+
+void cache_hash_update(CacheHash* hash, const void* data, size_t length) {
+    const unsigned char* bytes = data;
+    unsigned __int128 state = hash->state;
+    for (size_t i = 0; i < length; i++) {
+        state ^= bytes[i];
+        state *= FNV128_PRIME;
+    }
+    hash->state = state;
+}
+
+// Hashes the string and its terminator so adjacent fields cannot run together
+void cache_hash_string(CacheHash* hash, const char* str) {
+    cache_hash_update(hash, str, strlen(str) + 1);
+}
+
+CacheKey cache_hash_final(const CacheHash* hash) {
+    CacheKey key;
+    unsigned long long high = (unsigned long long)(hash->state >> 64);
+    unsigned long long low = (unsigned long long)hash->state;
+    snprintf(key.hex, sizeof(key.hex), "%016llx%016llx", high, low);
+    return key;
+}
+
+// Everything besides the input that changes what the compiler produces
+void cache_hash_options(CacheHash* hash, const FluentContext* ctx) {
+    char options[64];
+    snprintf(options, sizeof(options), "O%d emit=%d inline=%d", ctx->opt_level, (int)ctx->emit,
+             ctx->inline_threshold);
+    cache_hash_string(hash, FLUENT_VERSION);
+    cache_hash_string(hash, options);
+    cache_hash_string(hash, ctx->ir_pipeline ? ctx->ir_pipeline : "");
+}
+
+static void hash_slice(CacheHash* hash, Slice slice) {
+    cache_hash_update(hash, &slice.length, sizeof(slice.length));
+    cache_hash_update(hash, slice.start, slice.length);
+}
+
+static void hash_list(CacheHash* hash, const Ast* ast, NodeId id) {
+    cache_hash_update(hash, "(", 1);
+    for (; id; id = ast_node(ast, id)->next) {
+        cache_hash_ast(hash, ast, id);
+    }
+    cache_hash_update(hash, ")", 1);
+}
+
+// The text a node carries: a literal, or the name it declares
+static Slice node_text(const ASTNode* node) {
+    switch (node->type) {
+        case AST_VAR_DECL:
+        case AST_ASSIGNMENT:
+        case AST_PARAM:
+            return node->decl.name;
+        case AST_FUNC_DECL:
+            return node->func.name;
+        case AST_IDENTIFIER:
+            return node->ident.name;
+        case AST_CALL:
+            return node->call.name;
+        case AST_NUMBER:
+            return node->value;
+        default:
+            return (Slice){ "", 0 };
+    }
+}
+
+// Hashes the structure and text of one node and its children (not its
+// siblings), so formatting, comments and other functions do not affect the key
+void cache_hash_ast(CacheHash* hash, const Ast* ast, NodeId id) {
+    const ASTNode* node = ast_node(ast, id);
+    int fields[4] = { node->type, node->op, node->is_mutable, node->value_type };
+    cache_hash_update(hash, fields, sizeof(fields));
+    hash_slice(hash, node_text(node));
+    NodeId children[3];
+    int count = ast_children(node, children);
+    for (int i = 0; i < count; i++) {
+        hash_list(hash, ast, children[i]);
+    }
+}
+
+void cache_count(int* counter) {
+    __atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+}
+
+static void entry_path(const Cache* cache, const CacheKey* key, char* path, size_t size) {
+    snprintf(path, size, "%s/%.2s/%s", cache->directory, key->hex, key->hex + 2);
+}
+
+char* cache_load(Cache* cache, const CacheKey* key, size_t* length) {
+    char path[4096];
+    entry_path(cache, key, path, sizeof(path));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    char* data = NULL;
+    if (fstat(fd, &st) == 0 && (data = malloc(st.st_size ? st.st_size : 1))) {
+        size_t done = 0;
+        while (done < (size_t)st.st_size) {
+            ssize_t n = read(fd, data + done, st.st_size - done);
+            if (n <= 0) {
+                if (n < 0 && errno == EINTR) continue;
+                break;
+            }
+            done += n;
+        }
+        if (done != (size_t)st.st_size) {
+            free(data);
+            data = NULL;
+        } else {
+            *length = done;
+            futimens(fd, NULL);
+        }
+    }
+    close(fd);
+    return data;
+}
+
+// mkdir -p
+static void make_directories(const char* directory) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s", directory);
+    for (char* p = path + 1; *p; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            mkdir(path, 0755);
+            *p = '/';
+        }
+    }
+    mkdir(path, 0755);
+}
+
+// Best effort: a cache that cannot be written only costs speed
+void cache_store(Cache* cache, const CacheKey* key, const char* data, size_t length) {
+    char directory[4096], temp[4096], path[4096];
+    snprintf(directory, sizeof(directory), "%s/%.2s", cache->directory, key->hex);
+    if (snprintf(temp, sizeof(temp), "%s/.tmp-XXXXXX", directory) >= (int)sizeof(temp)) {
+        return;
+    }
+    int fd = mkstemp(temp);
+    if (fd < 0 && errno == ENOENT) {
+        make_directories(directory);
+        strcpy(temp + strlen(temp) - 6, "XXXXXX");
+        fd = mkstemp(temp);
+    }
+    if (fd < 0) {
+        return;
+    }
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = write(fd, data + done, length - done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        done += n;
+    }
+    entry_path(cache, key, path, sizeof(path));
+    if (close(fd) == 0 && done == length && rename(temp, path) == 0) {
+        cache_count(&cache->stored);
+    } else {
+        unlink(temp);
+    }
+}
+
+typedef struct {
+    char* path;
+    long long size;
+    time_t mtime;
+} CacheEntry;
+
+static int compare_by_age(const void* a, const void* b) {
+    const CacheEntry* x = a;
+    const CacheEntry* y = b;
+    return x->mtime < y->mtime ? -1 : x->mtime > y->mtime;
+}
+
+// Entry names are lowercase hex: a 2-digit shard directory holding files
+// named by the other 30. Anything else in the directory is not ours.
+static int is_hex_name(const char* name, size_t length) {
+    if (strlen(name) != length) {
+        return 0;
+    }
+    for (size_t i = 0; i < length; i++) {
+        if (!((name[i] >= '0' && name[i] <= '9') || (name[i] >= 'a' && name[i] <= 'f'))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Adds the shard's entries to the list; 0 when out of memory
+static int list_shard(const char* shard_path, CacheEntry** entries, int* count, int* capacity,
+                      long long* total) {
+    DIR* dir = opendir(shard_path);
+    if (!dir) {
+        return 1;
+    }
+    int ok = 1;
+    struct dirent* entry;
+    while (ok && (entry = readdir(dir))) {
+        char path[4096];
+        struct stat st;
+        if (!is_hex_name(entry->d_name, 30) ||
+            snprintf(path, sizeof(path), "%s/%s", shard_path, entry->d_name) >= (int)sizeof(path) ||
+            lstat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        if (*count == *capacity) {
+            int grown = *capacity ? *capacity * 2 : 256;
+            CacheEntry* resized = realloc(*entries, grown * sizeof(CacheEntry));
+            if (!resized) {
+                ok = 0;
+                break;
+            }
+            *entries = resized;
+            *capacity = grown;
+        }
+        char* copy = strdup(path);
+        if (!copy) {
+            ok = 0;
+            break;
+        }
+        (*entries)[(*count)++] = (CacheEntry){ copy, st.st_size, st.st_mtime };
+        *total += st.st_size;
+    }
+    closedir(dir);
+    return ok;
+}
+
+// Deletes least recently used entries until the cache is back under 90%
+// of its limit. Only needed after something was stored. Only files shaped
+// like entries are considered, so a cache directory shared with other
+// files never loses them.
+void trim_cache(Cache* cache) {
+    if (cache->stored == 0) {
+        return;
+    }
+    DIR* top = opendir(cache->directory);
+    if (!top) {
+        return;
+    }
+
+    CacheEntry* entries = NULL;
+    int count = 0, capacity = 0;
+    long long total = 0;
+    int complete = 1;
+    struct dirent* shard;
+    while (complete && (shard = readdir(top))) {
+        char shard_path[4096];
+        struct stat st;
+        if (!is_hex_name(shard->d_name, 2) ||
+            snprintf(shard_path, sizeof(shard_path), "%s/%s", cache->directory, shard->d_name) >=
+                (int)sizeof(shard_path) ||
+            lstat(shard_path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+            continue;
+        }
+        complete = list_shard(shard_path, &entries, &count, &capacity, &total);
+    }
+    closedir(top);
+
+    // Without the full list the oldest entries are unknown; try next time
+    if (complete && total > cache->max_bytes) {
+        qsort(entries, count, sizeof(CacheEntry), compare_by_age);
+        long long target = cache->max_bytes / 10 * 9;
+        for (int i = 0; i < count && total > target; i++) {
+            if (unlink(entries[i].path) == 0) {
+                total -= entries[i].size;
+                cache->evicted++;
+            }
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        free(entries[i].path);
+    }
+    free(entries);
+}
+
+// "64M", "1G", "500000" -> bytes; returns -1 when malformed
+long long parse_cache_size(const char* text) {
+    char* end;
+    long long value = strtoll(text, &end, 10);
+    if (end == text || value <= 0) {
+        return -1;
+    }
+    switch (*end) {
+        case 'k': case 'K': value <<= 10; end++; break;
+        case 'm': case 'M': value <<= 20; end++; break;
+        case 'g': case 'G': value <<= 30; end++; break;
+        default: break;
+    }
+    return *end ? -1 : value;
+}
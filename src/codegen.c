@@ -1,157 +1,730 @@
 // codegen.c
 // Implementation of the Fluent language code generator
+//
+// Every function is lowered to SSA, optimized according to the context's
+// settings and printed as C. With ctx->codegen_jobs above 1, functions are
+// generated on a pool of threads, each into its own buffer, and the buffers
+// are written in source order so the output matches a serial run.
+//
+// SSA values become locals named v<N> of the <stdint.h> or floating type of
+// their ValueType; phis are resolved by assigning p<N> on each incoming
+// edge and copying it into v<N> at the top of the block, which keeps the
+// copies parallel. Parameters are named a<N>.
 
 #include "codegen.h"
+#include "ir.h"
+#include "cache.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <setjmp.h>
+#include <limits.h>
+#include <pthread.h>
 
-// Function prototypes
-void generate_function(ASTNode* node); // Added function prototype
-void generate_statement(ASTNode* node);
-void generate_expression(ASTNode* node);
-void generate_block(ASTNode* node);
+static void emit_value(OutputBuffer* out, int value) {
+    out_char(out, 'v');
+    out_int(out, value);
+}
 
-void generate_code(ASTNode* ast) {
-    printf("#include <stdio.h>\n\n");
+static void emit_name(OutputBuffer* out, Slice name) {
+    out_str(out, "fl_");
+    out_slice(out, name);
+}
 
-    // Generate code for function declarations
-    ASTNode* stmt = ast->statements;
-    while (stmt) {
-        if (stmt->type == AST_FUNC_DECL) {
-            generate_function(stmt);
-        } else {
-            // Global code (e.g., variable declarations)
-            generate_statement(stmt);
-        }
-        stmt = stmt->next;
+// Floats print with enough digits to read back exactly, and always with a
+// '.' so C does not take them for integers
+static void emit_float(OutputBuffer* out, double value, ValueType type) {
+    char text[40];
+    int length = snprintf(text, sizeof(text), type == TYPE_F32 ? "%.9g" : "%.17g", value);
+    if (!strpbrk(text, ".e")) {
+        snprintf(text + length, sizeof(text) - length, ".0");
     }
+    out_str(out, text);
+    if (type == TYPE_F32) {
+        out_char(out, 'f');
+    }
+}
+
+// Values beyond an int are written with the <stdint.h> constant macros. The
+// most negative value of a signed type has no literal of its own.
+static void emit_constant(OutputBuffer* out, IRInstr* instr) {
+    char text[32];
+    if (type_is_float(instr->type)) {
+        emit_float(out, instr->fimm, (ValueType)instr->type);
+    } else if (instr->imm == INT_MIN && instr->type == TYPE_I32) {
+        out_str(out, "-2147483647 - 1");
+    } else if (instr->imm == LLONG_MIN && instr->type == TYPE_I64) {
+        out_str(out, "INT64_MIN");
+    } else if (instr->imm > INT_MIN && instr->imm <= INT_MAX && (instr->type != TYPE_U64 || instr->imm >= 0)) {
+        out_int(out, instr->imm);
+    } else if (instr->type == TYPE_U64) {
+        snprintf(text, sizeof(text), "UINT64_C(%llu)", (unsigned long long)instr->imm);
+        out_str(out, text);
+    } else {
+        snprintf(text, sizeof(text), "INT64_C(%lld)", instr->imm);
+        out_str(out, text);
+    }
+}
 
-    // If no 'main' function, create an empty main
-    printf("int main() {\n");
-    printf("    // Call the main function if it exists\n");
-    printf("    if (main) main();\n");
-    printf("    return 0;\n");
-    printf("}\n");
+static const char* operator_text(IROpcode op) {
+    switch (op) {
+        case IR_ADD: return " + ";
+        case IR_SUB: return " - ";
+        case IR_MUL: return " * ";
+        case IR_DIV: return " / ";
+        case IR_EQ: return " == ";
+        case IR_NE: return " != ";
+        case IR_LT: return " < ";
+        case IR_GT: return " > ";
+        case IR_LE: return " <= ";
+        case IR_GE: return " >= ";
+        default: return "";
+    }
 }
 
-void generate_function(ASTNode* node) {
-    printf("void %s() {\n", node->func_name);
-    // Generate function body
-    generate_block(node->body);
-    printf("}\n");
+// Assigns the phi inputs of target for the edge leaving block
+static void emit_edge_copies(IRFunction* fn, IRBlock* block, int target, OutputBuffer* out, const char* indent) {
+    IRBlock* succ = fn->blocks[target];
+    int index = -1;
+    for (int p = 0; p < succ->pred_count; p++) {
+        if (succ->preds[p] == block->id) {
+            index = p;
+            break;
+        }
+    }
+    for (int i = 0; i < succ->phi_count && index >= 0; i++) {
+        IRInstr* phi = fn->values[succ->phis[i]];
+        if (phi->op != IR_PHI) {
+            continue;
+        }
+        out_str(out, indent);
+        out_char(out, 'p');
+        out_int(out, phi->id);
+        out_str(out, " = ");
+        emit_value(out, phi->phi_args[index]);
+        out_str(out, ";\n");
+    }
 }
 
-void generate_block(ASTNode* node) {
-    ASTNode* stmt = node->statements;
-    while (stmt) {
-        generate_statement(stmt);
-        stmt = stmt->next;
+static int has_edge_copies(IRFunction* fn, int target) {
+    IRBlock* succ = fn->blocks[target];
+    for (int i = 0; i < succ->phi_count; i++) {
+        if (fn->values[succ->phis[i]]->op == IR_PHI) {
+            return 1;
+        }
     }
+    return 0;
 }
 
-void generate_statement(ASTNode* node) {
-    switch (node->type) {
-        case AST_VAR_DECL:
-            if (node->is_mutable) {
-                printf("    int %s = ", node->var_name);
-            } else {
-                printf("    const int %s = ", node->var_name);
+static void emit_goto(IRFunction* fn, IRBlock* block, int target, int next_block, OutputBuffer* out) {
+    emit_edge_copies(fn, block, target, out, "    ");
+    if (target != next_block) {
+        out_str(out, "    goto bb");
+        out_int(out, target);
+        out_str(out, ";\n");
+    }
+}
+
+static void emit_instr(IRFunction* fn, IRModule* module, IRBlock* block, IRInstr* instr,
+                       int next_block, OutputBuffer* out) {
+    switch (instr->op) {
+        case IR_CONST:
+            out_str(out, "    ");
+            emit_value(out, instr->id);
+            out_str(out, " = ");
+            emit_constant(out, instr);
+            out_str(out, ";\n");
+            break;
+        case IR_CONVERT:
+            out_str(out, "    ");
+            emit_value(out, instr->id);
+            out_str(out, " = (");
+            out_str(out, type_c_name(instr->type));
+            out_char(out, ')');
+            emit_value(out, instr->args[0]);
+            out_str(out, ";\n");
+            break;
+        case IR_COPY:
+            out_str(out, "    ");
+            emit_value(out, instr->id);
+            out_str(out, " = ");
+            emit_value(out, instr->args[0]);
+            out_str(out, ";\n");
+            break;
+        case IR_PHI:
+            out_str(out, "    ");
+            emit_value(out, instr->id);
+            out_str(out, " = p");
+            out_int(out, instr->id);
+            out_str(out, ";\n");
+            break;
+        case IR_PARAM:
+            out_str(out, "    ");
+            emit_value(out, instr->id);
+            out_str(out, " = a");
+            out_int(out, instr->imm);
+            out_str(out, ";\n");
+            break;
+        case IR_CALL:
+            out_str(out, "    ");
+            emit_value(out, instr->id);
+            out_str(out, " = ");
+            emit_name(out, module->functions[instr->callee].name);
+            out_char(out, '(');
+            for (int i = 0; i < instr->arg_count; i++) {
+                if (i > 0) {
+                    out_str(out, ", ");
+                }
+                emit_value(out, instr->args[i]);
             }
-            generate_expression(node->expr);
-            printf(";\n");
+            out_str(out, ");\n");
+            break;
+        case IR_LOAD_GLOBAL:
+            out_str(out, "    ");
+            emit_value(out, instr->id);
+            out_str(out, " = ");
+            emit_name(out, module->globals[instr->global].name);
+            out_str(out, ";\n");
             break;
-        case AST_ASSIGNMENT:
-            printf("    %s = ", node->var_name);
-            generate_expression(node->expr);
-            printf(";\n");
+        case IR_STORE_GLOBAL:
+            out_str(out, "    ");
+            emit_name(out, module->globals[instr->global].name);
+            out_str(out, " = ");
+            emit_value(out, instr->args[0]);
+            out_str(out, ";\n");
             break;
-        case AST_RETURN_STMT:
-            printf("    return ");
-            generate_expression(node->expr);
-            printf(";\n");
+        case IR_JUMP:
+            emit_goto(fn, block, instr->targets[0], next_block, out);
             break;
-        case AST_IF_STMT:
-            printf("    if (");
-            generate_expression(node->condition);
-            printf(") {\n");
-            generate_block(node->then_branch);
-            printf("    }");
-            if (node->else_branch) {
-                printf(" else {\n");
-                generate_block(node->else_branch);
-                printf("    }");
+        case IR_BRANCH:
+            out_str(out, "    if (");
+            emit_value(out, instr->args[0]);
+            if (has_edge_copies(fn, instr->targets[0])) {
+                out_str(out, ") {\n");
+                emit_edge_copies(fn, block, instr->targets[0], out, "        ");
+                out_str(out, "        goto bb");
+                out_int(out, instr->targets[0]);
+                out_str(out, ";\n    }\n");
+            } else {
+                out_str(out, ") goto bb");
+                out_int(out, instr->targets[0]);
+                out_str(out, ";\n");
             }
-            printf("\n");
+            emit_goto(fn, block, instr->targets[1], next_block, out);
             break;
-        case AST_WHILE_STMT:
-            printf("    while (");
-            generate_expression(node->condition);
-            printf(") {\n");
-            generate_block(node->body);
-            printf("    }\n");
+        case IR_RETURN:
+            out_str(out, "    return ");
+            emit_value(out, instr->args[0]);
+            out_str(out, ";\n");
             break;
-        case AST_BIN_OP:
-        case AST_NUMBER:
-        case AST_IDENTIFIER:
-            printf("    ");
-            generate_expression(node);
-            printf(";\n");
+        case IR_NOP:
             break;
         default:
-            // No operation
+            out_str(out, "    ");
+            emit_value(out, instr->id);
+            out_str(out, " = ");
+            emit_value(out, instr->args[0]);
+            out_str(out, operator_text(instr->op));
+            emit_value(out, instr->args[1]);
+            out_str(out, ";\n");
             break;
     }
 }
 
-void generate_expression(ASTNode* node) {
-    switch (node->type) {
-        case AST_NUMBER:
-            printf("%s", node->value);
-            break;
-        case AST_IDENTIFIER:
-            printf("%s", node->value);
-            break;
-        case AST_BIN_OP:
-            printf("(");
-            generate_expression(node->left);
-            switch (node->op) {
-                case TOKEN_PLUS:
-                    printf(" + ");
-                    break;
-                case TOKEN_MINUS:
-                    printf(" - ");
-                    break;
-                case TOKEN_ASTERISK:
-                    printf(" * ");
-                    break;
-                case TOKEN_SLASH:
-                    printf(" / ");
-                    break;
-                case TOKEN_EQUAL:
-                    printf(" == ");
-                    break;
-                case TOKEN_NOT_EQUAL:
-                    printf(" != ");
-                    break;
-                case TOKEN_LESS:
-                    printf(" < ");
-                    break;
-                case TOKEN_GREATER:
-                    printf(" > ");
-                    break;
-                case TOKEN_LESS_EQUAL:
-                    printf(" <= ");
-                    break;
-                case TOKEN_GREATER_EQUAL:
-                    printf(" >= ");
-                    break;
-                default:
-                    break;
+// Declares the locals of one type that hold the function's values and phi
+// inputs
+static void emit_locals_of_type(IRFunction* fn, ValueType type, OutputBuffer* out) {
+    int on_line = 0;
+    for (int b = 0; b < fn->block_count; b++) {
+        IRBlock* block = fn->blocks[b];
+        if (block->removed) {
+            continue;
+        }
+        for (int pass = 0; pass < 2; pass++) {
+            int* list = pass == 0 ? block->phis : block->instrs;
+            int count = pass == 0 ? block->phi_count : block->instr_count;
+            for (int i = 0; i < count; i++) {
+                IRInstr* instr = fn->values[list[i]];
+                if (instr->op >= IR_STORE_GLOBAL || instr->type != type) {
+                    continue;
+                }
+                if (!on_line) {
+                    out_str(out, "    ");
+                    out_str(out, type_c_name(type));
+                    out_char(out, ' ');
+                } else {
+                    out_str(out, ", ");
+                }
+                emit_value(out, instr->id);
+                if (instr->op == IR_PHI) {
+                    out_str(out, ", p");
+                    out_int(out, instr->id);
+                }
+                if (++on_line == 12) {
+                    out_str(out, ";\n");
+                    on_line = 0;
+                }
             }
-            generate_expression(node->right);
-            printf(")");
-            break;
-        default:
+        }
+    }
+    if (on_line) {
+        out_str(out, ";\n");
+    }
+}
+
+static void emit_locals(IRFunction* fn, OutputBuffer* out) {
+    for (int type = TYPE_I32; type <= TYPE_F64; type++) {
+        emit_locals_of_type(fn, (ValueType)type, out);
+    }
+}
+
+// Prints the body of fn; the caller has written its signature
+static void emit_function(IRFunction* fn, IRModule* module, OutputBuffer* out) {
+    out_str(out, " {\n");
+    emit_locals(fn, out);
+
+    for (int b = 0; b < fn->block_count; b++) {
+        IRBlock* block = fn->blocks[b];
+        if (block->removed) {
+            continue;
+        }
+        int next_block = b + 1;
+        while (next_block < fn->block_count && fn->blocks[next_block]->removed) {
+            next_block++;
+        }
+
+        if (block->pred_count > 0) {
+            out_str(out, "bb");
+            out_int(out, block->id);
+            out_str(out, ":\n");
+        }
+        // Real phis read their edge inputs first, then the copies that
+        // replaced trivial phis
+        for (int i = 0; i < block->phi_count; i++) {
+            IRInstr* instr = fn->values[block->phis[i]];
+            if (instr->op == IR_PHI) {
+                emit_instr(fn, module, block, instr, next_block, out);
+            }
+        }
+        for (int i = 0; i < block->phi_count; i++) {
+            IRInstr* instr = fn->values[block->phis[i]];
+            if (instr->op != IR_PHI) {
+                emit_instr(fn, module, block, instr, next_block, out);
+            }
+        }
+        for (int i = 0; i < block->instr_count; i++) {
+            emit_instr(fn, module, block, fn->values[block->instrs[i]], next_block, out);
+        }
+    }
+    out_str(out, "}\n\n");
+}
+
+static void emit_signature(OutputBuffer* out, Slice name, ValueType return_type, const uint8_t* param_types,
+                           int param_count) {
+    out_str(out, type_c_name(return_type));
+    out_char(out, ' ');
+    emit_name(out, name);
+    out_char(out, '(');
+    if (param_count == 0) {
+        out_str(out, "void");
+    }
+    for (int i = 0; i < param_count; i++) {
+        if (i > 0) {
+            out_str(out, ", ");
+        }
+        out_str(out, type_c_name(param_types[i]));
+        out_str(out, " a");
+        out_int(out, i);
+    }
+    out_char(out, ')');
+}
+
+// Stores the parameter types of an AST_FUNC_DECL and returns how many
+static int param_types_of(FluentContext* ctx, NodeId func_decl, uint8_t types[MAX_PARAMETERS]) {
+    int count = 0;
+    for (NodeId param = ast_node(&ctx->ast, func_decl)->func.params; param; param = ast_node(&ctx->ast, param)->next) {
+        types[count++] = ast_node(&ctx->ast, param)->value_type;
+    }
+    return count;
+}
+
+// Hashes the ASTs of the functions called from the subtree at id, and of
+// those they call, once each
+static void hash_callees(CacheHash* hash, FluentContext* ctx, IRModule* module, NodeId id, char* seen) {
+    for (; id; id = ast_node(&ctx->ast, id)->next) {
+        const ASTNode* node = ast_node(&ctx->ast, id);
+        if (node->type == AST_CALL) {
+            int callee = symbol_at(&ctx->symbols, node->call.symbol)->slot;
+            if (!seen[callee] && module->functions[callee].decl) {
+                seen[callee] = 1;
+                cache_hash_ast(hash, &ctx->ast, module->functions[callee].decl);
+                hash_callees(hash, ctx, module, module->functions[callee].decl, seen);
+            }
+        }
+        NodeId children[3];
+        int count = ast_children(node, children);
+        for (int i = 0; i < count; i++) {
+            hash_callees(hash, ctx, module, children[i], seen);
+        }
+        if (node->type == AST_FUNC_DECL) {
             break;
+        }
+    }
+}
+
+// A function's C depends on its own AST, the globals and functions it can
+// see, the bodies of any it may inline and the options; nothing else in
+// the file
+static CacheKey function_cache_key(FluentContext* ctx, IRModule* module, NodeId func_decl) {
+    CacheHash hash;
+    cache_hash_init(&hash);
+    cache_hash_string(&hash, "function");
+    cache_hash_options(&hash, ctx);
+    for (int i = 0; i < module->global_count; i++) {
+        IRGlobal* global = &module->globals[i];
+        cache_hash_update(&hash, global->name.start, global->name.length);
+        cache_hash_update(&hash, global->is_mutable ? "=" : ":", 1);
+        cache_hash_string(&hash, type_name(global->type));
+    }
+    for (int i = 0; i < module->function_count; i++) {
+        IRCallee* callee = &module->functions[i];
+        cache_hash_update(&hash, callee->name.start, callee->name.length);
+        cache_hash_update(&hash, &callee->param_count, sizeof(callee->param_count));
+    }
+    cache_hash_ast(&hash, &ctx->ast, func_decl);
+    if (inlining_enabled(ctx)) {
+        char* seen = calloc(module->function_count + 1, 1);
+        hash_callees(&hash, ctx, module, func_decl, seen);
+        free(seen);
+    }
+    return cache_hash_final(&hash);
+}
+
+static void emit_c_function(FluentContext* ctx, IRModule* module, NodeId func_decl, IRFunction* fn,
+                            OutputBuffer* out) {
+    const ASTNode* node = ast_node(&ctx->ast, func_decl);
+    uint8_t param_types[MAX_PARAMETERS];
+    int param_count = param_types_of(ctx, func_decl, param_types);
+    emit_signature(out, node->func.name, (ValueType)node->value_type, param_types, param_count);
+    emit_function(fn, module, out);
+}
+
+void generate_c_function(FluentContext* ctx, IRModule* module, NodeId func_decl, OutputBuffer* out) {
+    if (!ctx->cache) {
+        IRFunction* fn = lower_function(ctx, module, func_decl);
+        optimize_ir_function(ctx, fn);
+        emit_c_function(ctx, module, func_decl, fn, out);
+        return;
+    }
+
+    CacheKey key = function_cache_key(ctx, module, func_decl);
+    size_t length;
+    char* cached = cache_load(ctx->cache, &key, &length);
+    if (cached) {
+        cache_count(&ctx->cache->function_hits);
+        out_write(out, cached, length);
+        free(cached);
+        return;
     }
+    cache_count(&ctx->cache->function_misses);
+
+    // Lowering may unwind on an error, so only buffer once it is done
+    IRFunction* fn = lower_function(ctx, module, func_decl);
+    optimize_ir_function(ctx, fn);
+    OutputBuffer text;
+    open_memory_output(&text);
+    emit_c_function(ctx, module, func_decl, fn, &text);
+    cache_store(ctx->cache, &key, text.buffer, text.length);
+    out_write(out, text.buffer, text.length);
+    close_output(&text);
+}
+
+void emit_c_prologue(OutputBuffer* out) {
+    out_str(out, "#include <stdint.h>\n#include <stdio.h>\n\n");
+}
+
+void emit_c_prototype(OutputBuffer* out, Slice name, ValueType return_type, const uint8_t* param_types,
+                      int param_count) {
+    emit_signature(out, name, return_type, param_types, param_count);
+    out_str(out, ";\n");
+}
+
+void emit_c_global(OutputBuffer* out, Slice name, ValueType type) {
+    out_str(out, "static ");
+    out_str(out, type_c_name(type));
+    out_char(out, ' ');
+    emit_name(out, name);
+    out_str(out, ";\n");
+}
+
+// Top-level statements of program other than functions, as one C function
+void generate_c_init(FluentContext* ctx, IRModule* module, NodeId program, const char* signature,
+                     OutputBuffer* out) {
+    IRFunction* init = lower_global_init(ctx, module, program);
+    optimize_ir_function(ctx, init);
+    out_str(out, signature);
+    emit_function(init, module, out);
+}
+
+// The C main, which runs fluent_init and then the Fluent main if there is one
+void emit_c_entry(OutputBuffer* out, int has_main) {
+    out_str(out, "int main(void) {\n"
+                 "    fluent_init();\n");
+    out_str(out, has_main ? "    return fl_main();\n" : "    return 0;\n");
+    out_str(out, "}\n");
+}
+
+// Lowers, optimizes and prints one function as C or IR
+static void generate_function(FluentContext* ctx, IRModule* module, NodeId func_decl, OutputBuffer* out) {
+    if (ctx->emit == EMIT_IR) {
+        IRFunction* fn = lower_function(ctx, module, func_decl);
+        optimize_ir_function(ctx, fn);
+        print_ir_function(fn, module, out);
+    } else {
+        generate_c_function(ctx, module, func_decl, out);
+    }
+}
+
+// Parallel generation
+
+typedef struct {
+    NodeId func_decl;
+    OutputBuffer text;
+    char* diagnostics;            // Errors reported while generating it
+    size_t diagnostics_length;
+    int failed;
+    int done;
+} FunctionJob;
+
+typedef struct {
+    FluentContext* ctx;           // Only read by the workers
+    IRModule* module;
+    FunctionJob* jobs;
+    int count;
+    int next_job;
+    int cancelled;                // An earlier function failed
+    OptimizeStats stats;          // Summed over the workers
+    pthread_mutex_t lock;
+    pthread_cond_t finished;      // Signalled whenever a job is done
+} FunctionQueue;
+
+static void add_opt_stats(OptimizeStats* total, const OptimizeStats* part) {
+    total->folded += part->folded;
+    total->simplified += part->simplified;
+    total->propagated += part->propagated;
+    total->nodes_removed += part->nodes_removed;
+    total->copies_propagated += part->copies_propagated;
+    total->values_numbered += part->values_numbered;
+    total->instrs_removed += part->instrs_removed;
+    total->blocks_removed += part->blocks_removed;
+}
+
+static FunctionJob* next_function(FunctionQueue* queue) {
+    FunctionJob* job = NULL;
+    pthread_mutex_lock(&queue->lock);
+    if (!queue->cancelled && queue->next_job < queue->count) {
+        job = &queue->jobs[queue->next_job++];
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return job;
+}
+
+// Each worker lowers into a context of its own that shares the AST, symbols
+// and options of the file but has its own arena, counters and error exit.
+// Nothing shared is written until the job is handed back under the lock.
+static void* function_worker(void* arg) {
+    FunctionQueue* queue = arg;
+    FluentContext local = *queue->ctx;
+    init_arena(&local.arena);
+    memset(&local.opt_stats, 0, sizeof(OptimizeStats));
+    local.profile = NULL;
+    local.error_count = 0;
+
+    FunctionJob* job;
+    while ((job = next_function(queue))) {
+        local.diagnostics = open_memstream(&job->diagnostics, &job->diagnostics_length);
+        open_memory_output(&job->text);
+        if (setjmp(local.error_jmp)) {
+            job->failed = 1;
+        } else {
+            generate_function(&local, queue->module, job->func_decl, &job->text);
+        }
+        if (local.diagnostics) {
+            fclose(local.diagnostics);
+        }
+        reset_arena(&local.arena);
+
+        pthread_mutex_lock(&queue->lock);
+        job->done = 1;
+        queue->cancelled |= job->failed;
+        pthread_cond_broadcast(&queue->finished);
+        pthread_mutex_unlock(&queue->lock);
+    }
+
+    pthread_mutex_lock(&queue->lock);
+    add_opt_stats(&queue->stats, &local.opt_stats);
+    pthread_mutex_unlock(&queue->lock);
+    free_arena(&local.arena);
+    return NULL;
+}
+
+// Generates the functions on up to ctx->codegen_jobs threads and writes each
+// to out, in order, as soon as it and everything before it are done. When
+// no thread can be started, the calling thread does the work itself.
+// Returns 0, -1 after passing on the first function's error, or 1 without
+// generating anything when the queue cannot be allocated.
+static int generate_functions_parallel(FluentContext* ctx, IRModule* module, NodeId* funcs, int count,
+                                       OutputBuffer* out) {
+    FunctionQueue queue;
+    memset(&queue, 0, sizeof(FunctionQueue));
+    queue.ctx = ctx;
+    queue.module = module;
+    queue.jobs = calloc(count, sizeof(FunctionJob));
+    if (!queue.jobs) {
+        return 1;
+    }
+    queue.count = count;
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_cond_init(&queue.finished, NULL);
+    for (int i = 0; i < count; i++) {
+        queue.jobs[i].func_decl = funcs[i];
+    }
+
+    int wanted = ctx->codegen_jobs < count ? ctx->codegen_jobs : count;
+    pthread_t* threads = malloc(wanted * sizeof(pthread_t));
+    int thread_count = 0;
+    while (threads && thread_count < wanted &&
+           pthread_create(&threads[thread_count], NULL, function_worker, &queue) == 0) {
+        thread_count++;
+    }
+    if (thread_count == 0) {
+        function_worker(&queue);
+    }
+
+    FILE* diagnostics = ctx->diagnostics ? ctx->diagnostics : stderr;
+    int status = 0;
+    for (int i = 0; i < count && status == 0; i++) {
+        FunctionJob* job = &queue.jobs[i];
+        pthread_mutex_lock(&queue.lock);
+        while (!job->done) {
+            pthread_cond_wait(&queue.finished, &queue.lock);
+        }
+        pthread_mutex_unlock(&queue.lock);
+
+        if (job->diagnostics_length) {
+            fwrite(job->diagnostics, 1, job->diagnostics_length, diagnostics);
+        }
+        if (job->failed) {
+            status = -1;
+        } else {
+            out_write(out, job->text.buffer, job->text.length);
+        }
+        free(job->diagnostics);
+        job->diagnostics = NULL;
+        close_output(&job->text);
+    }
+
+    for (int i = 0; i < thread_count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    // Jobs finished after a failure were never written
+    for (int i = 0; i < count; i++) {
+        if (queue.jobs[i].done) {
+            free(queue.jobs[i].diagnostics);
+            close_output(&queue.jobs[i].text);
+        }
+    }
+    add_opt_stats(&ctx->opt_stats, &queue.stats);
+    if (status != 0) {
+        ctx->error_count++;
+    }
+
+    free(threads);
+    free(queue.jobs);
+    pthread_cond_destroy(&queue.finished);
+    pthread_mutex_destroy(&queue.lock);
+    return status;
+}
+
+// Generates every top-level function, in parallel when the context allows
+static int generate_functions(FluentContext* ctx, IRModule* module, NodeId statements, OutputBuffer* out) {
+    int count = 0;
+    for (NodeId stmt = statements; stmt; stmt = ast_node(&ctx->ast, stmt)->next) {
+        count += ast_node(&ctx->ast, stmt)->type == AST_FUNC_DECL;
+    }
+
+    NodeId* funcs = ctx->codegen_jobs > 1 && count >= 2 ? malloc(count * sizeof(NodeId)) : NULL;
+    if (funcs) {
+        int n = 0;
+        for (NodeId stmt = statements; stmt; stmt = ast_node(&ctx->ast, stmt)->next) {
+            if (ast_node(&ctx->ast, stmt)->type == AST_FUNC_DECL) {
+                funcs[n++] = stmt;
+            }
+        }
+        int status = generate_functions_parallel(ctx, module, funcs, count, out);
+        free(funcs);
+        if (status <= 0) {
+            return status;
+        }
+    }
+
+    // One job, or not enough memory to queue them. Like the workers, each
+    // function's IR is released once its text is written.
+    ArenaMark mark = arena_mark(&ctx->arena);
+    for (NodeId stmt = statements; stmt; stmt = ast_node(&ctx->ast, stmt)->next) {
+        if (ast_node(&ctx->ast, stmt)->type == AST_FUNC_DECL) {
+            generate_function(ctx, module, stmt, out);
+            arena_rewind(&ctx->arena, mark);
+        }
+    }
+    return 0;
+}
+
+// Returns 0 on success, or -1 after reporting an error
+int generate_code(FluentContext* ctx, NodeId ast, OutputBuffer* out) {
+    ctx->out = out;
+    if (setjmp(ctx->error_jmp)) {
+        return -1;
+    }
+
+    IRModule module;
+    collect_globals(ctx, ast, &module);
+    NodeId statements = ast_node(&ctx->ast, ast)->block.statements;
+
+    if (ctx->emit == EMIT_IR) {
+        if (generate_functions(ctx, &module, statements, out) != 0) {
+            return -1;
+        }
+        IRFunction* init = lower_global_init(ctx, &module, ast);
+        optimize_ir_function(ctx, init);
+        print_ir_function(init, &module, out);
+        return 0;
+    }
+
+    emit_c_prologue(out);
+
+    // Prototypes and globals first so definitions can appear in any order
+    int has_main = 0;
+    for (NodeId id = statements; id; id = ast_node(&ctx->ast, id)->next) {
+        const ASTNode* stmt = ast_node(&ctx->ast, id);
+        if (stmt->type == AST_FUNC_DECL) {
+            uint8_t param_types[MAX_PARAMETERS];
+            int param_count = param_types_of(ctx, id, param_types);
+            emit_c_prototype(out, stmt->func.name, (ValueType)stmt->value_type, param_types, param_count);
+            has_main |= slice_equals(stmt->func.name, "main");
+        }
+    }
+    for (int i = 0; i < module.global_count; i++) {
+        emit_c_global(out, module.globals[i].name, module.globals[i].type);
+    }
+    out_char(out, '\n');
+
+    if (generate_functions(ctx, &module, statements, out) != 0) {
+        return -1;
+    }
+
+    // Top-level statements run before the Fluent main
+    generate_c_init(ctx, &module, ast, "static int fluent_init(void)", out);
+    emit_c_entry(out, has_main);
+    return 0;
 }
@@ -0,0 +1,50 @@
+// context.c
+// Implementation of the Fluent compilation context
+
+#include "context.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+void init_context(FluentContext* ctx) {
+    memset(ctx, 0, sizeof(FluentContext));
+    init_arena(&ctx->arena);
+    init_ast(&ctx->ast);
+    init_token_stream(&ctx->tokens);
+    init_interner(&ctx->names);
+    init_symbols(&ctx->symbols);
+    ctx->inline_threshold = DEFAULT_INLINE_THRESHOLD;
+}
+
+// Releases everything allocated for the previous compilation in one step
+void reset_context(FluentContext* ctx) {
+    reset_arena(&ctx->arena);
+    reset_ast(&ctx->ast);
+    reset_token_stream(&ctx->tokens);
+    reset_interner(&ctx->names);
+    reset_symbols(&ctx->symbols);
+    ctx->error_count = 0;
+    ctx->file_name = NULL;
+    memset(&ctx->opt_stats, 0, sizeof(OptimizeStats));
+}
+
+void free_context(FluentContext* ctx) {
+    free_arena(&ctx->arena);
+    free_ast(&ctx->ast);
+    free_token_stream(&ctx->tokens);
+    free_interner(&ctx->names);
+    free_symbols(&ctx->symbols);
+}
+
+void report_error(FluentContext* ctx, const char* format, ...) {
+    FILE* out = ctx->diagnostics ? ctx->diagnostics : stderr;
+    va_list args;
+    va_start(args, format);
+    if (ctx->file_name) {
+        fprintf(out, "%s: ", ctx->file_name);
+    }
+    vfprintf(out, format, args);
+    va_end(args);
+    fputc('\n', out);
+    ctx->error_count++;
+}
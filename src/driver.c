@@ -0,0 +1,355 @@
+// driver.c
+// Implementation of the build driver: compiles many files on a thread pool
+
+#include "driver.h"
+#include "parser.h"
+#include "codegen.h"
+#include "optimize.h"
+#include "source.h"
+#include "stream.h"
+#include "output.h"
+#include "vm.h"
+#include "jit.h"
+#include "cache.h"
+#include "profile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+typedef struct {
+    CompileJob* jobs;
+    int count;
+    int next_job;
+    pthread_mutex_t lock;
+    const BuildOptions* options;
+} JobQueue;
+
+typedef struct {
+    JobQueue* queue;
+    FluentContext ctx;            // Reused for every file this worker compiles
+    Profile profile;
+    pthread_t thread;
+} Worker;
+
+static int write_output(FluentContext* ctx, const char* output_path, const char* data, size_t length) {
+    OutputBuffer output;
+    if (open_output(&output, output_path) != 0) {
+        report_error(ctx, "Could not open output file '%s': %s", output_path, strerror(errno));
+        return 1;
+    }
+    out_write(&output, data, length);
+    if (close_output(&output) != 0) {
+        report_error(ctx, "Could not write output");
+        return 1;
+    }
+    return 0;
+}
+
+// Counts what the front end produced, for --mem-stats
+static void count_source(FluentContext* ctx, const SourceInput* source) {
+    if (ctx->profile) {
+        ctx->profile->files++;
+        ctx->profile->source_bytes += source->bytes_read;
+        ctx->profile->ast_nodes += ctx->ast.count - 1;
+        ctx->profile->ast_bytes += (ctx->ast.count - 1) * (long long)sizeof(ASTNode);
+    }
+}
+
+// --stream: output is written as each function is compiled, so neither the
+// whole AST nor the whole output is ever held
+static int stream_source(FluentContext* ctx, SourceInput* source, const char* output_path) {
+    OutputBuffer output;
+    if (open_output(&output, output_path) != 0) {
+        report_error(ctx, "Could not open output file '%s': %s", output_path, strerror(errno));
+        return 1;
+    }
+    profile_begin(ctx->profile, PHASE_CODEGEN);
+    int status = compile_streamed(ctx, source, &output) == 0 ? 0 : 1;
+    profile_end(ctx->profile);
+    if (close_output(&output) != 0) {
+        report_error(ctx, "Could not write output");
+        status = 1;
+    }
+    if (ctx->profile) {
+        ctx->profile->files++;
+        ctx->profile->source_bytes += source->bytes_read;
+    }
+    return status;
+}
+
+// The body of compile_file; an error may leave profiled phases open
+static int compile_source(FluentContext* ctx, const char* input_path, const char* output_path) {
+    // Map the source file, or stream it when it comes from a pipe
+    profile_begin(ctx->profile, PHASE_READ);
+    SourceInput source;
+    int opened = open_source(&source, input_path);
+    profile_end(ctx->profile);
+    if (opened != 0) {
+        report_error(ctx, "Could not open source file: %s", strerror(errno));
+        return 1;
+    }
+
+    if (ctx->stream) {
+        int status = stream_source(ctx, &source, output_path);
+        close_source(&source);
+        return status;
+    }
+
+    // A file seen before with the same options is answered from the cache
+    // without lexing or parsing. Pipes are not hashed up front.
+    CacheKey file_key;
+    int use_file_cache = ctx->cache && !source.is_stream;
+    if (use_file_cache) {
+        CacheHash hash;
+        cache_hash_init(&hash);
+        cache_hash_string(&hash, "file");
+        cache_hash_options(&hash, ctx);
+        cache_hash_update(&hash, source.data, source.length);
+        file_key = cache_hash_final(&hash);
+
+        size_t length;
+        char* cached = cache_load(ctx->cache, &file_key, &length);
+        if (cached) {
+            cache_count(&ctx->cache->file_hits);
+            close_source(&source);
+            int status = write_output(ctx, output_path, cached, length);
+            free(cached);
+            return status;
+        }
+        cache_count(&ctx->cache->file_misses);
+    }
+
+    init_lexer_input(ctx, &source);
+    NodeId ast = parse_program(ctx);
+    if (!ast) {
+        close_source(&source);
+        return 1;
+    }
+    count_source(ctx, &source);
+
+    if (ctx->opt_level >= 1) {
+        profile_begin(ctx->profile, PHASE_FOLD);
+        fold_constants(ctx, ast);
+        profile_end(ctx->profile);
+    }
+
+    // With the cache on, output is collected in memory so it can be stored
+    OutputBuffer output;
+    if (use_file_cache) {
+        open_memory_output(&output);
+    } else if (open_output(&output, output_path) != 0) {
+        report_error(ctx, "Could not open output file '%s': %s", output_path, strerror(errno));
+        close_source(&source);
+        return 1;
+    }
+    profile_begin(ctx->profile, PHASE_CODEGEN);
+    int generated = ctx->emit == EMIT_ASM ? generate_asm(ctx, ast, &output)
+                                          : generate_code(ctx, ast, &output);
+    profile_end(ctx->profile);
+    int status = generated == 0 ? 0 : 1;
+    if (use_file_cache && status == 0) {
+        cache_store(ctx->cache, &file_key, output.buffer, output.length);
+        status = write_output(ctx, output_path, output.buffer, output.length);
+    }
+    if (close_output(&output) != 0) {
+        report_error(ctx, "Could not write output");
+        status = 1;
+    }
+
+    close_source(&source);
+    return status;
+}
+
+// Runs lex -> parse_program -> generate_code for one file. Returns 0 on success.
+int compile_file(FluentContext* ctx, const char* input_path, const char* output_path) {
+    ctx->file_name = strcmp(input_path, "-") == 0 ? "<stdin>" : input_path;
+    if (ctx->profile) {
+        ctx->profile->file_name = ctx->file_name;
+    }
+    int status = compile_source(ctx, input_path, output_path);
+    profile_unwind(ctx->profile);
+    return status;
+}
+
+// Compiles one file to bytecode and executes it in-process, interpreted or
+// JIT-compiled. Returns 0 and stores main's return value on success.
+int run_file(FluentContext* ctx, const char* input_path, RunMode mode, int* exit_status) {
+    ctx->file_name = strcmp(input_path, "-") == 0 ? "<stdin>" : input_path;
+    if (ctx->profile) {
+        ctx->profile->file_name = ctx->file_name;
+    }
+
+    profile_begin(ctx->profile, PHASE_READ);
+    SourceInput source;
+    int opened = open_source(&source, input_path);
+    profile_end(ctx->profile);
+    if (opened != 0) {
+        report_error(ctx, "Could not open source file: %s", strerror(errno));
+        return 1;
+    }
+
+    init_lexer_input(ctx, &source);
+    NodeId ast = parse_program(ctx);
+    int status = 1;
+    if (ast) {
+        count_source(ctx, &source);
+        if (ctx->opt_level >= 1) {
+            profile_begin(ctx->profile, PHASE_FOLD);
+            fold_constants(ctx, ast);
+            profile_end(ctx->profile);
+        }
+        profile_begin(ctx->profile, PHASE_BYTECODE);
+        BytecodeProgram program;
+        int compiled = compile_bytecode(ctx, ast, &program);
+        profile_end(ctx->profile);
+        if (compiled == 0) {
+            profile_begin(ctx->profile, PHASE_EXECUTE);
+            int ran = mode == RUN_JIT ? run_jit(ctx, &program, exit_status)
+                                      : run_bytecode(ctx, &program, exit_status);
+            profile_end(ctx->profile);
+            status = ran == 0 ? 0 : 1;
+        }
+    }
+
+    profile_unwind(ctx->profile);
+    close_source(&source);
+    return status;
+}
+
+int wants_profile(const BuildOptions* options) {
+    return options->mem_stats || options->time_passes || options->trace_path;
+}
+
+// Prints the requested statistics summed over every worker and writes the
+// trace file. Returns nonzero if the trace could not be written.
+int report_profiles(const BuildOptions* options, Profile* profiles, int count, double started) {
+    double wall = profile_now() - started;
+    if (options->mem_stats || options->time_passes) {
+        Profile total;
+        init_profile(&total, 0, 0, started);
+        for (int i = 0; i < count; i++) {
+            merge_profile(&total, &profiles[i]);
+        }
+        print_profile(&total, stderr, options->stats_format, options->time_passes, options->mem_stats, wall);
+    }
+    if (options->trace_path && write_chrome_trace(profiles, count, options->trace_path) != 0) {
+        fprintf(stderr, "Could not write trace file '%s': %s\n", options->trace_path, strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+static CompileJob* next_job(JobQueue* queue) {
+    CompileJob* job = NULL;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->next_job < queue->count) {
+        job = &queue->jobs[queue->next_job++];
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return job;
+}
+
+static void* worker_main(void* arg) {
+    Worker* worker = arg;
+    const BuildOptions* options = worker->queue->options;
+    CompileJob* job;
+
+    while ((job = next_job(worker->queue))) {
+        // Diagnostics are collected per job and printed in input order later
+        FILE* diagnostics = open_memstream(&job->diagnostics, &job->diagnostics_length);
+        worker->ctx.diagnostics = diagnostics;
+        worker->ctx.opt_level = options->opt_level;
+        worker->ctx.ir_pipeline = options->ir_pipeline;
+        worker->ctx.inline_threshold = options->inline_threshold;
+        worker->ctx.pull_tokens = options->pull_tokens;
+        worker->ctx.stream = options->stream;
+        worker->ctx.emit = options->emit;
+        worker->ctx.cache = options->cache;
+        job->status = compile_file(&worker->ctx, job->input_path, job->output_path);
+        if (options->opt_stats && job->status == 0) {
+            print_opt_stats(&worker->ctx, diagnostics ? diagnostics : stderr);
+        }
+        worker->ctx.diagnostics = NULL;
+        if (diagnostics) {
+            fclose(diagnostics);
+        }
+        reset_context(&worker->ctx);
+    }
+    return NULL;
+}
+
+// Compiles every job and returns the number that failed
+int run_build(CompileJob* jobs, int count, const BuildOptions* options) {
+    JobQueue queue = { jobs, count, 0, PTHREAD_MUTEX_INITIALIZER, options };
+
+    int worker_count = options->jobs < 1 ? 1 : options->jobs;
+    if (worker_count > count) {
+        worker_count = count;
+    }
+
+    double started = profile_now();
+    Worker* workers = calloc(worker_count, sizeof(Worker));
+    for (int i = 0; i < worker_count; i++) {
+        workers[i].queue = &queue;
+        init_context(&workers[i].ctx);
+        // Threads not needed for whole files generate functions in parallel
+        workers[i].ctx.codegen_jobs = options->jobs / worker_count;
+        if (wants_profile(options)) {
+            init_profile(&workers[i].profile, options->time_passes, options->trace_path != NULL, started);
+            workers[i].ctx.profile = &workers[i].profile;
+        }
+    }
+
+    // The first worker runs on the calling thread. If a thread cannot be
+    // started, the workers that did start and this one share the queue.
+    int running = 1;
+    while (running < worker_count &&
+           pthread_create(&workers[running].thread, NULL, worker_main, &workers[running]) == 0) {
+        running++;
+    }
+    worker_main(&workers[0]);
+    for (int i = 1; i < running; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+
+    int failed = 0;
+    for (int i = 0; i < count; i++) {
+        if (jobs[i].diagnostics) {
+            fwrite(jobs[i].diagnostics, 1, jobs[i].diagnostics_length, stderr);
+            free(jobs[i].diagnostics);
+            jobs[i].diagnostics = NULL;
+        }
+        if (jobs[i].status != 0) {
+            failed++;
+        }
+    }
+
+    if (options->cache) {
+        trim_cache(options->cache);
+        if (options->cache_stats) {
+            Cache* cache = options->cache;
+            fprintf(stderr, "cache: files %d hit / %d miss, functions %d hit / %d miss, %d stored, %d evicted\n",
+                    cache->file_hits, cache->file_misses, cache->function_hits, cache->function_misses,
+                    cache->stored, cache->evicted);
+        }
+    }
+
+    Profile* profiles = malloc(worker_count * sizeof(Profile));
+    for (int i = 0; i < worker_count; i++) {
+        profiles[i] = workers[i].profile;
+        record_arena(&profiles[i], &workers[i].ctx.arena);
+        free_context(&workers[i].ctx);
+    }
+    free(workers);
+    if (wants_profile(options) && report_profiles(options, profiles, worker_count, started) != 0) {
+        failed++;
+    }
+    for (int i = 0; i < worker_count; i++) {
+        free_profile(&profiles[i]);
+    }
+    free(profiles);
+    pthread_mutex_destroy(&queue.lock);
+    return failed;
+}
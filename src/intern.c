@@ -0,0 +1,103 @@
+// intern.c
+// Implementation of the identifier interner
+
+#include "intern.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_NAMES 256
+
+static void* grow_array(void* items, size_t count) {
+    void* bigger = realloc(items, count);
+    if (!bigger) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    return bigger;
+}
+
+// FNV-1a; identifiers are short, so this beats anything wider
+static uint32_t hash_name(Slice name) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < name.length; i++) {
+        hash = (hash ^ (unsigned char)name.start[i]) * 16777619u;
+    }
+    return hash;
+}
+
+void init_interner(Interner* interner) {
+    memset(interner, 0, sizeof(Interner));
+}
+
+// Keeps the arrays for the next file
+void reset_interner(Interner* interner) {
+    if (interner->count > 1) {
+        memset(interner->table, 0, interner->table_capacity * sizeof(uint32_t));
+    }
+    interner->count = 0;
+}
+
+void free_interner(Interner* interner) {
+    free(interner->names);
+    free(interner->hashes);
+    free(interner->table);
+    init_interner(interner);
+}
+
+static void insert_slot(Interner* interner, NameId id) {
+    uint32_t mask = interner->table_capacity - 1;
+    uint32_t i = interner->hashes[id] & mask;
+    while (interner->table[i] != NO_NAME) {
+        i = (i + 1) & mask;
+    }
+    interner->table[i] = id;
+}
+
+// Keeps the table at most half full
+static void grow_table(Interner* interner) {
+    free(interner->table);
+    interner->table_capacity = interner->table_capacity ? interner->table_capacity * 2 : INITIAL_NAMES * 2;
+    interner->table = calloc(interner->table_capacity, sizeof(uint32_t));
+    if (!interner->table) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    for (NameId id = 1; id < interner->count; id++) {
+        insert_slot(interner, id);
+    }
+}
+
+NameId intern(Interner* interner, Slice name) {
+    if (interner->count == 0) {
+        interner->count = 1;      // Reserve NO_NAME
+    }
+    if (interner->count * 2 >= interner->table_capacity) {
+        grow_table(interner);
+    }
+
+    uint32_t hash = hash_name(name);
+    uint32_t mask = interner->table_capacity - 1;
+    uint32_t i = hash & mask;
+    for (NameId id; (id = interner->table[i]) != NO_NAME; i = (i + 1) & mask) {
+        Slice existing = interner->names[id];
+        if (interner->hashes[id] == hash && existing.length == name.length &&
+            memcmp(existing.start, name.start, name.length) == 0) {
+            return id;
+        }
+    }
+
+    if (interner->count >= interner->capacity) {
+        interner->capacity = interner->capacity ? interner->capacity * 2 : INITIAL_NAMES;
+        interner->names = grow_array(interner->names, interner->capacity * sizeof(Slice));
+        interner->hashes = grow_array(interner->hashes, interner->capacity * sizeof(uint32_t));
+    }
+    NameId id = interner->count++;
+    if (interner->storage) {
+        name.start = arena_strndup(interner->storage, name.start, name.length);
+    }
+    interner->names[id] = name;
+    interner->hashes[id] = hash;
+    interner->table[i] = id;
+    return id;
+}
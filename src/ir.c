@@ -0,0 +1,354 @@
+// ir.c
+// Implementation of the SSA IR data structures
+
+#include "ir.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Arena-backed growable arrays: the old storage is simply abandoned
+static void* grow_array(Arena* arena, void* items, int count, int* capacity, size_t size) {
+    if (count < *capacity) {
+        return items;
+    }
+    int new_capacity = *capacity ? *capacity * 2 : 4;
+    void* bigger = arena_alloc(arena, new_capacity * size);
+    if (count) {
+        memcpy(bigger, items, count * size);
+    }
+    *capacity = new_capacity;
+    return bigger;
+}
+
+IRFunction* create_ir_function(Arena* arena, Slice name) {
+    IRFunction* fn = arena_alloc(arena, sizeof(IRFunction));
+    memset(fn, 0, sizeof(IRFunction));
+    fn->name = name;
+    return fn;
+}
+
+IRBlock* create_ir_block(Arena* arena, IRFunction* fn) {
+    IRBlock* block = arena_alloc(arena, sizeof(IRBlock));
+    memset(block, 0, sizeof(IRBlock));
+    block->id = fn->block_count;
+    block->rpo_index = -1;
+    block->idom = -1;
+    fn->blocks = grow_array(arena, fn->blocks, fn->block_count, &fn->block_capacity, sizeof(IRBlock*));
+    fn->blocks[fn->block_count++] = block;
+    return block;
+}
+
+static IRInstr* new_instr(Arena* arena, IRFunction* fn, IRBlock* block, IROpcode op) {
+    IRInstr* instr = arena_alloc(arena, sizeof(IRInstr));
+    memset(instr, 0, sizeof(IRInstr));
+    instr->op = op;
+    instr->id = fn->value_count;
+    instr->block = block->id;
+    instr->type = TYPE_I32;
+    instr->args = instr->inline_args;
+    instr->args[0] = -1;
+    instr->args[1] = -1;
+    instr->global = -1;
+    instr->callee = -1;
+    instr->targets[0] = -1;
+    instr->targets[1] = -1;
+    fn->values = grow_array(arena, fn->values, fn->value_count, &fn->value_capacity, sizeof(IRInstr*));
+    fn->values[fn->value_count++] = instr;
+    return instr;
+}
+
+IRInstr* append_ir_instr(Arena* arena, IRFunction* fn, IRBlock* block, IROpcode op) {
+    IRInstr* instr = new_instr(arena, fn, block, op);
+    block->instrs = grow_array(arena, block->instrs, block->instr_count, &block->instr_capacity, sizeof(int));
+    block->instrs[block->instr_count++] = instr->id;
+    return instr;
+}
+
+IRInstr* append_ir_phi(Arena* arena, IRFunction* fn, IRBlock* block) {
+    IRInstr* instr = new_instr(arena, fn, block, IR_PHI);
+    block->phis = grow_array(arena, block->phis, block->phi_count, &block->phi_capacity, sizeof(int));
+    block->phis[block->phi_count++] = instr->id;
+    return instr;
+}
+
+IRInstr* append_ir_call(Arena* arena, IRFunction* fn, IRBlock* block, int callee, int arg_count) {
+    IRInstr* instr = append_ir_instr(arena, fn, block, IR_CALL);
+    instr->callee = callee;
+    instr->arg_count = arg_count;
+    if (arg_count > 2) {
+        instr->args = arena_alloc(arena, arg_count * sizeof(int));
+    }
+    return instr;
+}
+
+void add_ir_pred(Arena* arena, IRBlock* block, int pred) {
+    block->preds = grow_array(arena, block->preds, block->pred_count, &block->pred_capacity, sizeof(int));
+    block->preds[block->pred_count++] = pred;
+}
+
+// Drops one edge from pred, along with the matching operand of every phi
+void remove_ir_pred(IRFunction* fn, IRBlock* block, int pred) {
+    int index = -1;
+    for (int i = 0; i < block->pred_count; i++) {
+        if (block->preds[i] == pred) {
+            index = i;
+            break;
+        }
+    }
+    if (index < 0) {
+        return;
+    }
+    int tail = block->pred_count - index - 1;
+    memmove(&block->preds[index], &block->preds[index + 1], tail * sizeof(int));
+    for (int i = 0; i < block->phi_count; i++) {
+        IRInstr* phi = fn->values[block->phis[i]];
+        if (phi->op == IR_PHI && phi->phi_args) {
+            memmove(&phi->phi_args[index], &phi->phi_args[index + 1], tail * sizeof(int));
+        }
+    }
+    block->pred_count--;
+}
+
+IRInstr* ir_terminator(IRFunction* fn, IRBlock* block) {
+    if (block->instr_count == 0) {
+        return NULL;
+    }
+    IRInstr* last = fn->values[block->instrs[block->instr_count - 1]];
+    if (last->op == IR_JUMP || last->op == IR_BRANCH || last->op == IR_RETURN) {
+        return last;
+    }
+    return NULL;
+}
+
+int ir_successors(IRFunction* fn, IRBlock* block, int* succs) {
+    IRInstr* term = ir_terminator(fn, block);
+    if (!term) {
+        return 0;
+    }
+    switch (term->op) {
+        case IR_JUMP:
+            succs[0] = term->targets[0];
+            return 1;
+        case IR_BRANCH:
+            succs[0] = term->targets[0];
+            succs[1] = term->targets[1];
+            return 2;
+        default:
+            return 0;
+    }
+}
+
+// Pure instructions can be removed when unused and merged when equal
+int ir_is_pure(IROpcode op) {
+    return op <= IR_GE;
+}
+
+int ir_operand_count(IRInstr* instr) {
+    switch (instr->op) {
+        case IR_COPY:
+        case IR_CONVERT:
+        case IR_STORE_GLOBAL:
+        case IR_BRANCH:
+        case IR_RETURN:
+            return 1;
+        case IR_ADD:
+        case IR_SUB:
+        case IR_MUL:
+        case IR_DIV:
+        case IR_EQ:
+        case IR_NE:
+        case IR_LT:
+        case IR_GT:
+        case IR_LE:
+        case IR_GE:
+            return 2;
+        case IR_CALL:
+            return instr->arg_count;
+        default:
+            return 0;
+    }
+}
+
+// Orders reachable blocks in reverse postorder and computes immediate
+// dominators with the Cooper-Harvey-Kennedy iteration
+void compute_dominators(Arena* arena, IRFunction* fn) {
+    int count = fn->block_count;
+    int* postorder = malloc(count * sizeof(int));
+    int* stack = malloc(count * sizeof(int));
+    int* next_succ = calloc(count, sizeof(int));
+    char* visited = calloc(count, 1);
+    int post_count = 0;
+    int top = 0;
+
+    for (int i = 0; i < count; i++) {
+        fn->blocks[i]->rpo_index = -1;
+        fn->blocks[i]->idom = -1;
+    }
+
+    stack[top++] = 0;
+    visited[0] = 1;
+    while (top > 0) {
+        IRBlock* block = fn->blocks[stack[top - 1]];
+        int succs[2];
+        int succ_count = ir_successors(fn, block, succs);
+        if (next_succ[block->id] < succ_count) {
+            int succ = succs[next_succ[block->id]++];
+            if (!visited[succ]) {
+                visited[succ] = 1;
+                stack[top++] = succ;
+            }
+        } else {
+            postorder[post_count++] = block->id;
+            top--;
+        }
+    }
+
+    fn->rpo = arena_alloc(arena, post_count * sizeof(int));
+    fn->rpo_count = post_count;
+    for (int i = 0; i < post_count; i++) {
+        int id = postorder[post_count - 1 - i];
+        fn->rpo[i] = id;
+        fn->blocks[id]->rpo_index = i;
+    }
+
+    fn->blocks[0]->idom = 0;
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int i = 1; i < fn->rpo_count; i++) {
+            IRBlock* block = fn->blocks[fn->rpo[i]];
+            int new_idom = -1;
+            for (int p = 0; p < block->pred_count; p++) {
+                int pred = block->preds[p];
+                if (fn->blocks[pred]->idom < 0) {
+                    continue;
+                }
+                if (new_idom < 0) {
+                    new_idom = pred;
+                    continue;
+                }
+                // Walk both fingers up to their common dominator
+                int a = pred;
+                int b = new_idom;
+                while (a != b) {
+                    while (fn->blocks[a]->rpo_index > fn->blocks[b]->rpo_index) a = fn->blocks[a]->idom;
+                    while (fn->blocks[b]->rpo_index > fn->blocks[a]->rpo_index) b = fn->blocks[b]->idom;
+                }
+                new_idom = a;
+            }
+            if (block->idom != new_idom) {
+                block->idom = new_idom;
+                changed = 1;
+            }
+        }
+    }
+
+    free(postorder);
+    free(stack);
+    free(next_succ);
+    free(visited);
+}
+
+static const char* opcode_names[] = {
+    "const", "copy", "phi", "param", "convert", "add", "sub", "mul", "div",
+    "eq", "ne", "lt", "gt", "le", "ge", "load", "call", "store",
+    "jump", "branch", "ret", "nop"
+};
+
+static void print_instr(IRFunction* fn, IRModule* module, IRInstr* instr, OutputBuffer* out) {
+    out_str(out, "    ");
+    if (instr->op < IR_STORE_GLOBAL) {
+        out_char(out, 'v');
+        out_int(out, instr->id);
+        out_str(out, " = ");
+    }
+    out_str(out, opcode_names[instr->op]);
+    // Values other than i32 carry their type
+    if (instr->op < IR_STORE_GLOBAL && instr->type != TYPE_I32) {
+        out_char(out, '.');
+        out_str(out, type_name(instr->type));
+    }
+
+    switch (instr->op) {
+        case IR_CONST:
+            out_char(out, ' ');
+            if (type_is_float(instr->type)) {
+                char text[32];
+                snprintf(text, sizeof(text), "%.17g", instr->fimm);
+                out_str(out, text);
+            } else if (instr->type == TYPE_U64) {
+                char text[32];
+                snprintf(text, sizeof(text), "%llu", (unsigned long long)instr->imm);
+                out_str(out, text);
+            } else {
+                out_int(out, instr->imm);
+            }
+            break;
+        case IR_PARAM:
+            out_char(out, ' ');
+            out_int(out, instr->imm);
+            break;
+        case IR_CALL:
+            out_char(out, ' ');
+            out_slice(out, module->functions[instr->callee].name);
+            break;
+        case IR_PHI: {
+            IRBlock* block = fn->blocks[instr->block];
+            for (int i = 0; i < block->pred_count; i++) {
+                out_str(out, i ? ", [bb" : " [bb");
+                out_int(out, block->preds[i]);
+                out_str(out, ": v");
+                out_int(out, instr->phi_args ? instr->phi_args[i] : -1);
+                out_char(out, ']');
+            }
+            break;
+        }
+        case IR_LOAD_GLOBAL:
+        case IR_STORE_GLOBAL:
+            out_char(out, ' ');
+            out_slice(out, module->globals[instr->global].name);
+            break;
+        default:
+            break;
+    }
+
+    for (int i = 0; i < ir_operand_count(instr); i++) {
+        out_str(out, i || instr->op == IR_STORE_GLOBAL || instr->op == IR_CALL ? ", v" : " v");
+        out_int(out, instr->args[i]);
+    }
+
+    if (instr->op == IR_JUMP || instr->op == IR_BRANCH) {
+        int count = instr->op == IR_JUMP ? 1 : 2;
+        for (int i = 0; i < count; i++) {
+            out_str(out, i || instr->op == IR_BRANCH ? ", bb" : " bb");
+            out_int(out, instr->targets[i]);
+        }
+    }
+    out_char(out, '\n');
+}
+
+void print_ir_function(IRFunction* fn, IRModule* module, OutputBuffer* out) {
+    out_str(out, "func ");
+    out_slice(out, fn->name);
+    out_str(out, ":\n");
+    for (int b = 0; b < fn->block_count; b++) {
+        IRBlock* block = fn->blocks[b];
+        if (block->removed) {
+            continue;
+        }
+        out_str(out, "bb");
+        out_int(out, block->id);
+        out_char(out, ':');
+        for (int i = 0; i < block->pred_count; i++) {
+            out_str(out, i ? ", bb" : " ; preds bb");
+            out_int(out, block->preds[i]);
+        }
+        out_char(out, '\n');
+        for (int i = 0; i < block->phi_count; i++) {
+            print_instr(fn, module, fn->values[block->phis[i]], out);
+        }
+        for (int i = 0; i < block->instr_count; i++) {
+            print_instr(fn, module, fn->values[block->instrs[i]], out);
+        }
+    }
+}
@@ -0,0 +1,560 @@
+// jit.c
+// Template JIT from bytecode to x86-64 machine code
+//
+// Each bytecode instruction expands to a fixed machine code sequence.
+// The function's registers live in its stack frame, addressed from %rbx,
+// and constant registers become immediates. Code is assembled into a
+// private buffer and copied into an mmap'd region that is only made
+// executable once it is no longer writable. A function is compiled the
+// first time it is entered, so functions that never run cost nothing.
+//
+// Compiled functions take a pointer to their arguments and copy them into
+// the parameter registers. A call goes through jit_call, which compiles the
+// callee when needed; a set status makes every caller return at once.
+// Calls nest on the native stack. The program runs on a thread whose
+// stack is large enough for MAX_CALL_DEPTH calls of ordinary functions,
+// and jit_call refuses a call that would go deeper than that or into the
+// last JIT_STACK_RESERVE bytes of the stack, reporting a stack overflow.
+
+#define _GNU_SOURCE
+#include "jit.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if defined(__x86_64__)
+
+#define JIT_STACK_SIZE ((size_t)MAX_CALL_DEPTH * 256)
+#define JIT_STACK_RESERVE (256 * 1024)
+
+typedef int32_t (*JitEntry)(const int32_t* args);
+
+enum {
+    JIT_UNMAPPED = -1,            // Code could not be mapped
+    JIT_STACK_OVERFLOW = -2       // Calls nested too deep; see overflowed
+};
+
+typedef struct {
+    FluentContext* ctx;
+    const BytecodeProgram* program;
+    JitEntry* entries;            // NULL until first call
+    size_t* mapped_sizes;
+    int32_t* globals;
+    int32_t status;               // 1 + index of a function that divided by zero,
+                                  // or one of the values above
+    int depth;                    // Fluent calls active below the entry point
+    int overflowed;               // The function that could not be called
+    uintptr_t stack_limit;        // Lowest native stack address calls may use
+} Jit;
+
+typedef struct {
+    uint8_t* bytes;
+    size_t length;
+    size_t capacity;
+} CodeBuffer;
+
+typedef struct {
+    size_t position;              // Where the rel32 goes
+    int target;                   // Bytecode index, JUMP_ERROR or JUMP_PROPAGATE
+} Fixup;
+
+enum { RAX = 0, RCX = 1, RDX = 2, RBX = 3 };
+
+enum {
+    JUMP_ERROR = -1,              // Division by zero: set the status and return
+    JUMP_PROPAGATE = -2           // A callee set the status: return
+};
+
+static void emit_byte(CodeBuffer* cb, uint8_t byte) {
+    if (cb->length == cb->capacity) {
+        cb->capacity = cb->capacity ? cb->capacity * 2 : 4096;
+        cb->bytes = realloc(cb->bytes, cb->capacity);
+    }
+    cb->bytes[cb->length++] = byte;
+}
+
+static void emit_bytes(CodeBuffer* cb, const uint8_t* bytes, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        emit_byte(cb, bytes[i]);
+    }
+}
+
+static void emit_u32(CodeBuffer* cb, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        emit_byte(cb, (value >> (8 * i)) & 0xff);
+    }
+}
+
+static void emit_u64(CodeBuffer* cb, uint64_t value) {
+    emit_u32(cb, (uint32_t)value);
+    emit_u32(cb, (uint32_t)(value >> 32));
+}
+
+static void patch_u32(CodeBuffer* cb, size_t position, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        cb->bytes[position + i] = (value >> (8 * i)) & 0xff;
+    }
+}
+
+// ModRM (and displacement) for the VM register slot [%rbx + 4 * reg]
+static void emit_slot(CodeBuffer* cb, int reg_field, int slot) {
+    int disp = slot * 4;
+    if (disp < 128) {
+        emit_byte(cb, 0x40 | (reg_field << 3) | RBX);
+        emit_byte(cb, disp);
+    } else {
+        emit_byte(cb, 0x80 | (reg_field << 3) | RBX);
+        emit_u32(cb, disp);
+    }
+}
+
+typedef struct {
+    Jit* jit;
+    const BytecodeFunction* fn;
+    CodeBuffer code;
+    size_t* offsets;              // Machine code offset of each instruction
+    Fixup* fixups;
+    int fixup_count;
+} JitCompiler;
+
+static int is_constant(JitCompiler* jc, int slot) {
+    return slot < jc->fn->constant_count;
+}
+
+// mov reg, R[slot]
+static void emit_load(JitCompiler* jc, int reg, int slot) {
+    if (is_constant(jc, slot)) {
+        emit_byte(&jc->code, 0xB8 + reg);
+        emit_u32(&jc->code, (uint32_t)jc->fn->constants[slot]);
+    } else {
+        emit_byte(&jc->code, 0x8B);
+        emit_slot(&jc->code, reg, slot);
+    }
+}
+
+// mov R[slot], %eax
+static void emit_store(JitCompiler* jc, int slot) {
+    emit_byte(&jc->code, 0x89);
+    emit_slot(&jc->code, RAX, slot);
+}
+
+typedef enum { ALU_ADD, ALU_SUB, ALU_IMUL, ALU_CMP } AluOp;
+
+// %eax = %eax op R[slot], using an immediate form for constants
+static void emit_alu(JitCompiler* jc, AluOp op, int slot) {
+    CodeBuffer* cb = &jc->code;
+    if (is_constant(jc, slot)) {
+        static const uint8_t immediate[] = { 0x05, 0x2D, 0x69, 0x3D };
+        emit_byte(cb, immediate[op]);
+        if (op == ALU_IMUL) {
+            emit_byte(cb, 0xC0);                     // imul %eax, %eax, imm32
+        }
+        emit_u32(cb, (uint32_t)jc->fn->constants[slot]);
+        return;
+    }
+    switch (op) {
+        case ALU_ADD: emit_byte(cb, 0x03); break;
+        case ALU_SUB: emit_byte(cb, 0x2B); break;
+        case ALU_IMUL: emit_byte(cb, 0x0F); emit_byte(cb, 0xAF); break;
+        case ALU_CMP: emit_byte(cb, 0x3B); break;
+    }
+    emit_slot(cb, RAX, slot);
+}
+
+// Low nibble of the jcc/setcc opcodes
+static uint8_t condition_code(Opcode op) {
+    switch (op) {
+        case OP_EQ: case OP_JEQ: case OP_JZ: return 0x4;
+        case OP_NE: case OP_JNE: case OP_JNZ: return 0x5;
+        case OP_LT: case OP_JLT: return 0xC;
+        case OP_GE: case OP_JGE: return 0xD;
+        case OP_LE: case OP_JLE: return 0xE;
+        case OP_GT: case OP_JGT: return 0xF;
+        default: return 0x5;
+    }
+}
+
+static void emit_jump(JitCompiler* jc, int condition, int target) {
+    if (condition < 0) {
+        emit_byte(&jc->code, 0xE9);
+    } else {
+        emit_byte(&jc->code, 0x0F);
+        emit_byte(&jc->code, 0x80 | condition);
+    }
+    jc->fixups[jc->fixup_count++] = (Fixup){ jc->code.length, target };
+    emit_u32(&jc->code, 0);
+}
+
+static void emit_epilogue(JitCompiler* jc) {
+    static const uint8_t epilogue[] = {
+        0x48, 0x8D, 0x65, 0xF8,                     // lea -8(%rbp), %rsp
+        0x5B,                                       // pop %rbx
+        0x5D,                                       // pop %rbp
+        0xC3                                        // ret
+    };
+    emit_bytes(&jc->code, epilogue, sizeof(epilogue));
+}
+
+static void emit_divide(JitCompiler* jc, const BytecodeInstr* instr) {
+    CodeBuffer* cb = &jc->code;
+    emit_load(jc, RAX, instr->b);
+    emit_load(jc, RCX, instr->c);
+    int32_t divisor = is_constant(jc, instr->c) ? jc->fn->constants[instr->c] : 0;
+    if (divisor != 0 && divisor != -1) {
+        static const uint8_t divide[] = { 0x99, 0xF7, 0xF9 };          // cltd; idiv %ecx
+        emit_bytes(cb, divide, sizeof(divide));
+    } else {
+        static const uint8_t test[] = { 0x85, 0xC9 };                  // test %ecx, %ecx
+        emit_bytes(cb, test, sizeof(test));
+        emit_jump(jc, 0x4, JUMP_ERROR);
+        // INT_MIN / -1 wraps like the VM instead of trapping
+        static const uint8_t divide[] = {
+            0x83, 0xF9, 0xFF,                       // cmp $-1, %ecx
+            0x75, 0x04,                             // jne 1f
+            0xF7, 0xD8,                             // neg %eax
+            0xEB, 0x03,                             // jmp 2f
+            0x99, 0xF7, 0xF9                        // 1: cltd; idiv %ecx
+        };                                          // 2:
+        emit_bytes(cb, divide, sizeof(divide));
+    }
+    emit_store(jc, instr->a);
+}
+
+static int32_t jit_call(Jit* jit, int32_t index, const int32_t* args);
+
+static void emit_call(JitCompiler* jc, const BytecodeInstr* instr) {
+    CodeBuffer* cb = &jc->code;
+    int disp = instr->c * 4;
+    emit_byte(cb, 0x48);                             // lea R[c], %rdx
+    emit_byte(cb, 0x8D);
+    if (disp < 128) {
+        emit_byte(cb, 0x53);
+        emit_byte(cb, disp);
+    } else {
+        emit_byte(cb, 0x93);
+        emit_u32(cb, disp);
+    }
+    emit_byte(cb, 0x48);                             // movabs $jit, %rdi
+    emit_byte(cb, 0xBF);
+    emit_u64(cb, (uint64_t)(uintptr_t)jc->jit);
+    emit_byte(cb, 0xBE);                             // mov $index, %esi
+    emit_u32(cb, instr->b);
+    emit_byte(cb, 0x48);                             // movabs $jit_call, %rax
+    emit_byte(cb, 0xB8);
+    emit_u64(cb, (uint64_t)(uintptr_t)jit_call);
+    static const uint8_t call[] = { 0xFF, 0xD0 };    // call *%rax
+    emit_bytes(cb, call, sizeof(call));
+    emit_store(jc, instr->a);
+    emit_byte(cb, 0xA1);                             // movabs &status, %eax
+    emit_u64(cb, (uint64_t)(uintptr_t)&jc->jit->status);
+    static const uint8_t test[] = { 0x85, 0xC0 };    // test %eax, %eax
+    emit_bytes(cb, test, sizeof(test));
+    emit_jump(jc, 0x5, JUMP_PROPAGATE);
+}
+
+static void emit_instr(JitCompiler* jc, const BytecodeInstr* instr) {
+    CodeBuffer* cb = &jc->code;
+    switch ((Opcode)instr->op) {
+        case OP_MOVE:
+            emit_load(jc, RAX, instr->b);
+            emit_store(jc, instr->a);
+            break;
+        case OP_GETG:
+            emit_byte(cb, 0xA1);                     // movabs addr, %eax
+            emit_u64(cb, (uint64_t)(uintptr_t)&jc->jit->globals[instr->c]);
+            emit_store(jc, instr->a);
+            break;
+        case OP_SETG:
+            emit_load(jc, RAX, instr->a);
+            emit_byte(cb, 0xA3);                     // movabs %eax, addr
+            emit_u64(cb, (uint64_t)(uintptr_t)&jc->jit->globals[instr->c]);
+            break;
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+            emit_load(jc, RAX, instr->b);
+            emit_alu(jc, instr->op == OP_ADD ? ALU_ADD : instr->op == OP_SUB ? ALU_SUB : ALU_IMUL, instr->c);
+            emit_store(jc, instr->a);
+            break;
+        case OP_DIV:
+            emit_divide(jc, instr);
+            break;
+        case OP_EQ:
+        case OP_NE:
+        case OP_LT:
+        case OP_GT:
+        case OP_LE:
+        case OP_GE: {
+            emit_load(jc, RAX, instr->b);
+            emit_alu(jc, ALU_CMP, instr->c);
+            uint8_t set[] = {
+                0x0F, 0x90 | condition_code(instr->op), 0xC0,   // setcc %al
+                0x0F, 0xB6, 0xC0                                // movzbl %al, %eax
+            };
+            emit_bytes(cb, set, sizeof(set));
+            emit_store(jc, instr->a);
+            break;
+        }
+        case OP_ADDK:
+            emit_load(jc, RAX, instr->b);
+            emit_byte(cb, 0x05);                     // add $imm32, %eax
+            emit_u32(cb, (uint32_t)instr->c);
+            emit_store(jc, instr->a);
+            break;
+        case OP_INCK:
+            emit_byte(cb, 0x81);                     // addl $imm32, R[a]
+            emit_slot(cb, 0, instr->a);
+            emit_u32(cb, (uint32_t)instr->c);
+            break;
+        case OP_JMP:
+            emit_jump(jc, -1, instr->c);
+            break;
+        case OP_JZ:
+        case OP_JNZ:
+            if (is_constant(jc, instr->a)) {
+                if ((jc->fn->constants[instr->a] == 0) == (instr->op == OP_JZ)) {
+                    emit_jump(jc, -1, instr->c);
+                }
+                break;
+            }
+            emit_byte(cb, 0x83);                     // cmpl $0, R[a]
+            emit_slot(cb, 7, instr->a);
+            emit_byte(cb, 0);
+            emit_jump(jc, condition_code(instr->op), instr->c);
+            break;
+        case OP_JEQ:
+        case OP_JNE:
+        case OP_JLT:
+        case OP_JGT:
+        case OP_JLE:
+        case OP_JGE:
+            emit_load(jc, RAX, instr->a);
+            emit_alu(jc, ALU_CMP, instr->b);
+            emit_jump(jc, condition_code(instr->op), instr->c);
+            break;
+        case OP_CALL:
+            emit_call(jc, instr);
+            break;
+        case OP_RET:
+            emit_load(jc, RAX, instr->a);
+            emit_epilogue(jc);
+            break;
+        default:
+            break;
+    }
+}
+
+// Copies finished code into fresh pages that are never writable and
+// executable at the same time
+static JitEntry map_code(CodeBuffer* cb, size_t* mapped_size) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t size = (cb->length + page - 1) / page * page;
+    void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        return NULL;
+    }
+    memcpy(memory, cb->bytes, cb->length);
+    if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, size);
+        return NULL;
+    }
+    *mapped_size = size;
+    return (JitEntry)memory;
+}
+
+static JitEntry compile_function(Jit* jit, int index) {
+    JitCompiler jc;
+    memset(&jc, 0, sizeof(jc));
+    jc.jit = jit;
+    jc.fn = &jit->program->functions[index];
+    jc.offsets = malloc((jc.fn->code_count + 1) * sizeof(size_t));
+    // At most one jump per instruction plus one for a division check
+    jc.fixups = malloc((2 * jc.fn->code_count + 1) * sizeof(Fixup));
+
+    // push %rbp; mov %rsp, %rbp; push %rbx; sub $frame, %rsp; mov %rsp, %rbx
+    // The frame keeps %rsp 16-byte aligned.
+    uint32_t frame = ((uint32_t)jc.fn->register_count * 4 + 15) / 16 * 16 + 8;
+    static const uint8_t prologue[] = { 0x55, 0x48, 0x89, 0xE5, 0x53, 0x48, 0x81, 0xEC };
+    emit_bytes(&jc.code, prologue, sizeof(prologue));
+    emit_u32(&jc.code, frame);
+    static const uint8_t frame_base[] = { 0x48, 0x89, 0xE3 };
+    emit_bytes(&jc.code, frame_base, sizeof(frame_base));
+    for (int i = 0; i < jc.fn->param_count; i++) {
+        emit_byte(&jc.code, 0x8B);                  // mov 4*i(%rdi), %eax
+        if (i < 32) {
+            emit_byte(&jc.code, 0x47);
+            emit_byte(&jc.code, i * 4);
+        } else {
+            emit_byte(&jc.code, 0x87);
+            emit_u32(&jc.code, i * 4);
+        }
+        emit_store(&jc, jc.fn->constant_count + i);
+    }
+
+    for (int i = 0; i < jc.fn->code_count; i++) {
+        jc.offsets[i] = jc.code.length;
+        emit_instr(&jc, &jc.fn->code[i]);
+    }
+    jc.offsets[jc.fn->code_count] = jc.code.length;
+
+    // Division by zero: record the function and return
+    size_t error_exit = jc.code.length;
+    emit_byte(&jc.code, 0xB8);                      // mov $index+1, %eax
+    emit_u32(&jc.code, index + 1);
+    emit_byte(&jc.code, 0xA3);                      // movabs %eax, &status
+    emit_u64(&jc.code, (uint64_t)(uintptr_t)&jit->status);
+    size_t propagate_exit = jc.code.length;
+    emit_byte(&jc.code, 0x31);                      // xor %eax, %eax
+    emit_byte(&jc.code, 0xC0);
+    emit_epilogue(&jc);
+
+    for (int i = 0; i < jc.fixup_count; i++) {
+        int to = jc.fixups[i].target;
+        size_t target = to == JUMP_ERROR ? error_exit : to == JUMP_PROPAGATE ? propagate_exit : jc.offsets[to];
+        patch_u32(&jc.code, jc.fixups[i].position, (uint32_t)(target - (jc.fixups[i].position + 4)));
+    }
+
+    JitEntry entry = map_code(&jc.code, &jit->mapped_sizes[index]);
+    free(jc.code.bytes);
+    free(jc.offsets);
+    free(jc.fixups);
+    return entry;
+}
+
+// Returns the machine code for a function, compiling it on first use
+static JitEntry jit_entry(FluentContext* ctx, Jit* jit, int index) {
+    if (!jit->entries[index]) {
+        jit->entries[index] = compile_function(jit, index);
+        if (!jit->entries[index]) {
+            report_error(ctx, "Could not map executable memory for '%.*s'",
+                         SLICE_ARG(jit->program->functions[index].name));
+        }
+    }
+    return jit->entries[index];
+}
+
+// Called from compiled code for every Fluent call
+static int32_t jit_call(Jit* jit, int32_t index, const int32_t* args) {
+    char here;
+    if (jit->depth + 1 >= MAX_CALL_DEPTH || (uintptr_t)&here < jit->stack_limit) {
+        jit->overflowed = index;
+        jit->status = JIT_STACK_OVERFLOW;
+        return 0;
+    }
+    JitEntry entry = jit_entry(jit->ctx, jit, index);
+    if (!entry) {
+        jit->status = JIT_UNMAPPED;
+        return 0;
+    }
+    jit->depth++;
+    int32_t value = entry(args);
+    jit->depth--;
+    return value;
+}
+
+// Where the calling thread's stack ends, plus the reserve; 0 when unknown,
+// which leaves only the depth limit
+static uintptr_t native_stack_limit(void) {
+    pthread_attr_t attr;
+    void* low;
+    size_t size;
+    uintptr_t limit = 0;
+    if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+        if (pthread_attr_getstack(&attr, &low, &size) == 0 && size > 2 * JIT_STACK_RESERVE) {
+            limit = (uintptr_t)low + JIT_STACK_RESERVE;
+        }
+        pthread_attr_destroy(&attr);
+    }
+    return limit;
+}
+
+static int call_function(FluentContext* ctx, Jit* jit, int index, int32_t* result) {
+    JitEntry entry = jit_entry(ctx, jit, index);
+    if (!entry) {
+        return -1;
+    }
+    *result = entry(NULL);
+    if (jit->status > 0) {
+        report_error(ctx, "Division by zero in '%.*s'",
+                     SLICE_ARG(jit->program->functions[jit->status - 1].name));
+    } else if (jit->status == JIT_STACK_OVERFLOW) {
+        report_error(ctx, "Stack overflow in '%.*s'",
+                     SLICE_ARG(jit->program->functions[jit->overflowed].name));
+    }
+    return jit->status ? -1 : 0;
+}
+
+typedef struct {
+    Jit* jit;
+    int status;
+    int32_t value;
+} JitRun;
+
+static void* run_program(void* arg) {
+    JitRun* run = arg;
+    Jit* jit = run->jit;
+    jit->stack_limit = native_stack_limit();
+    run->status = call_function(jit->ctx, jit, jit->program->init_function, &run->value);
+    run->value = 0;
+    if (run->status == 0 && jit->program->main_function >= 0) {
+        run->status = call_function(jit->ctx, jit, jit->program->main_function, &run->value);
+    }
+    return NULL;
+}
+
+// Runs the top-level statements, then main, as native code. Returns 0 and
+// stores main's return value, or -1 after reporting an error.
+int run_jit(FluentContext* ctx, const BytecodeProgram* program, int* result) {
+    Jit jit;
+    memset(&jit, 0, sizeof(jit));
+    jit.ctx = ctx;
+    jit.program = program;
+    jit.entries = calloc(program->function_count, sizeof(JitEntry));
+    jit.mapped_sizes = calloc(program->function_count, sizeof(size_t));
+    jit.globals = calloc(program->global_count ? program->global_count : 1, sizeof(int32_t));
+
+    JitRun run = { &jit, -1, 0 };
+    if (!jit.entries || !jit.mapped_sizes || !jit.globals) {
+        report_error(ctx, "Out of memory running the program");
+    } else {
+        // Without a thread of its own the program runs on this one, and
+        // the stack check fires sooner
+        pthread_attr_t attr;
+        pthread_t thread;
+        int started = pthread_attr_init(&attr) == 0;
+        if (started) {
+            started = pthread_attr_setstacksize(&attr, JIT_STACK_SIZE) == 0 &&
+                      pthread_create(&thread, &attr, run_program, &run) == 0;
+            pthread_attr_destroy(&attr);
+        }
+        if (started) {
+            pthread_join(thread, NULL);
+        } else {
+            run_program(&run);
+        }
+    }
+    *result = run.value;
+
+    for (int i = 0; jit.entries && i < program->function_count; i++) {
+        if (jit.entries[i]) {
+            munmap((void*)jit.entries[i], jit.mapped_sizes[i]);
+        }
+    }
+    free(jit.entries);
+    free(jit.mapped_sizes);
+    free(jit.globals);
+    return run.status;
+}
+
+#else
+
+int run_jit(FluentContext* ctx, const BytecodeProgram* program, int* result) {
+    (void)program;
+    (void)result;
+    report_error(ctx, "--jit is only supported on x86-64");
+    return -1;
+}
+
+#endif
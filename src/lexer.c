@@ -2,258 +2,343 @@
 // Implementation of the Fluent language lexer
 
 #include "lexer.h"
-#include <stdlib.h>
+#include "context.h"
+#include "scan.h"
 #include <string.h>
 #include <ctype.h>
 
-static const char* src;
-static int pos = 0;
-static int line = 1;
-static int column = 1;
+void init_lexer(FluentContext* ctx, const char* source_code) {
+    Lexer* lexer = &ctx->lexer;
+    lexer->src = source_code;
+    lexer->src_length = strlen(source_code);
+    lexer->input = NULL;
+    lexer->pos = 0;
+    lexer->token_start = 0;
+    lexer->line = 1;
+    lexer->column = 1;
+    lexer->at_line_start = 1;
+    lexer->indent_levels[0] = 0;
+    lexer->indent_stack_top = 0;
+    lexer->pending_dedents = 0;
+}
 
-#define MAX_INDENT_LEVELS 100
-static int indent_levels[MAX_INDENT_LEVELS];
-static int indent_level = 0;
-static int indent_stack_top = 0;
+void init_lexer_input(FluentContext* ctx, SourceInput* source) {
+    init_lexer(ctx, "");
+    ctx->lexer.input = source;
+    ctx->lexer.src = source->data;
+    ctx->lexer.src_length = source->length;
+}
 
-void init_lexer(const char* source_code) {
-    src = source_code;
-    pos = 0;
-    line = 1;
-    column = 1;
-    indent_levels[0] = 0;
-    indent_level = 0;
-    indent_stack_top = 0;
+// Pulls the next chunk of a streamed input. The bytes of the token being
+// scanned are carried over, so token_start is rebased to the new buffer.
+static int refill(Lexer* lexer) {
+    if (!lexer->input || refill_source(lexer->input, lexer->token_start) == 0) {
+        return 0;
+    }
+    lexer->pos -= lexer->token_start;
+    lexer->token_start = 0;
+    lexer->src = lexer->input->data;
+    lexer->src_length = lexer->input->length;
+    return 1;
 }
 
-static char peek() {
-    return src[pos];
+static char peek(Lexer* lexer) {
+    if (lexer->pos >= lexer->src_length && !refill(lexer)) {
+        return '\0';
+    }
+    return lexer->src[lexer->pos];
 }
 
-static char advance() {
-    char c = src[pos++];
+static char advance(Lexer* lexer) {
+    char c = peek(lexer);
+    if (c == '\0') {
+        return c;
+    }
+    lexer->pos++;
     if (c == '\n') {
-        line++;
-        column = 1;
+        lexer->line++;
+        lexer->column = 1;
     } else {
-        column++;
+        lexer->column++;
     }
     return c;
 }
 
-static void skip_whitespace() {
-    while (peek() == ' ' || peek() == '\t') {
-        advance();
+typedef enum {
+    SCAN_SPAN,                    // Bytes equal to a or b
+    SCAN_UNTIL,                   // Bytes up to a or NUL
+    SCAN_IDENTIFIER
+} ScanKind;
+
+// Moves pos over a whole run found by the Scanner, pulling the next chunk
+// of a streamed input whenever the run reaches the end of the buffer.
+// Skipped runs move token_start along so a refill does not carry them.
+// Line and column are left to the caller. Returns the run's length.
+static size_t scan_run(Lexer* lexer, ScanKind kind, char a, char b, int skipped) {
+    size_t total = 0;
+    for (;;) {
+        const char* text = lexer->src + lexer->pos;
+        size_t length = lexer->src_length - lexer->pos;
+        size_t n = kind == SCAN_SPAN ? scanner->span(text, length, a, b)
+                 : kind == SCAN_UNTIL ? scanner->until(text, length, a)
+                 : scanner->identifier(text, length);
+        lexer->pos += n;
+        total += n;
+        if (skipped) {
+            lexer->token_start = lexer->pos;
+        }
+        if (lexer->pos < lexer->src_length || !refill(lexer)) {
+            return total;
+        }
     }
 }
 
-static void skip_comment() {
-    while (peek() != '\n' && peek() != '\0') {
-        advance();
+// Skipped bytes never end up in a token, so token_start follows pos and a
+// refill in the middle of a long comment does not carry it over.
+static void skip_whitespace(Lexer* lexer) {
+    lexer->column += (int)scan_run(lexer, SCAN_SPAN, ' ', '\t', 1);
+}
+
+static void skip_comment(Lexer* lexer) {
+    lexer->column += (int)scan_run(lexer, SCAN_UNTIL, '\n', 0, 1);
+}
+
+static Token make_token(Lexer* lexer, TokenType type, int length, int token_line, int token_column) {
+    Token token;
+    token.type = type;
+    token.text.start = &lexer->src[lexer->token_start];
+    token.text.length = length;
+    token.line = token_line;
+    token.column = token_column;
+    return token;
+}
+
+// Classifies an identifier as a keyword without copying it: the length and
+// first character select at most one candidate, which is then compared.
+TokenType lookup_keyword(const char* text, int length) {
+    switch (length) {
+        case 2:
+            if (text[0] == 'i' && text[1] == 'f') return TOKEN_IF;
+            break;
+        case 3:
+            switch (text[0]) {
+                case 'l': if (text[1] == 'e' && text[2] == 't') return TOKEN_LET; break;
+                case 'v': if (text[1] == 'a' && text[2] == 'r') return TOKEN_VAR; break;
+                case 'f': if (text[1] == 'o' && text[2] == 'r') return TOKEN_FOR; break;
+            }
+            break;
+        case 4:
+            switch (text[0]) {
+                case 'f': if (memcmp(text + 1, "unc", 3) == 0) return TOKEN_FUNC; break;
+                case 'e':
+                    if (memcmp(text + 1, "lse", 3) == 0) return TOKEN_ELSE;
+                    if (memcmp(text + 1, "lif", 3) == 0) return TOKEN_ELIF;
+                    break;
+            }
+            break;
+        case 5:
+            if (text[0] == 'w' && memcmp(text + 1, "hile", 4) == 0) return TOKEN_WHILE;
+            break;
+        case 6:
+            if (text[0] == 'r' && memcmp(text + 1, "eturn", 5) == 0) return TOKEN_RETURN;
+            break;
     }
+    return TOKEN_IDENTIFIER;
 }
 
-Token* get_next_token(void) {
-    static int at_line_start = 1;
+int slice_equals(Slice slice, const char* str) {
+    int length = (int)strlen(str);
+    return slice.length == length && memcmp(slice.start, str, length) == 0;
+}
 
-    if (peek() == '\0') {
-        // Handle remaining dedents
-        if (indent_stack_top > 0) {
-            indent_stack_top--;
-            return &(Token){TOKEN_DEDENT, strdup("<DEDENT>"), line, column};
-        }
-        return &(Token){TOKEN_EOF, strdup("<EOF>"), line, column};
+Token get_next_token(FluentContext* ctx) {
+    Lexer* lexer = &ctx->lexer;
+
+    lexer->token_start = lexer->pos;
+    if (lexer->pending_dedents > 0) {
+        lexer->pending_dedents--;
+        return make_token(lexer, TOKEN_DEDENT, 0, lexer->line, lexer->column);
     }
 
-    if (at_line_start) {
-        at_line_start = 0;
-        int spaces = 0;
-        while (peek() == ' ') {
-            advance();
-            spaces++;
+    // Blank and comment-only lines yield no tokens and do not change the
+    // indentation; they are skipped in a loop so long runs of them cost no
+    // stack
+    while (lexer->at_line_start) {
+        int spaces = (int)scan_run(lexer, SCAN_SPAN, ' ', ' ', 1);
+        lexer->column += spaces;
+        if (peek(lexer) == '#') {
+            skip_comment(lexer);
+        }
+        if (peek(lexer) == '\n') {
+            advance(lexer);
+            lexer->token_start = lexer->pos;
+            continue;
         }
-        if (peek() == '\n' || peek() == '\0') {
-            // Empty line
-            return get_next_token();
+        lexer->at_line_start = 0;
+        if (peek(lexer) == '\0') {
+            break;
         }
-        if (spaces > indent_levels[indent_stack_top]) {
-            indent_stack_top++;
-            if (indent_stack_top >= MAX_INDENT_LEVELS) {
-                fprintf(stderr, "Too many indentation levels\n");
-                exit(1);
+        if (spaces > lexer->indent_levels[lexer->indent_stack_top]) {
+            lexer->indent_stack_top++;
+            if (lexer->indent_stack_top >= MAX_INDENT_LEVELS) {
+                lexer->indent_stack_top--;
+                report_error(ctx, "Too many indentation levels");
+                return make_token(lexer, TOKEN_UNKNOWN, 0, lexer->line, lexer->column);
             }
-            indent_levels[indent_stack_top] = spaces;
-            return &(Token){TOKEN_INDENT, strdup("<INDENT>"), line, column};
-        } else {
-            while (spaces < indent_levels[indent_stack_top]) {
-                indent_stack_top--;
-                return &(Token){TOKEN_DEDENT, strdup("<DEDENT>"), line, column};
+            lexer->indent_levels[lexer->indent_stack_top] = spaces;
+            return make_token(lexer, TOKEN_INDENT, 0, lexer->line, lexer->column);
+        } else if (spaces < lexer->indent_levels[lexer->indent_stack_top]) {
+            // Closing several blocks at once yields one DEDENT per level
+            while (lexer->indent_stack_top > 0 && spaces < lexer->indent_levels[lexer->indent_stack_top]) {
+                lexer->indent_stack_top--;
+                lexer->pending_dedents++;
             }
+            lexer->pending_dedents--;
+            return make_token(lexer, TOKEN_DEDENT, 0, lexer->line, lexer->column);
         }
     }
 
-    skip_whitespace();
+    skip_whitespace(lexer);
+    if (peek(lexer) == '#') {
+        skip_comment(lexer);
+    }
 
-    char c = peek();
+    lexer->token_start = lexer->pos;
+    char c = peek(lexer);
 
-    if (c == '\n') {
-        advance();
-        at_line_start = 1;
-        return &(Token){TOKEN_NEWLINE, strdup("<NEWLINE>"), line - 1, column};
+    if (c == '\0') {
+        // Handle remaining dedents
+        if (lexer->indent_stack_top > 0) {
+            lexer->indent_stack_top--;
+            return make_token(lexer, TOKEN_DEDENT, 0, lexer->line, lexer->column);
+        }
+        return make_token(lexer, TOKEN_EOF, 0, lexer->line, lexer->column);
     }
 
-    if (c == '#') {
-        advance();
-        skip_comment();
-        return get_next_token();
+    if (c == '\n') {
+        advance(lexer);
+        lexer->at_line_start = 1;
+        return make_token(lexer, TOKEN_NEWLINE, 0, lexer->line - 1, lexer->column);
     }
 
     if (isalpha(c) || c == '_') {
         // Handle identifiers and keywords
-        int start_pos = pos;
-        int start_column = column;
-        while (isalnum(peek()) || peek() == '_') {
-            advance();
-        }
-        int length = pos - start_pos;
-        char* text = strndup(&src[start_pos], length);
-
-        TokenType type = TOKEN_IDENTIFIER;
-        if (strcmp(text, "func") == 0) type = TOKEN_FUNC;
-        else if (strcmp(text, "let") == 0) type = TOKEN_LET;
-        else if (strcmp(text, "var") == 0) type = TOKEN_VAR;
-        else if (strcmp(text, "if") == 0) type = TOKEN_IF;
-        else if (strcmp(text, "else") == 0) type = TOKEN_ELSE;
-        else if (strcmp(text, "elif") == 0) type = TOKEN_ELIF;
-        else if (strcmp(text, "for") == 0) type = TOKEN_FOR;
-        else if (strcmp(text, "while") == 0) type = TOKEN_WHILE;
-        else if (strcmp(text, "return") == 0) type = TOKEN_RETURN;
+        int start_column = lexer->column;
+        lexer->column += (int)scan_run(lexer, SCAN_IDENTIFIER, 0, 0, 0);
+        Token token = make_token(lexer, TOKEN_IDENTIFIER, lexer->pos - lexer->token_start, lexer->line, start_column);
 
-        Token* token = malloc(sizeof(Token));
-        token->type = type;
-        token->value = text;
-        token->line = line;
-        token->column = start_column;
+        token.type = lookup_keyword(token.text.start, token.text.length);
         return token;
     }
 
     // Handle numbers
     if (isdigit(c)) {
-        int start_pos = pos;
-        int start_column = column;
-        while (isdigit(peek())) {
-            advance();
+        int start_column = lexer->column;
+        while (isdigit(peek(lexer))) {
+            advance(lexer);
         }
         // Handle decimal point
-        if (peek() == '.') {
-            advance();
-            while (isdigit(peek())) {
-                advance();
+        if (peek(lexer) == '.') {
+            advance(lexer);
+            while (isdigit(peek(lexer))) {
+                advance(lexer);
             }
         }
-        int length = pos - start_pos;
-        char* text = strndup(&src[start_pos], length);
-
-        Token* token = malloc(sizeof(Token));
-        token->type = TOKEN_NUMBER;
-        token->value = text;
-        token->line = line;
-        token->column = start_column;
-        return token;
+        return make_token(lexer, TOKEN_NUMBER, lexer->pos - lexer->token_start, lexer->line, start_column);
     }
 
     // Handle strings
     if (c == '"' || c == '\'') {
-        char quote = advance(); // Consume the opening quote
-        int start_pos = pos;
-        int start_column = column;
-        while (peek() != quote && peek() != '\0') {
-            advance();
+        char quote = advance(lexer); // Consume the opening quote
+        lexer->token_start = lexer->pos;
+        int start_column = lexer->column;
+        scan_run(lexer, SCAN_UNTIL, quote, 0, 0);
+        // Strings may span lines; fix up line and column from the last newline
+        const char* text = lexer->src + lexer->token_start;
+        size_t length = lexer->pos - lexer->token_start;
+        const char* last_newline = NULL;
+        for (const char* p = text; (p = memchr(p, '\n', text + length - p)); p++) {
+            lexer->line++;
+            last_newline = p;
         }
-        if (peek() == '\0') {
-            fprintf(stderr, "Unterminated string at line %d, column %d\n", line, column);
-            exit(1);
+        lexer->column = last_newline ? (int)(text + length - last_newline) : lexer->column + (int)length;
+        if (peek(lexer) == '\0') {
+            report_error(ctx, "Unterminated string at line %d, column %d", lexer->line, lexer->column);
+            return make_token(lexer, TOKEN_UNKNOWN, 0, lexer->line, start_column);
         }
-        advance(); // Consume closing quote
-        int length = pos - start_pos - 1;
-        char* text = strndup(&src[start_pos], length);
-
-        Token* token = malloc(sizeof(Token));
-        token->type = TOKEN_STRING;
-        token->value = text;
-        token->line = line;
-        token->column = start_column;
-        return token;
+        advance(lexer); // Consume closing quote
+        // The slice excludes both quotes
+        return make_token(lexer, TOKEN_STRING, lexer->pos - lexer->token_start - 1, lexer->line, start_column);
     }
 
     // Handle operators and punctuation
+    int start_column = lexer->column;
     switch (c) {
         case '+':
-            advance();
-            return &(Token){TOKEN_PLUS, strdup("+"), line, column - 1};
+            advance(lexer);
+            return make_token(lexer, TOKEN_PLUS, 1, lexer->line, start_column);
         case '-':
-            advance();
-            return &(Token){TOKEN_MINUS, strdup("-"), line, column - 1};
+            advance(lexer);
+            if (peek(lexer) == '>') {
+                advance(lexer);
+                return make_token(lexer, TOKEN_ARROW, 2, lexer->line, start_column);
+            } else {
+                return make_token(lexer, TOKEN_MINUS, 1, lexer->line, start_column);
+            }
         case '*':
-            advance();
-            return &(Token){TOKEN_ASTERISK, strdup("*"), line, column - 1};
+            advance(lexer);
+            return make_token(lexer, TOKEN_ASTERISK, 1, lexer->line, start_column);
         case '/':
-            advance();
-            return &(Token){TOKEN_SLASH, strdup("/"), line, column - 1};
+            advance(lexer);
+            return make_token(lexer, TOKEN_SLASH, 1, lexer->line, start_column);
         case '(':
-            advance();
-            return &(Token){TOKEN_LPAREN, strdup("("), line, column - 1};
+            advance(lexer);
+            return make_token(lexer, TOKEN_LPAREN, 1, lexer->line, start_column);
         case ')':
-            advance();
-            return &(Token){TOKEN_RPAREN, strdup(")"), line, column - 1};
+            advance(lexer);
+            return make_token(lexer, TOKEN_RPAREN, 1, lexer->line, start_column);
         case ':':
-            advance();
-            return &(Token){TOKEN_COLON, strdup(":"), line, column - 1};
+            advance(lexer);
+            return make_token(lexer, TOKEN_COLON, 1, lexer->line, start_column);
         case ',':
-            advance();
-            return &(Token){TOKEN_COMMA, strdup(","), line, column - 1};
+            advance(lexer);
+            return make_token(lexer, TOKEN_COMMA, 1, lexer->line, start_column);
         case '=':
-            advance();
-            if (peek() == '=') {
-                advance();
-                return &(Token){TOKEN_EQUAL, strdup("=="), line, column - 2};
+            advance(lexer);
+            if (peek(lexer) == '=') {
+                advance(lexer);
+                return make_token(lexer, TOKEN_EQUAL, 2, lexer->line, start_column);
             } else {
-                return &(Token){TOKEN_ASSIGN, strdup("="), line, column - 1};
+                return make_token(lexer, TOKEN_ASSIGN, 1, lexer->line, start_column);
             }
         case '!':
-            advance();
-            if (peek() == '=') {
-                advance();
-                return &(Token){TOKEN_NOT_EQUAL, strdup("!="), line, column - 2};
+            advance(lexer);
+            if (peek(lexer) == '=') {
+                advance(lexer);
+                return make_token(lexer, TOKEN_NOT_EQUAL, 2, lexer->line, start_column);
             } else {
-                fprintf(stderr, "Unexpected character '!' at line %d, column %d\n", line, column);
-                exit(1);
+                report_error(ctx, "Unexpected character '!' at line %d, column %d", lexer->line, lexer->column);
+                return make_token(lexer, TOKEN_UNKNOWN, 1, lexer->line, start_column);
             }
         case '<':
-            advance();
-            if (peek() == '=') {
-                advance();
-                return &(Token){TOKEN_LESS_EQUAL, strdup("<="), line, column - 2};
+            advance(lexer);
+            if (peek(lexer) == '=') {
+                advance(lexer);
+                return make_token(lexer, TOKEN_LESS_EQUAL, 2, lexer->line, start_column);
             } else {
-                return &(Token){TOKEN_LESS, strdup("<"), line, column - 1};
+                return make_token(lexer, TOKEN_LESS, 1, lexer->line, start_column);
             }
         case '>':
-            advance();
-            if (peek() == '=') {
-                advance();
-                return &(Token){TOKEN_GREATER_EQUAL, strdup(">="), line, column - 2};
+            advance(lexer);
+            if (peek(lexer) == '=') {
+                advance(lexer);
+                return make_token(lexer, TOKEN_GREATER_EQUAL, 2, lexer->line, start_column);
             } else {
-                return &(Token){TOKEN_GREATER, strdup(">"), line, column - 1};
+                return make_token(lexer, TOKEN_GREATER, 1, lexer->line, start_column);
             }
         default:
-            fprintf(stderr, "Unknown character '%c' at line %d, column %d\n", c, line, column);
-            exit(1);
-    }
-}
-
-void free_token(Token* token) {
-    if (token) {
-        free(token->value);
-        free(token);
+            report_error(ctx, "Unknown character '%c' at line %d, column %d", c, lexer->line, lexer->column);
+            advance(lexer);
+            return make_token(lexer, TOKEN_UNKNOWN, 1, lexer->line, start_column);
     }
 }
@@ -0,0 +1,729 @@
+// lower.c
+// Lowering of the Fluent AST into SSA form
+//
+// Variables are renamed into SSA values while the AST is walked, using the
+// on-the-fly construction of Braun et al.: each block records the current
+// value of every variable it defines, reads walk up the predecessors, and
+// blocks whose predecessors are not all known yet (loop headers) get
+// placeholder phis that are completed when the block is sealed. Variables
+// are the local slots resolve_program gave each symbol. Every value carries
+// the type resolution inferred for its expression, and a phi the type of
+// the variable it merges.
+//
+// At -O2, calls to small functions are inlined while they are lowered: the
+// callee's body is lowered in place with its parameters bound to the
+// argument values, its locals renamed past the caller's, and its returns
+// turned into jumps to a block where the result meets in a phi. Whether a
+// callee is small is decided by inline_cost, which estimates the number of
+// IR instructions its body lowers to.
+
+#include "ir.h"
+#include "profile.h"
+#include <string.h>
+#include <setjmp.h>
+
+#define MAX_INLINE_DEPTH 8
+// A function may grow by this many times the threshold through inlining
+#define INLINE_BUDGET_FACTOR 10
+
+typedef struct {
+    long long key;                // block << 32 | variable
+    int value;
+} DefEntry;
+
+typedef struct {
+    int block;
+    int variable;
+    int phi;
+} IncompletePhi;
+
+typedef struct {
+    int cost;                     // -1 until computed
+    int locals;                   // Parameters and locals of its body
+} InlineSummary;
+
+typedef struct {
+    FluentContext* ctx;
+    Arena* arena;
+    IRModule* module;
+    IRFunction* fn;
+    IRBlock* block;               // Where new instructions go
+    int undef;                    // Value read from variables with no definition
+    int in_global_init;
+    NodeId self;                  // Function being lowered; NO_NODE for the initializer
+    ValueType return_type;
+
+    // Inlining
+    int variable_base;            // Added to local slots; nonzero in an inlined body
+    int next_variable;            // First variable no inlined body has taken
+    IRBlock* return_block;        // Where an inlined body's returns jump
+    int return_variable;          // Holds its result on the way there
+    int inlining[MAX_INLINE_DEPTH]; // Callees whose bodies are being lowered
+    int inline_depth;
+    int inlined_cost;
+    InlineSummary* summaries;     // Indexed by function, allocated on first use
+
+    uint8_t* variable_types;      // Indexed by variable; i32 until first written
+    int variable_type_capacity;
+
+    DefEntry* defs;               // Open-addressed (block, variable) -> value
+    int def_count;
+    int def_capacity;
+
+    IncompletePhi* incomplete;
+    int incomplete_count;
+    int incomplete_capacity;
+} Lowering;
+
+static int lower_expression(Lowering* lw, NodeId id);
+static int lower_call(Lowering* lw, NodeId id);
+static void lower_block(Lowering* lw, NodeId block);
+static void lower_statements(Lowering* lw, NodeId stmt, int top_level);
+
+static ASTNode* node_at(Lowering* lw, NodeId id) {
+    return ast_node(&lw->ctx->ast, id);
+}
+
+static Symbol* symbol_of(Lowering* lw, SymbolId id) {
+    return symbol_at(&lw->ctx->symbols, id);
+}
+
+static __attribute__((noreturn)) void lower_error(Lowering* lw, const char* format, Slice name) {
+    report_error(lw->ctx, format, SLICE_ARG(name));
+    longjmp(lw->ctx->error_jmp, 1);
+}
+
+// Scratch arrays come from the arena too, so an error that unwinds out of
+// the lowering leaks nothing
+static void* grow(Lowering* lw, void* items, int count, int* capacity, size_t size) {
+    if (count < *capacity) {
+        return items;
+    }
+    *capacity = *capacity ? *capacity * 2 : 16;
+    void* bigger = arena_alloc(lw->arena, *capacity * size);
+    if (count) {
+        memcpy(bigger, items, count * size);
+    }
+    return bigger;
+}
+
+// Definitions table
+
+static unsigned long long hash_key(long long key) {
+    unsigned long long h = (unsigned long long)key * 0x9E3779B97F4A7C15ull;
+    return h ^ (h >> 29);
+}
+
+static void write_variable(Lowering* lw, int variable, int block, int value);
+
+static void grow_defs(Lowering* lw) {
+    DefEntry* old = lw->defs;
+    int old_capacity = lw->def_capacity;
+    lw->def_capacity = old_capacity ? old_capacity * 2 : 256;
+    lw->defs = arena_alloc(lw->arena, lw->def_capacity * sizeof(DefEntry));
+    for (int i = 0; i < lw->def_capacity; i++) {
+        lw->defs[i].key = -1;
+    }
+    lw->def_count = 0;
+    for (int i = 0; i < old_capacity; i++) {
+        if (old[i].key >= 0) {
+            write_variable(lw, (int)(old[i].key & 0xffffffff), (int)(old[i].key >> 32), old[i].value);
+        }
+    }
+}
+
+static void set_variable_type(Lowering* lw, int variable, ValueType type) {
+    if (variable >= lw->variable_type_capacity) {
+        int old_capacity = lw->variable_type_capacity;
+        int capacity = old_capacity ? old_capacity : 64;
+        while (capacity <= variable) {
+            capacity *= 2;
+        }
+        uint8_t* types = arena_alloc(lw->arena, capacity);
+        if (old_capacity) {
+            memcpy(types, lw->variable_types, old_capacity);
+        }
+        memset(types + old_capacity, TYPE_I32, capacity - old_capacity);
+        lw->variable_types = types;
+        lw->variable_type_capacity = capacity;
+    }
+    lw->variable_types[variable] = type;
+}
+
+static ValueType variable_type(Lowering* lw, int variable) {
+    return variable < lw->variable_type_capacity ? (ValueType)lw->variable_types[variable] : TYPE_I32;
+}
+
+static void write_variable(Lowering* lw, int variable, int block, int value) {
+    set_variable_type(lw, variable, (ValueType)lw->fn->values[value]->type);
+    if (lw->def_count * 2 >= lw->def_capacity) {
+        grow_defs(lw);
+    }
+    long long key = ((long long)block << 32) | (unsigned int)variable;
+    unsigned long long mask = lw->def_capacity - 1;
+    unsigned long long i = hash_key(key) & mask;
+    while (lw->defs[i].key >= 0 && lw->defs[i].key != key) {
+        i = (i + 1) & mask;
+    }
+    if (lw->defs[i].key < 0) {
+        lw->defs[i].key = key;
+        lw->def_count++;
+    }
+    lw->defs[i].value = value;
+}
+
+static int find_definition(Lowering* lw, int variable, int block) {
+    if (lw->def_capacity == 0) {
+        return -1;
+    }
+    long long key = ((long long)block << 32) | (unsigned int)variable;
+    unsigned long long mask = lw->def_capacity - 1;
+    unsigned long long i = hash_key(key) & mask;
+    while (lw->defs[i].key >= 0) {
+        if (lw->defs[i].key == key) {
+            return lw->defs[i].value;
+        }
+        i = (i + 1) & mask;
+    }
+    return -1;
+}
+
+// SSA construction
+
+static int read_variable(Lowering* lw, int variable, IRBlock* block);
+
+// A phi whose operands are all the same value (or itself) is just a copy
+static int remove_trivial_phi(Lowering* lw, IRInstr* phi) {
+    IRBlock* block = lw->fn->blocks[phi->block];
+    int same = -1;
+    for (int i = 0; i < block->pred_count; i++) {
+        int arg = phi->phi_args[i];
+        if (arg == same || arg == phi->id) {
+            continue;
+        }
+        if (same >= 0) {
+            return phi->id;
+        }
+        same = arg;
+    }
+    phi->op = IR_COPY;
+    phi->args[0] = same >= 0 ? same : lw->undef;
+    phi->phi_args = NULL;
+    return phi->id;
+}
+
+static int add_phi_operands(Lowering* lw, int variable, IRInstr* phi) {
+    IRBlock* block = lw->fn->blocks[phi->block];
+    phi->phi_args = arena_alloc(lw->arena, (block->pred_count ? block->pred_count : 1) * sizeof(int));
+    for (int i = 0; i < block->pred_count; i++) {
+        phi->phi_args[i] = read_variable(lw, variable, lw->fn->blocks[block->preds[i]]);
+    }
+    return remove_trivial_phi(lw, phi);
+}
+
+static int read_variable(Lowering* lw, int variable, IRBlock* block) {
+    int value = find_definition(lw, variable, block->id);
+    if (value >= 0) {
+        return value;
+    }
+
+    if (!block->sealed) {
+        IRInstr* phi = append_ir_phi(lw->arena, lw->fn, block);
+        phi->type = variable_type(lw, variable);
+        lw->incomplete = grow(lw, lw->incomplete, lw->incomplete_count, &lw->incomplete_capacity, sizeof(IncompletePhi));
+        lw->incomplete[lw->incomplete_count++] = (IncompletePhi){ block->id, variable, phi->id };
+        value = phi->id;
+    } else if (block->pred_count == 0) {
+        value = lw->undef;
+    } else if (block->pred_count == 1) {
+        value = read_variable(lw, variable, lw->fn->blocks[block->preds[0]]);
+    } else {
+        // Record the phi first so that cycles through loops terminate
+        IRInstr* phi = append_ir_phi(lw->arena, lw->fn, block);
+        phi->type = variable_type(lw, variable);
+        write_variable(lw, variable, block->id, phi->id);
+        value = add_phi_operands(lw, variable, phi);
+    }
+    write_variable(lw, variable, block->id, value);
+    return value;
+}
+
+static void seal_block(Lowering* lw, IRBlock* block) {
+    int kept = 0;
+    for (int i = 0; i < lw->incomplete_count; i++) {
+        IncompletePhi entry = lw->incomplete[i];
+        if (entry.block == block->id) {
+            add_phi_operands(lw, entry.variable, lw->fn->values[entry.phi]);
+        } else {
+            lw->incomplete[kept++] = entry;
+        }
+    }
+    lw->incomplete_count = kept;
+    block->sealed = 1;
+}
+
+// Block and edge helpers
+
+static IRBlock* new_block(Lowering* lw) {
+    return create_ir_block(lw->arena, lw->fn);
+}
+
+static void jump_to(Lowering* lw, IRBlock* target) {
+    IRInstr* jump = append_ir_instr(lw->arena, lw->fn, lw->block, IR_JUMP);
+    jump->targets[0] = target->id;
+    add_ir_pred(lw->arena, target, lw->block->id);
+}
+
+static void branch_to(Lowering* lw, int condition, IRBlock* if_true, IRBlock* if_false) {
+    IRInstr* branch = append_ir_instr(lw->arena, lw->fn, lw->block, IR_BRANCH);
+    branch->args[0] = condition;
+    branch->targets[0] = if_true->id;
+    branch->targets[1] = if_false->id;
+    add_ir_pred(lw->arena, if_true, lw->block->id);
+    add_ir_pred(lw->arena, if_false, lw->block->id);
+}
+
+// Expressions
+
+static IROpcode binary_opcode(TokenType op) {
+    switch (op) {
+        case TOKEN_PLUS: return IR_ADD;
+        case TOKEN_MINUS: return IR_SUB;
+        case TOKEN_ASTERISK: return IR_MUL;
+        case TOKEN_SLASH: return IR_DIV;
+        case TOKEN_EQUAL: return IR_EQ;
+        case TOKEN_NOT_EQUAL: return IR_NE;
+        case TOKEN_LESS: return IR_LT;
+        case TOKEN_GREATER: return IR_GT;
+        case TOKEN_LESS_EQUAL: return IR_LE;
+        case TOKEN_GREATER_EQUAL: return IR_GE;
+        default: return IR_NOP;
+    }
+}
+
+// Resolution has checked that the literal fits its type
+static int lower_number(Lowering* lw, NodeId id) {
+    const ASTNode* node = node_at(lw, id);
+    NumericValue value = { 0 };
+    literal_value(node->value, (ValueType)node->value_type, &value);
+    IRInstr* instr = append_ir_instr(lw->arena, lw->fn, lw->block, IR_CONST);
+    instr->type = node->value_type;
+    if (type_is_float((ValueType)node->value_type)) {
+        instr->fimm = value.f;
+    } else {
+        instr->imm = value.i;
+    }
+    return instr->id;
+}
+
+// What falling off the end of a function returns
+static int zero_value(Lowering* lw, ValueType type) {
+    if (type == TYPE_I32) {
+        return lw->undef;
+    }
+    IRInstr* zero = append_ir_instr(lw->arena, lw->fn, lw->block, IR_CONST);
+    zero->type = type;
+    if (type_is_float(type)) {
+        zero->fimm = 0.0;
+    }
+    return zero->id;
+}
+
+static int lower_expression(Lowering* lw, NodeId id) {
+    ASTNode* node = node_at(lw, id);
+    switch (node->type) {
+        case AST_NUMBER:
+            return lower_number(lw, id);
+        case AST_IDENTIFIER: {
+            Symbol* symbol = symbol_of(lw, node->ident.symbol);
+            if (symbol->kind == SYMBOL_GLOBAL) {
+                IRInstr* load = append_ir_instr(lw->arena, lw->fn, lw->block, IR_LOAD_GLOBAL);
+                load->global = symbol->slot;
+                load->type = node->value_type;
+                return load->id;
+            }
+            return read_variable(lw, lw->variable_base + symbol->slot, lw->block);
+        }
+        case AST_CALL:
+            return lower_call(lw, id);
+        case AST_BIN_OP: {
+            int left = lower_expression(lw, node->binary.left);
+            int right = lower_expression(lw, node->binary.right);
+            IRInstr* instr = append_ir_instr(lw->arena, lw->fn, lw->block, binary_opcode(node->op));
+            instr->type = node->value_type;
+            instr->args[0] = left;
+            instr->args[1] = right;
+            return instr->id;
+        }
+        case AST_CAST: {
+            int value = lower_expression(lw, node->cast.expr);
+            if (lw->fn->values[value]->type == node->value_type) {
+                return value;
+            }
+            IRInstr* instr = append_ir_instr(lw->arena, lw->fn, lw->block, IR_CONVERT);
+            instr->type = node->value_type;
+            instr->args[0] = value;
+            return instr->id;
+        }
+        default:
+            // The parser builds no other expression nodes
+            return lw->undef;
+    }
+}
+
+// Calls and inlining
+
+int inlining_enabled(const FluentContext* ctx) {
+    return ctx->opt_level >= 2 && ctx->inline_threshold > 0;
+}
+
+// Estimated IR instructions for the subtree at id and the rest of its list.
+// Names and literals are free: locals become SSA values and constants
+// immediates. Raises *locals past every local slot declared inside.
+static int inline_cost(Lowering* lw, NodeId id, int* locals) {
+    int cost = 0;
+    for (; id; id = node_at(lw, id)->next) {
+        ASTNode* node = node_at(lw, id);
+        switch (node->type) {
+            case AST_NUMBER:
+                break;
+            case AST_IDENTIFIER:
+                cost += symbol_of(lw, node->ident.symbol)->kind == SYMBOL_GLOBAL;
+                break;
+            case AST_VAR_DECL:
+            case AST_ASSIGNMENT:
+            case AST_PARAM: {
+                Symbol* symbol = symbol_of(lw, node->decl.symbol);
+                if (symbol->kind == SYMBOL_GLOBAL) {
+                    cost++;
+                } else if ((int)symbol->slot >= *locals) {
+                    *locals = symbol->slot + 1;
+                }
+                break;
+            }
+            case AST_CALL:
+                // The call and moving each argument into place
+                cost += 1 + ast_list_length(&lw->ctx->ast, node->call.args);
+                break;
+            case AST_WHILE_STMT:
+                cost += 2;
+                break;
+            default:
+                cost += node->type == AST_BIN_OP || node->type == AST_CAST || node->type == AST_IF_STMT ||
+                        node->type == AST_RETURN_STMT;
+                break;
+        }
+        NodeId children[3];
+        int count = ast_children(node, children);
+        for (int i = 0; i < count; i++) {
+            cost += inline_cost(lw, children[i], locals);
+        }
+    }
+    return cost;
+}
+
+static InlineSummary* inline_summary(Lowering* lw, int callee) {
+    if (!lw->summaries) {
+        int count = lw->module->function_count;
+        lw->summaries = arena_alloc(lw->arena, count * sizeof(InlineSummary));
+        for (int i = 0; i < count; i++) {
+            lw->summaries[i] = (InlineSummary){ -1, 0 };
+        }
+    }
+    InlineSummary* summary = &lw->summaries[callee];
+    if (summary->cost < 0) {
+        const ASTNode* decl = node_at(lw, lw->module->functions[callee].decl);
+        int locals = 0;
+        int cost = inline_cost(lw, decl->func.params, &locals);
+        cost += inline_cost(lw, decl->func.body, &locals);
+        *summary = (InlineSummary){ cost, locals };
+    }
+    return summary;
+}
+
+// Recursion is never inlined, so each body is lowered at most once per
+// level; the budget keeps chains of small calls from multiplying
+static int should_inline(Lowering* lw, int callee) {
+    FluentContext* ctx = lw->ctx;
+    if (!inlining_enabled(ctx) || lw->module->functions[callee].decl == NO_NODE ||
+        lw->module->functions[callee].decl == lw->self || lw->inline_depth == MAX_INLINE_DEPTH) {
+        return 0;
+    }
+    for (int i = 0; i < lw->inline_depth; i++) {
+        if (lw->inlining[i] == callee) {
+            return 0;
+        }
+    }
+    int cost = inline_summary(lw, callee)->cost;
+    return cost <= ctx->inline_threshold &&
+           lw->inlined_cost + cost <= INLINE_BUDGET_FACTOR * ctx->inline_threshold;
+}
+
+static int inline_call(Lowering* lw, int callee, const int* args) {
+    InlineSummary* summary = inline_summary(lw, callee);
+    const ASTNode* decl = node_at(lw, lw->module->functions[callee].decl);
+    NodeId params = decl->func.params;
+    NodeId body = decl->func.body;
+
+    int saved_base = lw->variable_base;
+    IRBlock* saved_return_block = lw->return_block;
+    int saved_return_variable = lw->return_variable;
+
+    // Local slots are below the symbol count, so the caller's never reach
+    // the variables handed out here
+    if (lw->next_variable == 0) {
+        lw->next_variable = (int)lw->ctx->symbols.count;
+    }
+    lw->variable_base = lw->next_variable;
+    lw->return_variable = lw->variable_base + summary->locals;
+    lw->next_variable = lw->return_variable + 1;
+    int index = 0;
+    for (NodeId param = params; param; param = node_at(lw, param)->next) {
+        Symbol* symbol = symbol_of(lw, node_at(lw, param)->decl.symbol);
+        write_variable(lw, lw->variable_base + symbol->slot, lw->block->id, args[index++]);
+    }
+
+    IRBlock* return_block = new_block(lw);
+    lw->return_block = return_block;
+    lw->inlining[lw->inline_depth++] = callee;
+    lw->inlined_cost += summary->cost;
+    lower_block(lw, body);
+
+    // Falling off the end returns 0
+    write_variable(lw, lw->return_variable, lw->block->id, zero_value(lw, (ValueType)decl->value_type));
+    jump_to(lw, return_block);
+    seal_block(lw, return_block);
+    lw->block = return_block;
+    int result = read_variable(lw, lw->return_variable, return_block);
+
+    lw->inline_depth--;
+    lw->variable_base = saved_base;
+    lw->return_block = saved_return_block;
+    lw->return_variable = saved_return_variable;
+    return result;
+}
+
+static int lower_call(Lowering* lw, NodeId id) {
+    int callee = symbol_of(lw, node_at(lw, id)->call.symbol)->slot;
+    int count = ast_list_length(&lw->ctx->ast, node_at(lw, id)->call.args);
+    int* args = arena_alloc(lw->arena, (count ? count : 1) * sizeof(int));
+    int index = 0;
+    for (NodeId arg = node_at(lw, id)->call.args; arg; arg = node_at(lw, arg)->next) {
+        args[index++] = lower_expression(lw, arg);
+    }
+
+    if (should_inline(lw, callee)) {
+        return inline_call(lw, callee, args);
+    }
+    IRInstr* call = append_ir_call(lw->arena, lw->fn, lw->block, callee, count);
+    call->type = node_at(lw, id)->value_type;
+    memcpy(call->args, args, count * sizeof(int));
+    return call->id;
+}
+
+// Statements
+
+static void lower_block(Lowering* lw, NodeId block) {
+    lower_statements(lw, node_at(lw, block)->block.statements, 0);
+}
+
+static void lower_statement(Lowering* lw, NodeId id) {
+    ASTNode* node = node_at(lw, id);
+    switch (node->type) {
+        case AST_VAR_DECL:
+        case AST_ASSIGNMENT: {
+            // A top-level declaration stores to the global collect_globals made
+            int value = lower_expression(lw, node->decl.expr);
+            Symbol* symbol = symbol_of(lw, node->decl.symbol);
+            if (symbol->kind == SYMBOL_GLOBAL) {
+                IRInstr* store = append_ir_instr(lw->arena, lw->fn, lw->block, IR_STORE_GLOBAL);
+                store->args[0] = value;
+                store->global = symbol->slot;
+            } else {
+                write_variable(lw, lw->variable_base + symbol->slot, lw->block->id, value);
+            }
+            break;
+        }
+        case AST_RETURN_STMT: {
+            int value = lower_expression(lw, node->ret.expr);
+            if (lw->return_block) {
+                write_variable(lw, lw->return_variable, lw->block->id, value);
+                jump_to(lw, lw->return_block);
+            } else {
+                IRInstr* ret = append_ir_instr(lw->arena, lw->fn, lw->block, IR_RETURN);
+                ret->args[0] = value;
+            }
+            // Anything after the return lands in an unreachable block
+            lw->block = new_block(lw);
+            lw->block->sealed = 1;
+            break;
+        }
+        case AST_IF_STMT: {
+            int condition = lower_expression(lw, node->if_stmt.condition);
+            IRBlock* then_block = new_block(lw);
+            IRBlock* else_block = node->if_stmt.else_branch ? new_block(lw) : NULL;
+            IRBlock* merge_block = new_block(lw);
+            branch_to(lw, condition, then_block, else_block ? else_block : merge_block);
+            seal_block(lw, then_block);
+
+            lw->block = then_block;
+            lower_block(lw, node->if_stmt.then_branch);
+            jump_to(lw, merge_block);
+
+            if (else_block) {
+                seal_block(lw, else_block);
+                lw->block = else_block;
+                lower_block(lw, node->if_stmt.else_branch);
+                jump_to(lw, merge_block);
+            }
+
+            seal_block(lw, merge_block);
+            lw->block = merge_block;
+            break;
+        }
+        case AST_WHILE_STMT: {
+            IRBlock* header = new_block(lw);
+            IRBlock* body = new_block(lw);
+            IRBlock* exit_block = new_block(lw);
+            jump_to(lw, header);
+
+            // The header stays unsealed until the back edge exists
+            lw->block = header;
+            int condition = lower_expression(lw, node->loop.condition);
+            branch_to(lw, condition, body, exit_block);
+            seal_block(lw, body);
+            seal_block(lw, exit_block);
+
+            lw->block = body;
+            lower_block(lw, node->loop.body);
+            jump_to(lw, header);
+            seal_block(lw, header);
+
+            lw->block = exit_block;
+            break;
+        }
+        case AST_FUNC_DECL:
+            lower_error(lw, "Nested function '%.*s' is not supported", node->func.name);
+        case AST_BIN_OP:
+        case AST_NUMBER:
+        case AST_IDENTIFIER:
+        case AST_CALL:
+        case AST_CAST:
+            // Evaluated for its effects; dead-code elimination drops the rest
+            lower_expression(lw, id);
+            break;
+        default:
+            break;
+    }
+}
+
+static void lower_statements(Lowering* lw, NodeId stmt, int top_level) {
+    for (; stmt; stmt = node_at(lw, stmt)->next) {
+        if (top_level && node_at(lw, stmt)->type == AST_FUNC_DECL) {
+            continue;
+        }
+        lower_statement(lw, stmt);
+    }
+}
+
+static void begin_function(Lowering* lw, FluentContext* ctx, IRModule* module, Slice name) {
+    memset(lw, 0, sizeof(Lowering));
+    lw->ctx = ctx;
+    lw->arena = &ctx->arena;
+    lw->module = module;
+    lw->fn = create_ir_function(lw->arena, name);
+    lw->return_type = TYPE_I32;
+    lw->block = new_block(lw);
+    lw->block->sealed = 1;
+
+    IRInstr* undef = append_ir_instr(lw->arena, lw->fn, lw->block, IR_CONST);
+    undef->imm = 0;
+    lw->undef = undef->id;
+}
+
+static IRFunction* end_function(Lowering* lw) {
+    // Falling off the end returns 0
+    if (!ir_terminator(lw->fn, lw->block)) {
+        int zero = zero_value(lw, lw->return_type);
+        IRInstr* ret = append_ir_instr(lw->arena, lw->fn, lw->block, IR_RETURN);
+        ret->args[0] = zero;
+    }
+    return lw->fn;
+}
+
+static void add_callee(FluentContext* ctx, IRModule* module, const ASTNode* stmt, NodeId id) {
+    if (module->function_count == module->function_capacity) {
+        int capacity = module->function_capacity ? module->function_capacity * 2 : 16;
+        IRCallee* functions = arena_alloc(&ctx->arena, capacity * sizeof(IRCallee));
+        if (module->function_count) {
+            memcpy(functions, module->functions, module->function_count * sizeof(IRCallee));
+        }
+        module->functions = functions;
+        module->function_capacity = capacity;
+    }
+    int param_count = ast_list_length(&ctx->ast, stmt->func.params);
+    module->functions[module->function_count++] = (IRCallee){ stmt->func.name, param_count, id };
+}
+
+// Registers every top-level 'let'/'var' so functions can refer to them, and
+// every function so calls can, in the order resolve_program numbered them;
+// it has already rejected duplicates
+void collect_globals(FluentContext* ctx, NodeId program, IRModule* module) {
+    memset(module, 0, sizeof(IRModule));
+    for (NodeId id = ast_node(&ctx->ast, program)->block.statements; id; id = ast_node(&ctx->ast, id)->next) {
+        const ASTNode* stmt = ast_node(&ctx->ast, id);
+        if (stmt->type == AST_FUNC_DECL) {
+            add_callee(ctx, module, stmt, id);
+            continue;
+        }
+        if (stmt->type != AST_VAR_DECL) {
+            continue;
+        }
+        if (module->global_count == module->global_capacity) {
+            int capacity = module->global_capacity ? module->global_capacity * 2 : 16;
+            IRGlobal* globals = arena_alloc(&ctx->arena, capacity * sizeof(IRGlobal));
+            if (module->global_count) {
+                memcpy(globals, module->globals, module->global_count * sizeof(IRGlobal));
+            }
+            module->globals = globals;
+            module->global_capacity = capacity;
+        }
+        module->globals[module->global_count++] =
+            (IRGlobal){ stmt->decl.name, stmt->is_mutable, (ValueType)stmt->value_type };
+    }
+}
+
+IRFunction* lower_function(FluentContext* ctx, IRModule* module, NodeId func_decl) {
+    profile_begin(ctx->profile, PHASE_LOWER);
+    Lowering lw;
+    const ASTNode* node = ast_node(&ctx->ast, func_decl);
+    begin_function(&lw, ctx, module, node->func.name);
+    NodeId body = node->func.body;
+    lw.self = func_decl;
+    lw.return_type = (ValueType)node->value_type;
+
+    // Parameters arrive as values defined at the top of the entry block
+    int index = 0;
+    for (NodeId param = node->func.params; param; param = ast_node(&ctx->ast, param)->next) {
+        IRInstr* instr = append_ir_instr(lw.arena, lw.fn, lw.block, IR_PARAM);
+        instr->imm = index++;
+        instr->type = ast_node(&ctx->ast, param)->value_type;
+        write_variable(&lw, symbol_of(&lw, ast_node(&ctx->ast, param)->decl.symbol)->slot, lw.block->id, instr->id);
+    }
+    lower_block(&lw, body);
+    IRFunction* fn = end_function(&lw);
+    profile_end(ctx->profile);
+    return fn;
+}
+
+// Top-level statements other than functions run once before main
+IRFunction* lower_global_init(FluentContext* ctx, IRModule* module, NodeId program) {
+    profile_begin(ctx->profile, PHASE_LOWER);
+    Lowering lw;
+    begin_function(&lw, ctx, module, (Slice){ "<init>", 6 });
+    lw.in_global_init = 1;
+    lower_statements(&lw, ast_node(&ctx->ast, program)->block.statements, 1);
+    IRFunction* fn = end_function(&lw);
+    profile_end(ctx->profile);
+    return fn;
+}
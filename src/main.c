@@ -3,40 +3,185 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include "lexer.h"
-#include "parser.h"
-#include "codegen.h"
-#include "ast.h"
+#include <string.h>
+#include "driver.h"
+#include "ir.h"
+#include "cache.h"
+
+static void usage(const char* program) {
+    fprintf(stderr, "Usage: %s [-o output.c] [-j jobs] [-O0|-O1|-O2] [--passes=list]\n       [--inline-threshold=N] [--emit=c|ir|asm] [--run|--jit] [--opt-stats] [--mem-stats] [--time-passes]\n       [--stats-format=table|json] [--trace=file.json]\n       [--cache-dir=dir] [--cache-size=N[KMG]] [--cache-stats] [--pull-tokens] [--stream] source.flu|- ...\n", program);
+}
+
+// a/b.flu -> a/b.c (or .s, .ir); other names get the extension appended
+static char* derive_output_path(const char* input_path, EmitKind emit) {
+    const char* extension = emit == EMIT_ASM ? ".s" : emit == EMIT_IR ? ".ir" : ".c";
+    size_t length = strlen(input_path);
+    if (length > 4 && strcmp(input_path + length - 4, ".flu") == 0) {
+        length -= 4;
+    }
+    char* path = malloc(length + strlen(extension) + 1);
+    memcpy(path, input_path, length);
+    strcpy(path + length, extension);
+    return path;
+}
 
 int main(int argc, char** argv) {
-    if (argc < 2) {
-        fprintf(stderr, "Usage: %s source.flu\n", argv[0]);
+    const char* output_path = NULL;
+    BuildOptions options = {
+        .jobs = 1,
+        .emit = EMIT_C,
+        .stats_format = STATS_TABLE,
+        .run = RUN_NONE,
+        .inline_threshold = DEFAULT_INLINE_THRESHOLD,
+    };
+    CompileJob* jobs = calloc(argc, sizeof(CompileJob));
+    int job_count = 0;
+    const char* cache_dir = getenv("FLUENTC_CACHE_DIR");
+    long long cache_size = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--mem-stats") == 0) {
+            options.mem_stats = 1;
+        } else if (strcmp(argv[i], "--time-passes") == 0) {
+            options.time_passes = 1;
+        } else if (strcmp(argv[i], "--stats-format=table") == 0) {
+            options.stats_format = STATS_TABLE;
+        } else if (strcmp(argv[i], "--stats-format=json") == 0) {
+            options.stats_format = STATS_JSON;
+        } else if (strncmp(argv[i], "--trace=", 8) == 0 && argv[i][8]) {
+            options.trace_path = argv[i] + 8;
+        } else if (strcmp(argv[i], "--opt-stats") == 0) {
+            options.opt_stats = 1;
+        } else if (strcmp(argv[i], "-O0") == 0 || strcmp(argv[i], "-O1") == 0 ||
+                   strcmp(argv[i], "-O2") == 0) {
+            options.opt_level = argv[i][2] - '0';
+        } else if (strncmp(argv[i], "--passes=", 9) == 0) {
+            options.ir_pipeline = argv[i] + 9;
+            if (!valid_ir_pipeline(options.ir_pipeline)) {
+                fprintf(stderr, "Unknown pass in '%s' (available: copyprop, gvn, dce)\n", options.ir_pipeline);
+                free(jobs);
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--inline-threshold=", 19) == 0) {
+            char* end;
+            long threshold = strtol(argv[i] + 19, &end, 10);
+            if (end == argv[i] + 19 || *end || threshold < 0 || threshold > 1000000) {
+                fprintf(stderr, "Invalid inline threshold '%s'\n", argv[i] + 19);
+                free(jobs);
+                return 1;
+            }
+            options.inline_threshold = (int)threshold;
+        } else if (strcmp(argv[i], "--emit=c") == 0) {
+            options.emit = EMIT_C;
+        } else if (strcmp(argv[i], "--emit=ir") == 0) {
+            options.emit = EMIT_IR;
+        } else if (strcmp(argv[i], "--emit=asm") == 0) {
+            options.emit = EMIT_ASM;
+        } else if (strcmp(argv[i], "--run") == 0) {
+            options.run = RUN_VM;
+        } else if (strcmp(argv[i], "--jit") == 0) {
+            options.run = RUN_JIT;
+        } else if (strncmp(argv[i], "--cache-dir=", 12) == 0) {
+            cache_dir = argv[i] + 12;
+        } else if (strncmp(argv[i], "--cache-size=", 13) == 0) {
+            cache_size = parse_cache_size(argv[i] + 13);
+            if (cache_size < 0) {
+                fprintf(stderr, "Invalid cache size '%s'\n", argv[i] + 13);
+                free(jobs);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--cache-stats") == 0) {
+            options.cache_stats = 1;
+        } else if (strcmp(argv[i], "--pull-tokens") == 0) {
+            options.pull_tokens = 1;
+        } else if (strcmp(argv[i], "--stream") == 0) {
+            options.stream = 1;
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output_path = argv[++i];
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            options.jobs = atoi(argv[++i]);
+        } else if (strncmp(argv[i], "-j", 2) == 0 && argv[i][2]) {
+            options.jobs = atoi(argv[i] + 2);
+        } else {
+            jobs[job_count++].input_path = argv[i];
+        }
+    }
+
+    if (job_count == 0 || options.jobs < 1) {
+        usage(argv[0]);
+        free(jobs);
         return 1;
     }
 
-    // Read source code from file
-    FILE* file = fopen(argv[1], "r");
-    if (!file) {
-        perror("Could not open source file");
+    if (options.stream && (options.emit != EMIT_C || options.run != RUN_NONE)) {
+        fprintf(stderr, "--stream only produces C\n");
+        free(jobs);
         return 1;
     }
-    fseek(file, 0, SEEK_END);
-    long fsize = ftell(file);
-    rewind(file);
-    char* source_code = malloc(fsize + 1);
-    fread(source_code, 1, fsize, file);
-    fclose(file);
-    source_code[fsize] = '\0';
-
-    // Initialize lexer and parse the source code
-    init_lexer(source_code);
-    ASTNode* ast = parse_program();
-
-    // Generate code
-    generate_code(ast);
-
-    // Clean up
-    free_ast(ast);
-    free(source_code);
-    return 0;
+
+    // --run and --jit execute a single program and exit with main's
+    // return value
+    if (options.run != RUN_NONE) {
+        if (job_count != 1) {
+            fprintf(stderr, "--run and --jit take exactly one source file\n");
+            free(jobs);
+            return 1;
+        }
+        FluentContext ctx;
+        init_context(&ctx);
+        ctx.opt_level = options.opt_level;
+        ctx.pull_tokens = options.pull_tokens;
+        Profile profile;
+        double started = profile_now();
+        if (wants_profile(&options)) {
+            init_profile(&profile, options.time_passes, options.trace_path != NULL, started);
+            ctx.profile = &profile;
+        }
+        int exit_status = 0;
+        int failed = run_file(&ctx, jobs[0].input_path, options.run, &exit_status);
+        if (ctx.profile) {
+            record_arena(&profile, &ctx.arena);
+            failed |= report_profiles(&options, &profile, 1, started);
+            free_profile(&profile);
+        }
+        free_context(&ctx);
+        free(jobs);
+        return failed ? 1 : exit_status & 0xff;
+    }
+
+    // One input keeps the old behaviour of writing to -o or stdout; with
+    // several, each gets its own output file next to it.
+    if (job_count == 1) {
+        jobs[0].output_path = output_path;
+    } else {
+        if (output_path) {
+            fprintf(stderr, "-o cannot be used with multiple source files\n");
+            free(jobs);
+            return 1;
+        }
+        for (int i = 0; i < job_count; i++) {
+            if (strcmp(jobs[i].input_path, "-") == 0) {
+                fprintf(stderr, "Standard input cannot be combined with other source files\n");
+                free(jobs);
+                return 1;
+            }
+            jobs[i].output_path = derive_output_path(jobs[i].input_path, options.emit);
+        }
+    }
+
+    Cache cache;
+    if (cache_dir && *cache_dir) {
+        init_cache(&cache, cache_dir, cache_size);
+        options.cache = &cache;
+    }
+
+    int failed = run_build(jobs, job_count, &options);
+
+    if (job_count > 1) {
+        for (int i = 0; i < job_count; i++) {
+            free((char*)jobs[i].output_path);
+        }
+    }
+    free(jobs);
+    return failed ? 1 : 0;
 }
@@ -0,0 +1,343 @@
+// optimize.c
+// Implementation of constant folding and algebraic simplification on the AST
+
+#include "optimize.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+
+typedef struct {
+    FluentContext* ctx;
+    FoldConstant* constants;      // Indexed by SymbolId
+} FoldState;
+
+static NodeId fold_expression(FoldState* state, NodeId id);
+static NodeId fold_statements(FoldState* state, NodeId first);
+
+static ASTNode* node_at(FoldState* state, NodeId id) {
+    return ast_node(&state->ctx->ast, id);
+}
+
+// i32 literals that C reads as a decimal int. Other types, octal-looking
+// literals and values beyond INT_MAX are left for the C compiler.
+static int constant_value(const ASTNode* node, int* value) {
+    if (node->type != AST_NUMBER || node->value_type != TYPE_I32) {
+        return 0;
+    }
+    const char* text = node->value.start;
+    int length = node->value.length;
+    int negative = length > 1 && text[0] == '-';
+    int i = negative ? 1 : 0;
+    if (length - i > 1 && text[i] == '0') {
+        return 0;
+    }
+    long long result = 0;
+    for (; i < length; i++) {
+        if (text[i] < '0' || text[i] > '9') {
+            return 0;
+        }
+        result = result * 10 + (text[i] - '0');
+        if (result > (long long)INT_MAX + 1) {
+            return 0;
+        }
+    }
+    if (negative) {
+        result = -result;
+    }
+    if (result < INT_MIN || result > INT_MAX) {
+        return 0;
+    }
+    *value = (int)result;
+    return 1;
+}
+
+static NodeId make_number(FoldState* state, int value) {
+    char text[16];
+    int length = snprintf(text, sizeof(text), "%d", value);
+    NodeId id = new_ast_node(&state->ctx->ast, AST_NUMBER);
+    ASTNode* node = node_at(state, id);
+    node->value.start = arena_strndup(&state->ctx->arena, text, length);
+    node->value.length = length;
+    node->value_type = TYPE_I32;
+    return id;
+}
+
+static int count_nodes(FoldState* state, NodeId id) {
+    if (!id) {
+        return 0;
+    }
+    ASTNode* node = node_at(state, id);
+    if (node->type == AST_CAST) {
+        return 1 + count_nodes(state, node->cast.expr);
+    }
+    if (node->type != AST_BIN_OP) {
+        return 1;
+    }
+    return 1 + count_nodes(state, node->binary.left) + count_nodes(state, node->binary.right);
+}
+
+// Calls are the only expressions with effects
+static int has_side_effects(FoldState* state, NodeId id) {
+    ASTNode* node = node_at(state, id);
+    switch (node->type) {
+        case AST_NUMBER:
+        case AST_IDENTIFIER:
+            return 0;
+        case AST_BIN_OP:
+            return has_side_effects(state, node->binary.left) || has_side_effects(state, node->binary.right);
+        case AST_CAST:
+            return has_side_effects(state, node->cast.expr);
+        default:
+            return 1;
+    }
+}
+
+// Evaluates a binary operation with C int semantics. Returns 0 when the
+// result would be undefined (overflow, division by zero) or op is unknown.
+static int evaluate(TokenType op, int a, int b, int* result) {
+    switch (op) {
+        case TOKEN_PLUS: return !__builtin_add_overflow(a, b, result);
+        case TOKEN_MINUS: return !__builtin_sub_overflow(a, b, result);
+        case TOKEN_ASTERISK: return !__builtin_mul_overflow(a, b, result);
+        case TOKEN_SLASH:
+            if (b == 0 || (a == INT_MIN && b == -1)) return 0;
+            *result = a / b;
+            return 1;
+        case TOKEN_EQUAL: *result = a == b; return 1;
+        case TOKEN_NOT_EQUAL: *result = a != b; return 1;
+        case TOKEN_LESS: *result = a < b; return 1;
+        case TOKEN_GREATER: *result = a > b; return 1;
+        case TOKEN_LESS_EQUAL: *result = a <= b; return 1;
+        case TOKEN_GREATER_EQUAL: *result = a >= b; return 1;
+        default: return 0;
+    }
+}
+
+// Replaces the operation with one of its operands
+static NodeId keep_operand(FoldState* state, NodeId node, NodeId kept) {
+    state->ctx->opt_stats.simplified++;
+    state->ctx->opt_stats.nodes_removed += count_nodes(state, node) - count_nodes(state, kept);
+    return kept;
+}
+
+static NodeId simplify(FoldState* state, NodeId id) {
+    ASTNode* node = node_at(state, id);
+    NodeId left = node->binary.left;
+    NodeId right = node->binary.right;
+    int value;
+    int left_constant = constant_value(node_at(state, left), &value) ? 1 : 0;
+    int left_value = value;
+    int right_constant = constant_value(node_at(state, right), &value) ? 1 : 0;
+    int right_value = value;
+
+    switch (node->op) {
+        case TOKEN_PLUS:
+            if (right_constant && right_value == 0) return keep_operand(state, id, left);
+            if (left_constant && left_value == 0) return keep_operand(state, id, right);
+            break;
+        case TOKEN_MINUS:
+            if (right_constant && right_value == 0) return keep_operand(state, id, left);
+            break;
+        case TOKEN_ASTERISK:
+            if (right_constant && right_value == 1) return keep_operand(state, id, left);
+            if (left_constant && left_value == 1) return keep_operand(state, id, right);
+            if (right_constant && right_value == 0 && !has_side_effects(state, left)) {
+                return keep_operand(state, id, right);
+            }
+            if (left_constant && left_value == 0 && !has_side_effects(state, right)) {
+                return keep_operand(state, id, left);
+            }
+            break;
+        case TOKEN_SLASH:
+            if (right_constant && right_value == 1) return keep_operand(state, id, left);
+            break;
+        default:
+            break;
+    }
+    return id;
+}
+
+// make_number() may move the node array, so no ASTNode pointer is kept
+// across a call that folds
+static NodeId fold_expression(FoldState* state, NodeId id) {
+    switch (node_at(state, id)->type) {
+        case AST_IDENTIFIER: {
+            FoldConstant* constant = &state->constants[node_at(state, id)->ident.symbol];
+            if (constant->is_constant) {
+                state->ctx->opt_stats.propagated++;
+                return make_number(state, constant->value);
+            }
+            return id;
+        }
+        case AST_BIN_OP: {
+            NodeId left = fold_expression(state, node_at(state, id)->binary.left);
+            NodeId right = fold_expression(state, node_at(state, id)->binary.right);
+            ASTNode* node = node_at(state, id);
+            node->binary.left = left;
+            node->binary.right = right;
+            int a, b, result;
+            if (constant_value(node_at(state, left), &a) && constant_value(node_at(state, right), &b) &&
+                evaluate(node->op, a, b, &result)) {
+                state->ctx->opt_stats.folded++;
+                state->ctx->opt_stats.nodes_removed += 2;
+                return make_number(state, result);
+            }
+            return simplify(state, id);
+        }
+        case AST_CAST: {
+            NodeId expr = fold_expression(state, node_at(state, id)->cast.expr);
+            node_at(state, id)->cast.expr = expr;
+            return id;
+        }
+        case AST_CALL: {
+            // Arguments are a list, so a replaced one is spliced back in
+            NodeId previous = NO_NODE;
+            for (NodeId arg = node_at(state, id)->call.args; arg; ) {
+                NodeId next = node_at(state, arg)->next;
+                NodeId folded = fold_expression(state, arg);
+                node_at(state, folded)->next = next;
+                if (previous) {
+                    node_at(state, previous)->next = folded;
+                } else {
+                    node_at(state, id)->call.args = folded;
+                }
+                previous = folded;
+                arg = next;
+            }
+            return id;
+        }
+        default:
+            return id;
+    }
+}
+
+static void fold_block(FoldState* state, NodeId block) {
+    NodeId statements = fold_statements(state, node_at(state, block)->block.statements);
+    node_at(state, block)->block.statements = statements;
+}
+
+static NodeId fold_statement(FoldState* state, NodeId id) {
+    int value;
+    NodeId expr;
+    switch (node_at(state, id)->type) {
+        case AST_VAR_DECL: {
+            expr = fold_expression(state, node_at(state, id)->decl.expr);
+            ASTNode* node = node_at(state, id);
+            node->decl.expr = expr;
+            // Only code folded after the declaration sees the value
+            if (!node->is_mutable && constant_value(node_at(state, expr), &value)) {
+                state->constants[node->decl.symbol] = (FoldConstant){ 1, value };
+            }
+            return id;
+        }
+        case AST_ASSIGNMENT:
+            expr = fold_expression(state, node_at(state, id)->decl.expr);
+            node_at(state, id)->decl.expr = expr;
+            return id;
+        case AST_RETURN_STMT:
+            expr = fold_expression(state, node_at(state, id)->ret.expr);
+            node_at(state, id)->ret.expr = expr;
+            return id;
+        case AST_IF_STMT:
+            expr = fold_expression(state, node_at(state, id)->if_stmt.condition);
+            node_at(state, id)->if_stmt.condition = expr;
+            fold_block(state, node_at(state, id)->if_stmt.then_branch);
+            if (node_at(state, id)->if_stmt.else_branch) {
+                fold_block(state, node_at(state, id)->if_stmt.else_branch);
+            }
+            return id;
+        case AST_WHILE_STMT:
+            expr = fold_expression(state, node_at(state, id)->loop.condition);
+            node_at(state, id)->loop.condition = expr;
+            fold_block(state, node_at(state, id)->loop.body);
+            return id;
+        case AST_FUNC_DECL:
+            fold_block(state, node_at(state, id)->func.body);
+            return id;
+        case AST_BIN_OP:
+        case AST_NUMBER:
+        case AST_IDENTIFIER:
+        case AST_CALL:
+        case AST_CAST:
+            return fold_expression(state, id);
+        default:
+            return id;
+    }
+}
+
+// Folds a statement list, splicing in any replaced statement, and returns
+// its new head
+static NodeId fold_statements(FoldState* state, NodeId first) {
+    NodeId head = NO_NODE;
+    NodeId previous = NO_NODE;
+    for (NodeId stmt = first; stmt; ) {
+        NodeId next = node_at(state, stmt)->next;
+        NodeId folded = fold_statement(state, stmt);
+        node_at(state, folded)->next = next;
+        if (previous) {
+            node_at(state, previous)->next = folded;
+        } else {
+            head = folded;
+        }
+        previous = folded;
+        stmt = next;
+    }
+    return head;
+}
+
+void init_fold_table(FoldTable* table) {
+    table->constants = NULL;
+    table->capacity = 0;
+}
+
+void free_fold_table(FoldTable* table) {
+    free(table->constants);
+    init_fold_table(table);
+}
+
+void fold_constants(FluentContext* ctx, NodeId program) {
+    FoldTable table;
+    init_fold_table(&table);
+    fold_with_table(ctx, &table, program, 0);
+    free_fold_table(&table);
+}
+
+void fold_with_table(FluentContext* ctx, FoldTable* table, NodeId program, SymbolId first_new) {
+    uint32_t needed = ctx->symbols.count + 1;
+    if (needed > table->capacity) {
+        FoldConstant* constants = realloc(table->constants, needed * sizeof(FoldConstant));
+        if (!constants) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        // Symbols declared before this piece, such as those a mapped file's
+        // scan declares up front, must not see uninitialized slots
+        memset(constants + table->capacity, 0, (needed - table->capacity) * sizeof(FoldConstant));
+        table->constants = constants;
+        table->capacity = needed;
+    }
+    // Symbols from first_new on may reuse the IDs of released ones
+    if (first_new < needed) {
+        memset(table->constants + first_new, 0, (needed - first_new) * sizeof(FoldConstant));
+    }
+
+    FoldState state = { ctx, table->constants };
+    fold_block(&state, program);
+}
+
+void print_opt_stats(FluentContext* ctx, FILE* out) {
+    const OptimizeStats* stats = &ctx->opt_stats;
+    if (ctx->file_name) {
+        fprintf(out, "%s: ", ctx->file_name);
+    }
+    fprintf(out, "folded %d operations, simplified %d, propagated %d constants, removed %d nodes\n",
+            stats->folded, stats->simplified, stats->propagated, stats->nodes_removed);
+    if (ctx->opt_level >= 2 || ctx->ir_pipeline) {
+        if (ctx->file_name) {
+            fprintf(out, "%s: ", ctx->file_name);
+        }
+        fprintf(out, "ssa: %d copies propagated, %d values numbered, %d instructions and %d blocks removed\n",
+                stats->copies_propagated, stats->values_numbered, stats->instrs_removed, stats->blocks_removed);
+    }
+}
@@ -0,0 +1,113 @@
+// output.c
+// Implementation of the buffered output used by the code generator
+
+#include "output.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+int open_output(OutputBuffer* out, const char* path) {
+    memset(out, 0, sizeof(OutputBuffer));
+
+    if (!path || strcmp(path, "-") == 0) {
+        out->fd = STDOUT_FILENO;
+    } else {
+        out->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out->fd < 0) {
+            return -1;
+        }
+        out->owns_fd = 1;
+    }
+
+    out->buffer = malloc(OUTPUT_BUFFER_SIZE);
+    if (!out->buffer) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    out->capacity = OUTPUT_BUFFER_SIZE;
+    return 0;
+}
+
+void open_memory_output(OutputBuffer* out) {
+    memset(out, 0, sizeof(OutputBuffer));
+    out->fd = -1;
+    out->buffer = malloc(4096);
+    if (!out->buffer) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    out->capacity = 4096;
+}
+
+static void write_all(OutputBuffer* out, const char* data, size_t length) {
+    while (length > 0 && !out->failed) {
+        ssize_t n = write(out->fd, data, length);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            out->failed = 1;
+            break;
+        }
+        data += n;
+        length -= n;
+    }
+}
+
+void flush_output(OutputBuffer* out) {
+    if (out->fd < 0) {
+        return;
+    }
+    write_all(out, out->buffer, out->length);
+    out->length = 0;
+}
+
+void out_write_slow(OutputBuffer* out, const char* data, size_t length) {
+    if (out->fd < 0) {
+        while (out->capacity - out->length < length) {
+            out->capacity *= 2;
+        }
+        out->buffer = realloc(out->buffer, out->capacity);
+        if (!out->buffer) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        memcpy(out->buffer + out->length, data, length);
+        out->length += length;
+        return;
+    }
+    flush_output(out);
+    if (length >= out->capacity) {
+        // Too large to be worth buffering
+        write_all(out, data, length);
+    } else {
+        memcpy(out->buffer, data, length);
+        out->length = length;
+    }
+}
+
+void out_int(OutputBuffer* out, long value) {
+    char digits[24];
+    int i = sizeof(digits);
+    unsigned long magnitude = value < 0 ? -(unsigned long)value : (unsigned long)value;
+    do {
+        digits[--i] = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude);
+    if (value < 0) {
+        digits[--i] = '-';
+    }
+    out_write(out, digits + i, sizeof(digits) - i);
+}
+
+// Flushes and releases the buffer. Returns -1 if any write failed.
+int close_output(OutputBuffer* out) {
+    flush_output(out);
+    int failed = out->failed;
+    if (out->owns_fd && close(out->fd) != 0) {
+        failed = 1;
+    }
+    free(out->buffer);
+    out->buffer = NULL;
+    return failed ? -1 : 0;
+}
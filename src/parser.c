@@ -4,346 +4,559 @@
 #include "parser.h"
 #include "lexer.h"
 #include "ast.h"
-#include <stdlib.h>
+#include "profile.h"
+#include "symbols.h"
+#include "tokens.h"
 #include <stdio.h>
 #include <string.h>
+#include <setjmp.h>
+
+static void advance_token(FluentContext* ctx);
+static NodeId parse_statement(FluentContext* ctx);
+static NodeId parse_expression(FluentContext* ctx);
+static NodeId parse_binary(FluentContext* ctx, int min_precedence);
+static NodeId parse_primary(FluentContext* ctx);
+static NodeId parse_call(FluentContext* ctx, Slice name);
+static ValueType parse_type(FluentContext* ctx);
+static NodeId parse_block(FluentContext* ctx);
+static NodeId parse_variable_declaration(FluentContext* ctx);
+static NodeId parse_assignment(FluentContext* ctx);
+static NodeId parse_function_declaration(FluentContext* ctx);
+static NodeId parse_if_statement(FluentContext* ctx);
+static NodeId parse_while_statement(FluentContext* ctx);
+static NodeId parse_for_statement(FluentContext* ctx);
+
+// Nodes are created after their children, so no ASTNode pointer is held
+// across a call that may grow the node array
+static NodeId new_node(FluentContext* ctx, ASTNodeType type) {
+    return new_ast_node(&ctx->ast, type);
+}
+
+static ASTNode* node_at(FluentContext* ctx, NodeId id) {
+    return ast_node(&ctx->ast, id);
+}
+
+// Appends stmt to the list whose last element is *last
+static void append_statement(FluentContext* ctx, NodeId* first, NodeId* last, NodeId stmt) {
+    if (*last == NO_NODE) {
+        *first = stmt;
+    } else {
+        node_at(ctx, *last)->next = stmt;
+    }
+    *last = stmt;
+}
+
+// Returns NO_NODE if the program has syntax or name errors
+NodeId parse_program(FluentContext* ctx) {
+    if (setjmp(ctx->error_jmp)) {
+        return NO_NODE;
+    }
+
+    // Contiguous sources are lexed up front; the parser then only walks
+    // the token arrays
+    ctx->token_index = 0;
+    ctx->has_next_token = 0;
+    reset_token_stream(&ctx->tokens);
+    if (!ctx->pull_tokens && can_tokenize(&ctx->lexer)) {
+        profile_begin(ctx->profile, PHASE_LEX);
+        int tokenized = tokenize(ctx, &ctx->tokens);
+        profile_end(ctx->profile);
+        if (tokenized != 0) {
+            // The lexer has already reported the error
+            return NO_NODE;
+        }
+        if (ctx->profile) {
+            ctx->profile->tokens += ctx->tokens.count;
+        }
+    }
+
+    profile_begin(ctx->profile, PHASE_PARSE);
+    advance_token(ctx);
+    NodeId program = new_node(ctx, AST_PROGRAM);
+
+    NodeId first_stmt = NO_NODE;
+    NodeId last_stmt = NO_NODE;
 
-static Token* current_token;
-
-static void advance_token(void);
-static ASTNode* parse_statement(void);
-static ASTNode* parse_expression(void);
-static ASTNode* parse_term(void);
-static ASTNode* parse_factor(void);
-static ASTNode* parse_block(void);
-static ASTNode* parse_variable_declaration(void);
-static ASTNode* parse_assignment_or_function_call(void);
-static ASTNode* parse_function_declaration(void);
-static ASTNode* parse_if_statement(void);
-static ASTNode* parse_while_statement(void);
-static ASTNode* parse_for_statement(void);
-
-ASTNode* parse_program(void) {
-    advance_token();
-    ASTNode* program = create_ast_node(AST_PROGRAM);
-    program->statements = NULL; // Initialize statements list
-
-    ASTNode* last_stmt = NULL;
-
-    while (current_token->type != TOKEN_EOF) {
-        ASTNode* stmt = parse_statement();
+    while (ctx->current_token.type != TOKEN_EOF) {
+        NodeId stmt = parse_statement(ctx);
         if (stmt) {
-            if (last_stmt == NULL) {
-                program->statements = stmt;
-            } else {
-                last_stmt->next = stmt;
-            }
-            last_stmt = stmt;
+            append_statement(ctx, &first_stmt, &last_stmt, stmt);
         }
     }
+    node_at(ctx, program)->block.statements = first_stmt;
+    profile_end(ctx->profile);
 
+    resolve_program(ctx, program);
     return program;
 }
 
-static void advance_token(void) {
-    if (current_token) {
-        free_token(current_token);
+static void skip_newlines(FluentContext* ctx) {
+    while (ctx->current_token.type == TOKEN_NEWLINE) {
+        advance_token(ctx); // Consume newline
+    }
+}
+
+// Primes the lookahead for parse_top_level. Tokens are pulled on demand,
+// so nothing but the current statement is held in memory. Between
+// statements current_token is the first token of the next one.
+void begin_streaming_parse(FluentContext* ctx) {
+    ctx->token_index = 0;
+    ctx->has_next_token = 0;
+    reset_token_stream(&ctx->tokens);
+    profile_begin(ctx->profile, PHASE_PARSE);
+    advance_token(ctx);
+    skip_newlines(ctx);
+    profile_end(ctx->profile);
+}
+
+// Parses the next top-level statement, or returns NO_NODE at the end of the
+// file. Errors unwind to ctx->error_jmp, which the caller sets; names are
+// left for the caller to resolve.
+NodeId parse_top_level(FluentContext* ctx) {
+    profile_begin(ctx->profile, PHASE_PARSE);
+    NodeId stmt = parse_statement(ctx);
+    skip_newlines(ctx);
+    profile_end(ctx->profile);
+    return stmt;
+}
+
+// Reports a syntax error and abandons the parse
+static __attribute__((noreturn)) void parse_error(FluentContext* ctx, const char* message) {
+    report_error(ctx, "%s", message);
+    longjmp(ctx->error_jmp, 1);
+}
+
+static Token pull_token(FluentContext* ctx) {
+    Token token;
+    if (ctx->profile) {
+        profile_begin(ctx->profile, PHASE_LEX);
+        token = get_next_token(ctx);
+        profile_end(ctx->profile);
+        ctx->profile->tokens++;
+    } else {
+        token = get_next_token(ctx);
+    }
+    if (token.type == TOKEN_UNKNOWN) {
+        // The lexer has already reported the error
+        longjmp(ctx->error_jmp, 1);
+    }
+    return token;
+}
+
+static void advance_token(FluentContext* ctx) {
+    if (ctx->tokens.count) {
+        // Stays on the final TOKEN_EOF
+        ctx->current_token = token_at(&ctx->tokens, ctx->token_index);
+        if (ctx->token_index + 1 < ctx->tokens.count) {
+            ctx->token_index++;
+        }
+    } else if (ctx->has_next_token) {
+        ctx->current_token = ctx->next_token;
+        ctx->has_next_token = 0;
+    } else {
+        ctx->current_token = pull_token(ctx);
+    }
+}
+
+// Type of the token after current_token
+static TokenType peek_token_type(FluentContext* ctx) {
+    if (ctx->tokens.count) {
+        return (TokenType)ctx->tokens.kinds[ctx->token_index];
     }
-    current_token = get_next_token();
+    if (!ctx->has_next_token) {
+        ctx->next_token = pull_token(ctx);
+        ctx->has_next_token = 1;
+    }
+    return ctx->next_token.type;
 }
 
-static ASTNode* parse_statement(void) {
-    if (current_token->type == TOKEN_LET || current_token->type == TOKEN_VAR) {
-        return parse_variable_declaration();
-    } else if (current_token->type == TOKEN_IDENTIFIER) {
-        return parse_assignment_or_function_call();
-    } else if (current_token->type == TOKEN_FUNC) {
-        return parse_function_declaration();
-    } else if (current_token->type == TOKEN_IF) {
-        return parse_if_statement();
-    } else if (current_token->type == TOKEN_WHILE) {
-        return parse_while_statement();
-    } else if (current_token->type == TOKEN_FOR) {
-        return parse_for_statement();
-    } else if (current_token->type == TOKEN_RETURN) {
-        advance_token(); // Consume 'return'
-        ASTNode* expr = parse_expression();
-        ASTNode* return_stmt = create_ast_node(AST_RETURN_STMT);
-        return_stmt->expr = expr;
+static NodeId parse_statement(FluentContext* ctx) {
+    skip_newlines(ctx);
+
+    if (ctx->current_token.type == TOKEN_LET || ctx->current_token.type == TOKEN_VAR) {
+        return parse_variable_declaration(ctx);
+    } else if (ctx->current_token.type == TOKEN_IDENTIFIER && peek_token_type(ctx) == TOKEN_ASSIGN) {
+        return parse_assignment(ctx);
+    } else if (ctx->current_token.type == TOKEN_FUNC) {
+        return parse_function_declaration(ctx);
+    } else if (ctx->current_token.type == TOKEN_IF) {
+        return parse_if_statement(ctx);
+    } else if (ctx->current_token.type == TOKEN_WHILE) {
+        return parse_while_statement(ctx);
+    } else if (ctx->current_token.type == TOKEN_FOR) {
+        return parse_for_statement(ctx);
+    } else if (ctx->current_token.type == TOKEN_RETURN) {
+        advance_token(ctx); // Consume 'return'
+        NodeId expr = parse_expression(ctx);
+        NodeId return_stmt = new_node(ctx, AST_RETURN_STMT);
+        node_at(ctx, return_stmt)->ret.expr = expr;
         return return_stmt;
-    } else if (current_token->type == TOKEN_NEWLINE) {
-        advance_token(); // Consume newline
-        return parse_statement();
-    } else if (current_token->type == TOKEN_EOF) {
-        return NULL;
+    } else if (ctx->current_token.type == TOKEN_EOF) {
+        return NO_NODE;
     } else {
         // Expression as statement
-        ASTNode* expr = parse_expression();
-        return expr;
+        return parse_expression(ctx);
     }
 }
 
-static ASTNode* parse_variable_declaration(void) {
-    TokenType var_type = current_token->type; // TOKEN_LET or TOKEN_VAR
-    advance_token(); // Consume 'let' or 'var'
+static NodeId parse_variable_declaration(FluentContext* ctx) {
+    TokenType var_type = ctx->current_token.type; // TOKEN_LET or TOKEN_VAR
+    advance_token(ctx); // Consume 'let' or 'var'
 
-    if (current_token->type != TOKEN_IDENTIFIER) {
-        fprintf(stderr, "Expected identifier after 'let' or 'var'\n");
-        exit(1);
+    if (ctx->current_token.type != TOKEN_IDENTIFIER) {
+        parse_error(ctx, "Expected identifier after 'let' or 'var'");
     }
 
-    char* var_name = strdup(current_token->value);
-    advance_token(); // Consume identifier
+    Slice var_name = ctx->current_token.text;
+    advance_token(ctx); // Consume identifier
+
+    // Without an annotation the type is inferred from the initializer
+    ValueType annotation = TYPE_NONE;
+    if (ctx->current_token.type == TOKEN_COLON) {
+        advance_token(ctx); // Consume ':'
+        annotation = parse_type(ctx);
+    }
 
-    if (current_token->type != TOKEN_ASSIGN) {
-        fprintf(stderr, "Expected '=' after variable name\n");
-        exit(1);
+    if (ctx->current_token.type != TOKEN_ASSIGN) {
+        parse_error(ctx, "Expected '=' after variable name");
     }
 
-    advance_token(); // Consume '='
+    advance_token(ctx); // Consume '='
 
-    ASTNode* expr = parse_expression();
+    NodeId expr = parse_expression(ctx);
 
-    ASTNode* var_decl = create_ast_node(AST_VAR_DECL);
-    var_decl->var_name = var_name;
-    var_decl->expr = expr;
-    var_decl->is_mutable = (var_type == TOKEN_VAR);
+    NodeId var_decl = new_node(ctx, AST_VAR_DECL);
+    ASTNode* node = node_at(ctx, var_decl);
+    node->decl.name = var_name;
+    node->decl.expr = expr;
+    node->is_mutable = (var_type == TOKEN_VAR);
+    node->value_type = annotation;
 
-    if (current_token->type == TOKEN_NEWLINE) {
-        advance_token(); // Consume newline
+    if (ctx->current_token.type == TOKEN_NEWLINE) {
+        advance_token(ctx); // Consume newline
     }
 
     return var_decl;
 }
 
-static ASTNode* parse_assignment_or_function_call(void) {
-    char* identifier = strdup(current_token->value);
-    advance_token(); // Consume identifier
+static NodeId parse_assignment(FluentContext* ctx) {
+    Slice identifier = ctx->current_token.text;
+    advance_token(ctx); // Consume identifier
+    advance_token(ctx); // Consume '='
+    NodeId expr = parse_expression(ctx);
 
-    if (current_token->type == TOKEN_ASSIGN) {
-        // Assignment
-        advance_token(); // Consume '='
-        ASTNode* expr = parse_expression();
+    NodeId assignment = new_node(ctx, AST_ASSIGNMENT);
+    node_at(ctx, assignment)->decl.name = identifier;
+    node_at(ctx, assignment)->decl.expr = expr;
 
-        ASTNode* assignment = create_ast_node(AST_ASSIGNMENT);
-        assignment->var_name = identifier;
-        assignment->expr = expr;
-
-        if (current_token->type == TOKEN_NEWLINE) {
-            advance_token(); // Consume newline
-        }
-
-        return assignment;
-    } else if (current_token->type == TOKEN_LPAREN) {
-        // Function call (not implemented yet)
-        fprintf(stderr, "Function calls not implemented\n");
-        exit(1);
-    } else {
-        fprintf(stderr, "Unexpected token after identifier\n");
-        exit(1);
+    if (ctx->current_token.type == TOKEN_NEWLINE) {
+        advance_token(ctx); // Consume newline
     }
+
+    return assignment;
 }
 
-static ASTNode* parse_expression(void) {
-    ASTNode* node = parse_term();
+static NodeId make_binary(FluentContext* ctx, TokenType op, NodeId left, NodeId right) {
+    NodeId bin_op = new_node(ctx, AST_BIN_OP);
+    ASTNode* node = node_at(ctx, bin_op);
+    node->binary.left = left;
+    node->binary.right = right;
+    node->op = op; // Store the operator
+    return bin_op;
+}
 
-    while (current_token->type == TOKEN_PLUS || current_token->type == TOKEN_MINUS) {
-        TokenType op = current_token->type;
-        advance_token(); // Consume '+' or '-'
+// Binding power of each binary operator; 0 for tokens that are not one.
+// All binary operators are left-associative.
+static const uint8_t binary_precedence[TOKEN_UNKNOWN + 1] = {
+    [TOKEN_EQUAL] = 1,
+    [TOKEN_NOT_EQUAL] = 1,
+    [TOKEN_LESS] = 2,
+    [TOKEN_GREATER] = 2,
+    [TOKEN_LESS_EQUAL] = 2,
+    [TOKEN_GREATER_EQUAL] = 2,
+    [TOKEN_PLUS] = 3,
+    [TOKEN_MINUS] = 3,
+    [TOKEN_ASTERISK] = 4,
+    [TOKEN_SLASH] = 4,
+};
+
+// Unary minus binds tighter than every binary operator
+#define UNARY_PRECEDENCE 5
+
+static NodeId parse_expression(FluentContext* ctx) {
+    return parse_binary(ctx, 0);
+}
 
-        ASTNode* right = parse_term();
+// Parses operators binding tighter than min_precedence. An operand followed
+// by a weaker operator returns after one primary, so a chain costs one call
+// per operand whatever its operators.
+static NodeId parse_binary(FluentContext* ctx, int min_precedence) {
+    NodeId node;
+    if (ctx->current_token.type == TOKEN_MINUS) {
+        advance_token(ctx); // Consume '-'
+        if (ctx->current_token.type == TOKEN_NUMBER) {
+            // A literal takes its sign before it is typed, so -2147483648
+            // is an i32. Nothing binds tighter than the minus, so this is
+            // the same value as 0 - literal.
+            Slice digits = ctx->current_token.text;
+            node = parse_primary(ctx);
+            char* text = arena_alloc(&ctx->arena, digits.length + 1);
+            text[0] = '-';
+            memcpy(text + 1, digits.start, digits.length);
+            node_at(ctx, node)->value = (Slice){ text, digits.length + 1 };
+        } else {
+            // -x is 0 - x, which the backends and the folder already handle
+            NodeId zero = new_node(ctx, AST_NUMBER);
+            node_at(ctx, zero)->value = (Slice){ "0", 1 };
+            NodeId operand = parse_binary(ctx, UNARY_PRECEDENCE - 1);
+            node = make_binary(ctx, TOKEN_MINUS, zero, operand);
+        }
+    } else {
+        node = parse_primary(ctx);
+    }
 
-        ASTNode* bin_op = create_ast_node(AST_BIN_OP);
-        bin_op->left = node;
-        bin_op->right = right;
-        bin_op->op = op; // Store the operator
+    for (;;) {
+        TokenType op = ctx->current_token.type;
+        int precedence = binary_precedence[op];
+        if (precedence <= min_precedence) {
+            return node;
+        }
+        advance_token(ctx); // Consume the operator
+        NodeId right = parse_binary(ctx, precedence);
+        node = make_binary(ctx, op, node, right);
+    }
+}
 
-        node = bin_op;
+static NodeId parse_primary(FluentContext* ctx) {
+    NodeId node = NO_NODE;
+
+    if (ctx->current_token.type == TOKEN_NUMBER) {
+        node = new_node(ctx, AST_NUMBER);
+        node_at(ctx, node)->value = ctx->current_token.text;
+        advance_token(ctx); // Consume number
+    } else if (ctx->current_token.type == TOKEN_IDENTIFIER) {
+        Slice name = ctx->current_token.text;
+        advance_token(ctx); // Consume identifier
+        if (ctx->current_token.type == TOKEN_LPAREN) {
+            return parse_call(ctx, name);
+        }
+        node = new_node(ctx, AST_IDENTIFIER);
+        node_at(ctx, node)->ident.name = name;
+    } else if (ctx->current_token.type == TOKEN_LPAREN) {
+        advance_token(ctx); // Consume '('
+        node = parse_expression(ctx);
+        if (ctx->current_token.type != TOKEN_RPAREN) {
+            parse_error(ctx, "Expected ')' after expression");
+        }
+        advance_token(ctx); // Consume ')'
+    } else {
+        parse_error(ctx, "Unexpected token in expression");
     }
 
     return node;
 }
 
-static ASTNode* parse_term(void) {
-    ASTNode* node = parse_factor();
-
-    while (current_token->type == TOKEN_ASTERISK || current_token->type == TOKEN_SLASH) {
-        TokenType op = current_token->type;
-        advance_token(); // Consume '*' or '/'
-
-        ASTNode* right = parse_factor();
+// Arguments are linked through their 'next' like statements
+static NodeId parse_call(FluentContext* ctx, Slice name) {
+    advance_token(ctx); // Consume '('
+    NodeId first_arg = NO_NODE;
+    NodeId last_arg = NO_NODE;
+    if (ctx->current_token.type != TOKEN_RPAREN) {
+        for (;;) {
+            append_statement(ctx, &first_arg, &last_arg, parse_expression(ctx));
+            if (ctx->current_token.type != TOKEN_COMMA) {
+                break;
+            }
+            advance_token(ctx); // Consume ','
+        }
+    }
+    if (ctx->current_token.type != TOKEN_RPAREN) {
+        parse_error(ctx, "Expected ')' after arguments");
+    }
+    advance_token(ctx); // Consume ')'
 
-        ASTNode* bin_op = create_ast_node(AST_BIN_OP);
-        bin_op->left = node;
-        bin_op->right = right;
-        bin_op->op = op; // Store the operator
+    NodeId call = new_node(ctx, AST_CALL);
+    node_at(ctx, call)->call.name = name;
+    node_at(ctx, call)->call.args = first_arg;
+    return call;
+}
 
-        node = bin_op;
+static ValueType parse_type(FluentContext* ctx) {
+    if (ctx->current_token.type != TOKEN_IDENTIFIER) {
+        parse_error(ctx, "Expected a type");
     }
-
-    return node;
+    ValueType type = type_from_name(ctx->current_token.text);
+    if (!type) {
+        report_error(ctx, "Unknown type '%.*s'", SLICE_ARG(ctx->current_token.text));
+        longjmp(ctx->error_jmp, 1);
+    }
+    advance_token(ctx); // Consume type name
+    return type;
 }
 
-static ASTNode* parse_factor(void) {
-    ASTNode* node = NULL;
-
-    if (current_token->type == TOKEN_NUMBER) {
-        node = create_ast_node(AST_NUMBER);
-        node->value = strdup(current_token->value);
-        advance_token(); // Consume number
-    } else if (current_token->type == TOKEN_IDENTIFIER) {
-        node = create_ast_node(AST_IDENTIFIER);
-        node->value = strdup(current_token->value);
-        advance_token(); // Consume identifier
-    } else if (current_token->type == TOKEN_LPAREN) {
-        advance_token(); // Consume '('
-        node = parse_expression();
-        if (current_token->type != TOKEN_RPAREN) {
-            fprintf(stderr, "Expected ')' after expression\n");
-            exit(1);
+// '(' [name ':' type {',' name ':' type}] ')'
+static NodeId parse_parameters(FluentContext* ctx) {
+    advance_token(ctx); // Consume '('
+    NodeId first_param = NO_NODE;
+    NodeId last_param = NO_NODE;
+    int count = 0;
+    while (ctx->current_token.type != TOKEN_RPAREN) {
+        if (count > 0) {
+            if (ctx->current_token.type != TOKEN_COMMA) {
+                parse_error(ctx, "Expected ',' or ')' after parameter");
+            }
+            advance_token(ctx); // Consume ','
         }
-        advance_token(); // Consume ')'
-    } else {
-        fprintf(stderr, "Unexpected token in factor\n");
-        exit(1);
-    }
+        if (ctx->current_token.type != TOKEN_IDENTIFIER) {
+            parse_error(ctx, "Expected parameter name");
+        }
+        if (++count > MAX_PARAMETERS) {
+            parse_error(ctx, "Too many parameters");
+        }
+        Slice name = ctx->current_token.text;
+        advance_token(ctx); // Consume parameter name
+        if (ctx->current_token.type != TOKEN_COLON) {
+            parse_error(ctx, "Expected ':' and a type after parameter name");
+        }
+        advance_token(ctx); // Consume ':'
+        ValueType type = parse_type(ctx);
 
-    return node;
+        NodeId param = new_node(ctx, AST_PARAM);
+        node_at(ctx, param)->decl.name = name;
+        node_at(ctx, param)->value_type = type;
+        append_statement(ctx, &first_param, &last_param, param);
+    }
+    advance_token(ctx); // Consume ')'
+    return first_param;
 }
 
-static ASTNode* parse_function_declaration(void) {
-    advance_token(); // Consume 'func'
+static NodeId parse_function_declaration(FluentContext* ctx) {
+    advance_token(ctx); // Consume 'func'
 
-    if (current_token->type != TOKEN_IDENTIFIER) {
-        fprintf(stderr, "Expected function name after 'func'\n");
-        exit(1);
+    if (ctx->current_token.type != TOKEN_IDENTIFIER) {
+        parse_error(ctx, "Expected function name after 'func'");
     }
 
-    char* func_name = strdup(current_token->value);
-    advance_token(); // Consume function name
+    Slice func_name = ctx->current_token.text;
+    advance_token(ctx); // Consume function name
 
-    // Parameters (not implemented yet)
-    if (current_token->type == TOKEN_LPAREN) {
-        fprintf(stderr, "Function parameters not implemented\n");
-        exit(1);
+    // The parameter list and return type are optional; functions return
+    // an i32 by default
+    NodeId params = NO_NODE;
+    ValueType return_type = TYPE_I32;
+    if (ctx->current_token.type == TOKEN_LPAREN) {
+        params = parse_parameters(ctx);
+    }
+    if (ctx->current_token.type == TOKEN_ARROW) {
+        advance_token(ctx); // Consume '->'
+        return_type = parse_type(ctx);
     }
 
-    if (current_token->type != TOKEN_COLON) {
-        fprintf(stderr, "Expected ':' after function name\n");
-        exit(1);
+    if (ctx->current_token.type != TOKEN_COLON) {
+        parse_error(ctx, "Expected ':' after function signature");
     }
 
-    advance_token(); // Consume ':'
+    advance_token(ctx); // Consume ':'
 
-    ASTNode* body = parse_block();
+    NodeId body = parse_block(ctx);
 
-    ASTNode* func_decl = create_ast_node(AST_FUNC_DECL);
-    func_decl->func_name = func_name;
-    func_decl->body = body;
+    NodeId func_decl = new_node(ctx, AST_FUNC_DECL);
+    node_at(ctx, func_decl)->func.name = func_name;
+    node_at(ctx, func_decl)->func.params = params;
+    node_at(ctx, func_decl)->func.body = body;
+    node_at(ctx, func_decl)->value_type = return_type;
 
     return func_decl;
 }
 
-static ASTNode* parse_block(void) {
-    if (current_token->type != TOKEN_INDENT) {
-        fprintf(stderr, "Expected indentation\n");
-        exit(1);
+static NodeId parse_block(FluentContext* ctx) {
+    // The block starts on the line after the ':'
+    while (ctx->current_token.type == TOKEN_NEWLINE) {
+        advance_token(ctx); // Consume newline
     }
 
-    advance_token(); // Consume TOKEN_INDENT
+    if (ctx->current_token.type != TOKEN_INDENT) {
+        parse_error(ctx, "Expected indentation");
+    }
 
-    ASTNode* block = create_ast_node(AST_BLOCK);
-    block->statements = NULL;
+    advance_token(ctx); // Consume TOKEN_INDENT
 
-    ASTNode* last_stmt = NULL;
+    NodeId first_stmt = NO_NODE;
+    NodeId last_stmt = NO_NODE;
 
-    while (current_token->type != TOKEN_DEDENT && current_token->type != TOKEN_EOF) {
-        if (current_token->type == TOKEN_NEWLINE) {
-            advance_token(); // Consume newline
+    while (ctx->current_token.type != TOKEN_DEDENT && ctx->current_token.type != TOKEN_EOF) {
+        if (ctx->current_token.type == TOKEN_NEWLINE) {
+            advance_token(ctx); // Consume newline
             continue;
         }
 
-        ASTNode* stmt = parse_statement();
+        NodeId stmt = parse_statement(ctx);
         if (stmt) {
-            if (last_stmt == NULL) {
-                block->statements = stmt;
-            } else {
-                last_stmt->next = stmt;
-            }
-            last_stmt = stmt;
+            append_statement(ctx, &first_stmt, &last_stmt, stmt);
         }
     }
 
-    if (current_token->type == TOKEN_DEDENT) {
-        advance_token(); // Consume TOKEN_DEDENT
+    if (ctx->current_token.type == TOKEN_DEDENT) {
+        advance_token(ctx); // Consume TOKEN_DEDENT
     } else {
-        fprintf(stderr, "Expected dedentation\n");
-        exit(1);
+        parse_error(ctx, "Expected dedentation");
     }
 
+    NodeId block = new_node(ctx, AST_BLOCK);
+    node_at(ctx, block)->block.statements = first_stmt;
     return block;
 }
 
-static ASTNode* parse_if_statement(void) {
-    advance_token(); // Consume 'if'
+static NodeId parse_if_statement(FluentContext* ctx) {
+    advance_token(ctx); // Consume 'if'
 
-    ASTNode* condition = parse_expression();
+    NodeId condition = parse_expression(ctx);
 
-    if (current_token->type != TOKEN_COLON) {
-        fprintf(stderr, "Expected ':' after if condition\n");
-        exit(1);
+    if (ctx->current_token.type != TOKEN_COLON) {
+        parse_error(ctx, "Expected ':' after if condition");
     }
-    advance_token(); // Consume ':'
+    advance_token(ctx); // Consume ':'
 
-    ASTNode* then_block = parse_block();
-
-    ASTNode* if_stmt = create_ast_node(AST_IF_STMT);
-    if_stmt->condition = condition;
-    if_stmt->then_branch = then_block;
-    if_stmt->else_branch = NULL;
+    NodeId then_block = parse_block(ctx);
+    NodeId else_block = NO_NODE;
 
     // Handle 'else' or 'elif'
-    if (current_token->type == TOKEN_ELSE) {
-        advance_token(); // Consume 'else'
-        if (current_token->type != TOKEN_COLON) {
-            fprintf(stderr, "Expected ':' after 'else'\n");
-            exit(1);
+    if (ctx->current_token.type == TOKEN_ELSE) {
+        advance_token(ctx); // Consume 'else'
+        if (ctx->current_token.type != TOKEN_COLON) {
+            parse_error(ctx, "Expected ':' after 'else'");
         }
-        advance_token(); // Consume ':'
-        ASTNode* else_block = parse_block();
-        if_stmt->else_branch = else_block;
+        advance_token(ctx); // Consume ':'
+        else_block = parse_block(ctx);
     }
 
+    NodeId if_stmt = new_node(ctx, AST_IF_STMT);
+    ASTNode* node = node_at(ctx, if_stmt);
+    node->if_stmt.condition = condition;
+    node->if_stmt.then_branch = then_block;
+    node->if_stmt.else_branch = else_block;
     return if_stmt;
 }
 
-static ASTNode* parse_while_statement(void) {
-    advance_token(); // Consume 'while'
+static NodeId parse_while_statement(FluentContext* ctx) {
+    advance_token(ctx); // Consume 'while'
 
-    ASTNode* condition = parse_expression();
+    NodeId condition = parse_expression(ctx);
 
-    if (current_token->type != TOKEN_COLON) {
-        fprintf(stderr, "Expected ':' after while condition\n");
-        exit(1);
+    if (ctx->current_token.type != TOKEN_COLON) {
+        parse_error(ctx, "Expected ':' after while condition");
     }
-    advance_token(); // Consume ':'
+    advance_token(ctx); // Consume ':'
 
-    ASTNode* body = parse_block();
+    NodeId body = parse_block(ctx);
 
-    ASTNode* while_stmt = create_ast_node(AST_WHILE_STMT);
-    while_stmt->condition = condition;
-    while_stmt->body = body;
+    NodeId while_stmt = new_node(ctx, AST_WHILE_STMT);
+    node_at(ctx, while_stmt)->loop.condition = condition;
+    node_at(ctx, while_stmt)->loop.body = body;
 
     return while_stmt;
 }
 
-static ASTNode* parse_for_statement(void) {
-    fprintf(stderr, "'for' loops not implemented yet\n");
-    exit(1);
-}
-
-void free_parser(void) {
-    if (current_token) {
-        free_token(current_token);
-    }
+static NodeId parse_for_statement(FluentContext* ctx) {
+    parse_error(ctx, "'for' loops not implemented yet");
 }
@@ -0,0 +1,645 @@
+// passes.c
+// SSA optimization passes and the pass manager that sequences them
+
+#include "ir.h"
+#include "profile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+typedef struct {
+    const char* name;
+    int (*run)(FluentContext* ctx, IRFunction* fn);
+} IRPass;
+
+#define DEFAULT_PIPELINE "copyprop,gvn,copyprop,dce"
+#define MAX_PIPELINE_ROUNDS 8
+
+// Follows a chain of copies to the value it ultimately names
+static int resolve_copies(IRFunction* fn, int value) {
+    int steps = 0;
+    while (value >= 0 && fn->values[value]->op == IR_COPY && steps++ < fn->value_count) {
+        value = fn->values[value]->args[0];
+    }
+    return value;
+}
+
+static int is_constant(IRFunction* fn, int value, long long* imm) {
+    IRInstr* instr = fn->values[value];
+    if (instr->op != IR_CONST) {
+        return 0;
+    }
+    *imm = instr->imm;
+    return 1;
+}
+
+// Copy propagation: every operand names the original value, not a copy
+
+static int copy_propagation(FluentContext* ctx, IRFunction* fn) {
+    int replaced = 0;
+    for (int b = 0; b < fn->block_count; b++) {
+        IRBlock* block = fn->blocks[b];
+        if (block->removed) {
+            continue;
+        }
+        for (int i = 0; i < block->phi_count; i++) {
+            IRInstr* phi = fn->values[block->phis[i]];
+            if (phi->op != IR_PHI) {
+                continue;
+            }
+            for (int p = 0; p < block->pred_count; p++) {
+                int value = resolve_copies(fn, phi->phi_args[p]);
+                if (value != phi->phi_args[p]) {
+                    phi->phi_args[p] = value;
+                    replaced++;
+                }
+            }
+        }
+        for (int i = 0; i < block->instr_count; i++) {
+            IRInstr* instr = fn->values[block->instrs[i]];
+            if (instr->op == IR_COPY) {
+                continue;
+            }
+            for (int a = 0; a < ir_operand_count(instr); a++) {
+                int value = resolve_copies(fn, instr->args[a]);
+                if (value != instr->args[a]) {
+                    instr->args[a] = value;
+                    replaced++;
+                }
+            }
+        }
+    }
+    ctx->opt_stats.copies_propagated += replaced;
+    return replaced;
+}
+
+// Global value numbering over the dominator tree, with constant folding
+
+typedef struct {
+    IROpcode op;
+    uint8_t type;
+    int args[2];
+    long long imm;
+    int value;                    // -1 marks an empty slot
+} ValueEntry;
+
+static int is_commutative(IROpcode op) {
+    return op == IR_ADD || op == IR_MUL || op == IR_EQ || op == IR_NE;
+}
+
+// C int semantics; returns 0 where C leaves the result undefined
+static int fold_binary(IROpcode op, long long a, long long b, long long* result) {
+    int x = (int)a;
+    int y = (int)b;
+    int r;
+    switch (op) {
+        case IR_ADD: if (__builtin_add_overflow(x, y, &r)) return 0; break;
+        case IR_SUB: if (__builtin_sub_overflow(x, y, &r)) return 0; break;
+        case IR_MUL: if (__builtin_mul_overflow(x, y, &r)) return 0; break;
+        case IR_DIV:
+            if (y == 0 || (x == INT_MIN && y == -1)) return 0;
+            r = x / y;
+            break;
+        case IR_EQ: r = x == y; break;
+        case IR_NE: r = x != y; break;
+        case IR_LT: r = x < y; break;
+        case IR_GT: r = x > y; break;
+        case IR_LE: r = x <= y; break;
+        case IR_GE: r = x >= y; break;
+        default: return 0;
+    }
+    *result = r;
+    return 1;
+}
+
+static void make_constant(IRInstr* instr, long long value) {
+    instr->op = IR_CONST;
+    instr->imm = value;
+    instr->args[0] = -1;
+    instr->args[1] = -1;
+}
+
+static void make_copy(IRInstr* instr, int value) {
+    instr->op = IR_COPY;
+    instr->args[0] = value;
+    instr->args[1] = -1;
+    instr->phi_args = NULL;
+}
+
+// Converts an integer constant as C would. Float sources are left alone:
+// their conversion to an integer is undefined out of range.
+static int fold_convert(IRFunction* fn, IRInstr* instr) {
+    IRInstr* source = fn->values[resolve_copies(fn, instr->args[0])];
+    if (source->op != IR_CONST || type_is_float(source->type)) {
+        return 0;
+    }
+    long long value = source->imm;
+    int from_unsigned = source->type == TYPE_U64;
+    switch (instr->type) {
+        case TYPE_I32:
+            make_constant(instr, (int32_t)value);
+            break;
+        case TYPE_F32:
+            make_constant(instr, 0);
+            instr->fimm = from_unsigned ? (float)(unsigned long long)value : (float)value;
+            break;
+        case TYPE_F64:
+            make_constant(instr, 0);
+            instr->fimm = from_unsigned ? (double)(unsigned long long)value : (double)value;
+            break;
+        default:
+            // i64 and u64 share the bits
+            make_constant(instr, value);
+            break;
+    }
+    return 1;
+}
+
+// Rewrites instr in place when its operands make the result known.
+// Returns 1 if it changed.
+static int simplify_instr(IRFunction* fn, IRInstr* instr) {
+    if (instr->op == IR_PHI) {
+        IRBlock* block = fn->blocks[instr->block];
+        int same = -1;
+        for (int p = 0; p < block->pred_count; p++) {
+            int arg = resolve_copies(fn, instr->phi_args[p]);
+            if (arg == instr->id || arg == same) {
+                continue;
+            }
+            if (same >= 0) {
+                return 0;
+            }
+            same = arg;
+        }
+        if (same < 0) {
+            return 0;
+        }
+        make_copy(instr, same);
+        return 1;
+    }
+
+    if (instr->op == IR_CONVERT) {
+        return fold_convert(fn, instr);
+    }
+    if (ir_operand_count(instr) != 2 || !ir_is_pure(instr->op)) {
+        return 0;
+    }
+
+    // The identities below do not hold for floats (x * 0 may be NaN), and
+    // only i32 arithmetic is folded
+    int left = resolve_copies(fn, instr->args[0]);
+    int right = resolve_copies(fn, instr->args[1]);
+    ValueType type = (ValueType)fn->values[left]->type;
+    if (type_is_float(type)) {
+        return 0;
+    }
+    long long a, b, result;
+    int left_constant = is_constant(fn, left, &a);
+    int right_constant = is_constant(fn, right, &b);
+
+    if (left_constant && right_constant) {
+        if (type != TYPE_I32) {
+            return 0;
+        }
+        if (fold_binary(instr->op, a, b, &result)) {
+            make_constant(instr, result);
+            return 1;
+        }
+        return 0;
+    }
+
+    switch (instr->op) {
+        case IR_ADD:
+            if (right_constant && b == 0) { make_copy(instr, left); return 1; }
+            if (left_constant && a == 0) { make_copy(instr, right); return 1; }
+            break;
+        case IR_SUB:
+            if (right_constant && b == 0) { make_copy(instr, left); return 1; }
+            if (left == right) { make_constant(instr, 0); return 1; }
+            break;
+        case IR_MUL:
+            if (right_constant && b == 1) { make_copy(instr, left); return 1; }
+            if (left_constant && a == 1) { make_copy(instr, right); return 1; }
+            if ((right_constant && b == 0) || (left_constant && a == 0)) {
+                make_constant(instr, 0);
+                return 1;
+            }
+            break;
+        case IR_DIV:
+            if (right_constant && b == 1) { make_copy(instr, left); return 1; }
+            break;
+        case IR_EQ:
+        case IR_LE:
+        case IR_GE:
+            if (left == right) { make_constant(instr, 1); return 1; }
+            break;
+        case IR_NE:
+        case IR_LT:
+        case IR_GT:
+            if (left == right) { make_constant(instr, 0); return 1; }
+            break;
+        default:
+            break;
+    }
+    return 0;
+}
+
+static unsigned long long hash_value(IROpcode op, int type, int a, int b, long long imm) {
+    unsigned long long h = (unsigned long long)(op * 8 + type) * 0x9E3779B97F4A7C15ull;
+    h ^= (unsigned long long)(unsigned int)a * 0xC2B2AE3D27D4EB4Full;
+    h ^= (unsigned long long)(unsigned int)b * 0x165667B19E3779F9ull;
+    h ^= (unsigned long long)imm * 0x27D4EB2F165667C5ull;
+    return h ^ (h >> 31);
+}
+
+static int global_value_numbering(FluentContext* ctx, IRFunction* fn) {
+    compute_dominators(&ctx->arena, fn);
+
+    // Number the dominator tree so dominance is an interval check
+    int count = fn->block_count;
+    int* first_child = malloc(count * sizeof(int));
+    int* next_sibling = malloc(count * sizeof(int));
+    int* dom_in = malloc(count * sizeof(int));
+    int* dom_out = malloc(count * sizeof(int));
+    int* stack = malloc(count * sizeof(int));
+    for (int i = 0; i < count; i++) {
+        first_child[i] = -1;
+        next_sibling[i] = -1;
+    }
+    for (int i = fn->rpo_count - 1; i > 0; i--) {
+        int id = fn->rpo[i];
+        int parent = fn->blocks[id]->idom;
+        next_sibling[id] = first_child[parent];
+        first_child[parent] = id;
+    }
+    int clock = 0;
+    int top = 0;
+    stack[top++] = 0;
+    dom_in[0] = clock++;
+    while (top > 0) {
+        int id = stack[top - 1];
+        int child = first_child[id];
+        if (child >= 0) {
+            first_child[id] = next_sibling[child];
+            dom_in[child] = clock++;
+            stack[top++] = child;
+        } else {
+            dom_out[id] = clock++;
+            top--;
+        }
+    }
+
+    int capacity = 64;
+    while (capacity < fn->value_count * 2) {
+        capacity *= 2;
+    }
+    ValueEntry* table = malloc(capacity * sizeof(ValueEntry));
+    for (int i = 0; i < capacity; i++) {
+        table[i].value = -1;
+    }
+
+    int changed = 0;
+    for (int r = 0; r < fn->rpo_count; r++) {
+        IRBlock* block = fn->blocks[fn->rpo[r]];
+        for (int pass = 0; pass < 2; pass++) {
+            int* list = pass == 0 ? block->phis : block->instrs;
+            int list_count = pass == 0 ? block->phi_count : block->instr_count;
+            for (int i = 0; i < list_count; i++) {
+                IRInstr* instr = fn->values[list[i]];
+                if (simplify_instr(fn, instr)) {
+                    ctx->opt_stats.values_numbered++;
+                    changed++;
+                }
+                if (instr->op == IR_PHI || instr->op == IR_COPY || !ir_is_pure(instr->op)) {
+                    continue;
+                }
+
+                int a = resolve_copies(fn, instr->args[0]);
+                int b = resolve_copies(fn, instr->args[1]);
+                if (is_commutative(instr->op) && a > b) {
+                    int t = a;
+                    a = b;
+                    b = t;
+                }
+                // Constants and parameters are told apart by their immediate
+                // (a float's bits) and type
+                long long imm = instr->op == IR_CONST || instr->op == IR_PARAM ? instr->imm : 0;
+                unsigned long long slot = hash_value(instr->op, instr->type, a, b, imm) & (capacity - 1);
+                while (table[slot].value >= 0) {
+                    ValueEntry* entry = &table[slot];
+                    if (entry->op == instr->op && entry->type == instr->type && entry->args[0] == a &&
+                        entry->args[1] == b && entry->imm == imm) {
+                        break;
+                    }
+                    slot = (slot + 1) & (capacity - 1);
+                }
+
+                ValueEntry* entry = &table[slot];
+                if (entry->value >= 0) {
+                    int other_block = fn->values[entry->value]->block;
+                    if (dom_in[other_block] <= dom_in[block->id] && dom_out[block->id] <= dom_out[other_block]) {
+                        // An equal value already dominates this one
+                        make_copy(instr, entry->value);
+                        ctx->opt_stats.values_numbered++;
+                        changed++;
+                        continue;
+                    }
+                }
+                *entry = (ValueEntry){ instr->op, instr->type, { a, b }, imm, instr->id };
+            }
+        }
+    }
+
+    free(table);
+    free(first_child);
+    free(next_sibling);
+    free(dom_in);
+    free(dom_out);
+    free(stack);
+    return changed;
+}
+
+// Dead-code elimination: constant branches, unreachable blocks, straight-line
+// block chains and instructions whose results are never used
+
+static void remove_block(IRFunction* fn, IRBlock* block) {
+    int succs[2];
+    int succ_count = ir_successors(fn, block, succs);
+    for (int s = 0; s < succ_count; s++) {
+        remove_ir_pred(fn, fn->blocks[succs[s]], block->id);
+    }
+    for (int i = 0; i < block->phi_count; i++) {
+        fn->values[block->phis[i]]->op = IR_NOP;
+    }
+    for (int i = 0; i < block->instr_count; i++) {
+        fn->values[block->instrs[i]]->op = IR_NOP;
+    }
+    block->phi_count = 0;
+    block->instr_count = 0;
+    block->pred_count = 0;
+    block->removed = 1;
+}
+
+static int fold_branches(FluentContext* ctx, IRFunction* fn) {
+    int changed = 0;
+    for (int b = 0; b < fn->block_count; b++) {
+        IRBlock* block = fn->blocks[b];
+        IRInstr* term = block->removed ? NULL : ir_terminator(fn, block);
+        long long condition;
+        if (!term || term->op != IR_BRANCH ||
+            !is_constant(fn, resolve_copies(fn, term->args[0]), &condition)) {
+            continue;
+        }
+        int taken = condition ? term->targets[0] : term->targets[1];
+        int dropped = condition ? term->targets[1] : term->targets[0];
+        if (dropped != taken) {
+            remove_ir_pred(fn, fn->blocks[dropped], block->id);
+        }
+        term->op = IR_JUMP;
+        term->args[0] = -1;
+        term->targets[0] = taken;
+        term->targets[1] = -1;
+        changed++;
+    }
+    return changed;
+}
+
+static int remove_unreachable_blocks(FluentContext* ctx, IRFunction* fn) {
+    char* reachable = calloc(fn->block_count, 1);
+    int* stack = malloc(fn->block_count * sizeof(int));
+    int top = 0;
+    stack[top++] = 0;
+    reachable[0] = 1;
+    while (top > 0) {
+        int succs[2];
+        int succ_count = ir_successors(fn, fn->blocks[stack[--top]], succs);
+        for (int s = 0; s < succ_count; s++) {
+            if (!reachable[succs[s]]) {
+                reachable[succs[s]] = 1;
+                stack[top++] = succs[s];
+            }
+        }
+    }
+
+    int removed = 0;
+    for (int b = 0; b < fn->block_count; b++) {
+        if (!reachable[b] && !fn->blocks[b]->removed) {
+            remove_block(fn, fn->blocks[b]);
+            removed++;
+        }
+    }
+    free(reachable);
+    free(stack);
+    ctx->opt_stats.blocks_removed += removed;
+    return removed;
+}
+
+// Appends B to A when A always jumps to B and nothing else reaches B
+static int merge_blocks(FluentContext* ctx, IRFunction* fn) {
+    int merged = 0;
+    for (int b = 0; b < fn->block_count; b++) {
+        IRBlock* block = fn->blocks[b];
+        while (!block->removed) {
+            IRInstr* term = ir_terminator(fn, block);
+            if (!term || term->op != IR_JUMP) {
+                break;
+            }
+            IRBlock* next = fn->blocks[term->targets[0]];
+            if (next == block || next->id == 0 || next->pred_count != 1) {
+                break;
+            }
+
+            // Drop the jump, then take over next's code and successors
+            block->instr_count--;
+            term->op = IR_NOP;
+            int moved = next->phi_count + next->instr_count;
+            int needed = block->instr_count + moved;
+            if (needed > block->instr_capacity) {
+                int* instrs = arena_alloc(&ctx->arena, needed * 2 * sizeof(int));
+                memcpy(instrs, block->instrs, block->instr_count * sizeof(int));
+                block->instrs = instrs;
+                block->instr_capacity = needed * 2;
+            }
+            for (int i = 0; i < next->phi_count; i++) {
+                IRInstr* phi = fn->values[next->phis[i]];
+                if (phi->op == IR_PHI) {
+                    make_copy(phi, phi->phi_args[0]);
+                }
+                phi->block = block->id;
+                block->instrs[block->instr_count++] = phi->id;
+            }
+            for (int i = 0; i < next->instr_count; i++) {
+                fn->values[next->instrs[i]]->block = block->id;
+                block->instrs[block->instr_count++] = next->instrs[i];
+            }
+
+            int succs[2];
+            int succ_count = ir_successors(fn, block, succs);
+            for (int s = 0; s < succ_count; s++) {
+                IRBlock* succ = fn->blocks[succs[s]];
+                for (int p = 0; p < succ->pred_count; p++) {
+                    if (succ->preds[p] == next->id) {
+                        succ->preds[p] = block->id;
+                    }
+                }
+            }
+
+            next->phi_count = 0;
+            next->instr_count = 0;
+            next->pred_count = 0;
+            next->removed = 1;
+            ctx->opt_stats.blocks_removed++;
+            merged++;
+        }
+    }
+    return merged;
+}
+
+static int remove_dead_instructions(FluentContext* ctx, IRFunction* fn) {
+    char* live = calloc(fn->value_count, 1);
+    int* worklist = malloc(fn->value_count * sizeof(int));
+    int top = 0;
+
+    // Roots: everything with an effect beyond its result
+    for (int b = 0; b < fn->block_count; b++) {
+        IRBlock* block = fn->blocks[b];
+        if (block->removed) {
+            continue;
+        }
+        for (int i = 0; i < block->instr_count; i++) {
+            IRInstr* instr = fn->values[block->instrs[i]];
+            if (!ir_is_pure(instr->op) && instr->op != IR_LOAD_GLOBAL) {
+                live[instr->id] = 1;
+                worklist[top++] = instr->id;
+            }
+        }
+    }
+
+    while (top > 0) {
+        IRInstr* instr = fn->values[worklist[--top]];
+        int operand_count = instr->op == IR_PHI ? fn->blocks[instr->block]->pred_count
+                                                : ir_operand_count(instr);
+        for (int a = 0; a < operand_count; a++) {
+            int operand = instr->op == IR_PHI ? instr->phi_args[a] : instr->args[a];
+            if (operand >= 0 && !live[operand]) {
+                live[operand] = 1;
+                worklist[top++] = operand;
+            }
+        }
+    }
+
+    int removed = 0;
+    for (int b = 0; b < fn->block_count; b++) {
+        IRBlock* block = fn->blocks[b];
+        if (block->removed) {
+            continue;
+        }
+        int kept = 0;
+        for (int i = 0; i < block->phi_count; i++) {
+            if (live[block->phis[i]]) {
+                block->phis[kept++] = block->phis[i];
+            } else {
+                fn->values[block->phis[i]]->op = IR_NOP;
+                removed++;
+            }
+        }
+        block->phi_count = kept;
+        kept = 0;
+        for (int i = 0; i < block->instr_count; i++) {
+            if (live[block->instrs[i]]) {
+                block->instrs[kept++] = block->instrs[i];
+            } else {
+                fn->values[block->instrs[i]]->op = IR_NOP;
+                removed++;
+            }
+        }
+        block->instr_count = kept;
+    }
+
+    free(live);
+    free(worklist);
+    ctx->opt_stats.instrs_removed += removed;
+    return removed;
+}
+
+static int dead_code_elimination(FluentContext* ctx, IRFunction* fn) {
+    int changed = fold_branches(ctx, fn);
+    changed += remove_unreachable_blocks(ctx, fn);
+    changed += merge_blocks(ctx, fn);
+    changed += remove_dead_instructions(ctx, fn);
+    return changed;
+}
+
+// Pass manager
+
+static const IRPass ir_passes[] = {
+    { "copyprop", copy_propagation },
+    { "gvn", global_value_numbering },
+    { "dce", dead_code_elimination },
+};
+
+// NULL past the last pass; used to label per-pass timers
+const char* ir_pass_name(int index) {
+    return index >= 0 && index < (int)(sizeof(ir_passes) / sizeof(ir_passes[0])) ? ir_passes[index].name : NULL;
+}
+
+static const IRPass* find_pass(const char* name, size_t length) {
+    for (size_t i = 0; i < sizeof(ir_passes) / sizeof(ir_passes[0]); i++) {
+        if (strlen(ir_passes[i].name) == length && strncmp(ir_passes[i].name, name, length) == 0) {
+            return &ir_passes[i];
+        }
+    }
+    return NULL;
+}
+
+// Checks a comma-separated pass list such as "gvn,dce"
+int valid_ir_pipeline(const char* pipeline) {
+    const char* p = pipeline;
+    while (*p) {
+        size_t length = strcspn(p, ",");
+        if (!find_pass(p, length)) {
+            return 0;
+        }
+        p += length;
+        if (*p == ',') p++;
+    }
+    return 1;
+}
+
+// Runs the pipeline (NULL for the default) until it stops changing the
+// function. Returns the total number of changes made.
+int run_ir_passes(FluentContext* ctx, IRFunction* fn, const char* pipeline) {
+    if (!pipeline) {
+        pipeline = DEFAULT_PIPELINE;
+    }
+    int total = 0;
+    for (int round = 0; round < MAX_PIPELINE_ROUNDS; round++) {
+        int changed = 0;
+        const char* p = pipeline;
+        while (*p) {
+            size_t length = strcspn(p, ",");
+            const IRPass* pass = find_pass(p, length);
+            if (pass) {
+                profile_begin(ctx->profile, PHASE_PASSES + (int)(pass - ir_passes));
+                changed += pass->run(ctx, fn);
+                profile_end(ctx->profile);
+            }
+            p += length;
+            if (*p == ',') p++;
+        }
+        total += changed;
+        if (!changed) {
+            break;
+        }
+    }
+    return total;
+}
+
+// Runs the pipeline the context asks for: an explicit --passes list, or
+// the default one at -O2 and above
+void optimize_ir_function(FluentContext* ctx, IRFunction* fn) {
+    if (ctx->ir_pipeline || ctx->opt_level >= 2) {
+        run_ir_passes(ctx, fn, ctx->ir_pipeline);
+    }
+}
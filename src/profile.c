@@ -0,0 +1,225 @@
+// profile.c
+// Implementation of --time-passes, --mem-stats and --trace reporting
+
+#include "profile.h"
+#include "ir.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+static const char* const phase_names[PHASE_PASSES] = {
+    "read", "lex", "parse", "resolve", "fold", "lower", "codegen", "bytecode", "execute"
+};
+
+double profile_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void init_profile(Profile* profile, int timing, int tracing, double epoch) {
+    memset(profile, 0, sizeof(Profile));
+    profile->timing = timing || tracing;
+    profile->tracing = tracing;
+    profile->epoch = epoch;
+}
+
+void free_profile(Profile* profile) {
+    free(profile->events);
+    profile->events = NULL;
+}
+
+const char* phase_name(int phase) {
+    if (phase < PHASE_PASSES) {
+        return phase_names[phase];
+    }
+    const char* name = ir_pass_name(phase - PHASE_PASSES);
+    return name ? name : "pass";
+}
+
+// Pauses the enclosing phase and starts charging time to this one. A NULL
+// profile is allowed so call sites need no check.
+void profile_begin(Profile* profile, int phase) {
+    if (!profile || !profile->timing) {
+        return;
+    }
+    double now = profile_now();
+    if (profile->depth > 0 && profile->depth <= MAX_PHASE_DEPTH) {
+        profile->phases[profile->stack[profile->depth - 1].phase].seconds += now - profile->last;
+    }
+    if (profile->depth < MAX_PHASE_DEPTH) {
+        profile->stack[profile->depth] = (OpenPhase){ phase, now };
+    }
+    profile->depth++;
+    profile->last = now;
+}
+
+static void record_event(Profile* profile, int phase, double start, double end) {
+    if (profile->event_count == profile->event_capacity) {
+        profile->event_capacity = profile->event_capacity ? profile->event_capacity * 2 : 256;
+        profile->events = realloc(profile->events, profile->event_capacity * sizeof(TraceEvent));
+    }
+    profile->events[profile->event_count++] = (TraceEvent){
+        phase, profile->file_name, (start - profile->epoch) * 1e6, (end - start) * 1e6
+    };
+}
+
+// Ends the innermost phase and resumes the one around it
+void profile_end(Profile* profile) {
+    if (!profile || !profile->timing || profile->depth == 0) {
+        return;
+    }
+    double now = profile_now();
+    profile->depth--;
+    if (profile->depth < MAX_PHASE_DEPTH) {
+        OpenPhase* open = &profile->stack[profile->depth];
+        PhaseTimer* timer = &profile->phases[open->phase];
+        timer->seconds += now - profile->last;
+        timer->calls++;
+        // Lexing is timed per token; one span each would swamp the trace
+        if (profile->tracing && open->phase != PHASE_LEX) {
+            record_event(profile, open->phase, open->start, now);
+        }
+    }
+    profile->last = now;
+}
+
+// Closes phases left open when an error unwound past their end
+void profile_unwind(Profile* profile) {
+    while (profile && profile->depth > 0) {
+        profile_end(profile);
+    }
+}
+
+// Arena counters accumulate over every file a context compiled
+void record_arena(Profile* profile, const Arena* arena) {
+    profile->arena_allocations = arena->allocations;
+    profile->arena_bytes = arena->bytes_allocated;
+    profile->arena_reserved = arena->bytes_reserved;
+}
+
+void merge_profile(Profile* total, const Profile* part) {
+    for (int i = 0; i < MAX_PHASES; i++) {
+        total->phases[i].seconds += part->phases[i].seconds;
+        total->phases[i].calls += part->phases[i].calls;
+    }
+    total->files += part->files;
+    total->source_bytes += part->source_bytes;
+    total->tokens += part->tokens;
+    total->ast_nodes += part->ast_nodes;
+    total->ast_bytes += part->ast_bytes;
+    total->arena_allocations += part->arena_allocations;
+    total->arena_bytes += part->arena_bytes;
+    total->arena_reserved += part->arena_reserved;
+}
+
+static long peak_rss_kb(void) {
+    struct rusage usage;
+    return getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : 0;
+}
+
+static void print_table(const Profile* profile, FILE* out, int time_passes, int mem_stats, double wall_seconds) {
+    if (time_passes) {
+        double total = 0;
+        for (int i = 0; i < MAX_PHASES; i++) {
+            total += profile->phases[i].seconds;
+        }
+        fprintf(out, "%-12s %12s %8s %10s\n", "phase", "time (ms)", "%", "calls");
+        for (int i = 0; i < MAX_PHASES; i++) {
+            const PhaseTimer* timer = &profile->phases[i];
+            if (timer->calls == 0) {
+                continue;
+            }
+            fprintf(out, "%-12s %12.3f %7.1f%% %10lld\n", phase_name(i), timer->seconds * 1e3,
+                    total > 0 ? timer->seconds * 100 / total : 0.0, timer->calls);
+        }
+        fprintf(out, "%-12s %12.3f %7.1f%%\n", "total", total * 1e3, 100.0);
+        fprintf(out, "%-12s %12.3f\n", "wall", wall_seconds * 1e3);
+    }
+    if (mem_stats) {
+        fprintf(out, "memory: %lld files, %lld source bytes, %lld tokens, %lld AST nodes (%lld bytes)\n",
+                profile->files, profile->source_bytes, profile->tokens, profile->ast_nodes, profile->ast_bytes);
+        fprintf(out, "arena: %lld allocations, %lld bytes allocated, %lld bytes reserved\n",
+                profile->arena_allocations, profile->arena_bytes, profile->arena_reserved);
+        fprintf(out, "memory: peak RSS %ld KB\n", peak_rss_kb());
+    }
+}
+
+static void print_json(const Profile* profile, FILE* out, int time_passes, int mem_stats, double wall_seconds) {
+    fprintf(out, "{");
+    const char* separator = "";
+    if (time_passes) {
+        fprintf(out, "\"wall_ms\": %.3f, \"phases\": [", wall_seconds * 1e3);
+        for (int i = 0; i < MAX_PHASES; i++) {
+            const PhaseTimer* timer = &profile->phases[i];
+            if (timer->calls == 0) {
+                continue;
+            }
+            fprintf(out, "%s{\"name\": \"%s\", \"ms\": %.3f, \"calls\": %lld}",
+                    separator, phase_name(i), timer->seconds * 1e3, timer->calls);
+            separator = ", ";
+        }
+        fprintf(out, "]");
+        separator = ", ";
+    }
+    if (mem_stats) {
+        fprintf(out, "%s\"memory\": {\"files\": %lld, \"source_bytes\": %lld, \"tokens\": %lld, "
+                "\"ast_nodes\": %lld, \"ast_bytes\": %lld, \"arena_allocations\": %lld, \"arena_bytes\": %lld, "
+                "\"arena_reserved\": %lld, \"peak_rss_kb\": %ld}",
+                separator, profile->files, profile->source_bytes, profile->tokens, profile->ast_nodes,
+                profile->ast_bytes,
+                profile->arena_allocations, profile->arena_bytes, profile->arena_reserved, peak_rss_kb());
+    }
+    fprintf(out, "}\n");
+}
+
+void print_profile(const Profile* profile, FILE* out, StatsFormat format,
+                   int time_passes, int mem_stats, double wall_seconds) {
+    if (format == STATS_JSON) {
+        print_json(profile, out, time_passes, mem_stats, wall_seconds);
+    } else {
+        print_table(profile, out, time_passes, mem_stats, wall_seconds);
+    }
+}
+
+static void write_json_string(FILE* out, const char* str) {
+    fputc('"', out);
+    for (const unsigned char* p = (const unsigned char*)str; *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            fprintf(out, "\\%c", *p);
+        } else if (*p < 0x20) {
+            fprintf(out, "\\u%04x", *p);
+        } else {
+            fputc(*p, out);
+        }
+    }
+    fputc('"', out);
+}
+
+// Writes every worker's spans in the Chrome trace-event format, one thread
+// per worker, for chrome://tracing or Perfetto. Returns 0 on success.
+int write_chrome_trace(const Profile* profiles, int count, const char* path) {
+    FILE* out = fopen(path, "w");
+    if (!out) {
+        return -1;
+    }
+    fprintf(out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    const char* separator = "";
+    for (int worker = 0; worker < count; worker++) {
+        fprintf(out, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+                "\"args\": {\"name\": \"worker %d\"}}", separator, worker, worker);
+        separator = ",\n";
+        const Profile* profile = &profiles[worker];
+        for (int i = 0; i < profile->event_count; i++) {
+            const TraceEvent* event = &profile->events[i];
+            fprintf(out, ",\n{\"name\": \"%s\", \"cat\": \"fluentc\", \"ph\": \"X\", "
+                    "\"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": %d, \"args\": {\"file\": ",
+                    phase_name(event->phase), event->start, event->duration, worker);
+            write_json_string(out, event->file_name ? event->file_name : "");
+            fprintf(out, "}}");
+        }
+    }
+    fprintf(out, "\n]}\n");
+    return fclose(out) == 0 ? 0 : -1;
+}
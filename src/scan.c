@@ -0,0 +1,167 @@
+// scan.c
+// Scalar, SSE2 and AVX2 implementations of the lexer's byte-run scanners
+//
+// The vector versions classify 16 or 32 bytes per step into a bit mask and
+// stop at the first byte outside the run; the last partial block is left to
+// the scalar loop so nothing past the end of the buffer is ever loaded.
+
+#include "scan.h"
+#include <stdlib.h>
+#include <string.h>
+
+static int is_identifier_byte(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+static size_t scalar_span(const char* text, size_t length, char a, char b) {
+    size_t i = 0;
+    while (i < length && (text[i] == a || text[i] == b)) i++;
+    return i;
+}
+
+static size_t scalar_until(const char* text, size_t length, char stop) {
+    size_t i = 0;
+    while (i < length && text[i] != stop && text[i] != '\0') i++;
+    return i;
+}
+
+static size_t scalar_identifier(const char* text, size_t length) {
+    size_t i = 0;
+    while (i < length && is_identifier_byte((unsigned char)text[i])) i++;
+    return i;
+}
+
+static const Scanner scalar_scanner = {
+    "scalar", scalar_span, scalar_until, scalar_identifier
+};
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+
+// Bytes in [lo, hi]: shift the range down to start at -128, then one signed
+// compare decides, since SSE2 and AVX2 have no unsigned byte compares
+#define IN_RANGE_128(v, lo, hi) \
+    _mm_cmplt_epi8(_mm_add_epi8((v), _mm_set1_epi8((char)(0x80 - (lo)))), \
+                   _mm_set1_epi8((char)(0x80 + (hi) - (lo) + 1)))
+#define IN_RANGE_256(v, lo, hi) \
+    _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(0x80 + (hi) - (lo) + 1)), \
+                      _mm256_add_epi8((v), _mm256_set1_epi8((char)(0x80 - (lo)))))
+
+// SSE2 is part of x86-64, so these need no target attribute
+
+static size_t sse2_span(const char* text, size_t length, char a, char b) {
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(text + i));
+        __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(a)), _mm_cmpeq_epi8(v, _mm_set1_epi8(b)));
+        unsigned mask = ~(unsigned)_mm_movemask_epi8(hit) & 0xffff;
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + scalar_span(text + i, length - i, a, b);
+}
+
+static size_t sse2_until(const char* text, size_t length, char stop) {
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(text + i));
+        __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(stop)), _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+        unsigned mask = (unsigned)_mm_movemask_epi8(hit);
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + scalar_until(text + i, length - i, stop);
+}
+
+static size_t sse2_identifier(const char* text, size_t length) {
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(text + i));
+        __m128i letter = IN_RANGE_128(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'z');
+        __m128i digit = IN_RANGE_128(v, '0', '9');
+        __m128i underscore = _mm_cmpeq_epi8(v, _mm_set1_epi8('_'));
+        __m128i hit = _mm_or_si128(_mm_or_si128(letter, digit), underscore);
+        unsigned mask = ~(unsigned)_mm_movemask_epi8(hit) & 0xffff;
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + scalar_identifier(text + i, length - i);
+}
+
+static const Scanner sse2_scanner = {
+    "sse2", sse2_span, sse2_until, sse2_identifier
+};
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static size_t avx2_span(const char* text, size_t length, char a, char b) {
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(text + i));
+        __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(a)),
+                                      _mm256_cmpeq_epi8(v, _mm256_set1_epi8(b)));
+        unsigned mask = ~(unsigned)_mm256_movemask_epi8(hit);
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + sse2_span(text + i, length - i, a, b);
+}
+
+AVX2 static size_t avx2_until(const char* text, size_t length, char stop) {
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(text + i));
+        __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(stop)),
+                                      _mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(hit);
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + sse2_until(text + i, length - i, stop);
+}
+
+AVX2 static size_t avx2_identifier(const char* text, size_t length) {
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(text + i));
+        __m256i letter = IN_RANGE_256(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), 'a', 'z');
+        __m256i digit = IN_RANGE_256(v, '0', '9');
+        __m256i underscore = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_'));
+        __m256i hit = _mm256_or_si256(_mm256_or_si256(letter, digit), underscore);
+        unsigned mask = ~(unsigned)_mm256_movemask_epi8(hit);
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + sse2_identifier(text + i, length - i);
+}
+
+static const Scanner avx2_scanner = {
+    "avx2", avx2_span, avx2_until, avx2_identifier
+};
+#endif
+
+const Scanner* scanner = &scalar_scanner;
+
+// Runs before main, so worker threads only ever read the pointer
+__attribute__((constructor)) static void select_scanner(void) {
+    const char* forced = getenv("FLUENTC_SCAN");
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    int has_avx2 = __builtin_cpu_supports("avx2");
+    if (forced && strcmp(forced, "scalar") == 0) {
+        scanner = &scalar_scanner;
+    } else if (forced && strcmp(forced, "sse2") == 0) {
+        scanner = &sse2_scanner;
+    } else {
+        scanner = has_avx2 ? &avx2_scanner : &sse2_scanner;
+    }
+#else
+    (void)forced;
+#endif
+}
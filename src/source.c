@@ -0,0 +1,129 @@
+// source.c
+// Implementation of memory-mapped and streaming source input
+
+#include "source.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+int open_source(SourceInput* input, const char* path) {
+    memset(input, 0, sizeof(SourceInput));
+
+    if (strcmp(path, "-") == 0) {
+        input->fd = STDIN_FILENO;
+    } else {
+        input->fd = open(path, O_RDONLY);
+        if (input->fd < 0) {
+            return -1;
+        }
+    }
+
+    struct stat st;
+    if (fstat(input->fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        input->at_eof = 1;
+        if (st.st_size == 0) {
+            input->data = "";
+            return 0;
+        }
+        void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, input->fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            input->data = map;
+            input->length = st.st_size;
+            input->bytes_read = st.st_size;
+            input->is_mapped = 1;
+            return 0;
+        }
+        // Fall back to reading the file like a stream
+        input->at_eof = 0;
+    }
+
+    input->is_stream = 1;
+    input->data = "";
+    return 0;
+}
+
+// Replaces data with a new chunk holding data[keep_from..length) followed by
+// freshly read bytes. Only the unfinished token is copied; earlier chunks stay
+// alive, so slices into them remain valid, until release_source_chunks.
+// Returns the number of bytes read.
+int refill_source(SourceInput* input, size_t keep_from) {
+    if (!input->is_stream || input->at_eof) {
+        return 0;
+    }
+
+    size_t keep = input->length - keep_from;
+    SourceChunk* chunk = malloc(sizeof(SourceChunk) + keep + SOURCE_CHUNK_SIZE);
+    if (!chunk) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    memcpy(chunk->data, input->data + keep_from, keep);
+
+    ssize_t n;
+    do {
+        n = read(input->fd, chunk->data + keep, SOURCE_CHUNK_SIZE);
+    } while (n < 0 && errno == EINTR);
+
+    if (n <= 0) {
+        if (n < 0) {
+            perror("Could not read source");
+        }
+        input->at_eof = 1;
+        free(chunk);
+        return 0;
+    }
+
+    chunk->next = input->chunks;
+    chunk->length = keep + n;
+    input->chunks = chunk;
+    input->data = chunk->data;
+    input->length = keep + n;
+    input->bytes_read += n;
+    return (int)n;
+}
+
+static int chunk_holds(const SourceChunk* chunk, const char* pointer) {
+    return pointer >= chunk->data && pointer < chunk->data + chunk->length;
+}
+
+// Frees the chunks before the current one that none of the live pointers
+// (tokens still held by the parser) point into. The caller guarantees that
+// nothing else refers to them.
+void release_source_chunks(SourceInput* input, const char* const* live, int live_count) {
+    SourceChunk** link = &input->chunks;
+    while (*link) {
+        SourceChunk* chunk = *link;
+        int keep = chunk->data == input->data;
+        for (int i = 0; i < live_count && !keep; i++) {
+            keep = chunk_holds(chunk, live[i]);
+        }
+        if (keep) {
+            link = &chunk->next;
+        } else {
+            *link = chunk->next;
+            free(chunk);
+        }
+    }
+}
+
+void close_source(SourceInput* input) {
+    if (input->is_mapped) {
+        munmap((void*)input->data, input->length);
+    }
+    SourceChunk* chunk = input->chunks;
+    while (chunk) {
+        SourceChunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    if (input->fd > STDIN_FILENO) {
+        close(input->fd);
+    }
+    memset(input, 0, sizeof(SourceInput));
+}
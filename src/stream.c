@@ -0,0 +1,358 @@
+// stream.c
+// Implementation of streaming compilation: the file is compiled one piece
+// at a time, so memory is bounded by the largest function rather than the
+// file
+//
+// A piece is a top-level function, or a run of up to STREAM_INIT_STATEMENTS
+// other top-level statements that becomes one fluent_init_<N> function.
+// After a piece is written its AST nodes, IR and local symbols are released;
+// only the globals, their folded constants and the interned names survive.
+// Piped input is read in chunks, and the names are copied out of them so
+// that chunks no longer under the parser's lookahead can be freed too.
+//
+// A mapped file is lexed once up front for its top-level names and
+// signatures, so every prototype and global is declared before the first
+// definition and names resolve exactly as in a whole-file compile. A global
+// without a type annotation only gets its type, and its C definition, when
+// its initializer is resolved, so a function above it cannot refer to it. A
+// pipe cannot be read twice: its globals are declared when their group is
+// reached, so a function can only refer to globals defined above it, and
+// call functions defined above it. Callee bodies are released with their
+// piece, so calls are never inlined.
+
+#include "stream.h"
+#include "parser.h"
+#include "codegen.h"
+#include "optimize.h"
+#include "profile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+
+typedef struct {
+    FluentContext* ctx;
+    OutputBuffer* out;
+    SourceInput* source;
+    Arena names;                  // Interned names of piped input
+    IRModule module;              // Globals and functions declared so far; outlives the arena
+    FoldTable constants;
+    int declared_up_front;        // scan_declarations saw the whole file
+    int has_main;
+    int init_count;               // fluent_init_<N> functions written
+    NodeId group;                 // AST_PROGRAM of the pending statements
+    NodeId group_last;
+    int group_length;
+} Stream;
+
+// A global of TYPE_NONE is defined by define_inferred_globals
+static void add_global(Stream* st, Slice name, int is_mutable, ValueType type) {
+    IRModule* module = &st->module;
+    name = interned_name(&st->ctx->names, intern(&st->ctx->names, name));
+    declare_global(st->ctx, name, is_mutable, type, (uint32_t)module->global_count);
+    if (module->global_count == module->global_capacity) {
+        module->global_capacity = module->global_capacity ? module->global_capacity * 2 : 16;
+        module->globals = realloc(module->globals, module->global_capacity * sizeof(IRGlobal));
+        if (!module->globals) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+    module->globals[module->global_count++] = (IRGlobal){ name, is_mutable, type };
+    if (type) {
+        emit_c_global(st->out, name, type);
+    }
+}
+
+static void add_function(Stream* st, Slice name, const uint8_t* param_types, int param_count,
+                         ValueType return_type) {
+    IRModule* module = &st->module;
+    name = interned_name(&st->ctx->names, intern(&st->ctx->names, name));
+    declare_function(st->ctx, name, param_types, param_count, return_type, (uint32_t)module->function_count);
+    if (module->function_count == module->function_capacity) {
+        module->function_capacity = module->function_capacity ? module->function_capacity * 2 : 16;
+        module->functions = realloc(module->functions, module->function_capacity * sizeof(IRCallee));
+        if (!module->functions) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+    module->functions[module->function_count++] = (IRCallee){ name, param_count, NO_NODE };
+    emit_c_prototype(st->out, name, return_type, param_types, param_count);
+}
+
+static void free_stream(Stream* st) {
+    free(st->module.globals);
+    free(st->module.functions);
+    free_fold_table(&st->constants);
+    if (st->ctx->names.storage) {
+        // The names go with their storage
+        reset_interner(&st->ctx->names);
+        st->ctx->names.storage = NULL;
+    }
+    free_arena(&st->names);
+}
+
+static ValueType scanned_type(FluentContext* ctx, Slice name) {
+    ValueType type = type_from_name(name);
+    if (!type) {
+        report_error(ctx, "Unknown type '%.*s'", SLICE_ARG(name));
+        longjmp(ctx->error_jmp, 1);
+    }
+    return type;
+}
+
+// Lexes the whole file for the names of its top-level 'func', 'let' and
+// 'var' statements, their annotations and the signatures of the functions,
+// declaring each before anything is parsed
+static void scan_declarations(Stream* st, SourceInput* source) {
+    FluentContext* ctx = st->ctx;
+    profile_begin(ctx->profile, PHASE_LEX);
+    init_lexer_input(ctx, source);
+    int depth = 0;
+    int at_statement = 1;
+    TokenType declaring = TOKEN_EOF;      // Keyword whose name comes next
+    Slice function = { NULL, 0 };         // Function whose signature is being read
+    int in_params = 0;
+    int param_count = 0;
+    uint8_t param_types[MAX_PARAMETERS];
+    ValueType return_type = TYPE_I32;
+    Slice global = { NULL, 0 };           // Global whose annotation may follow
+    int global_mutable = 0;
+    TokenType previous = TOKEN_EOF;
+    for (;;) {
+        Token token = get_next_token(ctx);
+        if (token.type == TOKEN_UNKNOWN) {
+            // The lexer has already reported the error
+            longjmp(ctx->error_jmp, 1);
+        }
+        if (token.type == TOKEN_EOF) {
+            break;
+        }
+        if (token.type == TOKEN_INDENT) {
+            depth++;
+        } else if (token.type == TOKEN_DEDENT) {
+            depth--;
+        }
+
+        if (function.start) {
+            // In the parameter list each name follows the '(' or a ',' and
+            // each type a ':'; the return type follows the '->'. The parser
+            // reports anything malformed.
+            if (in_params && token.type == TOKEN_IDENTIFIER && previous == TOKEN_COLON) {
+                if (param_count > 0) {
+                    param_types[param_count - 1] = scanned_type(ctx, token.text);
+                }
+            } else if (in_params && token.type == TOKEN_IDENTIFIER &&
+                       (previous == TOKEN_LPAREN || previous == TOKEN_COMMA)) {
+                if (param_count < MAX_PARAMETERS) {
+                    param_types[param_count++] = TYPE_I32;
+                }
+            } else if (token.type == TOKEN_IDENTIFIER && previous == TOKEN_ARROW) {
+                return_type = scanned_type(ctx, token.text);
+            } else if (token.type == TOKEN_LPAREN && previous == TOKEN_IDENTIFIER) {
+                in_params = 1;
+            } else if (token.type == TOKEN_RPAREN && in_params) {
+                in_params = 0;
+            } else if (!(in_params && (token.type == TOKEN_COMMA || token.type == TOKEN_COLON)) &&
+                       token.type != TOKEN_ARROW) {
+                add_function(st, function, param_types, param_count, return_type);
+                function.start = NULL;
+            }
+        }
+        if (global.start && !(token.type == TOKEN_COLON && previous == TOKEN_IDENTIFIER)) {
+            // 'let name: type' or just 'let name'
+            ValueType type = TYPE_NONE;
+            if (token.type == TOKEN_IDENTIFIER && previous == TOKEN_COLON) {
+                type = scanned_type(ctx, token.text);
+            }
+            add_global(st, global, global_mutable, type);
+            global.start = NULL;
+        }
+
+        if (declaring == TOKEN_FUNC && token.type == TOKEN_IDENTIFIER) {
+            function = token.text;
+            in_params = 0;
+            param_count = 0;
+            return_type = TYPE_I32;
+            st->has_main |= slice_equals(token.text, "main");
+        } else if (declaring != TOKEN_EOF && token.type == TOKEN_IDENTIFIER) {
+            global = token.text;
+            global_mutable = declaring == TOKEN_VAR;
+        }
+        int is_declaration = token.type == TOKEN_FUNC || token.type == TOKEN_LET || token.type == TOKEN_VAR;
+        declaring = depth == 0 && at_statement && is_declaration ? token.type : TOKEN_EOF;
+        at_statement = token.type == TOKEN_NEWLINE || token.type == TOKEN_INDENT || token.type == TOKEN_DEDENT;
+        previous = token.type;
+    }
+    profile_end(ctx->profile);
+}
+
+// Drops the nodes, IR and local symbols of the piece just written.
+// Symbols from keep_symbols on were locals, so their IDs are reused.
+static void release_piece(Stream* st, uint32_t keep_symbols) {
+    FluentContext* ctx = st->ctx;
+    if (ctx->profile && ctx->ast.count > 1) {
+        ctx->profile->ast_nodes += ctx->ast.count - 1;
+        ctx->profile->ast_bytes += (ctx->ast.count - 1) * (long long)sizeof(ASTNode);
+    }
+    reset_ast(&ctx->ast);
+    reset_arena(&ctx->arena);
+    if (ctx->symbols.count > keep_symbols) {
+        ctx->symbols.count = keep_symbols;
+    }
+    if (st->source->is_stream) {
+        const char* live[] = { ctx->current_token.text.start, ctx->next_token.text.start };
+        release_source_chunks(st->source, live, 2);
+    }
+}
+
+static void fold_piece(Stream* st, NodeId piece, SymbolId first_new) {
+    FluentContext* ctx = st->ctx;
+    if (ctx->opt_level >= 1) {
+        profile_begin(ctx->profile, PHASE_FOLD);
+        fold_with_table(ctx, &st->constants, piece, first_new);
+        profile_end(ctx->profile);
+    }
+}
+
+// Defines the globals of the group that took their initializers' types
+static void define_inferred_globals(Stream* st, NodeId group) {
+    FluentContext* ctx = st->ctx;
+    for (NodeId id = ast_node(&ctx->ast, group)->block.statements; id; id = ast_node(&ctx->ast, id)->next) {
+        const ASTNode* stmt = ast_node(&ctx->ast, id);
+        if (stmt->type != AST_VAR_DECL) {
+            continue;
+        }
+        IRGlobal* global = &st->module.globals[symbol_at(&ctx->symbols, stmt->decl.symbol)->slot];
+        if (!global->type) {
+            global->type = (ValueType)stmt->value_type;
+            emit_c_global(st->out, global->name, global->type);
+        }
+    }
+}
+
+// Writes the pending top-level statements as the next initializer
+static void flush_group(Stream* st) {
+    FluentContext* ctx = st->ctx;
+    if (!st->group) {
+        return;
+    }
+    uint32_t first_symbol = ctx->symbols.count;
+    if (!st->declared_up_front) {
+        for (NodeId id = ast_node(&ctx->ast, st->group)->block.statements; id; id = ast_node(&ctx->ast, id)->next) {
+            const ASTNode* stmt = ast_node(&ctx->ast, id);
+            if (stmt->type == AST_VAR_DECL) {
+                add_global(st, stmt->decl.name, stmt->is_mutable, (ValueType)stmt->value_type);
+            }
+        }
+    }
+    uint32_t keep_symbols = ctx->symbols.count;
+
+    resolve_global_init(ctx, st->group);
+    define_inferred_globals(st, st->group);
+    fold_piece(st, st->group, first_symbol);
+    char signature[64];
+    snprintf(signature, sizeof(signature), "static int fluent_init_%d(void)", st->init_count++);
+    generate_c_init(ctx, &st->module, st->group, signature, st->out);
+
+    st->group = NO_NODE;
+    st->group_last = NO_NODE;
+    st->group_length = 0;
+    release_piece(st, keep_symbols);
+}
+
+static void add_to_group(Stream* st, NodeId stmt) {
+    FluentContext* ctx = st->ctx;
+    if (!st->group) {
+        st->group = new_ast_node(&ctx->ast, AST_PROGRAM);
+        ast_node(&ctx->ast, st->group)->block.statements = stmt;
+    } else {
+        ast_node(&ctx->ast, st->group_last)->next = stmt;
+    }
+    st->group_last = stmt;
+    if (++st->group_length == STREAM_INIT_STATEMENTS) {
+        flush_group(st);
+    }
+}
+
+static void compile_function(Stream* st, NodeId func_decl) {
+    FluentContext* ctx = st->ctx;
+    uint32_t first_symbol = ctx->symbols.count;
+    NodeId piece = new_ast_node(&ctx->ast, AST_PROGRAM);
+    ast_node(&ctx->ast, piece)->block.statements = func_decl;
+    const ASTNode* node = ast_node(&ctx->ast, func_decl);
+    if (!st->declared_up_front) {
+        // Declared before its body is resolved, so it can call itself
+        uint8_t param_types[MAX_PARAMETERS];
+        int param_count = 0;
+        for (NodeId param = node->func.params; param; param = ast_node(&ctx->ast, param)->next) {
+            param_types[param_count++] = ast_node(&ctx->ast, param)->value_type;
+        }
+        add_function(st, node->func.name, param_types, param_count, (ValueType)node->value_type);
+        st->has_main |= slice_equals(node->func.name, "main");
+    }
+    uint32_t keep_symbols = ctx->symbols.count;
+
+    resolve_function(ctx, func_decl);
+    fold_piece(st, piece, first_symbol);
+    generate_c_function(ctx, &st->module, func_decl, st->out);
+    release_piece(st, keep_symbols);
+}
+
+int compile_streamed(FluentContext* ctx, SourceInput* source, OutputBuffer* out) {
+    Stream st;
+    memset(&st, 0, sizeof(Stream));
+    st.ctx = ctx;
+    st.out = out;
+    st.source = source;
+    init_arena(&st.names);
+    init_fold_table(&st.constants);
+    if (source->is_stream) {
+        ctx->names.storage = &st.names;
+    }
+    ctx->out = out;
+    if (setjmp(ctx->error_jmp)) {
+        free_stream(&st);
+        return -1;
+    }
+
+    emit_c_prologue(out);
+    if (!source->is_stream) {
+        scan_declarations(&st, source);
+        st.declared_up_front = 1;
+        out_char(out, '\n');
+    }
+
+    init_lexer_input(ctx, source);
+    begin_streaming_parse(ctx);
+    for (;;) {
+        // A function ends the group of statements before it
+        TokenType next = ctx->current_token.type;
+        if (next == TOKEN_FUNC || next == TOKEN_EOF) {
+            flush_group(&st);
+        }
+        NodeId stmt = parse_top_level(ctx);
+        if (!stmt) {
+            break;
+        }
+        if (ast_node(&ctx->ast, stmt)->type == AST_FUNC_DECL) {
+            compile_function(&st, stmt);
+        } else {
+            add_to_group(&st, stmt);
+        }
+    }
+
+    // Top-level statements run in file order before the Fluent main
+    out_str(out, "static int fluent_init(void) {\n");
+    for (int i = 0; i < st.init_count; i++) {
+        out_str(out, "    fluent_init_");
+        out_int(out, i);
+        out_str(out, "();\n");
+    }
+    out_str(out, "    return 0;\n}\n\n");
+    emit_c_entry(out, st.has_main);
+
+    free_stream(&st);
+    return 0;
+}
@@ -0,0 +1,508 @@
+// symbols.c
+// Implementation of the scoped symbol table and the name resolution pass
+//
+// Resolution declares globals and functions up front, then visits the
+// top-level statements that make up the global initializer, which give
+// unannotated globals the types of their initializers, then each function
+// body. Locals are numbered per function in declaration order, which is
+// what the lowering and the bytecode compiler use as variable numbers.
+//
+// Types are inferred bottom-up in the same walk. A literal takes the type
+// its context expects when it fits; the operands of a binary operation meet
+// at the higher-ranked of their types; and a value converts implicitly only
+// to a type of equal or higher rank, through an AST_CAST the resolver adds.
+
+#include "symbols.h"
+#include "context.h"
+#include "profile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+
+static void* grow(void* items, int count, int* capacity, size_t size) {
+    if (count < *capacity) {
+        return items;
+    }
+    *capacity = *capacity ? *capacity * 2 : 64;
+    void* bigger = realloc(items, *capacity * size);
+    if (!bigger) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    return bigger;
+}
+
+void init_symbols(SymbolTable* table) {
+    memset(table, 0, sizeof(SymbolTable));
+}
+
+// Keeps the arrays for the next file
+void reset_symbols(SymbolTable* table) {
+    if (table->visible_capacity) {
+        memset(table->visible, 0, table->visible_capacity * sizeof(SymbolId));
+    }
+    table->count = 0;
+    table->shadowed_count = 0;
+    table->depth = 0;
+    table->type_count = 0;
+}
+
+void free_symbols(SymbolTable* table) {
+    free(table->symbols);
+    free(table->visible);
+    free(table->shadowed);
+    free(table->scopes);
+    free(table->types);
+    init_symbols(table);
+}
+
+void push_scope(SymbolTable* table) {
+    table->scopes = grow(table->scopes, table->depth, &table->scope_capacity, sizeof(int));
+    table->scopes[table->depth++] = table->shadowed_count;
+}
+
+void pop_scope(SymbolTable* table) {
+    int start = table->scopes[--table->depth];
+    while (table->shadowed_count > start) {
+        ShadowEntry* entry = &table->shadowed[--table->shadowed_count];
+        table->visible[entry->name] = entry->hidden;
+    }
+}
+
+SymbolId declare_symbol(SymbolTable* table, NameId name, SymbolKind kind, int is_mutable, uint32_t slot) {
+    if (table->count == 0) {
+        table->count = 1;         // Reserve NO_SYMBOL
+    }
+    if (table->count >= table->capacity) {
+        int capacity = (int)table->capacity;
+        table->symbols = grow(table->symbols, (int)table->count, &capacity, sizeof(Symbol));
+        table->capacity = (uint32_t)capacity;
+    }
+    if (name >= table->visible_capacity) {
+        uint32_t capacity = table->visible_capacity ? table->visible_capacity : 256;
+        while (capacity <= name) {
+            capacity *= 2;
+        }
+        table->visible = realloc(table->visible, capacity * sizeof(SymbolId));
+        if (!table->visible) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        memset(table->visible + table->visible_capacity, 0,
+               (capacity - table->visible_capacity) * sizeof(SymbolId));
+        table->visible_capacity = capacity;
+    }
+
+    SymbolId id = table->count++;
+    table->symbols[id] = (Symbol){ name, (uint8_t)kind, (uint8_t)is_mutable, TYPE_NONE, 0, slot, 0 };
+    table->shadowed = grow(table->shadowed, table->shadowed_count, &table->shadowed_capacity, sizeof(ShadowEntry));
+    table->shadowed[table->shadowed_count++] = (ShadowEntry){ name, table->visible[name] };
+    table->visible[name] = id;
+    return id;
+}
+
+// Resolution
+
+typedef struct {
+    FluentContext* ctx;
+    SymbolTable* table;
+    int in_global_init;
+    uint32_t next_local;          // Slot of the next local in this function
+    ValueType return_type;        // Of the function being resolved; i32 in the initializer
+} Resolver;
+
+static void resolve_statements(Resolver* rs, NodeId stmt, int top_level);
+
+static __attribute__((noreturn)) void resolve_error(Resolver* rs, const char* format, Slice name) {
+    report_error(rs->ctx, format, SLICE_ARG(name));
+    longjmp(rs->ctx->error_jmp, 1);
+}
+
+static ASTNode* node_at(Resolver* rs, NodeId id) {
+    return ast_node(&rs->ctx->ast, id);
+}
+
+static SymbolId lookup(Resolver* rs, Slice name) {
+    return lookup_symbol(rs->table, intern(&rs->ctx->names, name));
+}
+
+static ValueType symbol_type(Resolver* rs, SymbolId symbol, Slice name) {
+    ValueType type = (ValueType)symbol_at(rs->table, symbol)->type;
+    if (!type) {
+        // A global whose initializer has not been resolved yet
+        resolve_error(rs, "The type of '%.*s' is not known here; annotate its declaration", name);
+    }
+    return type;
+}
+
+static NodeId make_cast(Resolver* rs, NodeId expr, ValueType type) {
+    NodeId cast = new_ast_node(&rs->ctx->ast, AST_CAST);
+    ASTNode* node = node_at(rs, cast);
+    node->cast.expr = expr;
+    node->value_type = type;
+    node->next = node_at(rs, expr)->next;
+    node_at(rs, expr)->next = NO_NODE;
+    return cast;
+}
+
+// Returns the resolved expression at id as a value of type: a literal that
+// fits is retyped in place and anything of lower rank is wrapped in a cast,
+// which takes over id's place in a list
+static NodeId convert_to(Resolver* rs, NodeId id, ValueType type) {
+    ASTNode* node = node_at(rs, id);
+    ValueType from = (ValueType)node->value_type;
+    if (from == type) {
+        return id;
+    }
+    NumericValue value;
+    if (node->type == AST_NUMBER) {
+        if (literal_value(node->value, type, &value)) {
+            node->value_type = type;
+            return id;
+        }
+        if (!type_is_float(from)) {
+            report_error(rs->ctx, "Integer literal '%.*s' is out of range for %s", SLICE_ARG(node->value),
+                         type_name(type));
+            longjmp(rs->ctx->error_jmp, 1);
+        }
+    }
+    if (from > type) {
+        report_error(rs->ctx, "Cannot convert %s to %s implicitly; write %s(...)", type_name(from),
+                     type_name(type), type_name(type));
+        longjmp(rs->ctx->error_jmp, 1);
+    }
+    return make_cast(rs, id, type);
+}
+
+static int is_comparison(TokenType op) {
+    return op == TOKEN_EQUAL || op == TOKEN_NOT_EQUAL || op == TOKEN_LESS || op == TOKEN_GREATER ||
+           op == TOKEN_LESS_EQUAL || op == TOKEN_GREATER_EQUAL;
+}
+
+// The type two operands meet at. A literal that fits the other operand's
+// type takes it, so 'x * 2.5' stays f32 for an f32 x.
+static ValueType operand_type(Resolver* rs, NodeId left, NodeId right) {
+    const ASTNode* a = node_at(rs, left);
+    const ASTNode* b = node_at(rs, right);
+    NumericValue value;
+    if (b->type == AST_NUMBER && a->type != AST_NUMBER && literal_value(b->value, a->value_type, &value)) {
+        return (ValueType)a->value_type;
+    }
+    if (a->type == AST_NUMBER && b->type != AST_NUMBER && literal_value(a->value, b->value_type, &value)) {
+        return (ValueType)b->value_type;
+    }
+    return a->value_type > b->value_type ? (ValueType)a->value_type : (ValueType)b->value_type;
+}
+
+// Binds the names in the expression and infers its type. Literals take the
+// expected type when they fit it; TYPE_NONE expects nothing.
+static void resolve_expression(Resolver* rs, NodeId id, ValueType expected) {
+    ASTNode* node = node_at(rs, id);
+    switch (node->type) {
+        case AST_NUMBER: {
+            NumericValue value;
+            if (expected && literal_value(node->value, expected, &value)) {
+                node->value_type = expected;
+                break;
+            }
+            node->value_type = literal_type(node->value);
+            if (!node->value_type) {
+                resolve_error(rs, "Integer literal '%.*s' is out of range", node->value);
+            }
+            break;
+        }
+        case AST_IDENTIFIER:
+            node->ident.symbol = lookup(rs, node->ident.name);
+            if (!node->ident.symbol) {
+                resolve_error(rs, "Undeclared identifier '%.*s'", node->ident.name);
+            }
+            if (symbol_at(rs->table, node->ident.symbol)->kind == SYMBOL_FUNCTION) {
+                resolve_error(rs, "Function '%.*s' is used as a value", node->ident.name);
+            }
+            node->value_type = symbol_type(rs, node->ident.symbol, node->ident.name);
+            break;
+        case AST_BIN_OP: {
+            // A comparison is an i32 whatever its operands, so what is
+            // expected of it says nothing about them
+            int comparison = is_comparison((TokenType)node->op);
+            ValueType operand_expected = comparison ? TYPE_NONE : expected;
+            NodeId left = node->binary.left;
+            NodeId right = node->binary.right;
+            resolve_expression(rs, left, operand_expected);
+            resolve_expression(rs, right, operand_expected);
+            ValueType type = operand_type(rs, left, right);
+            left = convert_to(rs, left, type);
+            right = convert_to(rs, right, type);
+            node = node_at(rs, id);
+            node->binary.left = left;
+            node->binary.right = right;
+            node->value_type = comparison ? TYPE_I32 : type;
+            break;
+        }
+        case AST_CALL: {
+            Slice name = node->call.name;
+            SymbolId symbol = lookup(rs, name);
+            ValueType cast_type = type_from_name(name);
+            if (cast_type && (!symbol || symbol_at(rs->table, symbol)->kind != SYMBOL_FUNCTION)) {
+                // 'f64(n)' writes out a conversion, which may narrow, unless
+                // a function of that name hides the type
+                NodeId expr = node->call.args;
+                if (!expr || node_at(rs, expr)->next) {
+                    resolve_error(rs, "Conversion to %.*s takes exactly one value", name);
+                }
+                node->type = AST_CAST;
+                node->cast.expr = expr;
+                node->value_type = cast_type;
+                resolve_expression(rs, expr, cast_type);
+                break;
+            }
+            if (!symbol) {
+                resolve_error(rs, "Undeclared function '%.*s'", name);
+            }
+            if (symbol_at(rs->table, symbol)->kind != SYMBOL_FUNCTION) {
+                resolve_error(rs, "'%.*s' is not a function", name);
+            }
+            node->call.symbol = symbol;
+            int count = ast_list_length(&rs->ctx->ast, node->call.args);
+            int expected_count = symbol_at(rs->table, symbol)->param_count;
+            if (count != expected_count) {
+                report_error(rs->ctx, "Function '%.*s' takes %d argument%s, but %d %s given", SLICE_ARG(name),
+                             expected_count, expected_count == 1 ? "" : "s", count, count == 1 ? "was" : "were");
+                longjmp(rs->ctx->error_jmp, 1);
+            }
+
+            // Each argument converts to its parameter's type; a cast
+            // replaces it in the list
+            uint32_t param_types = symbol_at(rs->table, symbol)->param_types;
+            NodeId previous = NO_NODE;
+            int index = 0;
+            for (NodeId arg = node->call.args; arg; index++) {
+                ValueType param_type = (ValueType)rs->table->types[param_types + index];
+                resolve_expression(rs, arg, param_type);
+                NodeId converted = convert_to(rs, arg, param_type);
+                if (previous) {
+                    node_at(rs, previous)->next = converted;
+                } else {
+                    node_at(rs, id)->call.args = converted;
+                }
+                previous = converted;
+                arg = node_at(rs, converted)->next;
+            }
+            node_at(rs, id)->value_type = symbol_at(rs->table, symbol)->type;
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+// Resolves the expression at id as a value of type
+static NodeId resolve_value(Resolver* rs, NodeId id, ValueType type) {
+    resolve_expression(rs, id, type);
+    return convert_to(rs, id, type);
+}
+
+static void resolve_condition(Resolver* rs, NodeId id) {
+    resolve_expression(rs, id, TYPE_NONE);
+    ValueType type = (ValueType)node_at(rs, id)->value_type;
+    if (type != TYPE_I32) {
+        report_error(rs->ctx, "Condition is an %s, not an i32; compare it with 0", type_name(type));
+        longjmp(rs->ctx->error_jmp, 1);
+    }
+}
+
+static void resolve_block(Resolver* rs, NodeId block) {
+    push_scope(rs->table);
+    resolve_statements(rs, node_at(rs, block)->block.statements, 0);
+    pop_scope(rs->table);
+}
+
+static void resolve_statement(Resolver* rs, NodeId id, int top_level) {
+    ASTNode* node = node_at(rs, id);
+    switch (node->type) {
+        case AST_VAR_DECL: {
+            // The initializer cannot see the name it is declaring. Without
+            // an annotation the variable takes the initializer's type.
+            ValueType type = (ValueType)node->value_type;
+            NodeId expr = node->decl.expr;
+            if (type) {
+                expr = resolve_value(rs, expr, type);
+            } else {
+                resolve_expression(rs, expr, TYPE_NONE);
+                type = (ValueType)node_at(rs, expr)->value_type;
+            }
+            node = node_at(rs, id);
+            node->decl.expr = expr;
+            node->value_type = type;
+            if (top_level && rs->in_global_init) {
+                node->decl.symbol = lookup(rs, node->decl.name);
+            } else {
+                NameId name = intern(&rs->ctx->names, node->decl.name);
+                node->decl.symbol = declare_symbol(rs->table, name, SYMBOL_LOCAL, node->is_mutable, rs->next_local++);
+            }
+            symbol_at(rs->table, node->decl.symbol)->type = type;
+            break;
+        }
+        case AST_ASSIGNMENT: {
+            SymbolId symbol = lookup(rs, node->decl.name);
+            if (!symbol) {
+                resolve_error(rs, "Undeclared identifier '%.*s'", node->decl.name);
+            }
+            if (symbol_at(rs->table, symbol)->kind == SYMBOL_FUNCTION) {
+                resolve_error(rs, "Cannot assign to function '%.*s'", node->decl.name);
+            }
+            if (!symbol_at(rs->table, symbol)->is_mutable) {
+                resolve_error(rs, "Cannot assign to '%.*s' declared with 'let'", node->decl.name);
+            }
+            node->decl.symbol = symbol;
+            NodeId expr = resolve_value(rs, node->decl.expr, symbol_type(rs, symbol, node->decl.name));
+            node_at(rs, id)->decl.expr = expr;
+            break;
+        }
+        case AST_RETURN_STMT: {
+            NodeId expr = resolve_value(rs, node->ret.expr, rs->return_type);
+            node_at(rs, id)->ret.expr = expr;
+            break;
+        }
+        case AST_IF_STMT:
+            resolve_condition(rs, node->if_stmt.condition);
+            resolve_block(rs, node->if_stmt.then_branch);
+            if (node->if_stmt.else_branch) {
+                resolve_block(rs, node->if_stmt.else_branch);
+            }
+            break;
+        case AST_WHILE_STMT:
+            resolve_condition(rs, node->loop.condition);
+            resolve_block(rs, node->loop.body);
+            break;
+        case AST_FUNC_DECL:
+            resolve_error(rs, "Nested function '%.*s' is not supported", node->func.name);
+        default:
+            resolve_expression(rs, id, TYPE_NONE);
+            break;
+    }
+}
+
+static void resolve_statements(Resolver* rs, NodeId stmt, int top_level) {
+    for (; stmt; stmt = node_at(rs, stmt)->next) {
+        if (top_level && node_at(rs, stmt)->type == AST_FUNC_DECL) {
+            continue;
+        }
+        resolve_statement(rs, stmt, top_level);
+    }
+}
+
+// Parameters are mutable locals numbered before the body's, in a scope of
+// their own around it
+static void resolve_function_body(Resolver* rs, NodeId func_decl) {
+    rs->next_local = 0;
+    rs->return_type = (ValueType)node_at(rs, func_decl)->value_type;
+    push_scope(rs->table);
+    for (NodeId param = node_at(rs, func_decl)->func.params; param; param = node_at(rs, param)->next) {
+        ASTNode* node = node_at(rs, param);
+        NameId name = intern(&rs->ctx->names, node->decl.name);
+        SymbolId shadowed = lookup_symbol(rs->table, name);
+        if (shadowed && symbol_at(rs->table, shadowed)->kind == SYMBOL_LOCAL) {
+            resolve_error(rs, "Duplicate parameter '%.*s'", node->decl.name);
+        }
+        node->decl.symbol = declare_symbol(rs->table, name, SYMBOL_LOCAL, 1, rs->next_local++);
+        symbol_at(rs->table, node->decl.symbol)->type = node->value_type;
+    }
+    resolve_block(rs, node_at(rs, func_decl)->func.body);
+    pop_scope(rs->table);
+}
+
+void declare_global(FluentContext* ctx, Slice name, int is_mutable, ValueType type, uint32_t slot) {
+    NameId id = intern(&ctx->names, name);
+    if (lookup_symbol(&ctx->symbols, id)) {
+        report_error(ctx, "Duplicate global '%.*s'", SLICE_ARG(name));
+        longjmp(ctx->error_jmp, 1);
+    }
+    SymbolId symbol = declare_symbol(&ctx->symbols, id, SYMBOL_GLOBAL, is_mutable, slot);
+    symbol_at(&ctx->symbols, symbol)->type = type;
+}
+
+void declare_function(FluentContext* ctx, Slice name, const uint8_t* param_types, int param_count,
+                      ValueType return_type, uint32_t slot) {
+    NameId id = intern(&ctx->names, name);
+    if (lookup_symbol(&ctx->symbols, id)) {
+        report_error(ctx, "Duplicate definition of '%.*s'", SLICE_ARG(name));
+        longjmp(ctx->error_jmp, 1);
+    }
+    if (param_count > 0 && slice_equals(name, "main")) {
+        report_error(ctx, "Function 'main' cannot take parameters");
+        longjmp(ctx->error_jmp, 1);
+    }
+    if (return_type != TYPE_I32 && slice_equals(name, "main")) {
+        // Its result is the exit status
+        report_error(ctx, "Function 'main' must return an i32");
+        longjmp(ctx->error_jmp, 1);
+    }
+    SymbolTable* table = &ctx->symbols;
+    while (table->type_count + param_count > table->type_capacity) {
+        table->types = grow(table->types, table->type_capacity, &table->type_capacity, 1);
+    }
+    if (param_count) {
+        memcpy(table->types + table->type_count, param_types, param_count);
+    }
+    SymbolId symbol = declare_symbol(table, id, SYMBOL_FUNCTION, 0, slot);
+    Symbol* function = symbol_at(table, symbol);
+    function->type = return_type;
+    function->param_count = (uint8_t)param_count;
+    function->param_types = (uint32_t)table->type_count;
+    table->type_count += param_count;
+}
+
+void resolve_function(FluentContext* ctx, NodeId func_decl) {
+    profile_begin(ctx->profile, PHASE_RESOLVE);
+    Resolver rs = { ctx, &ctx->symbols, 0, 0, TYPE_I32 };
+    resolve_function_body(&rs, func_decl);
+    profile_end(ctx->profile);
+}
+
+// Top-level statements other than functions, which make up one initializer
+void resolve_global_init(FluentContext* ctx, NodeId program) {
+    profile_begin(ctx->profile, PHASE_RESOLVE);
+    Resolver rs = { ctx, &ctx->symbols, 1, 0, TYPE_I32 };
+    resolve_statements(&rs, node_at(&rs, program)->block.statements, 1);
+    profile_end(ctx->profile);
+}
+
+void resolve_program(FluentContext* ctx, NodeId program) {
+    profile_begin(ctx->profile, PHASE_RESOLVE);
+    Resolver rs = { ctx, &ctx->symbols, 1, 0, TYPE_I32 };
+    NodeId statements = node_at(&rs, program)->block.statements;
+
+    // Globals and functions are visible everywhere, including functions
+    // that come first
+    push_scope(rs.table);
+    uint32_t global_count = 0;
+    uint32_t function_count = 0;
+    uint8_t param_types[MAX_PARAMETERS];
+    for (NodeId id = statements; id; id = node_at(&rs, id)->next) {
+        ASTNode* node = node_at(&rs, id);
+        if (node->type == AST_VAR_DECL) {
+            declare_global(ctx, node->decl.name, node->is_mutable, (ValueType)node->value_type, global_count++);
+        } else if (node->type == AST_FUNC_DECL) {
+            int param_count = 0;
+            for (NodeId param = node->func.params; param; param = node_at(&rs, param)->next) {
+                param_types[param_count++] = node_at(&rs, param)->value_type;
+            }
+            declare_function(ctx, node->func.name, param_types, param_count, (ValueType)node->value_type,
+                             function_count++);
+        }
+    }
+
+    // The initializer first, so functions see the globals' types
+    resolve_statements(&rs, statements, 1);
+
+    rs.in_global_init = 0;
+    for (NodeId id = statements; id; id = node_at(&rs, id)->next) {
+        if (node_at(&rs, id)->type == AST_FUNC_DECL) {
+            resolve_function_body(&rs, id);
+        }
+    }
+    pop_scope(rs.table);
+    profile_end(ctx->profile);
+}
@@ -0,0 +1,80 @@
+// tokens.c
+// Implementation of the pre-tokenized token stream
+
+#include "tokens.h"
+#include "context.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_TOKEN_CAPACITY 4096
+
+void init_token_stream(TokenStream* stream) {
+    memset(stream, 0, sizeof(TokenStream));
+}
+
+// Keeps the arrays for the next file
+void reset_token_stream(TokenStream* stream) {
+    stream->count = 0;
+    stream->source = NULL;
+}
+
+void free_token_stream(TokenStream* stream) {
+    free(stream->kinds);
+    free(stream->offsets);
+    free(stream->lengths);
+    free(stream->lines);
+    init_token_stream(stream);
+}
+
+static void* grow_array(void* items, size_t size) {
+    void* bigger = realloc(items, size);
+    if (!bigger) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    return bigger;
+}
+
+static void grow_stream(TokenStream* stream) {
+    uint32_t capacity = stream->capacity ? stream->capacity * 2 : INITIAL_TOKEN_CAPACITY;
+    if (capacity <= stream->capacity) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    stream->kinds = grow_array(stream->kinds, capacity * sizeof(uint8_t));
+    stream->offsets = grow_array(stream->offsets, capacity * sizeof(uint32_t));
+    stream->lengths = grow_array(stream->lengths, capacity * sizeof(uint32_t));
+    stream->lines = grow_array(stream->lines, capacity * sizeof(uint32_t));
+    stream->capacity = capacity;
+}
+
+// A streamed source is refilled chunk by chunk, so its tokens do not share
+// one base address
+int can_tokenize(const Lexer* lexer) {
+    return (!lexer->input || !lexer->input->is_stream) && lexer->src_length <= UINT32_MAX;
+}
+
+// Lexes the rest of the lexer's input. Returns 0, or -1 if the lexer
+// reported an error.
+int tokenize(FluentContext* ctx, TokenStream* stream) {
+    reset_token_stream(stream);
+    stream->source = ctx->lexer.src;
+    for (;;) {
+        Token token = get_next_token(ctx);
+        if (token.type == TOKEN_UNKNOWN) {
+            return -1;
+        }
+        if (stream->count == stream->capacity) {
+            grow_stream(stream);
+        }
+        uint32_t i = stream->count++;
+        stream->kinds[i] = (uint8_t)token.type;
+        stream->offsets[i] = (uint32_t)(token.text.start - stream->source);
+        stream->lengths[i] = (uint32_t)token.text.length;
+        stream->lines[i] = (uint32_t)token.line;
+        if (token.type == TOKEN_EOF) {
+            return 0;
+        }
+    }
+}
@@ -0,0 +1,123 @@
+// types.c
+// Implementation of the numeric types: names, C spellings and literals
+
+#include "types.h"
+#include "context.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <setjmp.h>
+
+static const char* type_names[] = { "none", "i32", "i64", "u64", "f32", "f64" };
+static const char* c_names[] = { "int32_t", "int32_t", "int64_t", "uint64_t", "float", "double" };
+
+ValueType type_from_name(Slice name) {
+    if (slice_equals(name, "int")) {
+        return TYPE_I32;
+    }
+    for (int type = TYPE_I32; type <= TYPE_F64; type++) {
+        if (slice_equals(name, type_names[type])) {
+            return (ValueType)type;
+        }
+    }
+    return TYPE_NONE;
+}
+
+const char* type_name(ValueType type) {
+    return type_names[type];
+}
+
+const char* type_c_name(ValueType type) {
+    return c_names[type];
+}
+
+int type_is_float(ValueType type) {
+    return type == TYPE_F32 || type == TYPE_F64;
+}
+
+static int is_decimal(Slice text) {
+    return memchr(text.start, '.', text.length) != NULL;
+}
+
+// Literals are slices of the source, so strtod gets a terminated copy
+static double parse_double(Slice text) {
+    char buffer[64];
+    char* copy = text.length < (int)sizeof(buffer) ? buffer : malloc(text.length + 1);
+    if (!copy) {
+        return HUGE_VAL;
+    }
+    memcpy(copy, text.start, text.length);
+    copy[text.length] = '\0';
+    double value = strtod(copy, NULL);
+    if (copy != buffer) {
+        free(copy);
+    }
+    return value;
+}
+
+int literal_value(Slice text, ValueType type, NumericValue* value) {
+    if (type_is_float(type)) {
+        double d = parse_double(text);
+        if (type == TYPE_F32) {
+            d = (float)d;
+        }
+        if (!isfinite(d)) {
+            return 0;
+        }
+        value->f = d;
+        return 1;
+    }
+    if (type == TYPE_NONE || is_decimal(text)) {
+        return 0;
+    }
+
+    // Folded constants may be negative
+    int negative = text.length > 1 && text.start[0] == '-';
+    unsigned long long magnitude = 0;
+    for (int i = negative; i < text.length; i++) {
+        unsigned int digit = (unsigned int)(text.start[i] - '0');
+        if (digit > 9 || __builtin_mul_overflow(magnitude, 10ull, &magnitude) ||
+            __builtin_add_overflow(magnitude, digit, &magnitude)) {
+            return 0;
+        }
+    }
+    unsigned long long limit = type == TYPE_I32 ? (unsigned long long)INT_MAX
+                             : type == TYPE_I64 ? (unsigned long long)LLONG_MAX : ULLONG_MAX;
+    if (negative) {
+        if (type == TYPE_U64 || magnitude > limit + 1) {
+            return 0;
+        }
+        value->i = (long long)(0ull - magnitude);
+    } else {
+        if (magnitude > limit) {
+            return 0;
+        }
+        value->i = (long long)magnitude;
+    }
+    return 1;
+}
+
+ValueType literal_type(Slice text) {
+    NumericValue value;
+    if (is_decimal(text)) {
+        return literal_value(text, TYPE_F64, &value) ? TYPE_F64 : TYPE_NONE;
+    }
+    for (int type = TYPE_I32; type <= TYPE_U64; type++) {
+        if (literal_value(text, (ValueType)type, &value)) {
+            return (ValueType)type;
+        }
+    }
+    return TYPE_NONE;
+}
+
+void require_i32_values(FluentContext* ctx, const char* backend) {
+    for (NodeId id = 1; id < ctx->ast.count; id++) {
+        ValueType type = ast_node(&ctx->ast, id)->value_type;
+        if (type > TYPE_I32) {
+            report_error(ctx, "%s values are not supported by %s; compile to C to use them",
+                         type_name(type), backend);
+            longjmp(ctx->error_jmp, 1);
+        }
+    }
+}
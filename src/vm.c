@@ -0,0 +1,193 @@
+// vm.c
+// Bytecode interpreter
+//
+// Dispatch uses GCC's labels-as-values: every handler ends in its own
+// indirect jump, which predicts far better than a shared switch. Arithmetic
+// wraps at 32 bits like the compiled C.
+//
+// Calls do not recurse in C. Every active function's registers sit in one
+// contiguous register stack, callee above caller, and a call pushes a
+// frame recording where the caller resumes. Chains deeper than
+// MAX_CALL_DEPTH are reported as a stack overflow.
+
+#include "vm.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define WRAP(op, x, y) ((int32_t)((uint32_t)(x) op (uint32_t)(y)))
+
+typedef struct {
+    const BytecodeFunction* fn;
+    const BytecodeInstr* ip;      // The call the caller resumes after
+    size_t base;                  // Index of the caller's R[0] in the register stack
+} Frame;
+
+typedef struct {
+    const BytecodeProgram* program;
+    int32_t* globals;
+    int32_t* registers;           // The register stack
+    size_t register_capacity;
+    Frame* frames;                // Callers of the running function
+    int frame_capacity;
+} Vm;
+
+// Makes room for slots registers at base, and one more frame than depth.
+// Returns 0 when the memory is not available.
+static int reserve(Vm* vm, size_t base, size_t slots, int depth) {
+    size_t needed = base + (slots ? slots : 1);
+    if (needed > vm->register_capacity) {
+        size_t capacity = vm->register_capacity ? vm->register_capacity : 1024;
+        while (capacity < needed) {
+            capacity *= 2;
+        }
+        int32_t* registers = realloc(vm->registers, capacity * sizeof(int32_t));
+        if (!registers) {
+            return 0;
+        }
+        vm->registers = registers;
+        vm->register_capacity = capacity;
+    }
+    if (depth >= vm->frame_capacity) {
+        int capacity = vm->frame_capacity ? vm->frame_capacity * 2 : 64;
+        Frame* frames = realloc(vm->frames, capacity * sizeof(Frame));
+        if (!frames) {
+            return 0;
+        }
+        vm->frames = frames;
+        vm->frame_capacity = capacity;
+    }
+    return 1;
+}
+
+// Runs fn, and every function it calls, to completion. Returns 0 and
+// stores the return value, or -1 after reporting a runtime error.
+static int run_function(FluentContext* ctx, Vm* vm, const BytecodeFunction* fn, int32_t* result) {
+    static const void* const dispatch[OP_COUNT] = {
+        [OP_MOVE] = &&op_move, [OP_GETG] = &&op_getg, [OP_SETG] = &&op_setg,
+        [OP_ADD] = &&op_add, [OP_SUB] = &&op_sub, [OP_MUL] = &&op_mul, [OP_DIV] = &&op_div,
+        [OP_EQ] = &&op_eq, [OP_NE] = &&op_ne, [OP_LT] = &&op_lt,
+        [OP_GT] = &&op_gt, [OP_LE] = &&op_le, [OP_GE] = &&op_ge,
+        [OP_ADDK] = &&op_addk, [OP_INCK] = &&op_inck,
+        [OP_JMP] = &&op_jmp, [OP_JZ] = &&op_jz, [OP_JNZ] = &&op_jnz,
+        [OP_JEQ] = &&op_jeq, [OP_JNE] = &&op_jne, [OP_JLT] = &&op_jlt,
+        [OP_JGT] = &&op_jgt, [OP_JLE] = &&op_jle, [OP_JGE] = &&op_jge,
+        [OP_CALL] = &&op_call, [OP_RET] = &&op_ret,
+    };
+
+    if (!reserve(vm, 0, fn->register_count, 0)) {
+        report_error(ctx, "Out of memory running '%.*s'", SLICE_ARG(fn->name));
+        return -1;
+    }
+    int32_t* globals = vm->globals;
+    int depth = 0;
+    size_t base = 0;
+    int32_t* r = vm->registers;
+    memcpy(r, fn->constants, fn->constant_count * sizeof(int32_t));
+    const BytecodeInstr* code = fn->code;
+    const BytecodeInstr* ip = code;
+
+#define NEXT() goto *dispatch[(++ip)->op]
+#define JUMP_IF(cond) do { if (cond) { ip = code + ip->c; goto *dispatch[ip->op]; } NEXT(); } while (0)
+
+    goto *dispatch[ip->op];
+
+op_move:  r[ip->a] = r[ip->b]; NEXT();
+op_getg:  r[ip->a] = globals[ip->c]; NEXT();
+op_setg:  globals[ip->c] = r[ip->a]; NEXT();
+op_add:   r[ip->a] = WRAP(+, r[ip->b], r[ip->c]); NEXT();
+op_sub:   r[ip->a] = WRAP(-, r[ip->b], r[ip->c]); NEXT();
+op_mul:   r[ip->a] = WRAP(*, r[ip->b], r[ip->c]); NEXT();
+op_div: {
+    int32_t divisor = r[ip->c];
+    if (divisor == 0) {
+        report_error(ctx, "Division by zero in '%.*s'", SLICE_ARG(fn->name));
+        return -1;
+    }
+    // INT_MIN / -1 wraps instead of trapping
+    r[ip->a] = divisor == -1 ? WRAP(-, 0, r[ip->b]) : r[ip->b] / divisor;
+    NEXT();
+}
+op_eq:    r[ip->a] = r[ip->b] == r[ip->c]; NEXT();
+op_ne:    r[ip->a] = r[ip->b] != r[ip->c]; NEXT();
+op_lt:    r[ip->a] = r[ip->b] < r[ip->c]; NEXT();
+op_gt:    r[ip->a] = r[ip->b] > r[ip->c]; NEXT();
+op_le:    r[ip->a] = r[ip->b] <= r[ip->c]; NEXT();
+op_ge:    r[ip->a] = r[ip->b] >= r[ip->c]; NEXT();
+op_addk:  r[ip->a] = WRAP(+, r[ip->b], ip->c); NEXT();
+op_inck:  r[ip->a] = WRAP(+, r[ip->a], ip->c); NEXT();
+op_jmp:   ip = code + ip->c; goto *dispatch[ip->op];
+op_jz:    JUMP_IF(r[ip->a] == 0);
+op_jnz:   JUMP_IF(r[ip->a] != 0);
+op_jeq:   JUMP_IF(r[ip->a] == r[ip->b]);
+op_jne:   JUMP_IF(r[ip->a] != r[ip->b]);
+op_jlt:   JUMP_IF(r[ip->a] < r[ip->b]);
+op_jgt:   JUMP_IF(r[ip->a] > r[ip->b]);
+op_jle:   JUMP_IF(r[ip->a] <= r[ip->b]);
+op_jge:   JUMP_IF(r[ip->a] >= r[ip->b]);
+op_call: {
+    const BytecodeFunction* callee = &vm->program->functions[ip->b];
+    size_t callee_base = base + fn->register_count;
+    if (depth + 1 >= MAX_CALL_DEPTH) {
+        report_error(ctx, "Stack overflow in '%.*s'", SLICE_ARG(callee->name));
+        return -1;
+    }
+    if (!reserve(vm, callee_base, callee->register_count, depth)) {
+        report_error(ctx, "Out of memory running '%.*s'", SLICE_ARG(callee->name));
+        return -1;
+    }
+    // The stack may have moved
+    r = vm->registers + base;
+    int32_t* callee_r = vm->registers + callee_base;
+    memcpy(callee_r, callee->constants, callee->constant_count * sizeof(int32_t));
+    memcpy(callee_r + callee->constant_count, r + ip->c, callee->param_count * sizeof(int32_t));
+    vm->frames[depth++] = (Frame){ fn, ip, base };
+    fn = callee;
+    base = callee_base;
+    r = callee_r;
+    code = ip = fn->code;
+    goto *dispatch[ip->op];
+}
+op_ret: {
+    int32_t value = r[ip->a];
+    if (depth == 0) {
+        *result = value;
+        return 0;
+    }
+    Frame* caller = &vm->frames[--depth];
+    fn = caller->fn;
+    ip = caller->ip;
+    base = caller->base;
+    code = fn->code;
+    r = vm->registers + base;
+    r[ip->a] = value;
+    NEXT();
+}
+
+#undef NEXT
+#undef JUMP_IF
+}
+
+// Runs the top-level statements, then main. Returns 0 and stores main's
+// return value, or -1 after reporting a runtime error.
+int run_bytecode(FluentContext* ctx, const BytecodeProgram* program, int* result) {
+    Vm vm;
+    memset(&vm, 0, sizeof(vm));
+    vm.program = program;
+    vm.globals = calloc(program->global_count ? program->global_count : 1, sizeof(int32_t));
+    int32_t value = 0;
+    int status = -1;
+    if (!vm.globals) {
+        report_error(ctx, "Out of memory running the program");
+    } else {
+        status = run_function(ctx, &vm, &program->functions[program->init_function], &value);
+    }
+    value = 0;
+    if (status == 0 && program->main_function >= 0) {
+        status = run_function(ctx, &vm, &program->functions[program->main_function], &value);
+    }
+    free(vm.registers);
+    free(vm.frames);
+    free(vm.globals);
+    *result = value;
+    return status;
+}